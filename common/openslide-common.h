@@ -30,6 +30,7 @@
 struct common_usage_info {
   const char *parameter_string;
   const char *summary;
+  const GOptionEntry *options;  // tool-specific, or NULL
 };
 
 void common_fix_argv(int *argc, char ***argv);
@@ -51,4 +52,8 @@ void common_fail(const char *fmt, ...) G_GNUC_NORETURN;
 
 char *common_get_fd_path(int fd);
 
+// threads
+
+int common_get_thread_count(void);
+
 #endif
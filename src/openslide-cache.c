@@ -33,8 +33,27 @@
 #define ptr_int uint64_t
 #endif
 
+// maximum number of independently locked shards; must be a power of two
+#define CACHE_MAX_SHARDS 16
+// don't split the capacity into shards smaller than this
+#define CACHE_MIN_SHARD_CAPACITY (8 * 1024 * 1024)
+// share of a sharded cache's capacity kept for entries too large for a
+// shard
+#define CACHE_OVERFLOW_PERCENT 25
+// share of a shard reserved to tiles used more than once, with the
+// segmented policy
+#define CACHE_PROTECTED_PERCENT 80
+
+// tile buffers are aligned to this, for vector loads and stores
+#define TILE_BUFFER_ALIGN 64
+// number of distinct buffer sizes kept for reuse
+#define TILE_BUFFER_CLASSES 16
+// idle bytes kept for reuse, over all sizes
+#define TILE_BUFFER_MAX_IDLE (64 * 1024 * 1024)
+
 // hash table key
 struct _openslide_cache_key {
+  uint64_t binding_id;  // distinguishes slides sharing the cache
   void *plane;  // cookie for coordinate plane (level, grid, etc.)
   int64_t x;
   int64_t y;
@@ -44,7 +63,8 @@ struct _openslide_cache_key {
 struct _openslide_cache_value {
   GList *link;            // direct pointer to the node in the list
   struct _openslide_cache_key *key; // for removing keys when aged out
-  struct _openslide_cache *cache; // sadly, for total_bytes and the list
+  struct _openslide_cache_shard *shard; // sadly, for total_bytes and the list
+  bool protected;         // in the protected segment rather than the list
 
   struct _openslide_cache_entry *entry;  // may outlive the value
 };
@@ -54,44 +74,245 @@ struct _openslide_cache_entry {
   gint refcount;  // atomic ops only
   void *data;
   int size;
+  bool tile_buffer;  // data is from _openslide_tile_buffer_alloc()
 };
 
-struct _openslide_cache {
+// one independently locked part of the cache, with its own LRU list and
+// its share of the capacity
+//
+// with the segmented policy, new entries go to the probationary list and
+// are promoted to the protected list when hit again.  entries demoted
+// from the protected list get another chance on the probationary list,
+// and eviction starts from the probationary list, so tiles read only
+// once by a sequential scan don't push out tiles that are reused.
+struct _openslide_cache_shard {
   GMutex *mutex;
-  GQueue *list;
+  GQueue *list;            // probationary list, the only one with plain LRU
+  GQueue *protected_list;
   GHashTable *hashtable;
 
-  int capacity;
-  int total_size;
+  uint64_t capacity;
+  uint64_t total_size;
+  uint64_t protected_capacity;  // 0 with plain LRU
+  uint64_t protected_size;
+  bool segmented;
+
+  gint entry_count;  // atomic ops only, so it can be read without the mutex
+
+  // statistics
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+};
+
+struct _openslide_cache {
+  struct _openslide_cache_shard shards[CACHE_MAX_SHARDS];
+  int shard_count;  // power of two
+  int shard_shift;  // 32 - log2(shard_count)
+
+  // entries too large for their shard, with CACHE_OVERFLOW_PERCENT of
+  // the capacity if there are several shards.  Large entries are few, so
+  // the shard is only locked by lookups while it holds some.
+  struct _openslide_cache_shard overflow;
 
+  uint64_t capacity;  // sum of all shard capacities, protected by all mutexes
+  enum _openslide_cache_policy policy;  // protected by all mutexes
+
+  // lower tier holding compressed tile data, so that a miss in this cache
+  // can be decoded again without rereading the slide; NULL in the lower
+  // tier itself
+  struct _openslide_cache *compressed;
+
+  gint refcount;  // atomic ops only
   gint warned_overlarge_entry;
 };
 
+// connection between an openslide_t and the cache it currently uses
+struct _openslide_cache_binding {
+  GMutex *mutex;
+  struct _openslide_cache *cache;  // protected by mutex
+  uint64_t id;  // unique for the lifetime of the process
+
+  // disk cache, set before the binding is shared
+  char *disk_key;           // NULL if disabled
+  GHashTable *disk_planes;  // plane -> position in the slide + 1
+
+  // tiles of pinned planes are also kept here, outside the capacity of
+  // any cache, so they are never evicted
+  GHashTable *pinned_planes;  // set before the binding is shared; or NULL
+  GHashTable *pinned;         // key -> entry, protected by mutex
+};
+
+// entries a thread gets or puts are also referenced here, if it is set,
+// so they can't be evicted until its caller is done with them
+static GPrivate *held_entries;  // GPtrArray
+
+// binding IDs are never reused, unlike openslide_t and plane addresses
+static uint64_t next_binding_id;
+G_LOCK_DEFINE_STATIC(next_binding_id);
+
+// idle tile buffers of one size
+struct tile_buffer_class {
+  int size;            // 0 if unused
+  void *idle;          // each idle buffer starts with a pointer to the next
+};
+
+// tiles of a slide mostly have the same few sizes, so buffers released by
+// eviction are kept by size for the next tiles to be decoded
+static struct tile_buffer_class tile_buffer_classes[TILE_BUFFER_CLASSES];
+static uint64_t tile_buffer_idle_size;
+G_LOCK_DEFINE_STATIC(tile_buffer_pool);
+
+static int tile_buffer_round_size(int size) {
+  g_assert(size >= 0);
+  return MAX((size + TILE_BUFFER_ALIGN - 1) & ~(TILE_BUFFER_ALIGN - 1),
+             TILE_BUFFER_ALIGN);
+}
+
+// the address returned by g_malloc() is kept just before the buffer
+static void *tile_buffer_new(int rounded_size) {
+  uint8_t *raw = g_malloc(rounded_size + TILE_BUFFER_ALIGN);
+  uint8_t *data = (uint8_t *)
+    (((ptr_int) raw + TILE_BUFFER_ALIGN) & ~(ptr_int) (TILE_BUFFER_ALIGN - 1));
+  ((void **) data)[-1] = raw;
+  return data;
+}
+
+static void tile_buffer_delete(void *data) {
+  g_free(((void **) data)[-1]);
+}
+
+// tile_buffer_pool lock must be held
+static struct tile_buffer_class *tile_buffer_get_class(int rounded_size,
+                                                       bool create) {
+  struct tile_buffer_class *spare = NULL;
+  for (int i = 0; i < TILE_BUFFER_CLASSES; i++) {
+    struct tile_buffer_class *c = &tile_buffer_classes[i];
+    if (c->size == rounded_size) {
+      return c;
+    }
+    if (!spare && !c->idle) {
+      spare = c;
+    }
+  }
+  if (create && spare) {
+    spare->size = rounded_size;
+    return spare;
+  }
+  return NULL;
+}
+
+// cache-line aligned, and usually recycled from an evicted tile
+void *_openslide_tile_buffer_alloc(int size) {
+  int rounded_size = tile_buffer_round_size(size);
+  void *data = NULL;
+
+  G_LOCK(tile_buffer_pool);
+  struct tile_buffer_class *c = tile_buffer_get_class(rounded_size, false);
+  if (c && c->idle) {
+    data = c->idle;
+    c->idle = *(void **) data;
+    tile_buffer_idle_size -= rounded_size;
+  }
+  G_UNLOCK(tile_buffer_pool);
+
+  if (!data) {
+    data = tile_buffer_new(rounded_size);
+  }
+  return data;
+}
+
+void _openslide_tile_buffer_free(void *data, int size) {
+  if (!data) {
+    return;
+  }
+  int rounded_size = tile_buffer_round_size(size);
+
+  G_LOCK(tile_buffer_pool);
+  if (tile_buffer_idle_size + rounded_size <= TILE_BUFFER_MAX_IDLE) {
+    struct tile_buffer_class *c = tile_buffer_get_class(rounded_size, true);
+    if (c) {
+      *(void **) data = c->idle;
+      c->idle = data;
+      tile_buffer_idle_size += rounded_size;
+      data = NULL;
+    }
+  }
+  G_UNLOCK(tile_buffer_pool);
+
+  if (data) {
+    tile_buffer_delete(data);
+  }
+}
+
 // eviction
-// mutex must be held
-static void possibly_evict(struct _openslide_cache *cache, int incoming_size) {
+// shard mutex must be held
+static void possibly_evict(struct _openslide_cache_shard *shard,
+                           int incoming_size) {
   g_assert(incoming_size >= 0);
 
-  int size = cache->total_size + incoming_size;
-  int target = cache->capacity;
-  // g_debug("EVICT: try to evict. size: %d, total size: %d, incoming size: %d, capacity: %d",
-  //        size, cache->total_size, incoming_size, cache->capacity);
+  uint64_t size = shard->total_size + incoming_size;
+  uint64_t target = shard->capacity;
+  // g_debug("EVICT: try to evict. size: %"PRIu64", total size: %"PRIu64", incoming size: %d, capacity: %"PRIu64,
+  //        size, shard->total_size, incoming_size, shard->capacity);
   while(size > target) {
-    // get key of last element
-    struct _openslide_cache_value *value = g_queue_peek_tail(cache->list);
+    // get key of last element, preferring the probationary list
+    struct _openslide_cache_value *value = g_queue_peek_tail(shard->list);
     if (value == NULL) {
-      return; // cache is empty
+      value = g_queue_peek_tail(shard->protected_list);
+    }
+    if (value == NULL) {
+      return; // shard is empty
     }
     struct _openslide_cache_key *key = value->key;
 
-    // g_debug("EVICT: size: %d, plane: %d, x: %d, y: %d", 
+    // g_debug("EVICT: size: %d, plane: %d, x: %d, y: %d",
     //        value->entry->size, key->plane, key->x, key->y);
 
     size -= value->entry->size;
 
     // remove from hashtable, this will trigger removal from everything
-    bool result = g_hash_table_remove(cache->hashtable, key);
+    bool result = g_hash_table_remove(shard->hashtable, key);
     g_assert(result);
+    shard->evictions++;
+  }
+}
+
+// move the least recently used protected entries back to the
+// probationary list until the protected segment fits
+// shard mutex must be held
+static void possibly_demote(struct _openslide_cache_shard *shard) {
+  while (shard->protected_size > shard->protected_capacity) {
+    struct _openslide_cache_value *value =
+      g_queue_peek_tail(shard->protected_list);
+    g_assert(value);
+
+    GList *link = value->link;
+    g_queue_unlink(shard->protected_list, link);
+    g_queue_push_head_link(shard->list, link);
+    value->protected = false;
+    shard->protected_size -= value->entry->size;
+  }
+}
+
+// a cached entry was used again
+// shard mutex must be held
+static void touch_value(struct _openslide_cache_shard *shard,
+                        struct _openslide_cache_value *value) {
+  GList *link = value->link;
+  if (value->protected) {
+    g_queue_unlink(shard->protected_list, link);
+    g_queue_push_head_link(shard->protected_list, link);
+  } else if (shard->segmented) {
+    // promote
+    g_queue_unlink(shard->list, link);
+    g_queue_push_head_link(shard->protected_list, link);
+    value->protected = true;
+    shard->protected_size += value->entry->size;
+    possibly_demote(shard);
+  } else {
+    g_queue_unlink(shard->list, link);
+    g_queue_push_head_link(shard->list, link);
   }
 }
 
@@ -101,7 +322,7 @@ static guint hash_func(gconstpointer key) {
   const struct _openslide_cache_key *c_key = key;
 
   // assume 32-bit hash
-  return (guint) (((ptr_int) c_key->plane) ^
+  return (guint) (((ptr_int) c_key->plane) ^ c_key->binding_id ^
                   ((34369 * (uint64_t) c_key->y) + ((uint64_t) c_key->x)));
 }
 
@@ -110,7 +331,8 @@ static gboolean key_equal_func(gconstpointer a,
   const struct _openslide_cache_key *c_a = a;
   const struct _openslide_cache_key *c_b = b;
 
-  return (c_a->plane == c_b->plane) && (c_a->x == c_b->x) && (c_a->y == c_b->y);
+  return (c_a->binding_id == c_b->binding_id) && (c_a->plane == c_b->plane) &&
+    (c_a->x == c_b->x) && (c_a->y == c_b->y);
 }
 
 static void hash_destroy_key(gpointer data) {
@@ -120,12 +342,18 @@ static void hash_destroy_key(gpointer data) {
 static void hash_destroy_value(gpointer data) {
   struct _openslide_cache_value *value = data;
 
-  // remove the item from the list
-  g_queue_delete_link(value->cache->list, value->link);
+  // remove the item from its list
+  if (value->protected) {
+    g_queue_delete_link(value->shard->protected_list, value->link);
+    value->shard->protected_size -= value->entry->size;
+  } else {
+    g_queue_delete_link(value->shard->list, value->link);
+  }
 
   // decrement the total size
-  value->cache->total_size -= value->entry->size;
-  g_assert(value->cache->total_size >= 0);
+  g_assert(value->shard->total_size >= (uint64_t) value->entry->size);
+  value->shard->total_size -= value->entry->size;
+  g_atomic_int_add(&value->shard->entry_count, -1);
 
   // unref the entry
   _openslide_cache_entry_unref(value->entry);
@@ -134,74 +362,392 @@ static void hash_destroy_value(gpointer data) {
   g_slice_free(struct _openslide_cache_value, value);
 }
 
-struct _openslide_cache *_openslide_cache_create(int capacity_in_bytes) {
-  //g_debug("_openslide_cache_create");
-  struct _openslide_cache *cache = g_slice_new0(struct _openslide_cache);
+// select the shard for a key
+// the low bits of hash_func() also select the hashtable bucket, so use
+// the high bits of a multiplicative hash instead
+static struct _openslide_cache_shard *get_shard(struct _openslide_cache *cache,
+                                                const struct _openslide_cache_key *key) {
+  if (cache->shard_count == 1) {
+    return &cache->shards[0];
+  }
+  guint32 h = (guint32) hash_func(key) * 2654435769U;
+  return &cache->shards[h >> cache->shard_shift];
+}
 
+// shard mutex must be held
+static void set_shard_capacity(struct _openslide_cache_shard *shard,
+                               uint64_t capacity_in_bytes,
+                               enum _openslide_cache_policy policy) {
+  shard->capacity = capacity_in_bytes;
+  shard->segmented = (policy == _OPENSLIDE_CACHE_POLICY_SEGMENTED_LRU);
+  if (shard->segmented) {
+    shard->protected_capacity =
+      shard->capacity / 100 * CACHE_PROTECTED_PERCENT;
+  } else {
+    shard->protected_capacity = 0;
+  }
+  possibly_demote(shard);
+  possibly_evict(shard, 0);
+}
+
+// all shard mutexes must be held
+static void set_shard_capacities(struct _openslide_cache *cache,
+                                 uint64_t capacity_in_bytes,
+                                 enum _openslide_cache_policy policy) {
+  cache->capacity = capacity_in_bytes;
+  cache->policy = policy;
+  // a single shard holds anything that fits the cache
+  uint64_t overflow = 0;
+  if (cache->shard_count > 1) {
+    overflow = capacity_in_bytes / 100 * CACHE_OVERFLOW_PERCENT;
+  }
+  for (int i = 0; i < cache->shard_count; i++) {
+    set_shard_capacity(&cache->shards[i],
+                       (capacity_in_bytes - overflow) / cache->shard_count,
+                       policy);
+  }
+  set_shard_capacity(&cache->overflow, overflow, policy);
+}
+
+// all shard mutexes are taken in index order, then the overflow shard's
+static void lock_shards(struct _openslide_cache *cache) {
+  for (int i = 0; i < cache->shard_count; i++) {
+    g_mutex_lock(cache->shards[i].mutex);
+  }
+  g_mutex_lock(cache->overflow.mutex);
+}
+
+static void unlock_shards(struct _openslide_cache *cache) {
+  g_mutex_unlock(cache->overflow.mutex);
+  for (int i = cache->shard_count - 1; i >= 0; i--) {
+    g_mutex_unlock(cache->shards[i].mutex);
+  }
+}
+
+static void shard_init(struct _openslide_cache_shard *shard) {
   // init mutex
-  cache->mutex = g_mutex_new();
+  shard->mutex = g_mutex_new();
 
-  // init queue
-  cache->list = g_queue_new();
+  // init queues
+  shard->list = g_queue_new();
+  shard->protected_list = g_queue_new();
 
   // init hashtable
-  cache->hashtable = g_hash_table_new_full(hash_func,
-					   key_equal_func,
-					   hash_destroy_key,
-					   hash_destroy_value);
+  shard->hashtable = g_hash_table_new_full(hash_func,
+                                           key_equal_func,
+                                           hash_destroy_key,
+                                           hash_destroy_value);
+}
+
+static void shard_destroy(struct _openslide_cache_shard *shard) {
+  // clear hashtable (auto-deletes all data)
+  g_mutex_lock(shard->mutex);
+  g_hash_table_unref(shard->hashtable);
+  g_mutex_unlock(shard->mutex);
+
+  // clear lists
+  g_queue_free(shard->list);
+  g_queue_free(shard->protected_list);
+
+  // free mutex
+  g_mutex_free(shard->mutex);
+}
+
+// the shard count is chosen from sizing_capacity, and never changes
+static struct _openslide_cache *cache_new(uint64_t capacity_in_bytes,
+                                          uint64_t sizing_capacity) {
+  //g_debug("_openslide_cache_create");
+  struct _openslide_cache *cache = g_slice_new0(struct _openslide_cache);
+  g_atomic_int_set(&cache->refcount, 1);
+
+  // choose shard count, keeping shards large enough to hold big tiles
+  cache->shard_count = 1;
+  cache->shard_shift = 32;
+  while (cache->shard_count < CACHE_MAX_SHARDS &&
+         sizing_capacity / (cache->shard_count * 2) >=
+         CACHE_MIN_SHARD_CAPACITY) {
+    cache->shard_count *= 2;
+    cache->shard_shift--;
+  }
+
+  for (int i = 0; i < cache->shard_count; i++) {
+    shard_init(&cache->shards[i]);
+  }
+  shard_init(&cache->overflow);
 
   // init byte_capacity
-  cache->capacity = capacity_in_bytes;
+  set_shard_capacities(cache, capacity_in_bytes, _OPENSLIDE_CACHE_POLICY_LRU);
 
   return cache;
 }
 
-void _openslide_cache_destroy(struct _openslide_cache *cache) {
-  //g_debug("_openslide_cache_destroy");
-  // clear hashtable (auto-deletes all data)
-  g_mutex_lock(cache->mutex);
-  g_hash_table_unref(cache->hashtable);
-  g_mutex_unlock(cache->mutex);
+struct _openslide_cache *_openslide_cache_create(uint64_t capacity_in_bytes) {
+  struct _openslide_cache *cache = cache_new(capacity_in_bytes,
+                                             capacity_in_bytes);
+  // the compressed tier is disabled until given a capacity, but is
+  // sharded like its parent so it can be enabled at any time
+  cache->compressed = cache_new(0, capacity_in_bytes);
+  return cache;
+}
 
-  // clear list
-  g_queue_free(cache->list);
+static void cache_destroy(struct _openslide_cache *cache) {
+  //g_debug("_openslide_cache_destroy");
+  for (int i = 0; i < cache->shard_count; i++) {
+    shard_destroy(&cache->shards[i]);
+  }
+  shard_destroy(&cache->overflow);
 
-  // free mutex
-  g_mutex_free(cache->mutex);
+  // destroy lower tier
+  if (cache->compressed) {
+    cache_destroy(cache->compressed);
+  }
 
   // destroy struct
   g_slice_free(struct _openslide_cache, cache);
 }
 
+struct _openslide_cache *_openslide_cache_ref(struct _openslide_cache *cache) {
+  g_atomic_int_inc(&cache->refcount);
+  return cache;
+}
+
+void _openslide_cache_unref(struct _openslide_cache *cache) {
+  if (g_atomic_int_dec_and_test(&cache->refcount)) {
+    cache_destroy(cache);
+  }
+}
+
+struct _openslide_cache_binding *_openslide_cache_binding_create(struct _openslide_cache *cache) {
+  struct _openslide_cache_binding *binding =
+    g_slice_new0(struct _openslide_cache_binding);
+  binding->mutex = g_mutex_new();
+  binding->cache = _openslide_cache_ref(cache);
+
+  G_LOCK(next_binding_id);
+  binding->id = next_binding_id++;
+  G_UNLOCK(next_binding_id);
+
+  return binding;
+}
+
+void _openslide_cache_binding_set(struct _openslide_cache_binding *binding,
+                                  struct _openslide_cache *cache) {
+  _openslide_cache_ref(cache);
 
-int _openslide_cache_get_capacity(struct _openslide_cache *cache) {
-  g_mutex_lock(cache->mutex);
-  int capacity = cache->capacity;
-  g_mutex_unlock(cache->mutex);
+  g_mutex_lock(binding->mutex);
+  struct _openslide_cache *old_cache = binding->cache;
+  binding->cache = cache;
+  g_mutex_unlock(binding->mutex);
+
+  // entries of this binding in the old cache will age out
+  _openslide_cache_unref(old_cache);
+}
+
+void _openslide_cache_binding_enable_disk(struct _openslide_cache_binding *binding,
+                                          const char *slide_key,
+                                          void * const *planes,
+                                          int32_t plane_count) {
+  g_assert(binding->disk_key == NULL);
+  binding->disk_key = g_strdup(slide_key);
+  binding->disk_planes = g_hash_table_new(g_direct_hash, g_direct_equal);
+  for (int32_t i = 0; i < plane_count; i++) {
+    g_hash_table_insert(binding->disk_planes, planes[i],
+                        GINT_TO_POINTER(i + 1));
+  }
+}
+
+// -1 if the plane's tiles aren't kept on disk
+static int32_t get_disk_plane(struct _openslide_cache_binding *binding,
+                              void *plane) {
+  if (!binding->disk_key) {
+    return -1;
+  }
+  return GPOINTER_TO_INT(g_hash_table_lookup(binding->disk_planes,
+                                             plane)) - 1;
+}
+
+void _openslide_cache_binding_pin(struct _openslide_cache_binding *binding,
+                                   void * const *planes,
+                                   int32_t plane_count) {
+  g_assert(binding->pinned_planes == NULL);
+  binding->pinned_planes = g_hash_table_new(g_direct_hash, g_direct_equal);
+  for (int32_t i = 0; i < plane_count; i++) {
+    g_hash_table_insert(binding->pinned_planes, planes[i], planes[i]);
+  }
+  binding->pinned = g_hash_table_new_full(hash_func, key_equal_func,
+                                          hash_destroy_key,
+                                          (GDestroyNotify) _openslide_cache_entry_unref);
+}
+
+static bool is_pinned(struct _openslide_cache_binding *binding,
+                      void *plane) {
+  return binding->pinned_planes &&
+    g_hash_table_lookup(binding->pinned_planes, plane) != NULL;
+}
+
+// keep another reference to the entry
+static void pin_entry(struct _openslide_cache_binding *binding,
+                      void *plane, int64_t x, int64_t y,
+                      struct _openslide_cache_entry *entry) {
+  struct _openslide_cache_key *key = g_slice_new(struct _openslide_cache_key);
+  key->binding_id = binding->id;
+  key->plane = plane;
+  key->x = x;
+  key->y = y;
+  g_atomic_int_inc(&entry->refcount);
+
+  g_mutex_lock(binding->mutex);
+  g_hash_table_replace(binding->pinned, key, entry);
+  g_mutex_unlock(binding->mutex);
+}
+
+static void *get_pinned(struct _openslide_cache_binding *binding,
+                        void *plane, int64_t x, int64_t y,
+                        struct _openslide_cache_entry **_entry) {
+  struct _openslide_cache_key key = {
+    .binding_id = binding->id,
+    .plane = plane,
+    .x = x,
+    .y = y,
+  };
+
+  g_mutex_lock(binding->mutex);
+  struct _openslide_cache_entry *entry = g_hash_table_lookup(binding->pinned,
+                                                             &key);
+  if (entry) {
+    g_atomic_int_inc(&entry->refcount);
+  }
+  g_mutex_unlock(binding->mutex);
+
+  *_entry = entry;
+  return entry ? entry->data : NULL;
+}
+
+void _openslide_cache_binding_destroy(struct _openslide_cache_binding *binding) {
+  if (binding->pinned) {
+    g_hash_table_destroy(binding->pinned);
+    g_hash_table_destroy(binding->pinned_planes);
+  }
+  if (binding->disk_planes) {
+    g_hash_table_destroy(binding->disk_planes);
+  }
+  g_free(binding->disk_key);
+  _openslide_cache_unref(binding->cache);
+  g_mutex_free(binding->mutex);
+  g_slice_free(struct _openslide_cache_binding, binding);
+}
+
+// returns a reference to the cache currently used by the binding
+struct _openslide_cache *_openslide_cache_binding_get(struct _openslide_cache_binding *binding) {
+  g_mutex_lock(binding->mutex);
+  struct _openslide_cache *cache = _openslide_cache_ref(binding->cache);
+  g_mutex_unlock(binding->mutex);
+  return cache;
+}
+
+
+uint64_t _openslide_cache_get_capacity(struct _openslide_cache *cache) {
+  // any shard mutex is enough to read the capacity
+  g_mutex_lock(cache->shards[0].mutex);
+  uint64_t capacity = cache->capacity;
+  g_mutex_unlock(cache->shards[0].mutex);
   return capacity;
 }
 
 void _openslide_cache_set_capacity(struct _openslide_cache *cache,
-				   int capacity_in_bytes) {
-  g_assert(capacity_in_bytes >= 0);
+				   uint64_t capacity_in_bytes) {
+  lock_shards(cache);
+  set_shard_capacities(cache, capacity_in_bytes, cache->policy);
+  unlock_shards(cache);
+}
 
-  g_mutex_lock(cache->mutex);
-  cache->capacity = capacity_in_bytes;
-  possibly_evict(cache, 0);
-  g_mutex_unlock(cache->mutex);
+enum _openslide_cache_policy _openslide_cache_get_policy(struct _openslide_cache *cache) {
+  // any shard mutex is enough to read the policy
+  g_mutex_lock(cache->shards[0].mutex);
+  enum _openslide_cache_policy policy = cache->policy;
+  g_mutex_unlock(cache->shards[0].mutex);
+  return policy;
+}
+
+void _openslide_cache_set_policy(struct _openslide_cache *cache,
+                                 enum _openslide_cache_policy policy) {
+  lock_shards(cache);
+  set_shard_capacities(cache, cache->capacity, policy);
+  unlock_shards(cache);
+}
+
+uint64_t _openslide_cache_get_compressed_capacity(struct _openslide_cache *cache) {
+  return _openslide_cache_get_capacity(cache->compressed);
+}
+
+void _openslide_cache_set_compressed_capacity(struct _openslide_cache *cache,
+                                              uint64_t capacity_in_bytes) {
+  _openslide_cache_set_capacity(cache->compressed, capacity_in_bytes);
+}
+
+// statistics, summed over the shards
+void _openslide_cache_get_stats(struct _openslide_cache *cache,
+                                uint64_t *hits,
+                                uint64_t *misses,
+                                uint64_t *evictions,
+                                uint64_t *size_in_bytes) {
+  *hits = 0;
+  *misses = 0;
+  *evictions = 0;
+  *size_in_bytes = 0;
+
+  for (int i = 0; i <= cache->shard_count; i++) {
+    struct _openslide_cache_shard *shard =
+      i < cache->shard_count ? &cache->shards[i] : &cache->overflow;
+    g_mutex_lock(shard->mutex);
+    *hits += shard->hits;
+    *misses += shard->misses;
+    *evictions += shard->evictions;
+    *size_in_bytes += shard->total_size;
+    g_mutex_unlock(shard->mutex);
+  }
 }
 
 // put and get
 
-// the cache retains one reference, and the caller gets another one.  the
-// entry must be unreffed when the caller is done with it.
-void _openslide_cache_put(struct _openslide_cache *cache,
-			  void *plane,
-			  int64_t x,
-			  int64_t y,
-			  void *data,
-			  int size_in_bytes,
-			  struct _openslide_cache_entry **_entry) {
+static gpointer held_entries_init(gpointer data G_GNUC_UNUSED) {
+  held_entries = g_private_new(NULL);
+  return NULL;
+}
+
+static GPrivate *get_held_entries(void) {
+  static GOnce once = G_ONCE_INIT;
+  g_once(&once, held_entries_init, NULL);
+  return held_entries;
+}
+
+void _openslide_cache_hold_entries(GPtrArray *held) {
+  g_private_set(get_held_entries(), held);
+}
+
+void _openslide_cache_release_held_entries(GPtrArray *held) {
+  for (guint i = 0; i < held->len; i++) {
+    _openslide_cache_entry_unref(held->pdata[i]);
+  }
+  g_ptr_array_set_size(held, 0);
+}
+
+static void hold_entry(struct _openslide_cache_entry *entry) {
+  GPtrArray *held = g_private_get(get_held_entries());
+  if (held) {
+    g_atomic_int_inc(&entry->refcount);
+    g_ptr_array_add(held, entry);
+  }
+}
+
+static void cache_put(struct _openslide_cache *cache,
+                      uint64_t binding_id,
+                      void *plane,
+                      int64_t x,
+                      int64_t y,
+                      void *data,
+                      int size_in_bytes,
+                      struct _openslide_cache_entry **_entry) {
   // always create cache entry for caller's reference
   struct _openslide_cache_entry *entry =
       g_slice_new(struct _openslide_cache_entry);
@@ -209,83 +755,127 @@ void _openslide_cache_put(struct _openslide_cache *cache,
   g_atomic_int_set(&entry->refcount, 1);
   entry->data = data;
   entry->size = size_in_bytes;
+  // only the compressed tier, which has no lower tier, holds other data
+  entry->tile_buffer = cache->compressed != NULL;
   *_entry = entry;
 
+  // tiles read by a scan won't be read again, and would only evict
+  // everyone else's.  The compressed tier still holds coalesced reads
+  // until they are decoded.
+  if (cache->compressed && _openslide_stats_get_scan()) {
+    return;
+  }
+
+  // create key
+  struct _openslide_cache_key *key = g_slice_new(struct _openslide_cache_key);
+  key->binding_id = binding_id;
+  key->plane = plane;
+  key->x = x;
+  key->y = y;
+
   // lock
-  g_mutex_lock(cache->mutex);
+  struct _openslide_cache_shard *shard = get_shard(cache, key);
+  g_mutex_lock(shard->mutex);
+
+  // too large for its shard, but maybe not for the cache
+  if ((uint64_t) size_in_bytes > shard->capacity && cache->shard_count > 1) {
+    g_mutex_unlock(shard->mutex);
+    shard = &cache->overflow;
+    g_mutex_lock(shard->mutex);
+  }
+
+  // caching disabled; nothing to warn about
+  if (shard->capacity == 0) {
+    g_mutex_unlock(shard->mutex);
+    g_slice_free(struct _openslide_cache_key, key);
+    return;
+  }
 
   // don't try to put anything in the cache that cannot possibly fit
-  if (size_in_bytes > cache->capacity) {
-    // g_debug("refused %p, size of %d bytes to large for cache capacity of %d bytes",
+  if ((uint64_t) size_in_bytes > shard->capacity) {
+    // g_debug("refused %p, size of %d bytes to large for cache capacity of %"PRIu64" bytes",
     //         entry,
     //         size_in_bytes,
-    //         cache->capacity);
-    g_mutex_unlock(cache->mutex);
+    //         shard->capacity);
+    g_mutex_unlock(shard->mutex);
+    g_slice_free(struct _openslide_cache_key, key);
     _openslide_performance_warn_once(&cache->warned_overlarge_entry,
                                      "Rejecting overlarge cache entry of "
                                      "size %d bytes", size_in_bytes);
     return;
   }
 
-  possibly_evict(cache, size_in_bytes); // already checks for size >= 0
-
-  // create key
-  struct _openslide_cache_key *key = g_slice_new(struct _openslide_cache_key);
-  key->plane = plane;
-  key->x = x;
-  key->y = y;
+  possibly_evict(shard, size_in_bytes); // already checks for size >= 0
 
   // create value
   struct _openslide_cache_value *value =
     g_slice_new(struct _openslide_cache_value);
   value->key = key;
-  value->cache = cache;
+  value->shard = shard;
+  value->protected = false;
   value->entry = entry;
 
   // insert at head of queue
-  g_queue_push_head(cache->list, value);
-  value->link = g_queue_peek_head_link(cache->list);
+  g_queue_push_head(shard->list, value);
+  value->link = g_queue_peek_head_link(shard->list);
 
   // insert into hash table
-  g_hash_table_replace(cache->hashtable, key, value);
+  g_hash_table_replace(shard->hashtable, key, value);
 
   // increase size
-  cache->total_size += size_in_bytes;
+  shard->total_size += size_in_bytes;
+  g_atomic_int_inc(&shard->entry_count);
 
   // another ref for the cache
   g_atomic_int_inc(&entry->refcount);
 
   // unlock
-  g_mutex_unlock(cache->mutex);
+  g_mutex_unlock(shard->mutex);
 
   //g_debug("insert %p", entry);
 }
 
-// entry must be unreffed when the caller is done with the data
-void *_openslide_cache_get(struct _openslide_cache *cache,
-			   void *plane,
-			   int64_t x,
-			   int64_t y,
-			   struct _openslide_cache_entry **_entry) {
-  // lock
-  g_mutex_lock(cache->mutex);
-
+static void *cache_get(struct _openslide_cache *cache,
+                       uint64_t binding_id,
+                       void *plane,
+                       int64_t x,
+                       int64_t y,
+                       struct _openslide_cache_entry **_entry) {
   // create key
-  struct _openslide_cache_key key = { .plane = plane, .x = x, .y = y };
+  struct _openslide_cache_key key = {
+    .binding_id = binding_id,
+    .plane = plane,
+    .x = x,
+    .y = y,
+  };
+
+  // lock
+  struct _openslide_cache_shard *shard = get_shard(cache, &key);
+  g_mutex_lock(shard->mutex);
 
-  // lookup key, maybe return NULL
-  struct _openslide_cache_value *value = g_hash_table_lookup(cache->hashtable,
+  // lookup key, then in the overflow shard if it holds anything, maybe
+  // return NULL
+  struct _openslide_cache_value *value = g_hash_table_lookup(shard->hashtable,
 							     &key);
+  if (value == NULL && cache->shard_count > 1 &&
+      g_atomic_int_get(&cache->overflow.entry_count)) {
+    g_mutex_unlock(shard->mutex);
+    shard = &cache->overflow;
+    g_mutex_lock(shard->mutex);
+    value = g_hash_table_lookup(shard->hashtable, &key);
+  }
   if (value == NULL) {
-    g_mutex_unlock(cache->mutex);
+    // counted in the shard looked at last
+    shard->misses++;
+    g_mutex_unlock(shard->mutex);
     *_entry = NULL;
     return NULL;
   }
 
+  shard->hits++;
+
   // if found, move to front of list
-  GList *link = value->link;
-  g_queue_unlink(cache->list, link);
-  g_queue_push_head_link(cache->list, link);
+  touch_value(shard, value);
 
   // acquire entry reference for the caller
   struct _openslide_cache_entry *entry = value->entry;
@@ -294,20 +884,205 @@ void *_openslide_cache_get(struct _openslide_cache *cache,
   //g_debug("cache hit! %p %p %"PRId64" %"PRId64, (void *) entry, (void *) plane, x, y);
 
   // unlock
-  g_mutex_unlock(cache->mutex);
+  g_mutex_unlock(shard->mutex);
 
   // return data
   *_entry = entry;
   return entry->data;
 }
 
+// the cache retains one reference, and the caller gets another one.  the
+// entry must be unreffed when the caller is done with it.  data must be
+// allocated with _openslide_tile_buffer_alloc(size_in_bytes).
+void _openslide_cache_put(struct _openslide_cache_binding *binding,
+			  void *plane,
+			  int64_t x,
+			  int64_t y,
+			  void *data,
+			  int size_in_bytes,
+			  struct _openslide_cache_entry **entry) {
+  struct _openslide_cache *cache = _openslide_cache_binding_get(binding);
+  cache_put(cache, binding->id, plane, x, y, data, size_in_bytes, entry);
+  _openslide_cache_unref(cache);
+  hold_entry(*entry);
+  if (is_pinned(binding, plane)) {
+    pin_entry(binding, plane, x, y, *entry);
+  }
+}
+
+// same, for a tile of w x h pixels, which is also kept in the disk cache
+void _openslide_cache_put_tile(struct _openslide_cache_binding *binding,
+                               void *plane,
+                               int64_t x,
+                               int64_t y,
+                               int32_t w,
+                               int32_t h,
+                               cairo_format_t format,
+                               void *data,
+                               struct _openslide_cache_entry **entry) {
+  _openslide_cache_put(binding, plane, x, y, data, w * h * 4, entry);
+
+  // a scan would only evict others' tiles from the disk, too
+  int32_t disk_plane = get_disk_plane(binding, plane);
+  if (disk_plane >= 0 && !_openslide_stats_get_scan()) {
+    const struct _openslide_diskcache_tile geometry = {
+      .w = w,
+      .h = h,
+      .format = format,
+    };
+    _openslide_diskcache_put(binding->disk_key, disk_plane, x, y,
+                             &geometry, data);
+  }
+}
+
+// look in memory, then on the disk if geometry is given
+static void *get_tile(struct _openslide_cache_binding *binding,
+                      void *plane,
+                      int64_t x,
+                      int64_t y,
+                      const struct _openslide_diskcache_tile *geometry,
+                      struct _openslide_cache_entry **entry) {
+  bool pinned = is_pinned(binding, plane);
+  if (pinned) {
+    void *data = get_pinned(binding, plane, x, y, entry);
+    if (data) {
+      _openslide_stats_add(OPENSLIDE_STAT_CACHE_HITS, 1);
+      hold_entry(*entry);
+      return data;
+    }
+  }
+
+  struct _openslide_cache *cache = _openslide_cache_binding_get(binding);
+  void *data = cache_get(cache, binding->id, plane, x, y, entry);
+  _openslide_stats_add(data ? OPENSLIDE_STAT_CACHE_HITS :
+                       OPENSLIDE_STAT_CACHE_MISSES, 1);
+
+  // look on the disk, and keep what we find in memory
+  int32_t disk_plane = geometry ? get_disk_plane(binding, plane) : -1;
+  if (!data && disk_plane >= 0) {
+    data = _openslide_diskcache_get(binding->disk_key, disk_plane, x, y,
+                                    geometry);
+    if (data) {
+      _openslide_stats_add(OPENSLIDE_STAT_DISK_CACHE_HITS, 1);
+      cache_put(cache, binding->id, plane, x, y, data,
+                geometry->w * geometry->h * 4, entry);
+    }
+  }
+  if (data) {
+    hold_entry(*entry);
+  }
+  if (data && pinned) {
+    // pinned after it was evicted, or before pinning began
+    pin_entry(binding, plane, x, y, *entry);
+  }
+  _openslide_cache_unref(cache);
+  return data;
+}
+
+// entry must be unreffed when the caller is done with the data
+void *_openslide_cache_get(struct _openslide_cache_binding *binding,
+			   void *plane,
+			   int64_t x,
+			   int64_t y,
+			   struct _openslide_cache_entry **entry) {
+  return get_tile(binding, plane, x, y, NULL, entry);
+}
+
+// same, for a tile put with _openslide_cache_put_tile().  A tile found in
+// the disk cache is only returned if it has the same size and format.
+void *_openslide_cache_get_tile(struct _openslide_cache_binding *binding,
+                                void *plane,
+                                int64_t x,
+                                int64_t y,
+                                int32_t w,
+                                int32_t h,
+                                cairo_format_t format,
+                                struct _openslide_cache_entry **entry) {
+  const struct _openslide_diskcache_tile geometry = {
+    .w = w,
+    .h = h,
+    .format = format,
+  };
+  return get_tile(binding, plane, x, y, &geometry, entry);
+}
+
+// whether a decoded tile is in memory, without using it
+bool _openslide_cache_contains(struct _openslide_cache_binding *binding,
+                               void *plane,
+                               int64_t x,
+                               int64_t y) {
+  struct _openslide_cache_key key = {
+    .binding_id = binding->id,
+    .plane = plane,
+    .x = x,
+    .y = y,
+  };
+
+  if (is_pinned(binding, plane)) {
+    g_mutex_lock(binding->mutex);
+    bool found = g_hash_table_lookup(binding->pinned, &key) != NULL;
+    g_mutex_unlock(binding->mutex);
+    if (found) {
+      return true;
+    }
+  }
+
+  struct _openslide_cache *cache = _openslide_cache_binding_get(binding);
+  struct _openslide_cache_shard *shard = get_shard(cache, &key);
+  g_mutex_lock(shard->mutex);
+  bool found = g_hash_table_lookup(shard->hashtable, &key) != NULL;
+  g_mutex_unlock(shard->mutex);
+  if (!found && cache->shard_count > 1 &&
+      g_atomic_int_get(&cache->overflow.entry_count)) {
+    g_mutex_lock(cache->overflow.mutex);
+    found = g_hash_table_lookup(cache->overflow.hashtable, &key) != NULL;
+    g_mutex_unlock(cache->overflow.mutex);
+  }
+  _openslide_cache_unref(cache);
+  return found;
+}
+
+// same as above, for the compressed tier.  data must be allocated with
+// g_slice_alloc(size_in_bytes).
+void _openslide_cache_put_compressed(struct _openslide_cache_binding *binding,
+                                     void *plane,
+                                     int64_t x,
+                                     int64_t y,
+                                     void *data,
+                                     int size_in_bytes,
+                                     struct _openslide_cache_entry **entry) {
+  struct _openslide_cache *cache = _openslide_cache_binding_get(binding);
+  cache_put(cache->compressed, binding->id, plane, x, y,
+            data, size_in_bytes, entry);
+  _openslide_cache_unref(cache);
+}
+
+void *_openslide_cache_get_compressed(struct _openslide_cache_binding *binding,
+                                      void *plane,
+                                      int64_t x,
+                                      int64_t y,
+                                      int *size_in_bytes,
+                                      struct _openslide_cache_entry **entry) {
+  struct _openslide_cache *cache = _openslide_cache_binding_get(binding);
+  void *data = cache_get(cache->compressed, binding->id, plane, x, y, entry);
+  _openslide_cache_unref(cache);
+  if (data) {
+    *size_in_bytes = (*entry)->size;
+  }
+  return data;
+}
+
 // value unref
 void _openslide_cache_entry_unref(struct _openslide_cache_entry *entry) {
   //g_debug("unref %p, refs %d", entry, g_atomic_int_get(&entry->refcount));
 
   if (g_atomic_int_dec_and_test(&entry->refcount)) {
     // free the data
-    g_slice_free1(entry->size, entry->data);
+    if (entry->tile_buffer) {
+      _openslide_tile_buffer_free(entry->data, entry->size);
+    } else {
+      g_slice_free1(entry->size, entry->data);
+    }
 
     // free the entry
     g_slice_free(struct _openslide_cache_entry, entry);
@@ -0,0 +1,202 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2007-2014 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <config.h>
+
+#include "openslide-private.h"
+#include "openslide-decode-bmp.h"
+#include "openslide-decode-gdkpixbuf.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+// BMP decoding for the common uncompressed cases.  Rows are read a block
+// at a time and converted straight into the destination, without the
+// intermediate pixbuf of a gdk-pixbuf loader.
+
+#define FILE_HEADER_SIZE 14
+#define INFO_HEADER_SIZE 40
+#define BI_RGB 0
+
+// bytes read at once, rounded down to whole rows
+#define BUFSIZE (64 << 10)
+
+static uint16_t read_le16(const uint8_t *p) {
+  return p[0] | p[1] << 8;
+}
+
+static uint32_t read_le32(const uint8_t *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static void convert_row(const uint8_t *in, uint32_t *out, int32_t w,
+                        int32_t bpp, const uint32_t *palette) {
+  switch (bpp) {
+  case 8:
+    for (int32_t x = 0; x < w; x++) {
+      out[x] = palette[in[x]];
+    }
+    break;
+  case 24:
+    for (int32_t x = 0; x < w; x++, in += 3) {
+      out[x] = 0xFF000000 | in[2] << 16 | in[1] << 8 | in[0];
+    }
+    break;
+  case 32:
+    // the fourth byte is unused without BI_BITFIELDS
+    for (int32_t x = 0; x < w; x++, in += 4) {
+      out[x] = 0xFF000000 | in[2] << 16 | in[1] << 8 | in[0];
+    }
+    break;
+  default:
+    g_assert_not_reached();
+  }
+}
+
+static bool read_file(FILE *f,
+                      const char *filename,
+                      int64_t offset,
+                      int64_t length,
+                      uint32_t *dest,
+                      int32_t w, int32_t h,
+                      GError **err) {
+  uint8_t header[FILE_HEADER_SIZE + INFO_HEADER_SIZE];
+  uint32_t palette[256];
+  uint8_t *buf = NULL;
+  bool success = false;
+
+  // read headers
+  if (fseeko(f, offset, SEEK_SET)) {
+    _openslide_io_error(err, "Couldn't fseek %s", filename);
+    return false;
+  }
+  if (length < (int64_t) sizeof(header) ||
+      _openslide_fread(f, header, sizeof(header)) != sizeof(header)) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Short read loading BMP header from %s", filename);
+    return false;
+  }
+  if (header[0] != 'B' || header[1] != 'M') {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Not a BMP image");
+    return false;
+  }
+  const uint8_t *info = header + FILE_HEADER_SIZE;
+  uint32_t data_offset = read_le32(header + 10);
+  uint32_t info_size = read_le32(info);
+  int32_t width = read_le32(info + 4);
+  int64_t height = (int32_t) read_le32(info + 8);
+  int32_t bpp = read_le16(info + 14);
+  uint32_t compression = read_le32(info + 16);
+  uint32_t colors = read_le32(info + 32);
+
+  // leave the less common variants to gdk-pixbuf
+  if (info_size < INFO_HEADER_SIZE || compression != BI_RGB ||
+      (bpp != 8 && bpp != 24 && bpp != 32) || colors > 256) {
+    return _openslide_gdkpixbuf_read_file("bmp", f, filename, offset, length,
+                                          dest, w, h, err);
+  }
+
+  // rows are stored bottom-up, unless the height is negative
+  bool top_down = height < 0;
+  if (top_down) {
+    height = -height;
+  }
+  if (width != w || height != h) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Dimensional mismatch reading BMP: "
+                "expected %dx%d, found %dx%"PRId64, w, h, width, height);
+    return false;
+  }
+
+  // rows are padded to 4 bytes
+  int64_t row_size = ((int64_t) w * bpp / 8 + 3) & ~3;
+  if (data_offset < FILE_HEADER_SIZE + info_size ||
+      data_offset + row_size * h > length) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "BMP pixel data extends past the image");
+    return false;
+  }
+
+  // the palette follows the info header, as BGRx
+  if (bpp == 8) {
+    uint32_t count = colors ? colors : 256;
+    uint8_t entries[256 * 4];
+    if (FILE_HEADER_SIZE + info_size + count * 4 > data_offset ||
+        fseeko(f, offset + FILE_HEADER_SIZE + info_size, SEEK_SET) ||
+        _openslide_fread(f, entries, count * 4) != count * 4) {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Couldn't read BMP palette");
+      return false;
+    }
+    memset(palette, 0, sizeof(palette));
+    for (uint32_t i = 0; i < count; i++) {
+      const uint8_t *e = entries + i * 4;
+      palette[i] = 0xFF000000 | e[2] << 16 | e[1] << 8 | e[0];
+    }
+  }
+
+  if (fseeko(f, offset + data_offset, SEEK_SET)) {
+    _openslide_io_error(err, "Couldn't fseek %s to BMP pixel data", filename);
+    return false;
+  }
+
+  // read and convert blocks of rows
+  int32_t rows_per_block = MAX(1, BUFSIZE / row_size);
+  size_t buf_size = row_size * MIN(rows_per_block, h);
+  buf = g_slice_alloc(buf_size);
+  for (int32_t row = 0; row < h; row += rows_per_block) {
+    int32_t count = MIN(rows_per_block, h - row);
+    size_t len = row_size * count;
+    if (_openslide_fread(f, buf, len) != len) {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Short read loading BMP pixel data from %s",
+                  filename);
+      goto DONE;
+    }
+    for (int32_t i = 0; i < count; i++) {
+      int32_t y = top_down ? row + i : h - 1 - (row + i);
+      convert_row(buf + i * row_size, dest + (int64_t) y * w, w, bpp,
+                  palette);
+    }
+  }
+  success = true;
+
+DONE:
+  g_slice_free1(buf_size, buf);
+  return success;
+}
+
+bool _openslide_bmp_read_file(FILE *f,
+                              const char *filename,
+                              int64_t offset,
+                              int64_t length,
+                              uint32_t *dest,
+                              int32_t w, int32_t h,
+                              GError **err) {
+  struct _openslide_stats_timer timer;
+  _openslide_stats_begin(&timer);
+  bool success = read_file(f, filename, offset, length, dest, w, h, err);
+  _openslide_stats_end(&timer, OPENSLIDE_STAT_DECODE_TIME_BMP);
+  return success;
+}
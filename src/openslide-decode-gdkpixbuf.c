@@ -81,13 +81,14 @@ static void area_prepared(GdkPixbufLoader *loader, void *data) {
   state->pixbuf = pixbuf;
 }
 
-bool _openslide_gdkpixbuf_read(const char *format,
-                               const char *filename,
-                               int64_t offset,
-                               int64_t length,
-                               uint32_t *dest,
-                               int32_t w, int32_t h,
-                               GError **err) {
+bool _openslide_gdkpixbuf_read_file(const char *format,
+                                    FILE *f,
+                                    const char *filename,
+                                    int64_t offset,
+                                    int64_t length,
+                                    uint32_t *dest,
+                                    int32_t w, int32_t h,
+                                    GError **err) {
   GdkPixbufLoader *loader = NULL;
   uint8_t *buf = g_slice_alloc(BUFSIZE);
   bool success = false;
@@ -95,12 +96,10 @@ bool _openslide_gdkpixbuf_read(const char *format,
     .w = w,
     .h = h,
   };
+  struct _openslide_stats_timer timer;
+  _openslide_stats_begin(&timer);
 
-  // open and seek
-  FILE *f = _openslide_fopen(filename, "rb", err);
-  if (!f) {
-    goto DONE;
-  }
+  // seek
   if (fseeko(f, offset, SEEK_SET)) {
     _openslide_io_error(err, "Couldn't fseek %s", filename);
     goto DONE;
@@ -115,7 +114,7 @@ bool _openslide_gdkpixbuf_read(const char *format,
 
   // read data
   while (length) {
-    size_t count = fread(buf, 1, MIN(length, BUFSIZE), f);
+    size_t count = _openslide_fread(f, buf, MIN(length, BUFSIZE));
     if (!count) {
       g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                   "Short read loading pixbuf from %s", filename);
@@ -161,9 +160,6 @@ DONE:
     gdk_pixbuf_loader_close(loader, NULL);
     g_object_unref(loader);
   }
-  if (f) {
-    fclose(f);
-  }
   g_slice_free1(BUFSIZE, buf);
 
   // now that the loader is closed, we know state.err won't be set
@@ -175,5 +171,24 @@ DONE:
     // signal handler errors should have been noticed before falling through
     g_assert(!success);
   }
+  _openslide_stats_end(&timer, OPENSLIDE_STAT_DECODE_TIME_OTHER);
+  return success;
+}
+
+bool _openslide_gdkpixbuf_read(const char *format,
+                               const char *filename,
+                               int64_t offset,
+                               int64_t length,
+                               uint32_t *dest,
+                               int32_t w, int32_t h,
+                               GError **err) {
+  FILE *f = _openslide_fopen(filename, "rb", err);
+  if (!f) {
+    return false;
+  }
+  bool success = _openslide_gdkpixbuf_read_file(format, f, filename,
+                                                offset, length,
+                                                dest, w, h, err);
+  fclose(f);
   return success;
 }
@@ -22,11 +22,23 @@
 #ifndef OPENSLIDE_OPENSLIDE_DECODE_GDKPIXBUF_H_
 #define OPENSLIDE_OPENSLIDE_DECODE_GDKPIXBUF_H_
 
+#include <stdio.h>
 #include <stdint.h>
 #include <glib.h>
 
 /* Support for formats supported by gdk-pixbuf (BMP, PNM, etc.) */
 
+// reads from a FILE that may be reused, like one from a filecache;
+// filename is only used in error messages
+bool _openslide_gdkpixbuf_read_file(const char *format,
+                                    FILE *f,
+                                    const char *filename,
+                                    int64_t offset,
+                                    int64_t length,
+                                    uint32_t *dest,
+                                    int32_t w, int32_t h,
+                                    GError **err);
+
 bool _openslide_gdkpixbuf_read(const char *format,
                                const char *filename,
                                int64_t offset,
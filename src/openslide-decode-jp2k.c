@@ -58,12 +58,14 @@ static void unpack_argb(enum _openslide_jp2k_colorspace space,
                         opj_image_comp_t *comps,
                         uint32_t *dest,
                         int32_t w, int32_t h) {
-  int c0_sub_x = w / comps[0].w;
-  int c1_sub_x = w / comps[1].w;
-  int c2_sub_x = w / comps[2].w;
-  int c0_sub_y = h / comps[0].h;
-  int c1_sub_y = h / comps[1].h;
-  int c2_sub_y = h / comps[2].h;
+  // from the component headers, since reduced or odd-sized components
+  // round their dimensions up
+  int c0_sub_x = comps[0].dx;
+  int c1_sub_x = comps[1].dx;
+  int c2_sub_x = comps[2].dx;
+  int c0_sub_y = comps[0].dy;
+  int c1_sub_y = comps[1].dy;
+  int c2_sub_y = comps[2].dy;
 
   //g_debug("color space %d, subsamples x %d-%d-%d y %d-%d-%d", space, c0_sub_x, c1_sub_x, c2_sub_x, c0_sub_y, c1_sub_y, c2_sub_y);
 
@@ -71,32 +73,33 @@ static void unpack_argb(enum _openslide_jp2k_colorspace space,
       c0_sub_x == 1 && c1_sub_x == 2 && c2_sub_x == 2 &&
       c0_sub_y == 1 && c1_sub_y == 1 && c2_sub_y == 1) {
     // Aperio 33003
+    // Look up the chroma of each pair of pixels into row buffers, then
+    // add the luma in a plain loop over the row, which the compiler
+    // can vectorize.  Sized for a trailing odd pixel.
+    int16_t *R_chroma = g_new(int16_t, w + 1);
+    int16_t *G_chroma = g_new(int16_t, w + 1);
+    int16_t *B_chroma = g_new(int16_t, w + 1);
     for (int32_t y = 0; y < h; y++) {
-      int32_t c0_row_base = y * comps[0].w;
-      int32_t c1_row_base = y * comps[1].w;
-      int32_t c2_row_base = y * comps[2].w;
-      int32_t x;
-      for (x = 0; x < w - 1; x += 2) {
-        uint8_t c0 = comps[0].data[c0_row_base + x];
-        uint8_t c1 = comps[1].data[c1_row_base + (x / 2)];
-        uint8_t c2 = comps[2].data[c2_row_base + (x / 2)];
-        int16_t R_chroma = _openslide_R_Cr[c2];
-        int16_t G_chroma = (_openslide_G_Cb[c1] + _openslide_G_Cr[c2]) >> 16;
-        int16_t B_chroma = _openslide_B_Cb[c1];
-        write_pixel_ycbcr(dest++, c0, R_chroma, G_chroma, B_chroma);
-        c0 = comps[0].data[c0_row_base + x + 1];
-        write_pixel_ycbcr(dest++, c0, R_chroma, G_chroma, B_chroma);
+      const int32_t *c0 = comps[0].data + y * comps[0].w;
+      const int32_t *c1 = comps[1].data + y * comps[1].w;
+      const int32_t *c2 = comps[2].data + y * comps[2].w;
+      for (int32_t x = 0; x < w; x += 2) {
+        uint8_t cb = c1[x / 2];
+        uint8_t cr = c2[x / 2];
+        R_chroma[x] = R_chroma[x + 1] = _openslide_R_Cr[cr];
+        G_chroma[x] = G_chroma[x + 1] =
+          (_openslide_G_Cb[cb] + _openslide_G_Cr[cr]) >> 16;
+        B_chroma[x] = B_chroma[x + 1] = _openslide_B_Cb[cb];
       }
-      if (x < w) {
-        uint8_t c0 = comps[0].data[c0_row_base + x];
-        uint8_t c1 = comps[1].data[c1_row_base + (x / 2)];
-        uint8_t c2 = comps[2].data[c2_row_base + (x / 2)];
-        int16_t R_chroma = _openslide_R_Cr[c2];
-        int16_t G_chroma = (_openslide_G_Cb[c1] + _openslide_G_Cr[c2]) >> 16;
-        int16_t B_chroma = _openslide_B_Cb[c1];
-        write_pixel_ycbcr(dest++, c0, R_chroma, G_chroma, B_chroma);
+      for (int32_t x = 0; x < w; x++) {
+        write_pixel_ycbcr(dest + x, c0[x],
+                          R_chroma[x], G_chroma[x], B_chroma[x]);
       }
+      dest += w;
     }
+    g_free(R_chroma);
+    g_free(G_chroma);
+    g_free(B_chroma);
 
   } else if (space == OPENSLIDE_JP2K_YCBCR) {
     // Slow fallback
@@ -128,15 +131,13 @@ static void unpack_argb(enum _openslide_jp2k_colorspace space,
              c0_sub_y == 1 && c1_sub_y == 1 && c2_sub_y == 1) {
     // Aperio 33005
     for (int32_t y = 0; y < h; y++) {
-      int32_t c0_row_base = y * comps[0].w;
-      int32_t c1_row_base = y * comps[1].w;
-      int32_t c2_row_base = y * comps[2].w;
+      const int32_t *c0 = comps[0].data + y * comps[0].w;
+      const int32_t *c1 = comps[1].data + y * comps[1].w;
+      const int32_t *c2 = comps[2].data + y * comps[2].w;
       for (int32_t x = 0; x < w; x++) {
-        uint8_t c0 = comps[0].data[c0_row_base + x];
-        uint8_t c1 = comps[1].data[c1_row_base + x];
-        uint8_t c2 = comps[2].data[c2_row_base + x];
-        write_pixel_rgb(dest++, c0, c1, c2);
+        write_pixel_rgb(dest + x, c0[x], c1[x], c2[x]);
       }
+      dest += w;
     }
 
   } else if (space == OPENSLIDE_JP2K_RGB) {
@@ -163,6 +164,70 @@ static void unpack_argb(enum _openslide_jp2k_colorspace space,
   }
 }
 
+// image size after discarding reduce resolution levels
+static uint32_t reduced_dimension(uint32_t full, int32_t reduce) {
+  return (full + (1 << reduce) - 1) >> reduce;
+}
+
+static uint16_t read_be16(const uint8_t *p) {
+  return p[0] << 8 | p[1];
+}
+
+// walk the main header markers of a codestream to find how many
+// decomposition levels every component has
+bool _openslide_jp2k_get_resolution_reductions(const void *data,
+                                               int32_t datalen,
+                                               int32_t *reductions,
+                                               GError **err) {
+  const uint8_t *p = data;
+  const uint8_t *end = p + datalen;
+  int32_t components = 0;
+  int32_t levels = -1;
+
+  if (datalen < 2 || read_be16(p) != 0xff4f) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Not a JPEG 2000 codestream");
+    return false;
+  }
+  p += 2;
+
+  // up to the first tile-part
+  while (end - p >= 4 && read_be16(p) != 0xff90) {
+    uint16_t marker = read_be16(p);
+    uint16_t len = read_be16(p + 2);
+    const uint8_t *seg = p + 4;
+    if (len < 2 || end - (p + 2) < len) {
+      break;
+    }
+    int32_t seglen = len - 2;
+
+    if (marker == 0xff51 && seglen >= 36) {
+      // SIZ
+      components = read_be16(seg + 34);
+    } else if (marker == 0xff52 && seglen >= 6) {
+      // COD: default for all components
+      int32_t cod_levels = seg[5];
+      levels = levels == -1 ? cod_levels : MIN(levels, cod_levels);
+    } else if (marker == 0xff53 && components) {
+      // COC: override for one component
+      int32_t offset = components < 257 ? 2 : 3;
+      if (seglen > offset) {
+        int32_t coc_levels = seg[offset];
+        levels = levels == -1 ? coc_levels : MIN(levels, coc_levels);
+      }
+    }
+    p += 2 + len;
+  }
+
+  if (levels == -1) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Couldn't find JPEG 2000 coding style");
+    return false;
+  }
+  *reductions = levels;
+  return true;
+}
+
 static void warning_callback(const char *msg G_GNUC_UNUSED,
                              void *data G_GNUC_UNUSED) {
   //g_debug("%s", msg);
@@ -216,11 +281,13 @@ static OPJ_BOOL seek_callback(OPJ_OFF_T offset, void *data) {
   return OPJ_TRUE;
 }
 
-bool _openslide_jp2k_decode_buffer(uint32_t *dest,
-                                   int32_t w, int32_t h,
-                                   void *data, int32_t datalen,
-                                   enum _openslide_jp2k_colorspace space,
-                                   GError **err) {
+static bool decode_buffer(uint32_t *dest,
+                          int32_t w, int32_t h,
+                          void *data, int32_t datalen,
+                          enum _openslide_jp2k_colorspace space,
+                          int32_t reduce,
+                          int32_t threads,
+                          GError **err) {
   opj_image_t *image = NULL;
   GError *tmp_err = NULL;
   bool success = false;
@@ -246,8 +313,19 @@ bool _openslide_jp2k_decode_buffer(uint32_t *dest,
   opj_codec_t *codec = opj_create_decompress(OPJ_CODEC_J2K);
   opj_dparameters_t parameters;
   opj_set_default_decoder_parameters(&parameters);
+  parameters.cp_reduce = reduce;
   opj_setup_decoder(codec, &parameters);
 
+#ifdef HAVE_OPJ_CODEC_SET_THREADS
+  // decode code blocks in parallel; ignored if OpenJPEG was built
+  // without thread support
+  if (threads > 1) {
+    opj_codec_set_threads(codec, threads);
+  }
+#else
+  (void) threads;
+#endif
+
   // enable error handlers
   // note: don't use info_handler, it outputs lots of junk
   opj_set_warning_handler(codec, warning_callback, &tmp_err);
@@ -266,11 +344,13 @@ bool _openslide_jp2k_decode_buffer(uint32_t *dest,
   g_clear_error(&tmp_err);  // clear any spurious message
 
   // sanity checks
-  if (image->x1 != (OPJ_UINT32) w || image->y1 != (OPJ_UINT32) h) {
+  if (reduced_dimension(image->x1, reduce) != (OPJ_UINT32) w ||
+      reduced_dimension(image->y1, reduce) != (OPJ_UINT32) h) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "Dimensional mismatch reading JP2K, "
                 "expected %dx%d, got %ux%u",
-                w, h, image->x1, image->y1);
+                w, h, reduced_dimension(image->x1, reduce),
+                reduced_dimension(image->y1, reduce));
     goto DONE;
   }
   if (image->numcomps != 3) {
@@ -306,11 +386,13 @@ DONE:
 
 #else  // HAVE_OPENJPEG2
 
-bool _openslide_jp2k_decode_buffer(uint32_t *dest,
-                                   int32_t w, int32_t h,
-                                   void *data, int32_t datalen,
-                                   enum _openslide_jp2k_colorspace space,
-                                   GError **err) {
+static bool decode_buffer(uint32_t *dest,
+                          int32_t w, int32_t h,
+                          void *data, int32_t datalen,
+                          enum _openslide_jp2k_colorspace space,
+                          int32_t reduce,
+                          int32_t threads G_GNUC_UNUSED,
+                          GError **err) {
   GError *tmp_err = NULL;
   bool success = false;
 
@@ -331,6 +413,7 @@ bool _openslide_jp2k_decode_buffer(uint32_t *dest,
   opj_dparameters_t parameters;
   dinfo = opj_create_decompress(CODEC_J2K);
   opj_set_default_decoder_parameters(&parameters);
+  parameters.cp_reduce = reduce;
   opj_setup_decoder(dinfo, &parameters);
   stream = opj_cio_open((opj_common_ptr) dinfo, data, datalen);
   opj_set_event_mgr((opj_common_ptr) dinfo, &event_callbacks, &tmp_err);
@@ -366,11 +449,13 @@ bool _openslide_jp2k_decode_buffer(uint32_t *dest,
   }
 
   // sanity checks
-  if (image->x1 != w || image->y1 != h) {
+  if ((int32_t) reduced_dimension(image->x1, reduce) != w ||
+      (int32_t) reduced_dimension(image->y1, reduce) != h) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "Dimensional mismatch reading JP2K, "
                 "expected %dx%d, got %dx%d",
-                w, h, image->x1, image->y1);
+                w, h, reduced_dimension(image->x1, reduce),
+                reduced_dimension(image->y1, reduce));
     goto DONE;
   }
   if (image->numcomps != 3) {
@@ -399,3 +484,18 @@ DONE:
 }
 
 #endif // HAVE_OPENJPEG2
+
+bool _openslide_jp2k_decode_buffer(uint32_t *dest,
+                                   int32_t w, int32_t h,
+                                   void *data, int32_t datalen,
+                                   enum _openslide_jp2k_colorspace space,
+                                   int32_t reduce,
+                                   int32_t threads,
+                                   GError **err) {
+  struct _openslide_stats_timer timer;
+  _openslide_stats_begin(&timer);
+  bool success = decode_buffer(dest, w, h, data, datalen, space, reduce,
+                               threads, err);
+  _openslide_stats_end(&timer, OPENSLIDE_STAT_DECODE_TIME_JPEG2000);
+  return success;
+}
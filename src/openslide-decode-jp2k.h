@@ -32,10 +32,20 @@ enum _openslide_jp2k_colorspace {
   OPENSLIDE_JP2K_YCBCR,
 };
 
+// w and h are the dimensions after discarding reduce resolution levels.
+// threads > 1 lets OpenJPEG >= 2.2 decode one buffer in parallel
 bool _openslide_jp2k_decode_buffer(uint32_t *dest,
                                    int32_t w, int32_t h,
                                    void *data, int32_t datalen,
                                    enum _openslide_jp2k_colorspace space,
+                                   int32_t reduce,
+                                   int32_t threads,
                                    GError **err);
 
+// number of resolution levels that can be discarded while decoding
+bool _openslide_jp2k_get_resolution_reductions(const void *data,
+                                               int32_t datalen,
+                                               int32_t *reductions,
+                                               GError **err);
+
 #endif
@@ -39,6 +39,14 @@
 #define JCS_EXT_ARGB 15
 #endif
 
+// SSSE3 RGB expansion, selected at runtime
+#if defined(__GNUC__) && !defined(__clang__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SSSE3_EXPAND 1
+#include <tmmintrin.h>
+#endif
+
 static const uint8_t one_pixel_rgb_jpeg[] = {
   0xff, 0xd8, 0xff, 0xdb, 0x00, 0x43, 0x00, 0x08, 0x06, 0x06, 0x07, 0x06,
   0x05, 0x08, 0x07, 0x07, 0x07, 0x09, 0x09, 0x08, 0x0a, 0x0c, 0x14, 0x0d,
@@ -67,9 +75,23 @@ struct _openslide_jpeg_decompress {
   struct jpeg_decompress_struct cinfo;
   struct openslide_jpeg_error_mgr jerr;
   JSAMPROW rows[MAX_SAMP_FACTOR];
-  gsize allocated_row_size;
 };
 
+// scanline buffer for libjpegs without JCS_ALPHA_EXTENSIONS, kept by each
+// thread from one image to the next
+struct row_buffer {
+  uint8_t *data;
+  gsize size;
+};
+
+static GPrivate *thread_row_buffer;
+G_LOCK_DEFINE_STATIC(thread_row_buffer);
+
+typedef void (*expand_rgb_fn)(uint32_t *dest, const uint8_t *src,
+                              int32_t count);
+
+static GOnce expand_rgb_selector = G_ONCE_INIT;
+
 struct associated_image {
   struct _openslide_associated_image base;
   char *filename;
@@ -153,6 +175,71 @@ static void *detect_jcs_alpha_extensions(void *arg G_GNUC_UNUSED) {
   return GINT_TO_POINTER(alpha_extensions);
 }
 
+static void row_buffer_free(gpointer data) {
+  struct row_buffer *rb = data;
+  g_free(rb->data);
+  g_slice_free(struct row_buffer, rb);
+}
+
+static uint8_t *get_row_buffer(gsize size) {
+  G_LOCK(thread_row_buffer);
+  if (!thread_row_buffer) {
+    thread_row_buffer = g_private_new(row_buffer_free);
+  }
+  G_UNLOCK(thread_row_buffer);
+
+  struct row_buffer *rb = g_private_get(thread_row_buffer);
+  if (!rb) {
+    rb = g_slice_new0(struct row_buffer);
+    g_private_set(thread_row_buffer, rb);
+  }
+  if (rb->size < size) {
+    g_free(rb->data);
+    rb->data = g_malloc(size);
+    rb->size = size;
+  }
+  return rb->data;
+}
+
+// RGB888 to opaque ARGB8888
+static void expand_rgb(uint32_t *dest, const uint8_t *src, int32_t count) {
+  for (int32_t i = 0; i < count; i++) {
+    dest[i] = 0xFF000000 |      // A
+      src[i * 3 + 0] << 16 |    // R
+      src[i * 3 + 1] << 8 |     // G
+      src[i * 3 + 2];           // B
+  }
+}
+
+#ifdef HAVE_SSSE3_EXPAND
+__attribute__((target("ssse3")))
+static void expand_rgb_ssse3(uint32_t *dest, const uint8_t *src,
+                             int32_t count) {
+  // little-endian ARGB is B, G, R, A in memory
+  const __m128i shuffle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1,
+                                        8, 7, 6, -1, 11, 10, 9, -1);
+  const __m128i alpha = _mm_set1_epi32(0xFF000000);
+  int32_t i = 0;
+  // each load reads 16 bytes for 4 pixels, so stop before overrunning
+  for (; i + 6 <= count; i += 4) {
+    __m128i in = _mm_loadu_si128((const __m128i *) (src + i * 3));
+    __m128i out = _mm_or_si128(_mm_shuffle_epi8(in, shuffle), alpha);
+    _mm_storeu_si128((__m128i *) (dest + i), out);
+  }
+  expand_rgb(dest + i, src + i * 3, count - i);
+}
+#endif
+
+static void *select_expand_rgb(void *arg G_GNUC_UNUSED) {
+#ifdef HAVE_SSSE3_EXPAND
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("ssse3")) {
+    return (void *) expand_rgb_ssse3;
+  }
+#endif
+  return (void *) expand_rgb;
+}
+
 // the caller must assign the struct _openslide_jpeg_decompress * before
 // calling setjmp() so that nothing will be clobbered by a longjmp()
 struct _openslide_jpeg_decompress *_openslide_jpeg_decompress_create(struct jpeg_decompress_struct **out_cinfo) {
@@ -161,6 +248,10 @@ struct _openslide_jpeg_decompress *_openslide_jpeg_decompress_create(struct jpeg
   return dc;
 }
 
+struct jpeg_decompress_struct *_openslide_jpeg_decompress_get_cinfo(struct _openslide_jpeg_decompress *dc) {
+  return &dc->cinfo;
+}
+
 // after setjmp(), initialize error handler and start decompressing
 void _openslide_jpeg_decompress_init(struct _openslide_jpeg_decompress *dc,
                                      jmp_buf *env) {
@@ -168,6 +259,19 @@ void _openslide_jpeg_decompress_init(struct _openslide_jpeg_decompress *dc,
   jpeg_create_decompress(&dc->cinfo);
 }
 
+// after setjmp(), prepare an initialized decompressor for another image.
+// the previous image must have been decoded successfully and aborted with
+// jpeg_abort_decompress(); tables and allocations are kept.
+void _openslide_jpeg_decompress_reinit(struct _openslide_jpeg_decompress *dc,
+                                       jmp_buf *env) {
+  g_assert(dc->jerr.err == NULL);
+  dc->jerr.env = env;
+  for (uint32_t row = 0; row < G_N_ELEMENTS(dc->rows); row++) {
+    // pointers into the previous destination or the row buffer
+    dc->rows[row] = NULL;
+  }
+}
+
 bool _openslide_jpeg_decompress_run(struct _openslide_jpeg_decompress *dc,
                                     // uint8_t * if grayscale, else uint32_t *
                                     void *_dest,
@@ -223,12 +327,15 @@ bool _openslide_jpeg_decompress_run(struct _openslide_jpeg_decompress *dc,
   } else {
     // decode into temporary buffer, then reformat
 
-    // allocate scanline buffers
-    dc->allocated_row_size = sizeof(JSAMPLE) * cinfo->output_width *
-                             cinfo->output_components;
+    // point scanlines into the row buffer of the thread
+    gsize row_size = sizeof(JSAMPLE) * cinfo->output_width *
+                     cinfo->output_components;
+    uint8_t *rows = get_row_buffer(row_size * cinfo->rec_outbuf_height);
     for (int i = 0; i < cinfo->rec_outbuf_height; i++) {
-      dc->rows[i] = g_slice_alloc(dc->allocated_row_size);
+      dc->rows[i] = rows + i * row_size;
     }
+    expand_rgb_fn expand = (expand_rgb_fn) g_once(&expand_rgb_selector,
+                                                  select_expand_rgb, NULL);
 
     // decompress
     uint32_t *dest = _dest;
@@ -239,12 +346,7 @@ bool _openslide_jpeg_decompress_run(struct _openslide_jpeg_decompress *dc,
       int cur_row = 0;
       while (rows_read > 0) {
         // copy a row
-        for (int32_t i = 0; i < (int32_t) cinfo->output_width; i++) {
-          dest[i] = 0xFF000000 |                 // A
-            dc->rows[cur_row][i * 3 + 0] << 16 | // R
-            dc->rows[cur_row][i * 3 + 1] << 8 |  // G
-            dc->rows[cur_row][i * 3 + 2];        // B
-        }
+        expand(dest, dc->rows[cur_row], cinfo->output_width);
         dest += cinfo->output_width;
 
         // advance 1 row
@@ -265,11 +367,6 @@ void _openslide_jpeg_propagate_error(GError **err,
 void _openslide_jpeg_decompress_destroy(struct _openslide_jpeg_decompress *dc) {
   jpeg_destroy_decompress(&dc->cinfo);
   g_assert(dc->jerr.err == NULL);
-  if (dc->allocated_row_size) {
-    for (uint32_t row = 0; row < G_N_ELEMENTS(dc->rows); row++) {
-      g_slice_free1(dc->allocated_row_size, dc->rows[row]);
-    }
-  }
   g_slice_free(struct _openslide_jpeg_decompress, dc);
 }
 
@@ -344,12 +441,18 @@ bool _openslide_jpeg_decode_buffer_dimensions(const void *buf, uint32_t len,
 
 static bool jpeg_decode(FILE *f,  // or:
                         const void *buf, uint32_t buflen,
+                        const void *tables, uint32_t tables_len,  // optional
+                        J_COLOR_SPACE space,  // JCS_UNKNOWN: from header
+                        int32_t scale_denom,  // DCT scaling, 1 for none
                         void *dest, bool grayscale,
                         int32_t w, int32_t h,
                         GError **err) {
   volatile bool result = false;
   jmp_buf env;
 
+  struct _openslide_stats_timer timer;
+  _openslide_stats_begin(&timer);
+
   struct jpeg_decompress_struct *cinfo;
   struct _openslide_jpeg_decompress *dc =
     _openslide_jpeg_decompress_create(&cinfo);
@@ -357,6 +460,16 @@ static bool jpeg_decode(FILE *f,  // or:
   if (setjmp(env) == 0) {
     _openslide_jpeg_decompress_init(dc, &env);
 
+    // load JPEG tables
+    if (tables) {
+      _openslide_jpeg_mem_src(cinfo, tables, tables_len);
+      if (jpeg_read_header(cinfo, false) != JPEG_HEADER_TABLES_ONLY) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                    "Couldn't load JPEG tables");
+        goto DONE;
+      }
+    }
+
     // set up I/O
     if (f) {
       _openslide_jpeg_stdio_src(cinfo, f);
@@ -371,6 +484,15 @@ static bool jpeg_decode(FILE *f,  // or:
       goto DONE;
     }
 
+    // override color space, e.g. from TIFF photometric tag (for Aperio)
+    if (space != JCS_UNKNOWN) {
+      cinfo->jpeg_color_space = space;
+    }
+
+    // decode at a fraction of the size, skipping most of the IDCT work
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = scale_denom;
+
     // decompress
     if (!_openslide_jpeg_decompress_run(dc, dest, grayscale, w, h, err)) {
       goto DONE;
@@ -383,6 +505,7 @@ static bool jpeg_decode(FILE *f,  // or:
 
 DONE:
   _openslide_jpeg_decompress_destroy(dc);
+  _openslide_stats_end(&timer, OPENSLIDE_STAT_DECODE_TIME_JPEG);
 
   return result;
 }
@@ -392,31 +515,67 @@ bool _openslide_jpeg_read(const char *filename,
                           uint32_t *dest,
                           int32_t w, int32_t h,
                           GError **err) {
+  return _openslide_jpeg_read_scaled(filename, offset, 1, dest, w, h, err);
+}
+
+bool _openslide_jpeg_read_scaled(const char *filename,
+                                 int64_t offset,
+                                 int32_t scale_denom,
+                                 uint32_t *dest,
+                                 int32_t w, int32_t h,
+                                 GError **err) {
   //g_debug("read JPEG: %s %"PRId64, filename, offset);
 
   FILE *f = _openslide_fopen(filename, "rb", err);
   if (f == NULL) {
     return false;
   }
-  if (offset && fseeko(f, offset, SEEK_SET) == -1) {
+
+  bool success = false;
+  if (fseeko(f, offset, SEEK_SET) == -1) {
     _openslide_io_error(err, "Cannot seek to offset");
-    fclose(f);
-    return false;
+  } else {
+    success = jpeg_decode(f, NULL, 0, NULL, 0, JCS_UNKNOWN, scale_denom,
+                          dest, false, w, h, err);
   }
 
-  bool success = jpeg_decode(f, NULL, 0, dest, false, w, h, err);
-
   fclose(f);
   return success;
 }
 
+bool _openslide_jpeg_read_file(FILE *f,
+                               int64_t offset,
+                               uint32_t *dest,
+                               int32_t w, int32_t h,
+                               GError **err) {
+  if (fseeko(f, offset, SEEK_SET) == -1) {
+    _openslide_io_error(err, "Cannot seek to offset");
+    return false;
+  }
+
+  return jpeg_decode(f, NULL, 0, NULL, 0, JCS_UNKNOWN, 1,
+                     dest, false, w, h, err);
+}
+
 bool _openslide_jpeg_decode_buffer(const void *buf, uint32_t len,
                                    uint32_t *dest,
                                    int32_t w, int32_t h,
                                    GError **err) {
   //g_debug("decode JPEG buffer: %x %u", buf, len);
 
-  return jpeg_decode(NULL, buf, len, dest, false, w, h, err);
+  return jpeg_decode(NULL, buf, len, NULL, 0, JCS_UNKNOWN, 1,
+                     dest, false, w, h, err);
+}
+
+bool _openslide_jpeg_decode_buffer_with_tables(const void *buf, uint32_t len,
+                                               const void *tables,
+                                               uint32_t tables_len,
+                                               J_COLOR_SPACE space,
+                                               uint32_t *dest,
+                                               int32_t w, int32_t h,
+                                               GError **err) {
+  return jpeg_decode(NULL, buf, len, tables, tables_len, space, 1,
+                     dest, false, w, h, err);
 }
 
 bool _openslide_jpeg_decode_buffer_gray(const void *buf, uint32_t len,
@@ -425,7 +584,8 @@ bool _openslide_jpeg_decode_buffer_gray(const void *buf, uint32_t len,
                                         GError **err) {
   //g_debug("decode grayscale JPEG buffer: %x %u", buf, len);
 
-  return jpeg_decode(NULL, buf, len, dest, true, w, h, err);
+  return jpeg_decode(NULL, buf, len, NULL, 0, JCS_UNKNOWN, 1,
+                     dest, true, w, h, err);
 }
 
 static bool get_associated_image_data(struct _openslide_associated_image *_img,
@@ -439,6 +599,19 @@ static bool get_associated_image_data(struct _openslide_associated_image *_img,
                               img->base.w, img->base.h, err);
 }
 
+static bool get_associated_image_scaled_data(struct _openslide_associated_image *_img,
+                                             uint32_t *dest,
+                                             int32_t scale_denom,
+                                             GError **err) {
+  struct associated_image *img = (struct associated_image *) _img;
+
+  return _openslide_jpeg_read_scaled(img->filename, img->offset,
+                                     scale_denom, dest,
+                                     (img->base.w + scale_denom - 1) / scale_denom,
+                                     (img->base.h + scale_denom - 1) / scale_denom,
+                                     err);
+}
+
 static void destroy_associated_image(struct _openslide_associated_image *_img) {
   struct associated_image *img = (struct associated_image *) _img;
 
@@ -448,6 +621,7 @@ static void destroy_associated_image(struct _openslide_associated_image *_img) {
 
 static const struct _openslide_associated_image_ops jpeg_associated_ops = {
   .get_argb_data = get_associated_image_data,
+  .get_argb_data_scaled = get_associated_image_scaled_data,
   .destroy = destroy_associated_image,
 };
 
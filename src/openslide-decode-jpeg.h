@@ -48,11 +48,38 @@ bool _openslide_jpeg_read(const char *filename,
                           int32_t w, int32_t h,
                           GError **err);
 
+// decodes at 1/scale_denom of the size, for scale_denom 1, 2, 4 or 8;
+// w and h are the scaled dimensions, rounded up
+bool _openslide_jpeg_read_scaled(const char *filename,
+                                 int64_t offset,
+                                 int32_t scale_denom,
+                                 uint32_t *dest,
+                                 int32_t w, int32_t h,
+                                 GError **err);
+
+// reads from a FILE that may be reused, like one from a filecache
+bool _openslide_jpeg_read_file(FILE *f,
+                               int64_t offset,
+                               uint32_t *dest,
+                               int32_t w, int32_t h,
+                               GError **err);
+
 bool _openslide_jpeg_decode_buffer(const void *buf, uint32_t len,
                                    uint32_t *dest,
                                    int32_t w, int32_t h,
                                    GError **err);
 
+// tables are the optional abbreviated tables of the image, like TIFF
+// JPEGTables.  space overrides the color space of the image, unless it
+// is JCS_UNKNOWN.
+bool _openslide_jpeg_decode_buffer_with_tables(const void *buf, uint32_t len,
+                                               const void *tables,
+                                               uint32_t tables_len,
+                                               J_COLOR_SPACE space,
+                                               uint32_t *dest,
+                                               int32_t w, int32_t h,
+                                               GError **err);
+
 bool _openslide_jpeg_decode_buffer_gray(const void *buf, uint32_t len,
                                         uint8_t *dest,
                                         int32_t w, int32_t h,
@@ -82,9 +109,14 @@ void _openslide_jpeg_mem_src (j_decompress_ptr cinfo,
  */
 struct _openslide_jpeg_decompress *_openslide_jpeg_decompress_create(struct jpeg_decompress_struct **out_cinfo);
 
+struct jpeg_decompress_struct *_openslide_jpeg_decompress_get_cinfo(struct _openslide_jpeg_decompress *dc);
+
 void _openslide_jpeg_decompress_init(struct _openslide_jpeg_decompress *dc,
                                      jmp_buf *env);
 
+void _openslide_jpeg_decompress_reinit(struct _openslide_jpeg_decompress *dc,
+                                       jmp_buf *env);
+
 bool _openslide_jpeg_decompress_run(struct _openslide_jpeg_decompress *dc,
                                     // uint8_t * if grayscale, else uint32_t *
                                     void *dest,
@@ -33,7 +33,11 @@ static ERR PKImageEncode_WritePixels_OpenSlide(PKImageEncode* pIE,
 
 static ERR PKImageEncode_Create_OpenSlide(PKImageEncode** ppIE);
 
-static ERR ResetWS_Memory(struct WMPStream** ppWS, void* pv);
+static ERR ResetWS_Memory(struct WMPStream** ppWS, void* pv, size_t cb);
+
+// decoders are kept per thread and reused for every tile it decodes
+static GPrivate *thread_decoder;
+G_LOCK_DEFINE_STATIC(thread_decoder);
 
 //================================================================
 // PKImageEncode_OpenSlide
@@ -103,14 +107,15 @@ Cleanup:
     return err;
 }
 
-// Reset an allocated WMPStream using a new data pointer without 
+// Reset an allocated WMPStream using a new data pointer and size without 
 // reallocating the internal buffer, without emptying data.
-ERR ResetWS_Memory(struct WMPStream** ppWS, void* pv)
+ERR ResetWS_Memory(struct WMPStream** ppWS, void* pv, size_t cb)
 {
     ERR err = WMP_errSuccess;
     struct WMPStream* pWS = *ppWS;
 
     pWS->state.buf.pbBuf = pv;
+    pWS->state.buf.cbBuf = cb;
     pWS->state.buf.cbCur = 0;
 
     return err;
@@ -118,9 +123,8 @@ ERR ResetWS_Memory(struct WMPStream** ppWS, void* pv)
 
 #endif
 
+// Create the objects that are kept from one tile to the next
 static bool _openslide_jxr_decoder_initialize(struct jxr_decoder * decoder,
-                                              uint32_t datalen,
-                                              int32_t w, int32_t h,
                                               GError **error) {
 #ifdef HAVE_LIBJXR // HAVE_LIBJXR
     
@@ -135,57 +139,29 @@ static bool _openslide_jxr_decoder_initialize(struct jxr_decoder * decoder,
   decoder->pConverter = NULL;
   ERR err = WMP_errSuccess;
 
-  // Get information on
+  // Get information on decoded format
   const PKPixelFormatGUID * pxfg = &GUID_PKPixelFormat24bppBGR;
 
   decoder->PI.pGUIDPixFmt = pxfg;
   PixelFormatLookup(&(decoder->PI), LOOKUP_FORWARD);
 
+  // and on output formats
+  decoder->outPI[JXR_OUTPUT_BGR24] = decoder->PI;
+  decoder->outPI[JXR_OUTPUT_BGRX32].pGUIDPixFmt = &GUID_PKPixelFormat32bppBGR;
+  PixelFormatLookup(&(decoder->outPI[JXR_OUTPUT_BGRX32]), LOOKUP_FORWARD);
+
   // Create a converter
   Call(PKCodecFactory_CreateFormatConverter(&(decoder->pConverter)));
 
-  // Set decoding region
-  decoder->region = (PKRect){0, 0, 0, 0};
-  decoder->region.Width = (I32)w;
-  decoder->region.Height = (I32)h;
-
-  // Create stream using input/output buffer
-  Call(CreateWS_Memory(&(decoder->pStream), NULL, datalen));
-  Call(CreateWS_Memory(&(decoder->pEncodeStream), NULL, w * h * 3));
+  // Create streams, their buffers are set for each tile
+  Call(CreateWS_Memory(&(decoder->pStream), NULL, 0));
+  Call(CreateWS_Memory(&(decoder->pEncodeStream), NULL, 0));
 
-  // Create decoder/encoder
-  Call(PKImageDecode_Create_WMP(&(decoder->pDecoder)));
+  // Create encoder
   Call(PKImageEncode_Create_OpenSlide(&(decoder->pEncoder)));
 
-  // Set decoder options
-  decoder->pDecoder->WMP.wmiI.cfColorFormat = decoder->PI.cfColorFormat;
-  decoder->pDecoder->guidPixFormat = *(decoder->PI.pGUIDPixFmt);
-  decoder->pDecoder->WMP.wmiI.cfColorFormat = decoder->PI.cfColorFormat;
-  decoder->pDecoder->WMP.wmiI.bdBitDepth = decoder->PI.bdBitDepth;
-  decoder->pDecoder->WMP.wmiI.cBitsPerUnit = decoder->PI.cbitUnit;
-  decoder->pDecoder->WMP.wmiI.cROIWidth = w;
-  decoder->pDecoder->WMP.wmiI.cROIHeight = h;
-  decoder->pDecoder->WMP.wmiSCP.uAlphaMode = 0;
-  decoder->pDecoder->WMP.wmiSCP.sbSubband = SB_ALL;
-  decoder->pDecoder->WMP.bIgnoreOverlap = FALSE;
-  decoder->pDecoder->WMP.wmiI.cThumbnailWidth = decoder->pDecoder->WMP.wmiI.cWidth;
-  decoder->pDecoder->WMP.wmiI.cThumbnailHeight = decoder->pDecoder->WMP.wmiI.cHeight;
-  decoder->pDecoder->WMP.wmiI.bSkipFlexbits = FALSE;
-
   // Set encoder write source method
   decoder->pEncoder->WriteSource = PKImageEncode_Transcode;
-    
-  Call(
-    decoder->pConverter->Initialize(
-      decoder->pConverter, decoder->pDecoder,
-        NULL, *(decoder->PI.pGUIDPixFmt)
-    ));
-  
-  Call(
-    decoder->pEncoder->SetSize(
-      decoder->pEncoder, 
-      decoder->region.Width,
-      decoder->region.Height));
   
   decoder->initialized = true;
   return true;
@@ -207,16 +183,57 @@ Cleanup:
 
 static bool _openslide_jxr_decoder_decode(struct jxr_decoder * decoder,
                                           const void *data,
+                                          uint32_t datalen,
                                           uint32_t *dest,
+                                          int32_t w, int32_t h,
+                                          enum jxr_output_format format,
                                           GError **error) {
 #ifdef HAVE_LIBJXR
-  g_assert(decoder);
+  g_assert(decoder && decoder->initialized);
   
   ERR err = WMP_errSuccess;
+  const PKPixelInfo * outPI = &(decoder->outPI[format]);
   
   // Reset streams using input/output buffers
-  ResetWS_Memory(&(decoder->pStream), (void *)data);
-  ResetWS_Memory(&(decoder->pEncodeStream), (void *)dest);
+  ResetWS_Memory(&(decoder->pStream), (void *)data, datalen);
+  ResetWS_Memory(&(decoder->pEncodeStream), (void *)dest,
+                 (size_t)w * h * (outPI->cbitUnit / 8));
+
+  // Set decoding region
+  decoder->region = (PKRect){0, 0, 0, 0};
+  decoder->region.Width = (I32)w;
+  decoder->region.Height = (I32)h;
+
+  // jxrlib decoders can only be initialized once, so this is the one
+  // object that is created for each tile
+  Call(PKImageDecode_Create_WMP(&(decoder->pDecoder)));
+
+  // Set decoder options
+  decoder->pDecoder->WMP.wmiI.cfColorFormat = decoder->PI.cfColorFormat;
+  decoder->pDecoder->guidPixFormat = *(decoder->PI.pGUIDPixFmt);
+  decoder->pDecoder->WMP.wmiI.cfColorFormat = decoder->PI.cfColorFormat;
+  decoder->pDecoder->WMP.wmiI.bdBitDepth = decoder->PI.bdBitDepth;
+  decoder->pDecoder->WMP.wmiI.cBitsPerUnit = decoder->PI.cbitUnit;
+  decoder->pDecoder->WMP.wmiI.cROIWidth = w;
+  decoder->pDecoder->WMP.wmiI.cROIHeight = h;
+  decoder->pDecoder->WMP.wmiSCP.uAlphaMode = 0;
+  decoder->pDecoder->WMP.wmiSCP.sbSubband = SB_ALL;
+  decoder->pDecoder->WMP.bIgnoreOverlap = FALSE;
+  decoder->pDecoder->WMP.wmiI.cThumbnailWidth = decoder->pDecoder->WMP.wmiI.cWidth;
+  decoder->pDecoder->WMP.wmiI.cThumbnailHeight = decoder->pDecoder->WMP.wmiI.cHeight;
+  decoder->pDecoder->WMP.wmiI.bSkipFlexbits = FALSE;
+
+  Call(
+    decoder->pConverter->Initialize(
+      decoder->pConverter, decoder->pDecoder,
+        NULL, *(outPI->pGUIDPixFmt)
+    ));
+  
+  Call(
+    decoder->pEncoder->SetSize(
+      decoder->pEncoder, 
+      decoder->region.Width,
+      decoder->region.Height));
   
   // Attach stream to decoder/encoder
   // It is necessary to do decoder/encoder with the correct buffers
@@ -229,11 +246,12 @@ static bool _openslide_jxr_decoder_decode(struct jxr_decoder * decoder,
     decoder->pEncoder->Initialize(
       decoder->pEncoder, decoder->pEncodeStream, NULL, 0
     ));
+  decoder->pEncoder->idxCurrentLine = 0;
   
   Call(
     decoder->pEncoder->SetPixelFormat(
       decoder->pEncoder, 
-      *(decoder->PI.pGUIDPixFmt)));
+      *(outPI->pGUIDPixFmt)));
 
   // Convert data from original image
   Call(
@@ -243,10 +261,11 @@ static bool _openslide_jxr_decoder_decode(struct jxr_decoder * decoder,
       &(decoder->region)
     ));
   
+  decoder->pDecoder->Release(&(decoder->pDecoder));
   return true;
   
 Cleanup:
-  // Release objects
+  // Release objects, the next tile starts over
   decoder->finalize(decoder, error);
 
   if (err != 0) {
@@ -274,6 +293,12 @@ bool _openslide_jxr_decoder_finalize(struct jxr_decoder * decoder,
     if (decoder->pConverter)
         decoder->pConverter->Release(&(decoder->pConverter));
     
+    if (decoder->pEncodeStream)
+        decoder->pEncodeStream->Close(&(decoder->pEncodeStream));
+    
+    if (decoder->pStream)
+        decoder->pStream->Close(&(decoder->pStream));
+    
     decoder->initialized = false;
     
     return true;
@@ -312,6 +337,36 @@ bool openslide_jxr_decoder_free(struct jxr_decoder * ptr, GError ** error)
   return false;
 }
 
+#ifdef HAVE_LIBJXR
+
+static void thread_decoder_free(gpointer data)
+{
+  openslide_jxr_decoder_free(data, NULL);
+}
+
+// Get the decoder of the calling thread, initializing it on first use.
+static struct jxr_decoder * get_thread_decoder(GError ** error)
+{
+  G_LOCK(thread_decoder);
+  if (!thread_decoder) {
+    thread_decoder = g_private_new(thread_decoder_free);
+  }
+  G_UNLOCK(thread_decoder);
+
+  struct jxr_decoder * decoder = g_private_get(thread_decoder);
+  if (!decoder) {
+    decoder = openslide_jxr_decoder_new(error);
+    g_private_set(thread_decoder, decoder);
+  }
+  if (!decoder->initialized &&
+      !decoder->initialize(decoder, error)) {
+    return NULL;
+  }
+  return decoder;
+}
+
+#endif // HAVE_LIBJXR
+
 bool _openslide_jxr_decode_buffer(const void *data,
                                   uint32_t datalen,
                                   uint32_t *dest,
@@ -324,13 +379,49 @@ bool _openslide_jxr_decode_buffer(const void *data,
   //  TODO: Add support for float (32 bit), 24 bit (3x 16 bit) color,
   //       8 bit and 16 bit greyscale
     
-  struct jxr_decoder * os_jxr_decoder = openslide_jxr_decoder_new(error);
-  os_jxr_decoder->initialize(os_jxr_decoder, datalen, w, h, error);
-  os_jxr_decoder->decode(os_jxr_decoder, data, dest, error);
-  os_jxr_decoder->finalize(os_jxr_decoder, error);
-  openslide_jxr_decoder_free(os_jxr_decoder, error);
-  
-  return true;
+  struct jxr_decoder * os_jxr_decoder = get_thread_decoder(error);
+  if (!os_jxr_decoder)
+    return false;
+
+  struct _openslide_stats_timer timer;
+  _openslide_stats_begin(&timer);
+  bool success = os_jxr_decoder->decode(os_jxr_decoder, data, datalen,
+                                        dest, w, h, JXR_OUTPUT_BGR24, error);
+  _openslide_stats_end(&timer, OPENSLIDE_STAT_DECODE_TIME_JPEGXR);
+  return success;
+
+#else // HAVE_LIBJXR
+
+  g_set_error( error, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+               "Openslide is not able to decode JPEG XR" );
+
+  return false;
+
+#endif // HAVE_LIBJXR
+
+}
+
+// Decode to 32 bits per pixel, in B, G, R, unused byte order, which is
+// cairo's CAIRO_FORMAT_RGB24 on little-endian hosts.  dest must hold w * h
+// pixels.
+bool _openslide_jxr_decode_buffer_bgrx32(const void *data,
+                                         uint32_t datalen,
+                                         uint32_t *dest,
+                                         int32_t w,
+                                         int32_t h,
+                                         GError **error) {
+#ifdef HAVE_LIBJXR
+
+  struct jxr_decoder * os_jxr_decoder = get_thread_decoder(error);
+  if (!os_jxr_decoder)
+    return false;
+
+  struct _openslide_stats_timer timer;
+  _openslide_stats_begin(&timer);
+  bool success = os_jxr_decoder->decode(os_jxr_decoder, data, datalen,
+                                        dest, w, h, JXR_OUTPUT_BGRX32, error);
+  _openslide_stats_end(&timer, OPENSLIDE_STAT_DECODE_TIME_JPEGXR);
+  return success;
 
 #else // HAVE_LIBJXR
 
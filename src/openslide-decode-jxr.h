@@ -33,6 +33,12 @@
 #include <JXRGlue.h>
 #endif
 
+// Pixel formats the decoder can write
+enum jxr_output_format {
+  JXR_OUTPUT_BGR24,
+  JXR_OUTPUT_BGRX32,
+};
+
 struct jxr_decoder {
     
 #ifdef HAVE_LIBJXR
@@ -44,6 +50,7 @@ struct jxr_decoder {
   PKFormatConverter* pConverter;
   
   PKPixelInfo PI;
+  PKPixelInfo outPI[2];       // indexed by enum jxr_output_format
   PKRect region;
   
 #endif // HAVE_LIBJXR
@@ -51,12 +58,13 @@ struct jxr_decoder {
   bool initialized;
   
   bool (*initialize)(struct jxr_decoder * decoder,
-                     uint32_t datalen,
-                     int32_t w, int32_t h,
                      GError **error);
   bool (*decode)(struct jxr_decoder * decoder,
                  const void *data,
+                 uint32_t datalen,
                  uint32_t *dest,
+                 int32_t w, int32_t h,
+                 enum jxr_output_format format,
                  GError **error);
   bool (*finalize)(struct jxr_decoder * decoder,
                    GError **error);
@@ -78,4 +86,11 @@ bool _openslide_jxr_decode_buffer(const void       * data,
                                   int32_t            h,
                                   GError          ** err);
 
+bool _openslide_jxr_decode_buffer_bgrx32(const void       * data,
+                                         uint32_t           datalen,
+                                         uint32_t         * dest,
+                                         int32_t            w,
+                                         int32_t            h,
+                                         GError          ** err);
+
 #endif
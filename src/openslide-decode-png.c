@@ -51,16 +51,17 @@ static void error_callback(png_struct *png, const char *message) {
 
 static void read_callback(png_struct *png, png_byte *buf, png_size_t len) {
   FILE *f = png_get_io_ptr(png);
-  if (fread(buf, len, 1, f) != 1) {
+  if (_openslide_fread(f, buf, len) != len) {
     png_error(png, "Read failed");
   }
 }
 
-bool _openslide_png_read(const char *filename,
-                         int64_t offset,
-                         uint32_t *dest,
-                         int64_t w, int64_t h,
-                         GError **err) {
+static bool read_file(FILE *f,
+                      const char *filename,
+                      int64_t offset,
+                      uint32_t *dest,
+                      int64_t w, int64_t h,
+                      GError **err) {
   png_struct *png = NULL;
   png_info *info = NULL;
   volatile bool success = false;
@@ -68,17 +69,7 @@ bool _openslide_png_read(const char *filename,
   // allocate error context
   struct png_error_ctx *ectx = g_slice_new0(struct png_error_ctx);
 
-  // allocate row pointers
-  png_byte **rows = g_slice_alloc(h * sizeof(*rows));
-  for (int64_t y = 0; y < h; y++) {
-    rows[y] = (png_byte *) &dest[y * w];
-  }
-
-  // open and seek
-  FILE *f = _openslide_fopen(filename, "rb", err);
-  if (!f) {
-    goto DONE;
-  }
+  // seek
   if (fseeko(f, offset, SEEK_SET)) {
     _openslide_io_error(err, "Couldn't fseek %s", filename);
     goto DONE;
@@ -142,6 +133,9 @@ bool _openslide_png_read(const char *filename,
       png_set_filler(png, 0xff, PNG_FILLER_BEFORE);
     }
 
+    // interlaced images take several passes over the rows
+    int passes = png_set_interlace_handling(png);
+
     // check buffer size
     png_read_update_info(png, info);
     uint32_t rowbytes = png_get_rowbytes(png, info);
@@ -163,8 +157,12 @@ bool _openslide_png_read(const char *filename,
       goto DONE;
     }
 
-    // read image
-    png_read_image(png, rows);
+    // read image, a row at a time straight into dest
+    for (int pass = 0; pass < passes; pass++) {
+      for (int64_t y = 0; y < h; y++) {
+        png_read_row(png, (png_byte *) &dest[y * w], NULL);
+      }
+    }
 
     // finish
     png_read_end(png, NULL);
@@ -177,10 +175,34 @@ bool _openslide_png_read(const char *filename,
 
 DONE:
   png_destroy_read_struct(&png, &info, NULL);
-  if (f) {
-    fclose(f);
-  }
-  g_slice_free1(h * sizeof(*rows), rows);
   g_slice_free(struct png_error_ctx, ectx);
   return success;
 }
+
+bool _openslide_png_read_file(FILE *f,
+                              const char *filename,
+                              int64_t offset,
+                              uint32_t *dest,
+                              int64_t w, int64_t h,
+                              GError **err) {
+  struct _openslide_stats_timer timer;
+  _openslide_stats_begin(&timer);
+  bool success = read_file(f, filename, offset, dest, w, h, err);
+  _openslide_stats_end(&timer, OPENSLIDE_STAT_DECODE_TIME_PNG);
+  return success;
+}
+
+bool _openslide_png_read(const char *filename,
+                         int64_t offset,
+                         uint32_t *dest,
+                         int64_t w, int64_t h,
+                         GError **err) {
+  FILE *f = _openslide_fopen(filename, "rb", err);
+  if (!f) {
+    return false;
+  }
+  bool success = _openslide_png_read_file(f, filename, offset,
+                                          dest, w, h, err);
+  fclose(f);
+  return success;
+}
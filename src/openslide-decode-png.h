@@ -22,9 +22,19 @@
 #ifndef OPENSLIDE_OPENSLIDE_DECODE_PNG_H_
 #define OPENSLIDE_OPENSLIDE_DECODE_PNG_H_
 
+#include <stdio.h>
 #include <stdint.h>
 #include <glib.h>
 
+// reads from a FILE that may be reused, like one from a filecache;
+// filename is only used in error messages
+bool _openslide_png_read_file(FILE *f,
+                              const char *filename,
+                              int64_t offset,
+                              uint32_t *dest,
+                              int64_t w, int64_t h,
+                              GError **err);
+
 bool _openslide_png_read(const char *filename,
                          int64_t offset,
                          uint32_t *dest,
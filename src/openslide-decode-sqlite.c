@@ -28,6 +28,12 @@
 #define BUSY_TIMEOUT 500  // ms
 #define PROFILE 0
 
+// idle statements kept per stmtcache
+#define STMTCACHE_MAX 32
+// let pooled connections read the database through mmap, on SQLite
+// versions that support it; older ones ignore the pragma
+#define STMTCACHE_MMAP_PRAGMA "PRAGMA mmap_size = 2147418112"
+
 /* Can only use API supported in SQLite 3.6.20 for RHEL 6 compatibility */
 
 #if PROFILE
@@ -132,3 +138,90 @@ void _openslide_sqlite_close(sqlite3 *db) {
   }
 }
 #define sqlite3_close _OPENSLIDE_POISON(_openslide_sqlite_close)
+
+struct _openslide_sqlite_stmtcache {
+  char *filename;
+  char *sql;
+  GQueue *cache;
+  GMutex *lock;
+};
+
+struct _openslide_sqlite_stmtcache *_openslide_sqlite_stmtcache_create(const char *filename,
+                                                                       const char *sql) {
+  struct _openslide_sqlite_stmtcache *sc =
+    g_slice_new0(struct _openslide_sqlite_stmtcache);
+  sc->filename = g_strdup(filename);
+  sc->sql = g_strdup(sql);
+  sc->cache = g_queue_new();
+  sc->lock = g_mutex_new();
+  return sc;
+}
+
+// the statement is reset, with no bindings
+sqlite3_stmt *_openslide_sqlite_stmtcache_get(struct _openslide_sqlite_stmtcache *sc,
+                                              GError **err) {
+  g_mutex_lock(sc->lock);
+  sqlite3_stmt *stmt = g_queue_pop_head(sc->cache);
+  g_mutex_unlock(sc->lock);
+  if (stmt) {
+    return stmt;
+  }
+
+  // open a new connection
+  sqlite3 *db = _openslide_sqlite_open(sc->filename, err);
+  if (!db) {
+    return NULL;
+  }
+  sqlite3_exec(db, STMTCACHE_MMAP_PRAGMA, NULL, NULL, NULL);
+  stmt = _openslide_sqlite_prepare(db, sc->sql, err);
+  if (!stmt) {
+    _openslide_sqlite_close(db);
+    return NULL;
+  }
+  return stmt;
+}
+
+static void stmt_close(sqlite3_stmt *stmt) {
+  sqlite3 *db = sqlite3_db_handle(stmt);
+  sqlite3_finalize(stmt);
+  _openslide_sqlite_close(db);
+}
+
+void _openslide_sqlite_stmtcache_put(struct _openslide_sqlite_stmtcache *sc,
+                                     sqlite3_stmt *stmt) {
+  if (stmt == NULL) {
+    return;
+  }
+
+  // release the read transaction before the statement goes idle
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+
+  g_mutex_lock(sc->lock);
+  if (g_queue_get_length(sc->cache) < STMTCACHE_MAX) {
+    g_queue_push_head(sc->cache, stmt);
+    stmt = NULL;
+  }
+  g_mutex_unlock(sc->lock);
+
+  if (stmt) {
+    stmt_close(stmt);
+  }
+}
+
+void _openslide_sqlite_stmtcache_destroy(struct _openslide_sqlite_stmtcache *sc) {
+  if (sc == NULL) {
+    return;
+  }
+  g_mutex_lock(sc->lock);
+  sqlite3_stmt *stmt;
+  while ((stmt = g_queue_pop_head(sc->cache)) != NULL) {
+    stmt_close(stmt);
+  }
+  g_mutex_unlock(sc->lock);
+  g_queue_free(sc->cache);
+  g_mutex_free(sc->lock);
+  g_free(sc->filename);
+  g_free(sc->sql);
+  g_slice_free(struct _openslide_sqlite_stmtcache, sc);
+}
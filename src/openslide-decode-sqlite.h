@@ -36,4 +36,15 @@ void _openslide_sqlite_propagate_error(sqlite3 *db, GError **err);
 void _openslide_sqlite_propagate_stmt_error(sqlite3_stmt *stmt, GError **err);
 void _openslide_sqlite_close(sqlite3 *db);
 
+/* Pool of prepared statements of one query, each on its own connection */
+struct _openslide_sqlite_stmtcache;
+
+struct _openslide_sqlite_stmtcache *_openslide_sqlite_stmtcache_create(const char *filename,
+                                                                       const char *sql);
+sqlite3_stmt *_openslide_sqlite_stmtcache_get(struct _openslide_sqlite_stmtcache *sc,
+                                              GError **err);
+void _openslide_sqlite_stmtcache_put(struct _openslide_sqlite_stmtcache *sc,
+                                     sqlite3_stmt *stmt);
+void _openslide_sqlite_stmtcache_destroy(struct _openslide_sqlite_stmtcache *sc);
+
 #endif
@@ -37,12 +37,19 @@
 #include "openslide-hash.h"
 
 #define HANDLE_CACHE_MAX 32
+// bytes of directory reads shared between the handles of a tiffcache
+#define DIRECTORY_CACHE_MAX (64 * 1024 * 1024)
 
 struct _openslide_tiffcache {
   char *filename;
   GQueue *cache;
   GMutex *lock;
   int outstanding;
+
+  // shared by the handles, protected by lock
+  int64_t size;               // file size, or -1 before the first open
+  GHashTable *directory_reads;  // struct directory_read -> itself
+  int64_t directory_bytes;
 };
 
 // not thread-safe, like libtiff
@@ -50,6 +57,17 @@ struct tiff_file_handle {
   struct _openslide_tiffcache *tc;
   int64_t offset;
   int64_t size;
+  bool directory;  // libtiff is reading directories, not image data
+};
+
+// bytes read by libtiff while parsing directories.  libtiff can't copy
+// its parsed directories to another handle, but every handle reads the
+// same bytes to parse them, so later handles get them from memory.
+struct directory_read {
+  int64_t offset;
+  tsize_t size;  // requested
+  tsize_t len;   // returned
+  void *data;
 };
 
 struct associated_image {
@@ -84,7 +102,11 @@ bool _openslide_tiff_set_dir(TIFF *tiff,
     // avoid libtiff unnecessarily rereading directory contents
     return true;
   }
-  if (!TIFFSetDirectory(tiff, dir)) {
+  struct tiff_file_handle *hdl = TIFFClientdata(tiff);
+  hdl->directory = true;
+  int ok = TIFFSetDirectory(tiff, dir);
+  hdl->directory = false;
+  if (!ok) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "Cannot set TIFF directory %d", dir);
     return false;
@@ -209,62 +231,73 @@ static bool tiff_read_region(TIFF *tiff,
   return success;
 }
 
-static bool decode_jpeg(const void *buf, uint32_t buflen,
-                        const void *tables, uint32_t tables_len,  // optional
-                        J_COLOR_SPACE space,
-                        uint32_t *dest,
-                        int32_t w, int32_t h,
-                        GError **err) {
-  volatile bool result = false;
-  jmp_buf env;
-
-  struct jpeg_decompress_struct *cinfo;
-  struct _openslide_jpeg_decompress *dc =
-    _openslide_jpeg_decompress_create(&cinfo);
-
-  if (setjmp(env) == 0) {
-    _openslide_jpeg_decompress_init(dc, &env);
-
-    // load JPEG tables
-    if (tables) {
-      _openslide_jpeg_mem_src(cinfo, tables, tables_len);
-      if (jpeg_read_header(cinfo, false) != JPEG_HEADER_TABLES_ONLY) {
-        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                    "Couldn't load JPEG tables");
-        goto DONE;
-      }
-    }
+// returns the raw tile data, owned by *cache_entry
+static void *read_tile_data(openslide_t *osr,
+                            struct _openslide_tiff_level *tiffl,
+                            TIFF *tiff,
+                            int32_t *_len,
+                            int64_t tile_col, int64_t tile_row,
+                            struct _openslide_cache_entry **cache_entry,
+                            GError **err) {
+  // look in the compressed tier first
+  int len;
+  void *buf = _openslide_cache_get_compressed(osr->cache,
+                                              tiffl, tile_col, tile_row,
+                                              &len, cache_entry);
+  if (buf) {
+    *_len = len;
+    return buf;
+  }
 
-    // set up I/O
-    _openslide_jpeg_mem_src(cinfo, buf, buflen);
+  // set directory
+  if (!_openslide_tiff_set_dir(tiff, tiffl->dir, err)) {
+    return NULL;
+  }
 
-    // read header
-    if (jpeg_read_header(cinfo, true) != JPEG_HEADER_OK) {
-      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                  "Couldn't read JPEG header");
-      goto DONE;
-    }
+  // get tile number
+  ttile_t tile_no = TIFFComputeTile(tiff,
+                                    tile_col * tiffl->tile_w,
+                                    tile_row * tiffl->tile_h,
+                                    0, 0);
 
-    // set color space from TIFF photometric tag (for Aperio)
-    cinfo->jpeg_color_space = space;
+  //g_debug("read_tile_data reading tile %d", tile_no);
 
-    // decompress
-    if (!_openslide_jpeg_decompress_run(dc, dest, false, w, h, err)) {
-      goto DONE;
-    }
-    result = true;
-  } else {
-    // setjmp has returned again
-    _openslide_jpeg_propagate_error(err, dc);
+  // get tile size
+  toff_t *sizes;
+  if (TIFFGetField(tiff, TIFFTAG_TILEBYTECOUNTS, &sizes) == 0) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Cannot get tile size");
+    return NULL;  // ok, haven't allocated anything yet
   }
+  tsize_t tile_size = sizes[tile_no];
 
-DONE:
-  _openslide_jpeg_decompress_destroy(dc);
+  // get raw tile
+  buf = g_slice_alloc(tile_size);
+  tsize_t size = TIFFReadRawTile(tiff, tile_no, buf, tile_size);
+  if (size == -1) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Cannot read raw tile");
+    g_slice_free1(tile_size, buf);
+    return NULL;
+  }
+  if (size != tile_size) {
+    // the cache frees the buffer by its size
+    void *short_buf = g_slice_copy(size, buf);
+    g_slice_free1(tile_size, buf);
+    buf = short_buf;
+  }
 
-  return result;
+  // put it in the cache; the entry owns the buffer even if the cache
+  // doesn't keep it
+  _openslide_cache_put_compressed(osr->cache, tiffl, tile_col, tile_row,
+                                  buf, size, cache_entry);
+
+  *_len = size;
+  return buf;
 }
 
-bool _openslide_tiff_read_tile(struct _openslide_tiff_level *tiffl,
+bool _openslide_tiff_read_tile(openslide_t *osr,
+                               struct _openslide_tiff_level *tiffl,
                                TIFF *tiff,
                                uint32_t *dest,
                                int64_t tile_col, int64_t tile_row,
@@ -290,72 +323,134 @@ bool _openslide_tiff_read_tile(struct _openslide_tiff_level *tiffl,
     }
 
     // read data
-    void *buf;
+    struct _openslide_cache_entry *cache_entry;
     int32_t buflen;
-    if (!_openslide_tiff_read_tile_data(tiffl, tiff,
-                                        &buf, &buflen,
-                                        tile_col, tile_row,
-                                        err)) {
+    void *buf = read_tile_data(osr, tiffl, tiff, &buflen,
+                               tile_col, tile_row, &cache_entry, err);
+    if (!buf) {
       return false;
     }
 
     // decompress
-    bool ret = decode_jpeg(buf, buflen, tables, tables_len,
+    bool ret = _openslide_jpeg_decode_buffer_with_tables(buf, buflen,
+                           tables, tables_len,
                            tiffl->photometric == PHOTOMETRIC_YCBCR ? JCS_YCbCr : JCS_RGB,
                            dest,
                            tiffl->tile_w, tiffl->tile_h,
                            err);
-    g_free(buf);
+    _openslide_cache_entry_unref(cache_entry);
     return ret;
   } else {
     // Fallback: read tile through libtiff
     _openslide_performance_warn_once(&tiffl->warned_read_indirect,
                                      "Using slow libtiff read path for "
                                      "directory %d", tiffl->dir);
-    return tiff_read_region(tiff, dest,
-                            tile_col * tiffl->tile_w, tile_row * tiffl->tile_h,
-                            tiffl->tile_w, tiffl->tile_h, err);
+    struct _openslide_stats_timer timer;
+    _openslide_stats_begin(&timer);
+    bool ret = tiff_read_region(tiff, dest,
+                                tile_col * tiffl->tile_w,
+                                tile_row * tiffl->tile_h,
+                                tiffl->tile_w, tiffl->tile_h, err);
+    _openslide_stats_end(&timer, OPENSLIDE_STAT_DECODE_TIME_TIFF);
+    return ret;
   }
 }
 
-bool _openslide_tiff_read_tile_data(struct _openslide_tiff_level *tiffl,
+bool _openslide_tiff_read_tile_data(openslide_t *osr,
+                                    struct _openslide_tiff_level *tiffl,
                                     TIFF *tiff,
                                     void **_buf, int32_t *_len,
                                     int64_t tile_col, int64_t tile_row,
                                     GError **err) {
-  // set directory
-  SET_DIR_OR_FAIL(tiff, tiffl->dir);
+  struct _openslide_cache_entry *cache_entry;
+  int32_t len;
+  void *buf = read_tile_data(osr, tiffl, tiff, &len,
+                             tile_col, tile_row, &cache_entry, err);
+  if (!buf) {
+    return false;
+  }
 
-  // get tile number
-  ttile_t tile_no = TIFFComputeTile(tiff,
-                                    tile_col * tiffl->tile_w,
-                                    tile_row * tiffl->tile_h,
-                                    0, 0);
+  // set outputs
+  *_buf = g_memdup(buf, len);
+  *_len = len;
+  _openslide_cache_entry_unref(cache_entry);
+  return true;
+}
 
-  //g_debug("_openslide_tiff_read_tile_data reading tile %d", tile_no);
+// Adobe APP14 segment with transform 0, so that decoders don't convert
+// the components from YCbCr
+static const uint8_t adobe_rgb_marker[] = {
+  0xff, 0xee, 0x00, 0x0e, 'A', 'd', 'o', 'b', 'e',
+  0x00, 0x64, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
 
-  // get tile size
-  toff_t *sizes;
-  if (TIFFGetField(tiff, TIFFTAG_TILEBYTECOUNTS, &sizes) == 0) {
-    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                "Cannot get tile size");
-    return false;  // ok, haven't allocated anything yet
+// produce a self-contained JPEG from a JPEG tile and the JPEGTables of
+// its directory; *buf is NULL if the tile is missing
+bool _openslide_tiff_read_raw_jpeg_tile(openslide_t *osr,
+                                        struct _openslide_tiff_level *tiffl,
+                                        TIFF *tiff,
+                                        void **_buf, int32_t *_len,
+                                        int64_t tile_col, int64_t tile_row,
+                                        GError **err) {
+  g_assert(tiffl->tile_read_direct);
+
+  bool is_missing;
+  if (!_openslide_tiff_check_missing_tile(tiffl, tiff, tile_col, tile_row,
+                                          &is_missing, err)) {
+    return false;
+  }
+  if (is_missing) {
+    *_buf = NULL;
+    *_len = 0;
+    return true;
   }
-  tsize_t tile_size = sizes[tile_no];
 
-  // get raw tile
-  tdata_t buf = g_malloc(tile_size);
-  tsize_t size = TIFFReadRawTile(tiff, tile_no, buf, tile_size);
-  if (size == -1) {
+  // read tables; the directory is already set
+  uint8_t *tables;
+  uint32_t tables_len;
+  if (!TIFFGetField(tiff, TIFFTAG_JPEGTABLES, &tables_len, &tables)) {
+    // no separate tables
+    tables = NULL;
+    tables_len = 0;
+  }
+
+  struct _openslide_cache_entry *cache_entry;
+  int32_t len;
+  uint8_t *buf = read_tile_data(osr, tiffl, tiff, &len,
+                                tile_col, tile_row, &cache_entry, err);
+  if (!buf) {
+    return false;
+  }
+  // the tile must start with SOI
+  if (len < 4 || buf[0] != 0xff || buf[1] != 0xd8) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                "Cannot read raw tile");
-    g_free(buf);
+                "Tile data is not a JPEG stream");
+    _openslide_cache_entry_unref(cache_entry);
     return false;
   }
 
+  // tables stream without its EOI, then the tile without its SOI
+  if (tables_len < 4 || tables[tables_len - 2] != 0xff ||
+      tables[tables_len - 1] != 0xd9) {
+    tables = NULL;
+    tables_len = 0;
+  }
+  const uint8_t soi[] = {0xff, 0xd8};
+  GByteArray *out = g_byte_array_sized_new(len + tables_len +
+                                           sizeof(adobe_rgb_marker));
+  g_byte_array_append(out, soi, sizeof(soi));
+  if (tiffl->photometric == PHOTOMETRIC_RGB) {
+    g_byte_array_append(out, adobe_rgb_marker, sizeof(adobe_rgb_marker));
+  }
+  if (tables) {
+    g_byte_array_append(out, tables + 2, tables_len - 4);
+  }
+  g_byte_array_append(out, buf + 2, len - 2);
+  _openslide_cache_entry_unref(cache_entry);
+
   // set outputs
-  *_buf = buf;
-  *_len = size;
+  *_len = out->len;
+  *_buf = g_byte_array_free(out, false);
   return true;
 }
 
@@ -496,22 +591,69 @@ bool _openslide_tiff_add_associated_image(openslide_t *osr,
   return ret;
 }
 
+static guint directory_read_hash(gconstpointer key) {
+  const struct directory_read *r = key;
+  return _openslide_int64_hash(&r->offset) ^ (guint) r->size;
+}
+
+static gboolean directory_read_equal(gconstpointer a, gconstpointer b) {
+  const struct directory_read *ra = a;
+  const struct directory_read *rb = b;
+  return ra->offset == rb->offset && ra->size == rb->size;
+}
+
+static void directory_read_free(gpointer data) {
+  struct directory_read *r = data;
+  g_free(r->data);
+  g_slice_free(struct directory_read, r);
+}
+
 static tsize_t tiff_do_read(thandle_t th, tdata_t buf, tsize_t size) {
   struct tiff_file_handle *hdl = th;
+  struct _openslide_tiffcache *tc = hdl->tc;
 
-  // don't leave the file handle open between calls
-  // also ensures FD_CLOEXEC is set
-  FILE *f = _openslide_fopen(hdl->tc->filename, "rb", NULL);
-  if (f == NULL) {
-    return 0;
+  if (hdl->directory) {
+    struct directory_read key = {
+      .offset = hdl->offset,
+      .size = size,
+    };
+    g_mutex_lock(tc->lock);
+    struct directory_read *r = g_hash_table_lookup(tc->directory_reads, &key);
+    if (r) {
+      memcpy(buf, r->data, r->len);
+      hdl->offset += r->len;
+      g_mutex_unlock(tc->lock);
+      return r->len;
+    }
+    g_mutex_unlock(tc->lock);
   }
-  if (fseeko(f, hdl->offset, SEEK_SET)) {
-    fclose(f);
+
+  int64_t rsize = _openslide_read_range(tc->filename, hdl->offset,
+                                        buf, size, NULL);
+  if (rsize < 0) {
     return 0;
   }
-  int64_t rsize = fread(buf, 1, size, f);
+
+  if (hdl->directory && rsize > 0) {
+    g_mutex_lock(tc->lock);
+    if (tc->directory_bytes + rsize <= DIRECTORY_CACHE_MAX) {
+      struct directory_read *r = g_slice_new(struct directory_read);
+      r->offset = hdl->offset;
+      r->size = size;
+      r->len = rsize;
+      r->data = g_memdup(buf, rsize);
+      if (!g_hash_table_lookup(tc->directory_reads, r)) {
+        g_hash_table_insert(tc->directory_reads, r, r);
+        tc->directory_bytes += rsize;
+      } else {
+        // another handle got there first
+        directory_read_free(r);
+      }
+    }
+    g_mutex_unlock(tc->lock);
+  }
+
   hdl->offset += rsize;
-  fclose(f);
   return rsize;
 }
 
@@ -555,11 +697,13 @@ static toff_t tiff_do_size(thandle_t th) {
 }
 
 #undef TIFFClientOpen
-static TIFF *tiff_open(struct _openslide_tiffcache *tc, GError **err) {
+// check the magic number and get the file size
+static bool tiff_check(struct _openslide_tiffcache *tc, int64_t *_size,
+                       GError **err) {
   // open
   FILE *f = _openslide_fopen(tc->filename, "rb", err);
   if (f == NULL) {
-    return NULL;
+    return false;
   }
 
   // read magic
@@ -569,20 +713,20 @@ static TIFF *tiff_open(struct _openslide_tiffcache *tc, GError **err) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "Couldn't read TIFF magic number for %s", tc->filename);
     fclose(f);
-    return NULL;
+    return false;
   }
 
   // get size
   if (fseeko(f, 0, SEEK_END) == -1) {
     _openslide_io_error(err, "Couldn't seek to end of %s", tc->filename);
     fclose(f);
-    return NULL;
+    return false;
   }
   int64_t size = ftello(f);
   if (size == -1) {
     _openslide_io_error(err, "Couldn't ftello() for %s", tc->filename);
     fclose(f);
-    return NULL;
+    return false;
   }
   fclose(f);
 
@@ -610,6 +754,24 @@ static TIFF *tiff_open(struct _openslide_tiffcache *tc, GError **err) {
   if (version == 43 && sizeof(toff_t) == 4) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "BigTIFF support requires libtiff >= 4");
+    return false;
+  }
+
+  *_size = size;
+  return true;
+
+NOT_TIFF:
+  g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+              "Not a TIFF file: %s", tc->filename);
+  return false;
+}
+
+static TIFF *tiff_open(struct _openslide_tiffcache *tc, GError **err) {
+  // after the first handle, the file is known to be a TIFF of this size
+  g_mutex_lock(tc->lock);
+  int64_t size = tc->size;
+  g_mutex_unlock(tc->lock);
+  if (size == -1 && !tiff_check(tc, &size, err)) {
     return NULL;
   }
 
@@ -620,6 +782,7 @@ static TIFF *tiff_open(struct _openslide_tiffcache *tc, GError **err) {
 
   // TIFFOpen
   // mode: m disables mmap to avoid sigbus and other mmap fragility
+  hdl->directory = true;
   TIFF *tiff = TIFFClientOpen(tc->filename, "rm", hdl,
                               tiff_do_read, tiff_do_write, tiff_do_seek,
                               tiff_do_close, tiff_do_size, NULL, NULL);
@@ -627,13 +790,14 @@ static TIFF *tiff_open(struct _openslide_tiffcache *tc, GError **err) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "Invalid TIFF: %s", tc->filename);
     tiff_do_close(hdl);
+    return NULL;
   }
-  return tiff;
+  hdl->directory = false;
 
-NOT_TIFF:
-  g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-              "Not a TIFF file: %s", tc->filename);
-  return NULL;
+  g_mutex_lock(tc->lock);
+  tc->size = size;
+  g_mutex_unlock(tc->lock);
+  return tiff;
 }
 #define TIFFClientOpen _OPENSLIDE_POISON(_openslide_tiffcache_get)
 
@@ -642,6 +806,11 @@ struct _openslide_tiffcache *_openslide_tiffcache_create(const char *filename) {
   tc->filename = g_strdup(filename);
   tc->cache = g_queue_new();
   tc->lock = g_mutex_new();
+  tc->size = -1;
+  tc->directory_reads = g_hash_table_new_full(directory_read_hash,
+                                              directory_read_equal,
+                                              NULL,
+                                              directory_read_free);
   return tc;
 }
 
@@ -698,8 +867,108 @@ void _openslide_tiffcache_destroy(struct _openslide_tiffcache *tc) {
   }
   g_assert(tc->outstanding == 0);
   g_mutex_unlock(tc->lock);
+  g_hash_table_destroy(tc->directory_reads);
   g_queue_free(tc->cache);
   g_mutex_free(tc->lock);
   g_free(tc->filename);
   g_slice_free(struct _openslide_tiffcache, tc);
 }
+
+static void *tiffcache_get_arg(void *arg_data, GError **err) {
+  return _openslide_tiffcache_get(arg_data, err);
+}
+
+static void tiffcache_put_arg(void *arg_data, void *arg) {
+  _openslide_tiffcache_put(arg_data, arg);
+}
+
+// read the compressed tiles missing from the cache in few large reads,
+// and add them to the cache.  The decoded tiles are cached by level.
+static void fetch_tiles(openslide_t *osr,
+                        struct _openslide_level *level,
+                        void *arg,
+                        void *fetch_data,
+                        const int64_t *tiles,
+                        int64_t count) {
+  struct _openslide_tiff_level *tiffl = fetch_data;
+  TIFF *tiff = arg;
+  toff_t *offsets;
+  toff_t *sizes;
+  if (!tiff ||
+      !_openslide_tiff_set_dir(tiff, tiffl->dir, NULL) ||
+      !TIFFGetField(tiff, TIFFTAG_TILEOFFSETS, &offsets) ||
+      !TIFFGetField(tiff, TIFFTAG_TILEBYTECOUNTS, &sizes)) {
+    return;
+  }
+  ttile_t tile_count = TIFFNumberOfTiles(tiff);
+
+  struct _openslide_range_request *requests =
+    g_new0(struct _openslide_range_request, count);
+  int64_t *request_tiles = g_new(int64_t, count);
+  int64_t n = 0;
+  for (int64_t i = 0; i < count; i++) {
+    int64_t tile_col = tiles[2 * i];
+    int64_t tile_row = tiles[2 * i + 1];
+    // decoded tiles outlive compressed ones, and need no data at all
+    if (_openslide_cache_contains(osr->cache, level, tile_col, tile_row)) {
+      continue;
+    }
+    struct _openslide_cache_entry *cache_entry;
+    int len;
+    if (_openslide_cache_get_compressed(osr->cache, tiffl,
+                                        tile_col, tile_row,
+                                        &len, &cache_entry)) {
+      _openslide_cache_entry_unref(cache_entry);
+      continue;
+    }
+    ttile_t tile_no = TIFFComputeTile(tiff,
+                                      tile_col * tiffl->tile_w,
+                                      tile_row * tiffl->tile_h,
+                                      0, 0);
+    if (tile_no >= tile_count || sizes[tile_no] == 0) {
+      // missing tile; let the tile read handle it
+      continue;
+    }
+    requests[n].offset = offsets[tile_no];
+    requests[n].len = sizes[tile_no];
+    request_tiles[n] = i;
+    n++;
+  }
+
+  // a single tile gains nothing
+  if (n > 1) {
+    for (int64_t i = 0; i < n; i++) {
+      requests[i].buf = g_slice_alloc(requests[i].len);
+    }
+    _openslide_read_ranges(TIFFFileName(tiff), requests, n);
+    for (int64_t i = 0; i < n; i++) {
+      struct _openslide_range_request *r = &requests[i];
+      if (r->result != r->len) {
+        // the tile read will retry and report the error
+        g_slice_free1(r->len, r->buf);
+        continue;
+      }
+      // the cache frees the buffer by its size
+      struct _openslide_cache_entry *cache_entry;
+      const int64_t *tile = tiles + 2 * request_tiles[i];
+      _openslide_cache_put_compressed(osr->cache, tiffl, tile[0], tile[1],
+                                      r->buf, r->len, &cache_entry);
+      _openslide_cache_entry_unref(cache_entry);
+    }
+  }
+  g_free(request_tiles);
+  g_free(requests);
+}
+
+void _openslide_tiff_grid_enable_coalesced_reads(struct _openslide_grid *grid,
+                                                 struct _openslide_tiff_level *tiffl) {
+  _openslide_grid_simple_enable_coalesced_reads(grid, fetch_tiles, tiffl);
+}
+
+void _openslide_tiff_grid_enable_parallel_decode(struct _openslide_grid *grid,
+                                                 struct _openslide_tiffcache *tc) {
+  _openslide_grid_enable_parallel_decode(grid,
+                                         tiffcache_get_arg,
+                                         tiffcache_put_arg,
+                                         tc);
+}
@@ -57,18 +57,29 @@ bool _openslide_tiff_check_missing_tile(struct _openslide_tiff_level *tiffl,
                                         bool *is_missing,
                                         GError **err);
 
-bool _openslide_tiff_read_tile(struct _openslide_tiff_level *tiffl,
+bool _openslide_tiff_read_tile(openslide_t *osr,
+                               struct _openslide_tiff_level *tiffl,
                                TIFF *tiff,
                                uint32_t *dest,
                                int64_t tile_col, int64_t tile_row,
                                GError **err);
 
-bool _openslide_tiff_read_tile_data(struct _openslide_tiff_level *tiffl,
+// raw tile data goes through the compressed tier of the osr cache
+bool _openslide_tiff_read_tile_data(openslide_t *osr,
+                                    struct _openslide_tiff_level *tiffl,
                                     TIFF *tiff,
                                     void **buf, int32_t *len,
                                     int64_t tile_col, int64_t tile_row,
                                     GError **err);
 
+// tiles of levels with tile_read_direct are JPEGs
+bool _openslide_tiff_read_raw_jpeg_tile(openslide_t *osr,
+                                        struct _openslide_tiff_level *tiffl,
+                                        TIFF *tiff,
+                                        void **buf, int32_t *len,
+                                        int64_t tile_col, int64_t tile_row,
+                                        GError **err);
+
 bool _openslide_tiff_clip_tile(struct _openslide_tiff_level *tiffl,
                                uint32_t *tiledata,
                                int64_t tile_col, int64_t tile_row,
@@ -95,4 +106,15 @@ void _openslide_tiffcache_put(struct _openslide_tiffcache *tc, TIFF *tiff);
 
 void _openslide_tiffcache_destroy(struct _openslide_tiffcache *tc);
 
+/* Let the decode threads read tiles of a grid whose read argument is a
+   TIFF handle, each with its own handle from the cache */
+void _openslide_tiff_grid_enable_parallel_decode(struct _openslide_grid *grid,
+                                                 struct _openslide_tiffcache *tc);
+
+/* Fetch the tiles of a simple grid whose read argument is a TIFF handle
+   together, where they are adjacent in the file, into the compressed
+   tier of the cache, for tiles read with read_tile_data() from tiffl */
+void _openslide_tiff_grid_enable_coalesced_reads(struct _openslide_grid *grid,
+                                                 struct _openslide_tiff_level *tiffl);
+
 #endif
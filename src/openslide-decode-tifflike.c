@@ -45,6 +45,17 @@
 
 #define NDPI_TAG 65420
 
+// stdio buffer for the file, so that nearby directories and values don't
+// each cost a read
+#define READ_BUFFER_SIZE (64 * 1024)
+
+// a directory can't usefully have more entries than there are tags
+#define MAX_DIRECTORY_ENTRIES 65536
+
+// out-of-line values up to this size are loaded whole, even if only the
+// first value is wanted
+#define SCALAR_LOAD_ALL_MAX 4096
+
 
 struct _openslide_tifflike {
   char *filename;
@@ -52,6 +63,10 @@ struct _openslide_tifflike {
   bool ndpi;
   GPtrArray *directories;
   GMutex *value_lock;
+
+  // kept open for reading values; protected by value_lock
+  FILE *f;
+  char *f_buffer;
 };
 
 struct tiff_directory {
@@ -105,15 +120,9 @@ static void fix_byte_order(void *data, int32_t size, int64_t count,
   }
 }
 
-// only sets *ok on failure
-static uint64_t read_uint(FILE *f, int32_t size, bool big_endian, bool *ok) {
-  g_assert(ok != NULL);
-
+static uint64_t get_uint(const void *data, int32_t size, bool big_endian) {
   uint8_t buf[size];
-  if (fread(buf, size, 1, f) != 1) {
-    *ok = false;
-    return 0;
-  }
+  memcpy(buf, data, size);
   fix_byte_order(buf, sizeof(buf), 1, big_endian);
   switch (size) {
   case 1: {
@@ -141,6 +150,18 @@ static uint64_t read_uint(FILE *f, int32_t size, bool big_endian, bool *ok) {
   }
 }
 
+// only sets *ok on failure
+static uint64_t read_uint(FILE *f, int32_t size, bool big_endian, bool *ok) {
+  g_assert(ok != NULL);
+
+  uint8_t buf[size];
+  if (fread(buf, size, 1, f) != 1) {
+    *ok = false;
+    return 0;
+  }
+  return get_uint(buf, size, big_endian);
+}
+
 static uint32_t get_value_size(uint16_t type, uint64_t *count) {
   switch (type) {
   case TIFF_BYTE:
@@ -340,10 +361,7 @@ static bool populate_item(struct _openslide_tifflike *tl,
     return true;
   }
 
-  FILE *f = _openslide_fopen(tl->filename, "rb", err);
-  if (!f) {
-    goto FAIL;
-  }
+  FILE *f = tl->f;
 
   uint64_t count = item->count;
   int32_t value_size = get_value_size(item->type, &count);
@@ -378,12 +396,46 @@ static bool populate_item(struct _openslide_tifflike *tl,
 FAIL:
   g_mutex_unlock(tl->value_lock);
   g_free(buf);
-  if (f) {
-    fclose(f);
-  }
   return success;
 }
 
+static void clear_item_values(struct tiff_item *item) {
+  g_free(item->uints);
+  g_free(item->sints);
+  g_free(item->floats);
+  g_free(item->buffer);
+}
+
+// Return an item holding at least the first value of the given one.
+// Scalar getters don't need the rest of a large array, such as the tile
+// offsets, so it stays on disk until someone asks for all of it.  tmp
+// receives the first value and must be cleared afterward.
+static struct tiff_item *populate_first_value(struct _openslide_tifflike *tl,
+                                              struct tiff_item *item,
+                                              struct tiff_item *tmp,
+                                              GError **err) {
+  memset(tmp, 0, sizeof(*tmp));
+
+  g_mutex_lock(tl->value_lock);
+  bool loaded = item->offset == NO_OFFSET;
+  g_mutex_unlock(tl->value_lock);
+
+  uint64_t count = item->count;
+  uint32_t value_size = get_value_size(item->type, &count);
+  if (loaded || value_size * count <= SCALAR_LOAD_ALL_MAX) {
+    return populate_item(tl, item, err) ? item : NULL;
+  }
+
+  tmp->type = item->type;
+  tmp->count = 1;
+  tmp->offset = item->offset;
+  if (!populate_item(tl, tmp, err)) {
+    clear_item_values(tmp);
+    return NULL;
+  }
+  return tmp;
+}
+
 static void tiff_directory_destroy(struct tiff_directory *d) {
   if (d == NULL) {
     return;
@@ -395,10 +447,7 @@ static void tiff_directory_destroy(struct tiff_directory *d) {
 static void tiff_item_destroy(gpointer data) {
   struct tiff_item *item = data;
 
-  g_free(item->uints);
-  g_free(item->sints);
-  g_free(item->floats);
-  g_free(item->buffer);
+  clear_item_values(item);
   g_slice_free(struct tiff_item, item);
 }
 
@@ -412,6 +461,7 @@ static struct tiff_directory *read_directory(FILE *f, int64_t *diroff,
   int64_t off = *diroff;
   *diroff = 0;
   struct tiff_directory *d = NULL;
+  uint8_t *entries = NULL;
   bool ok = true;
 
   //  g_debug("diroff: %"PRId64, off);
@@ -449,6 +499,25 @@ static struct tiff_directory *read_directory(FILE *f, int64_t *diroff,
 
   //  g_debug("dircount: %"PRIu64, dircount);
 
+  if (dircount > MAX_DIRECTORY_ENTRIES) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Too many directory entries: %"PRIu64, dircount);
+    goto FAIL;
+  }
+
+  // read the entries and the next directory offset in one go, rather
+  // than field by field
+  const int32_t count_size = bigtiff ? 8 : 4;
+  const int32_t value_field_size = bigtiff ? 8 : 4;
+  const int32_t entry_size = 4 + count_size + value_field_size;
+  const int32_t nextdiroff_size = (bigtiff || ndpi) ? 8 : 4;
+  size_t entries_len = dircount * entry_size + nextdiroff_size;
+  entries = g_malloc(entries_len);
+  if (fread(entries, entries_len, 1, f) != 1) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Cannot read directory entries");
+    goto FAIL;
+  }
 
   // initial checks passed, initialize the directory
   d = g_slice_new0(struct tiff_directory);
@@ -456,17 +525,12 @@ static struct tiff_directory *read_directory(FILE *f, int64_t *diroff,
                                    NULL, tiff_item_destroy);
   d->offset = off;
 
-  // read all directory entries
+  // parse all directory entries
   for (uint64_t n = 0; n < dircount; n++) {
-    uint16_t tag = read_uint(f, 2, big_endian, &ok);
-    uint16_t type = read_uint(f, 2, big_endian, &ok);
-    uint64_t count = read_uint(f, bigtiff ? 8 : 4, big_endian, &ok);
-
-    if (!ok) {
-      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                  "Cannot read tag, type, and count");
-      goto FAIL;
-    }
+    const uint8_t *entry = entries + n * entry_size;
+    uint16_t tag = get_uint(entry, 2, big_endian);
+    uint16_t type = get_uint(entry + 2, 2, big_endian);
+    uint64_t count = get_uint(entry + 4, count_size, big_endian);
 
     //    g_debug(" tag: %d, type: %d, count: %"PRId64, tag, type, count);
 
@@ -491,13 +555,9 @@ static struct tiff_directory *read_directory(FILE *f, int64_t *diroff,
       goto FAIL;
     }
 
-    // read in the value/offset
-    uint8_t value[bigtiff ? 8 : 4];
-    if (fread(value, sizeof(value), 1, f) != 1) {
-      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                  "Cannot read value/offset");
-      goto FAIL;
-    }
+    // copy out the value/offset
+    uint8_t value[value_field_size];
+    memcpy(value, entry + 4 + count_size, sizeof(value));
 
     // does value/offset contain the value?
     if (value_size * count <= sizeof(value)) {
@@ -534,21 +594,17 @@ static struct tiff_directory *read_directory(FILE *f, int64_t *diroff,
     }
   }
 
-  // read the next dir offset
-  int64_t nextdiroff = read_uint(f, (bigtiff || ndpi) ? 8 : 4,
-                                 big_endian, &ok);
-  if (!ok) {
-    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                "Cannot read next directory offset");
-    goto FAIL;
-  }
-  *diroff = nextdiroff;
+  // the next dir offset
+  *diroff = get_uint(entries + dircount * entry_size, nextdiroff_size,
+                     big_endian);
 
   // success
+  g_free(entries);
   return d;
 
 
 FAIL:
+  g_free(entries);
   tiff_directory_destroy(d);
   return NULL;
 }
@@ -557,12 +613,15 @@ struct _openslide_tifflike *_openslide_tifflike_create(const char *filename,
                                                        GError **err) {
   struct _openslide_tifflike *tl = NULL;
   GHashTable *loop_detector = NULL;
+  char *f_buffer = NULL;
 
   // open file
   FILE *f = _openslide_fopen(filename, "rb", err);
   if (!f) {
     goto FAIL;
   }
+  f_buffer = g_malloc(READ_BUFFER_SIZE);
+  setvbuf(f, f_buffer, _IOFBF, READ_BUFFER_SIZE);
 
   // read and check magic
   uint16_t magic;
@@ -620,6 +679,11 @@ struct _openslide_tifflike *_openslide_tifflike_create(const char *filename,
   tl->big_endian = big_endian;
   tl->directories = g_ptr_array_new();
   tl->value_lock = g_mutex_new();
+  // values are read later through the same buffered handle
+  tl->f = f;
+  tl->f_buffer = f_buffer;
+  f = NULL;
+  f_buffer = NULL;
 
   // initialize directory reading
   loop_detector = g_hash_table_new_full(_openslide_int64_hash,
@@ -634,7 +698,7 @@ struct _openslide_tifflike *_openslide_tifflike_create(const char *filename,
   // valid directory containing the NDPI_TAG.
   if (!bigtiff && diroff != 0) {
     int64_t trial_diroff = diroff;
-    struct tiff_directory *d = read_directory(f, &trial_diroff,
+    struct tiff_directory *d = read_directory(tl->f, &trial_diroff,
                                               NULL,
                                               loop_detector,
                                               bigtiff, true, big_endian,
@@ -668,7 +732,7 @@ struct _openslide_tifflike *_openslide_tifflike_create(const char *filename,
   // read all the directories
   while (diroff != 0) {
     // read a directory
-    struct tiff_directory *d = read_directory(f, &diroff,
+    struct tiff_directory *d = read_directory(tl->f, &diroff,
                                               first_dir,
                                               loop_detector,
                                               bigtiff, tl->ndpi, big_endian,
@@ -694,7 +758,6 @@ struct _openslide_tifflike *_openslide_tifflike_create(const char *filename,
   }
 
   g_hash_table_unref(loop_detector);
-  fclose(f);
   return tl;
 
 FAIL:
@@ -705,6 +768,7 @@ FAIL:
   if (f) {
     fclose(f);
   }
+  g_free(f_buffer);
   return NULL;
 }
 
@@ -719,6 +783,10 @@ void _openslide_tifflike_destroy(struct _openslide_tifflike *tl) {
   }
   g_mutex_unlock(tl->value_lock);
   g_ptr_array_free(tl->directories, true);
+  if (tl->f) {
+    fclose(tl->f);
+  }
+  g_free(tl->f_buffer);
   g_free(tl->filename);
   g_mutex_free(tl->value_lock);
   g_slice_free(struct _openslide_tifflike, tl);
@@ -865,49 +933,61 @@ static struct tiff_item *get_and_check_item(struct _openslide_tifflike *tl,
 uint64_t _openslide_tifflike_get_uint(struct _openslide_tifflike *tl,
                                       int64_t dir, int32_t tag,
                                       GError **err) {
+  struct tiff_item tmp;
   struct tiff_item *item = get_and_check_item(tl, dir, tag, err);
-  if (item == NULL || !populate_item(tl, item, err)) {
+  if (item == NULL || !(item = populate_first_value(tl, item, &tmp, err))) {
     return 0;
   }
   if (!item->uints) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "Unexpected value type: directory %"PRId64", "
                 "tag %d, type %d", dir, tag, item->type);
+    clear_item_values(&tmp);
     return 0;
   }
-  return item->uints[0];
+  uint64_t result = item->uints[0];
+  clear_item_values(&tmp);
+  return result;
 }
 
 int64_t _openslide_tifflike_get_sint(struct _openslide_tifflike *tl,
                                      int64_t dir, int32_t tag,
                                      GError **err) {
+  struct tiff_item tmp;
   struct tiff_item *item = get_and_check_item(tl, dir, tag, err);
-  if (item == NULL || !populate_item(tl, item, err)) {
+  if (item == NULL || !(item = populate_first_value(tl, item, &tmp, err))) {
     return 0;
   }
   if (!item->sints) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "Unexpected value type: directory %"PRId64", "
                 "tag %d, type %d", dir, tag, item->type);
+    clear_item_values(&tmp);
     return 0;
   }
-  return item->sints[0];
+  int64_t result = item->sints[0];
+  clear_item_values(&tmp);
+  return result;
 }
 
 double _openslide_tifflike_get_float(struct _openslide_tifflike *tl,
                                      int64_t dir, int32_t tag,
                                      GError **err) {
+  struct tiff_item tmp;
   struct tiff_item *item = get_and_check_item(tl, dir, tag, err);
-  if (item == NULL || !populate_item(tl, item, err)) {
+  if (item == NULL || !(item = populate_first_value(tl, item, &tmp, err))) {
     return NAN;
   }
   if (!item->floats) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "Unexpected value type: directory %"PRId64", "
                 "tag %d, type %d", dir, tag, item->type);
+    clear_item_values(&tmp);
     return NAN;
   }
-  return item->floats[0];
+  double result = item->floats[0];
+  clear_item_values(&tmp);
+  return result;
 }
 
 const uint64_t *_openslide_tifflike_get_uints(struct _openslide_tifflike *tl,
@@ -1150,6 +1230,11 @@ static bool hash_tiff_level(struct _openslide_hash *hash,
     }
   }
 
+  if (!hash) {
+    // the caller doesn't want the hash
+    return true;
+  }
+
   // hash raw data of each tile/strip
   for (int64_t i = 0; i < count; i++) {
     if (!_openslide_hash_file_part(hash, tl->filename, offsets[i], lengths[i],
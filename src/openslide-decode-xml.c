@@ -33,6 +33,7 @@
 #include <libxml/tree.h>
 #include <libxml/xpath.h>
 #include <libxml/xpathInternals.h>
+#include <libxml/xmlreader.h>
 
 xmlDoc *_openslide_xml_parse(const char *xml, GError **err) {
   xmlDoc *doc = xmlReadMemory(xml, strlen(xml), "/", NULL,
@@ -47,6 +48,48 @@ xmlDoc *_openslide_xml_parse(const char *xml, GError **err) {
   return doc;
 }
 
+// a reader parses the document incrementally, without building a tree,
+// for callers that only need a few elements of a large document
+xmlTextReader *_openslide_xml_reader_create(const char *xml, GError **err) {
+  xmlTextReader *reader = xmlReaderForMemory(xml, strlen(xml), "/", NULL,
+                                             XML_PARSE_NOERROR |
+                                             XML_PARSE_NOWARNING |
+                                             XML_PARSE_NONET);
+  if (reader == NULL) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Could not parse XML");
+    return NULL;
+  }
+  return reader;
+}
+
+// advance to the next start tag, first skipping the contents of the
+// current element if skip_children is set
+// returns false at the end of the document, or with err set if the
+// document is malformed
+bool _openslide_xml_reader_next_element(xmlTextReader *reader,
+                                        bool skip_children,
+                                        GError **err) {
+  int ret;
+  if (skip_children &&
+      xmlTextReaderNodeType(reader) == XML_READER_TYPE_ELEMENT) {
+    ret = xmlTextReaderNext(reader);
+  } else {
+    ret = xmlTextReaderRead(reader);
+  }
+  while (ret == 1) {
+    if (xmlTextReaderNodeType(reader) == XML_READER_TYPE_ELEMENT) {
+      return true;
+    }
+    ret = xmlTextReaderRead(reader);
+  }
+  if (ret < 0) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Could not parse XML");
+  }
+  return false;
+}
+
 bool _openslide_xml_has_default_namespace(xmlDoc *doc, const char *ns) {
   xmlNode *root = xmlDocGetRootElement(doc);
   if (ns && root->ns) {
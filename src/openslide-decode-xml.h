@@ -28,11 +28,18 @@
 #include <glib.h>
 #include <libxml/tree.h>
 #include <libxml/xpath.h>
+#include <libxml/xmlreader.h>
 
 /* libxml support code */
 
 xmlDoc *_openslide_xml_parse(const char *xml, GError **err);
 
+xmlTextReader *_openslide_xml_reader_create(const char *xml, GError **err);
+
+bool _openslide_xml_reader_next_element(xmlTextReader *reader,
+                                        bool skip_children,
+                                        GError **err);
+
 bool _openslide_xml_has_default_namespace(xmlDoc *doc, const char *ns);
 
 int64_t _openslide_xml_parse_int_attr(xmlNode *node, const char *name,
@@ -0,0 +1,352 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2007-2014 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "openslide-private.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <zlib.h>
+
+// tile files: magic, a struct tile_header, then the zlib-compressed data
+#define TILE_MAGIC "OpenSlide cached tile 2\n"
+#define TILE_MAGIC_LEN (sizeof(TILE_MAGIC) - 1)
+#define TILE_HEADER_LEN (TILE_MAGIC_LEN + sizeof(struct tile_header))
+#define TILE_SUFFIX ".tile"
+// read back differently on hosts of the other byte order
+#define TILE_BYTE_ORDER 0x01020304
+
+// after this fraction of the capacity is written, look for files to evict
+#define SWEEP_FRACTION 16
+// and evict down to this fraction of the capacity
+#define SWEEP_TARGET_PERCENT 90
+// tiles waiting to be written beyond this are dropped
+#define MAX_QUEUED_BYTES (64 * 1024 * 1024)
+
+// other processes share the directory, so its size is only known by
+// looking
+static struct {
+  char *dir;         // NULL if disabled
+  int64_t capacity;
+  int64_t written;   // since the last sweep
+  int64_t queued;    // waiting for the writer thread
+} state;
+G_LOCK_DEFINE_STATIC(state);
+
+// in host byte order
+struct tile_header {
+  int32_t byte_order;
+  int32_t w;
+  int32_t h;
+  int32_t format;  // cairo_format_t
+};
+
+// work for the writer thread, which compresses and writes tiles off the
+// decode threads, and sweeps the directory
+struct write_job {
+  char *path;        // NULL to sweep
+  struct tile_header hdr;
+  void *data;
+  int size;
+};
+
+struct tile_file {
+  char *path;
+  int64_t size;
+  int64_t mtime;
+};
+
+static char *get_dir(void) {
+  G_LOCK(state);
+  char *dir = g_strdup(state.dir);
+  G_UNLOCK(state);
+  return dir;
+}
+
+static char *get_tile_path(const char *dir, const char *slide_key,
+                           int32_t plane_id, int64_t x, int64_t y) {
+  char *name = g_strdup_printf("%d-%"PRId64"-%"PRId64 TILE_SUFFIX,
+                               plane_id, x, y);
+  char *path = g_build_filename(dir, slide_key, name, NULL);
+  g_free(name);
+  return path;
+}
+
+static int tile_file_compare(const void *a, const void *b) {
+  const struct tile_file *fa = a;
+  const struct tile_file *fb = b;
+  return (fa->mtime > fb->mtime) - (fa->mtime < fb->mtime);
+}
+
+// evict the least recently used tiles of all slides until the directory
+// fits
+static void sweep(const char *dir, int64_t capacity) {
+  GArray *files = g_array_new(false, false, sizeof(struct tile_file));
+  int64_t total = 0;
+  GDir *top = g_dir_open(dir, 0, NULL);
+  const char *slide_name;
+  while (top && (slide_name = g_dir_read_name(top))) {
+    char *slide_dir = g_build_filename(dir, slide_name, NULL);
+    GDir *d = g_dir_open(slide_dir, 0, NULL);
+    const char *name;
+    while (d && (name = g_dir_read_name(d))) {
+      if (!g_str_has_suffix(name, TILE_SUFFIX)) {
+        continue;
+      }
+      struct tile_file file = {
+        .path = g_build_filename(slide_dir, name, NULL),
+      };
+      struct stat st;
+      if (g_stat(file.path, &st)) {
+        g_free(file.path);
+        continue;
+      }
+      file.size = st.st_size;
+      file.mtime = st.st_mtime;
+      total += file.size;
+      g_array_append_val(files, file);
+    }
+    if (d) {
+      g_dir_close(d);
+    }
+    g_free(slide_dir);
+  }
+  if (top) {
+    g_dir_close(top);
+  }
+
+  if (total > capacity) {
+    qsort(files->data, files->len, sizeof(struct tile_file),
+          tile_file_compare);
+    int64_t target = capacity / 100 * SWEEP_TARGET_PERCENT;
+    for (guint i = 0; i < files->len && total > target; i++) {
+      struct tile_file *file = &g_array_index(files, struct tile_file, i);
+      // another process may have evicted it already; it's gone either way
+      g_unlink(file->path);
+      total -= file->size;
+      // remove the slide directory once it is empty
+      char *slide_dir = g_path_get_dirname(file->path);
+      g_rmdir(slide_dir);
+      g_free(slide_dir);
+    }
+  }
+
+  for (guint i = 0; i < files->len; i++) {
+    g_free(g_array_index(files, struct tile_file, i).path);
+  }
+  g_array_free(files, true);
+}
+
+// returns the number of bytes written
+static int64_t write_tile(const char *path, const struct tile_header *hdr,
+                          const void *data, int size_in_bytes) {
+  uLongf compressed_len = compressBound(size_in_bytes);
+  char *buf = g_malloc(TILE_HEADER_LEN + compressed_len);
+  memcpy(buf, TILE_MAGIC, TILE_MAGIC_LEN);
+  memcpy(buf + TILE_MAGIC_LEN, hdr, sizeof(*hdr));
+  if (compress2((Bytef *) buf + TILE_HEADER_LEN, &compressed_len,
+                data, size_in_bytes, Z_BEST_SPEED) != Z_OK) {
+    g_free(buf);
+    return 0;
+  }
+
+  // failing to save is harmless, the tile is just decoded again.
+  // g_file_set_contents() renames into place, so other processes never
+  // see a partial file.
+  GError *tmp_err = NULL;
+  char *slide_dir = g_path_get_dirname(path);
+  int64_t len = TILE_HEADER_LEN + compressed_len;
+  if (g_mkdir_with_parents(slide_dir, 0700)) {
+    g_debug("Couldn't create %s", slide_dir);
+    len = 0;
+  } else if (!g_file_set_contents(path, buf, len, &tmp_err)) {
+    g_debug("Couldn't save cached tile: %s", tmp_err->message);
+    g_clear_error(&tmp_err);
+    len = 0;
+  }
+  g_free(slide_dir);
+  g_free(buf);
+  return len;
+}
+
+static gpointer writer_thread_func(gpointer data) {
+  GAsyncQueue *queue = data;
+  while (true) {
+    struct write_job *job = g_async_queue_pop(queue);
+    int64_t len = 0;
+    if (job->path) {
+      len = write_tile(job->path, &job->hdr, job->data, job->size);
+    }
+
+    G_LOCK(state);
+    state.queued -= job->size;
+    state.written += len;
+    char *dir = NULL;
+    int64_t capacity = state.capacity;
+    if (state.dir && (!job->path ||
+                      state.written > state.capacity / SWEEP_FRACTION)) {
+      dir = g_strdup(state.dir);
+      state.written = 0;
+    }
+    G_UNLOCK(state);
+
+    if (dir) {
+      sweep(dir, capacity);
+      g_free(dir);
+    }
+    g_free(job->path);
+    g_free(job->data);
+    g_slice_free(struct write_job, job);
+  }
+  return NULL;
+}
+
+static gpointer writer_init(gpointer data G_GNUC_UNUSED) {
+  GAsyncQueue *queue = g_async_queue_new();
+  GError *tmp_err = NULL;
+  if (!g_thread_create(writer_thread_func, queue, false, &tmp_err)) {
+    g_debug("Couldn't start disk cache thread: %s", tmp_err->message);
+    g_clear_error(&tmp_err);
+    g_async_queue_unref(queue);
+    return NULL;
+  }
+  return queue;
+}
+
+// NULL if the writer thread couldn't be started
+static GAsyncQueue *get_writer_queue(void) {
+  static GOnce once = G_ONCE_INIT;
+  return g_once(&once, writer_init, NULL);
+}
+
+void _openslide_diskcache_set(const char *dir, int64_t capacity) {
+  G_LOCK(state);
+  g_free(state.dir);
+  state.dir = (dir && *dir) ? g_strdup(dir) : NULL;
+  state.capacity = MAX(capacity, 0);
+  state.written = 0;
+  bool enabled = state.dir != NULL;
+  G_UNLOCK(state);
+
+  // the directory may be over a smaller capacity
+  GAsyncQueue *queue;
+  if (enabled && (queue = get_writer_queue()) != NULL) {
+    g_async_queue_push(queue, g_slice_new0(struct write_job));
+  }
+}
+
+bool _openslide_diskcache_enabled(void) {
+  G_LOCK(state);
+  bool enabled = state.dir != NULL;
+  G_UNLOCK(state);
+  return enabled;
+}
+
+void *_openslide_diskcache_get(const char *slide_key, int32_t plane_id,
+                               int64_t x, int64_t y,
+                               const struct _openslide_diskcache_tile *tile) {
+  char *dir = get_dir();
+  if (!dir) {
+    return NULL;
+  }
+
+  char *path = get_tile_path(dir, slide_key, plane_id, x, y);
+  char *buf;
+  gsize len;
+  void *data = NULL;
+  if (g_file_get_contents(path, &buf, &len, NULL)) {
+    // another version of the slide format code may have cached a tile
+    // of other dimensions at this position
+    int size = tile->w * tile->h * 4;
+    struct tile_header hdr;
+    if (len > TILE_HEADER_LEN &&
+        !memcmp(buf, TILE_MAGIC, TILE_MAGIC_LEN)) {
+      memcpy(&hdr, buf + TILE_MAGIC_LEN, sizeof(hdr));
+      if (hdr.byte_order == TILE_BYTE_ORDER &&
+          hdr.w == tile->w && hdr.h == tile->h &&
+          hdr.format == (int32_t) tile->format && size > 0) {
+        data = _openslide_tile_buffer_alloc(size);
+        uLongf data_len = size;
+        if (uncompress(data, &data_len,
+                       (const Bytef *) buf + TILE_HEADER_LEN,
+                       len - TILE_HEADER_LEN) != Z_OK ||
+            data_len != (uLongf) size) {
+          _openslide_tile_buffer_free(data, size);
+          data = NULL;
+        }
+      }
+    }
+    if (data) {
+      // the sweep evicts by modification time, so mark it recently used
+#if GLIB_CHECK_VERSION(2,18,0)
+      g_utime(path, NULL);
+#endif
+    } else {
+      // the tile is decoded and saved again
+      g_debug("Dropping invalid cached tile %s", path);
+      g_unlink(path);
+    }
+    g_free(buf);
+  }
+  g_free(path);
+  g_free(dir);
+  return data;
+}
+
+void _openslide_diskcache_put(const char *slide_key, int32_t plane_id,
+                              int64_t x, int64_t y,
+                              const struct _openslide_diskcache_tile *tile,
+                              const void *data) {
+  int size_in_bytes = tile->w * tile->h * 4;
+  GAsyncQueue *queue = get_writer_queue();
+  if (!queue) {
+    return;
+  }
+
+  // the writer thread can't keep up; the tile is just decoded again
+  G_LOCK(state);
+  bool queued = state.dir && state.queued + size_in_bytes <= MAX_QUEUED_BYTES;
+  char *path = NULL;
+  if (queued) {
+    state.queued += size_in_bytes;
+    path = get_tile_path(state.dir, slide_key, plane_id, x, y);
+  }
+  G_UNLOCK(state);
+  if (!queued) {
+    return;
+  }
+
+  // the caller's buffer belongs to the cache
+  struct write_job *job = g_slice_new(struct write_job);
+  job->path = path;
+  job->hdr.byte_order = TILE_BYTE_ORDER;
+  job->hdr.w = tile->w;
+  job->hdr.h = tile->h;
+  job->hdr.format = tile->format;
+  job->data = g_memdup(data, size_in_bytes);
+  job->size = size_in_bytes;
+  g_async_queue_push(queue, job);
+}
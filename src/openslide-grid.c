@@ -27,6 +27,14 @@
 #include "openslide-private.h"
 
 #define RANGE_BIN_SIZE_MULTIPLIER 3
+
+// a tilemap switches from a dense array to a hash table once the array
+// would have more than this many cells per tile, plus a constant
+#define TILEMAP_DENSE_MAX_CELLS_PER_TILE 4
+#define TILEMAP_DENSE_MIN_CELLS 4096
+// only decode in parallel if the tiles of the region use at most this
+// share of the cache, so they are still cached when they are painted
+#define DECODE_MAX_CACHE_FRACTION 2
 #define COLOR_TILE 0.6, 0,   0,   0.3
 #define COLOR_BIN  0,   0,   0.6, 0.15
 
@@ -43,6 +51,11 @@ struct region {
 
   double offset_x;
   double offset_y;
+
+  // tiles are copied into their cells rather than composited
+  bool blit;
+  // the region is exactly one tile, which may be decoded into the target
+  bool direct;
 };
 
 struct bounds {
@@ -78,22 +91,74 @@ struct _openslide_grid {
 
   double tile_advance_x;
   double tile_advance_y;
+
+  // parallel decode
+  bool parallel_decode;
+  _openslide_grid_get_arg_fn get_arg;
+  _openslide_grid_put_arg_fn put_arg;
+  void *arg_data;
+};
+
+// tiles of one paint_region call being decoded by the decode threads
+struct decode_batch {
+  GThreadPool *pool;
+  struct _openslide_grid *grid;
+  struct region *region;
+  struct _openslide_level *level;
+  read_tiles_callback_fn callback;
+  struct _openslide_stats *stats;  // of the read, or NULL
+
+  GMutex *mutex;
+  GCond *cond;
+  int pending;
+  GError *err;      // first failure
+  GPtrArray *held;  // cache entries decoded for the batch, until painted
+};
+
+struct decode_task {
+  struct decode_batch *batch;
+  int64_t tile_col;
+  int64_t tile_row;
+
+  // or a job from _openslide_grid_run_jobs()
+  _openslide_grid_job_fn job_fn;
+  void *job;
 };
 
+// decode threads shared by all grids
+static GThreadPool *decode_pool;
+static int decode_pool_threads;
+static GPrivate *decode_worker;  // non-NULL on the decode threads
+G_LOCK_DEFINE_STATIC(decode_pool);
+
 struct simple_grid {
   struct _openslide_grid base;
 
   int64_t tiles_across;
   int64_t tiles_down;
   _openslide_grid_simple_read_fn read_tile;
+
+  // coalesced reads, or NULL
+  _openslide_grid_simple_fetch_fn fetch_tiles;
+  void *fetch_data;
 };
 
 struct tilemap_grid {
   struct _openslide_grid base;
 
-  GHashTable *tiles;
+  // tiles are stored in a row-major array covering dense_cols x dense_rows
+  // cells from (dense_col0, dense_row0), or in a hash table if most of
+  // the array would be empty
+  struct tilemap_tile **dense;
+  int64_t dense_col0;
+  int64_t dense_row0;
+  int64_t dense_cols;
+  int64_t dense_rows;
+  int64_t tile_count;
+  GHashTable *tiles;  // NULL while dense
   _openslide_grid_tilemap_read_fn read_tile;
   GDestroyNotify destroy_tile;
+  bool snap;  // paint tiles at whole pixel positions
 
   // outer boundaries of grid
   double top;
@@ -130,8 +195,17 @@ struct range_grid {
   int bin_height;
 
   GPtrArray *tiles;
-  GHashTable *bins_init;  // address -> GPtrArray<tile>
-  GHashTable *bins_runtime;  // address -> [tile]
+
+  // dense bin index built by _openslide_grid_range_finish_adding_tiles():
+  // bin_cols x bin_rows bins in row-major order, starting at bin
+  // (bin_col0, bin_row0).  the tiles of bin i are bin_tiles[bin_starts[i]]
+  // up to bin_tiles[bin_starts[i + 1]].
+  int64_t bin_col0;
+  int64_t bin_row0;
+  int64_t bin_cols;
+  int64_t bin_rows;
+  int64_t *bin_starts;
+  struct range_tile **bin_tiles;
 
   _openslide_grid_range_read_fn read_tile;
   GDestroyNotify destroy_tile;
@@ -143,11 +217,6 @@ struct range_grid {
   double right;
 };
 
-struct range_bin_address {
-  int64_t col;
-  int64_t row;
-};
-
 struct range_tile {
   int64_t id;
   void *data;
@@ -156,6 +225,12 @@ struct range_tile {
   double y;
   double w;
   double h;
+
+  // bins covered
+  int64_t col;
+  int64_t row;
+  int64_t end_col;
+  int64_t end_row;
 };
 
 static void compute_region(struct _openslide_grid *grid,
@@ -174,6 +249,220 @@ static void compute_region(struct _openslide_grid *grid,
 
   region->offset_x = x - (region->start_tile_x * grid->tile_advance_x);
   region->offset_y = y - (region->start_tile_y * grid->tile_advance_y);
+
+  region->blit = false;
+  region->direct = false;
+}
+
+static cairo_user_data_key_t blit_key;
+static cairo_user_data_key_t direct_key;
+
+// state of a context marked by _openslide_grid_begin_blit()
+enum blit_mark {
+  BLIT_NONE,
+  BLIT_CLEARED,    // target is transparent
+  BLIT_UNCLEARED,  // target holds garbage
+  BLIT_TAKEN,      // a grid has painted it
+};
+
+// the first grid painting a marked context can copy its tiles; later ones
+// must composite with what it painted
+static enum blit_mark take_blit(cairo_t *cr) {
+  enum blit_mark mark = GPOINTER_TO_INT(cairo_get_user_data(cr, &blit_key));
+  if (mark != BLIT_CLEARED && mark != BLIT_UNCLEARED) {
+    return BLIT_NONE;
+  }
+  cairo_set_user_data(cr, &blit_key, GINT_TO_POINTER(BLIT_TAKEN), NULL);
+  return mark;
+}
+
+static void clear_target(cairo_t *cr) {
+  cairo_save(cr);
+  cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+  cairo_paint(cr);
+  cairo_restore(cr);
+}
+
+static void decode_task_run(gpointer data, gpointer user_data G_GNUC_UNUSED) {
+  struct decode_task *task = data;
+  struct decode_batch *batch = task->batch;
+  struct _openslide_grid *grid = batch->grid;
+  GPtrArray *held = NULL;  // jobs don't hold tiles
+  GError *tmp_err = NULL;
+
+  // nested paint_region calls, e.g. to render missing tiles from another
+  // level, must not wait for the pool they are running on
+  g_private_set(decode_worker, batch);
+  // tile decodes count toward the read they are for; jobs run within a
+  // decode already timed by the calling thread
+  _openslide_stats_set_current(batch->stats);
+
+  // skip the work if another tile already failed
+  g_mutex_lock(batch->mutex);
+  bool failed = batch->err != NULL;
+  g_mutex_unlock(batch->mutex);
+
+  if (task->job_fn) {
+    // the job reports its own errors
+    task->job_fn(task->job);
+  } else if (!failed) {
+    void *arg = NULL;
+    if (grid->get_arg) {
+      arg = grid->get_arg(grid->arg_data, &tmp_err);
+    }
+    if (!tmp_err) {
+      // nothing is drawn, but the tile is decoded into the cache
+      cairo_surface_t *surface =
+        cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 0, 0);
+      cairo_t *cr = cairo_create(surface);
+      cairo_surface_destroy(surface);
+      held = g_ptr_array_new();
+      _openslide_cache_hold_entries(held);
+      batch->callback(grid, batch->region, cr, batch->level,
+                      task->tile_col, task->tile_row, arg, &tmp_err);
+      _openslide_cache_hold_entries(NULL);
+      cairo_destroy(cr);
+      if (grid->put_arg) {
+        grid->put_arg(grid->arg_data, arg);
+      }
+    }
+  }
+
+  g_mutex_lock(batch->mutex);
+  for (guint i = 0; held && i < held->len; i++) {
+    g_ptr_array_add(batch->held, held->pdata[i]);
+  }
+  if (tmp_err) {
+    if (batch->err) {
+      g_error_free(tmp_err);
+    } else {
+      batch->err = tmp_err;
+    }
+  }
+  if (--batch->pending == 0) {
+    g_cond_signal(batch->cond);
+  }
+  g_mutex_unlock(batch->mutex);
+
+  _openslide_stats_set_current(NULL);
+  g_private_set(decode_worker, NULL);
+  if (held) {
+    g_ptr_array_free(held, true);
+  }
+  g_slice_free(struct decode_task, task);
+}
+
+// returns the decode threads, or NULL if they could not be started
+static GThreadPool *get_decode_pool(int threads) {
+  G_LOCK(decode_pool);
+  if (!decode_pool) {
+    GError *tmp_err = NULL;
+    if (!decode_worker) {
+      decode_worker = g_private_new(NULL);
+    }
+    decode_pool = g_thread_pool_new(decode_task_run, NULL,
+                                    threads, false, &tmp_err);
+    if (!decode_pool) {
+      // decode sequentially
+      g_debug("Couldn't start decode threads: %s", tmp_err->message);
+      g_clear_error(&tmp_err);
+    } else {
+      decode_pool_threads = threads;
+    }
+  } else if (threads > decode_pool_threads) {
+    // the pool grows to the largest count requested by any slide
+    g_thread_pool_set_max_threads(decode_pool, threads, NULL);
+    decode_pool_threads = threads;
+  }
+  GThreadPool *pool = decode_pool;
+  G_UNLOCK(decode_pool);
+  return pool;
+}
+
+// start decoding tiles on the decode threads, if enabled and worthwhile,
+// before they are painted in order by the caller
+// returns NULL if tiles should only be decoded by the caller
+static struct decode_batch *decode_batch_begin(struct _openslide_grid *grid,
+                                               struct region *region,
+                                               struct _openslide_level *level,
+                                               read_tiles_callback_fn callback,
+                                               int64_t tile_count,
+                                               double tile_bytes) {
+  int threads = g_atomic_int_get(&grid->osr->decode_threads);
+  if (!grid->parallel_decode || threads < 2 || tile_count < 2) {
+    return NULL;
+  }
+
+  // decoded tiles are held until they are painted, but shouldn't push
+  // most of the cache out
+  struct _openslide_cache *cache = _openslide_cache_binding_get(grid->osr->cache);
+  uint64_t capacity = _openslide_cache_get_capacity(cache);
+  _openslide_cache_unref(cache);
+  if (tile_bytes > capacity / DECODE_MAX_CACHE_FRACTION) {
+    return NULL;
+  }
+
+  GThreadPool *pool = get_decode_pool(threads);
+  if (!pool || g_private_get(decode_worker)) {
+    return NULL;
+  }
+
+  struct decode_batch *batch = g_slice_new0(struct decode_batch);
+  batch->pool = pool;
+  batch->grid = grid;
+  batch->region = region;
+  batch->level = level;
+  batch->callback = callback;
+  batch->stats = _openslide_stats_get_current();
+  batch->mutex = g_mutex_new();
+  batch->cond = g_cond_new();
+  batch->held = g_ptr_array_new();
+  return batch;
+}
+
+static void decode_batch_add(struct decode_batch *batch,
+                             int64_t tile_col, int64_t tile_row) {
+  struct decode_task *task = g_slice_new(struct decode_task);
+  task->batch = batch;
+  task->tile_col = tile_col;
+  task->tile_row = tile_row;
+
+  g_mutex_lock(batch->mutex);
+  batch->pending++;
+  g_mutex_unlock(batch->mutex);
+  g_thread_pool_push(batch->pool, task, NULL);
+}
+
+// wait for the decode threads
+static bool decode_batch_finish(struct decode_batch *batch, GError **err) {
+  // the decode threads count their own time
+  struct _openslide_stats_timer timer;
+  _openslide_stats_begin(&timer);
+  g_mutex_lock(batch->mutex);
+  while (batch->pending) {
+    g_cond_wait(batch->cond, batch->mutex);
+  }
+  g_mutex_unlock(batch->mutex);
+  _openslide_stats_end(&timer, -1);
+
+  if (batch->err) {
+    g_propagate_error(err, batch->err);
+    batch->err = NULL;
+    return false;
+  }
+  return true;
+}
+
+// release the decoded tiles and free the batch, once they are painted
+static void decode_batch_destroy(struct decode_batch *batch) {
+  if (!batch) {
+    return;
+  }
+  _openslide_cache_release_held_entries(batch->held);
+  g_ptr_array_free(batch->held, true);
+  g_cond_free(batch->cond);
+  g_mutex_free(batch->mutex);
+  g_slice_free(struct decode_batch, batch);
 }
 
 static bool read_tiles(cairo_t *cr,
@@ -202,6 +491,28 @@ static bool read_tiles(cairo_t *cr,
   //g_debug("start: %"PRId64" %"PRId64, region->start_tile_x, region->start_tile_y);
   //g_debug("end: %"PRId64" %"PRId64, region->end_tile_x, region->end_tile_y);
 
+  // decode in parallel, then paint below from the cache
+  int64_t tiles_across = region->end_tile_x - region->start_tile_x;
+  int64_t tiles_down = region->end_tile_y - region->start_tile_y;
+  struct decode_batch *batch =
+    decode_batch_begin(grid, region, level, callback,
+                       tiles_across * tiles_down,
+                       tiles_across * tiles_down * 4 *
+                       grid->tile_advance_x * grid->tile_advance_y);
+  if (batch) {
+    for (int64_t tile_y = region->start_tile_y;
+         tile_y < region->end_tile_y; tile_y++) {
+      for (int64_t tile_x = region->start_tile_x;
+           tile_x < region->end_tile_x; tile_x++) {
+        decode_batch_add(batch, tile_x, tile_y);
+      }
+    }
+    if (!decode_batch_finish(batch, err)) {
+      decode_batch_destroy(batch);
+      return false;
+    }
+  }
+
   cairo_matrix_t matrix;
   cairo_get_matrix(cr, &matrix);
 
@@ -222,6 +533,7 @@ static bool read_tiles(cairo_t *cr,
                               arg, err);
       cairo_set_matrix(cr, &matrix);
       if (!success) {
+        decode_batch_destroy(batch);
         return false;
       }
 
@@ -231,6 +543,7 @@ static bool read_tiles(cairo_t *cr,
     tile_y--;
   }
 
+  decode_batch_destroy(batch);
   return true;
 }
 
@@ -266,8 +579,33 @@ static void simple_get_bounds(struct _openslide_grid *_grid,
   bounds->h = grid->tiles_down * grid->base.tile_advance_y;
 }
 
+// report a tile read begun with _openslide_trace_begin()
+static void trace_tile(struct _openslide_trace *trace,
+                       struct _openslide_grid *grid,
+                       struct _openslide_level *level,
+                       int64_t tile_col, int64_t tile_row) {
+  openslide_t *osr = grid->osr;
+  openslide_trace_event_t event = {
+    .type = OPENSLIDE_TRACE_TILE_READ,
+    .level = -1,
+    .tile_col = tile_col,
+    .tile_row = tile_row,
+  };
+  // the decode threads paint into nothing
+  if (decode_worker && g_private_get(decode_worker)) {
+    event.type = OPENSLIDE_TRACE_TILE_DECODE;
+  }
+  for (int32_t i = 0; i < _openslide_get_level_count(osr); i++) {
+    if (_openslide_get_level(osr, i) == level) {
+      event.level = i;
+      break;
+    }
+  }
+  _openslide_trace_end(trace, &event);
+}
+
 static bool simple_read_tile(struct _openslide_grid *_grid,
-                             struct region *region G_GNUC_UNUSED,
+                             struct region *region,
                              cairo_t *cr,
                              struct _openslide_level *level,
                              int64_t tile_col, int64_t tile_row,
@@ -275,8 +613,34 @@ static bool simple_read_tile(struct _openslide_grid *_grid,
                              GError **err) {
   struct simple_grid *grid = (struct simple_grid *) _grid;
 
-  if (!grid->read_tile(grid->base.osr, cr, level,
-                       tile_col, tile_row, arg, err)) {
+  if (region->blit) {
+    // the cell is pixel aligned and still transparent, so replacing it
+    // is the same as saturating onto it, and pixman does it with memcpy
+    cairo_save(cr);
+    cairo_rectangle(cr, 0, 0,
+                    grid->base.tile_advance_x, grid->base.tile_advance_y);
+    cairo_clip(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+  }
+  if (region->direct) {
+    cairo_set_user_data(cr, &direct_key, &direct_key, NULL);
+  }
+  struct _openslide_trace trace;
+  bool tracing = _openslide_trace_begin(&trace);
+  bool success = grid->read_tile(grid->base.osr, cr, level,
+                                 tile_col, tile_row, arg, err);
+  if (tracing) {
+    trace_tile(&trace, _grid, level, tile_col, tile_row);
+  }
+  if (region->direct) {
+    cairo_set_user_data(cr, &direct_key, NULL, NULL);
+    // the tile may have been written without cairo
+    cairo_surface_mark_dirty(cairo_get_target(cr));
+  }
+  if (region->blit) {
+    cairo_restore(cr);
+  }
+  if (!success) {
     return false;
   }
   if (_openslide_debug(OPENSLIDE_DEBUG_TILES)) {
@@ -299,6 +663,7 @@ static bool simple_paint_region(struct _openslide_grid *_grid,
                                 GError **err) {
   struct simple_grid *grid = (struct simple_grid *) _grid;
   struct region region;
+  enum blit_mark blit = take_blit(cr);
 
   compute_region(_grid, x, y, w, h, &region);
 
@@ -307,6 +672,9 @@ static bool simple_paint_region(struct _openslide_grid *_grid,
       region.end_tile_y <= 0 ||
       region.start_tile_x > grid->tiles_across - 1 ||
       region.start_tile_y > grid->tiles_down - 1) {
+    if (blit == BLIT_UNCLEARED) {
+      clear_target(cr);
+    }
     return true;
   }
 
@@ -327,6 +695,68 @@ static bool simple_paint_region(struct _openslide_grid *_grid,
   region.end_tile_x = MIN(region.end_tile_x, grid->tiles_across);
   region.end_tile_y = MIN(region.end_tile_y, grid->tiles_down);
 
+  // tiles can only be copied if they land on whole pixels
+  cairo_surface_t *target = cairo_get_target(cr);
+  if (blit != BLIT_NONE) {
+    cairo_matrix_t m;
+    cairo_get_matrix(cr, &m);
+    region.blit = cairo_surface_get_type(target) == CAIRO_SURFACE_TYPE_IMAGE &&
+                  m.xx == 1 && m.yy == 1 && m.xy == 0 && m.yx == 0 &&
+                  m.x0 == floor(m.x0) && m.y0 == floor(m.y0) &&
+                  grid->base.tile_advance_x ==
+                  floor(grid->base.tile_advance_x) &&
+                  grid->base.tile_advance_y ==
+                  floor(grid->base.tile_advance_y) &&
+                  region.offset_x == floor(region.offset_x) &&
+                  region.offset_y == floor(region.offset_y);
+    region.direct = region.blit &&
+                    region.offset_x == 0 && region.offset_y == 0 &&
+                    region.w == grid->base.tile_advance_x &&
+                    region.h == grid->base.tile_advance_y;
+  }
+
+  if (blit == BLIT_UNCLEARED && !region.blit) {
+    // compositing needs a transparent target
+    clear_target(cr);
+  } else if (blit == BLIT_UNCLEARED) {
+    // copied tiles replace their whole cells, so only clear around them
+    cairo_save(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+    cairo_set_fill_rule(cr, CAIRO_FILL_RULE_EVEN_ODD);
+    cairo_rectangle(cr,
+                    -region.offset_x, -region.offset_y,
+                    (region.end_tile_x - region.start_tile_x) *
+                    grid->base.tile_advance_x,
+                    (region.end_tile_y - region.start_tile_y) *
+                    grid->base.tile_advance_y);
+    cairo_identity_matrix(cr);
+    cairo_rectangle(cr, 0, 0,
+                    cairo_image_surface_get_width(target),
+                    cairo_image_surface_get_height(target));
+    cairo_fill(cr);
+    cairo_restore(cr);
+  }
+
+  // fetch the data of all the tiles together
+  int64_t tiles_across = region.end_tile_x - region.start_tile_x;
+  int64_t tiles_down = region.end_tile_y - region.start_tile_y;
+  if (grid->fetch_tiles && tiles_across * tiles_down > 1) {
+    int64_t count = tiles_across * tiles_down;
+    int64_t *tiles = g_new(int64_t, 2 * count);
+    int64_t i = 0;
+    for (int64_t tile_y = region.start_tile_y;
+         tile_y < region.end_tile_y; tile_y++) {
+      for (int64_t tile_x = region.start_tile_x;
+           tile_x < region.end_tile_x; tile_x++) {
+        tiles[i++] = tile_x;
+        tiles[i++] = tile_y;
+      }
+    }
+    grid->fetch_tiles(_grid->osr, level, arg, grid->fetch_data,
+                      tiles, count);
+    g_free(tiles);
+  }
+
   // read
   bool result = read_tiles(cr, level, _grid, &region,
                            simple_read_tile, arg, err);
@@ -390,6 +820,113 @@ static void tilemap_tile_hash_destroy_value(gpointer data) {
   g_slice_free(struct tilemap_tile, tile);
 }
 
+static struct tilemap_tile *tilemap_lookup(struct tilemap_grid *grid,
+                                           int64_t col, int64_t row) {
+  if (grid->tiles) {
+    struct tilemap_tile coords = {
+      .col = col,
+      .row = row,
+    };
+    return g_hash_table_lookup(grid->tiles, &coords);
+  }
+  col -= grid->dense_col0;
+  row -= grid->dense_row0;
+  if (col < 0 || col >= grid->dense_cols ||
+      row < 0 || row >= grid->dense_rows) {
+    return NULL;
+  }
+  return grid->dense[row * grid->dense_cols + col];
+}
+
+static void tilemap_make_sparse(struct tilemap_grid *grid) {
+  grid->tiles = g_hash_table_new_full(tilemap_tile_hash_func,
+                                      tilemap_tile_hash_key_equal,
+                                      NULL,
+                                      tilemap_tile_hash_destroy_value);
+  for (int64_t i = 0; i < grid->dense_cols * grid->dense_rows; i++) {
+    if (grid->dense[i]) {
+      g_hash_table_insert(grid->tiles, grid->dense[i], grid->dense[i]);
+    }
+  }
+  g_free(grid->dense);
+  grid->dense = NULL;
+}
+
+// make room for (col, row) in the dense array, growing it by at least
+// its own size in each direction it grows, or give up on it
+static void tilemap_grow_dense(struct tilemap_grid *grid,
+                               int64_t col, int64_t row) {
+  int64_t col0 = grid->dense_col0;
+  int64_t row0 = grid->dense_row0;
+  int64_t col1 = col0 + grid->dense_cols;
+  int64_t row1 = row0 + grid->dense_rows;
+  if (!grid->dense_cols) {
+    col0 = col;
+    row0 = row;
+    col1 = col + 1;
+    row1 = row + 1;
+  }
+  if (col < col0) {
+    col0 = MIN(col, col0 - grid->dense_cols);
+  } else if (col >= col1) {
+    col1 = MAX(col + 1, col1 + grid->dense_cols);
+  }
+  if (row < row0) {
+    row0 = MIN(row, row0 - grid->dense_rows);
+  } else if (row >= row1) {
+    row1 = MAX(row + 1, row1 + grid->dense_rows);
+  }
+
+  int64_t cols = col1 - col0;
+  int64_t rows = row1 - row0;
+  if (cols > G_MAXINT64 / rows ||
+      cols * rows > TILEMAP_DENSE_MIN_CELLS +
+                    TILEMAP_DENSE_MAX_CELLS_PER_TILE * (grid->tile_count + 1)) {
+    tilemap_make_sparse(grid);
+    return;
+  }
+
+  struct tilemap_tile **dense = g_new0(struct tilemap_tile *, cols * rows);
+  for (int64_t r = 0; r < grid->dense_rows; r++) {
+    memcpy(dense + (grid->dense_row0 + r - row0) * cols +
+           (grid->dense_col0 - col0),
+           grid->dense + r * grid->dense_cols,
+           grid->dense_cols * sizeof(*dense));
+  }
+  g_free(grid->dense);
+  grid->dense = dense;
+  grid->dense_col0 = col0;
+  grid->dense_row0 = row0;
+  grid->dense_cols = cols;
+  grid->dense_rows = rows;
+}
+
+// replaces any tile already at the same position
+static void tilemap_insert(struct tilemap_grid *grid,
+                           struct tilemap_tile *tile) {
+  if (!grid->tiles &&
+      (tile->col < grid->dense_col0 ||
+       tile->col >= grid->dense_col0 + grid->dense_cols ||
+       tile->row < grid->dense_row0 ||
+       tile->row >= grid->dense_row0 + grid->dense_rows)) {
+    tilemap_grow_dense(grid, tile->col, tile->row);
+  }
+  if (grid->tiles) {
+    g_hash_table_replace(grid->tiles, tile, tile);
+    return;
+  }
+
+  struct tilemap_tile **slot =
+    &grid->dense[(tile->row - grid->dense_row0) * grid->dense_cols +
+                 (tile->col - grid->dense_col0)];
+  if (*slot) {
+    tilemap_tile_hash_destroy_value(*slot);
+  } else {
+    grid->tile_count++;
+  }
+  *slot = tile;
+}
+
 static void tilemap_get_bounds(struct _openslide_grid *_grid,
                                struct bounds *bounds) {
   struct tilemap_grid *grid = (struct tilemap_grid *) _grid;
@@ -411,11 +948,7 @@ static bool tilemap_read_tile(struct _openslide_grid *_grid,
                               GError **err) {
   struct tilemap_grid *grid = (struct tilemap_grid *) _grid;
 
-  struct tilemap_tile coords = {
-    .col = tile_col,
-    .row = tile_row,
-  };
-  struct tilemap_tile *tile = g_hash_table_lookup(grid->tiles, &coords);
+  struct tilemap_tile *tile = tilemap_lookup(grid, tile_col, tile_row);
   if (tile == NULL) {
     //g_debug("no tile at %"PRId64", %"PRId64, tile_col, tile_row);
     return true;
@@ -439,9 +972,26 @@ static bool tilemap_read_tile(struct _openslide_grid *_grid,
   cairo_matrix_t matrix;
   cairo_get_matrix(cr, &matrix);
   cairo_translate(cr, tile->offset_x, tile->offset_y);
+  if (grid->snap) {
+    // round the tile's device position, so cairo can copy it rather
+    // than resample it; moves the tile by at most half a pixel
+    cairo_matrix_t snapped;
+    cairo_get_matrix(cr, &snapped);
+    if (snapped.xx == 1 && snapped.yy == 1 &&
+        snapped.xy == 0 && snapped.yx == 0) {
+      snapped.x0 = round(snapped.x0);
+      snapped.y0 = round(snapped.y0);
+      cairo_set_matrix(cr, &snapped);
+    }
+  }
+  struct _openslide_trace trace;
+  bool tracing = _openslide_trace_begin(&trace);
   bool success = grid->read_tile(grid->base.osr, cr, level,
                                  tile->col, tile->row, tile->data,
                                  arg, err);
+  if (tracing) {
+    trace_tile(&trace, _grid, level, tile->col, tile->row);
+  }
   if (success && _openslide_debug(OPENSLIDE_DEBUG_TILES)) {
     char *coordinates = g_strdup_printf("%"PRId64", %"PRId64,
                                         tile_col, tile_row);
@@ -462,6 +1012,11 @@ static bool tilemap_paint_region(struct _openslide_grid *_grid,
   struct tilemap_grid *grid = (struct tilemap_grid *) _grid;
   struct region region;
 
+  // tiles may overlap, so always composite
+  if (take_blit(cr) == BLIT_UNCLEARED) {
+    clear_target(cr);
+  }
+
   compute_region(_grid, x, y, w, h, &region);
 
   //g_debug("coords: %g %g", x, y);
@@ -494,7 +1049,16 @@ static bool tilemap_paint_region(struct _openslide_grid *_grid,
 static void tilemap_destroy(struct _openslide_grid *_grid) {
   struct tilemap_grid *grid = (struct tilemap_grid *) _grid;
 
-  g_hash_table_destroy(grid->tiles);
+  if (grid->tiles) {
+    g_hash_table_destroy(grid->tiles);
+  }
+  for (int64_t i = 0; grid->dense && i < grid->dense_cols * grid->dense_rows;
+       i++) {
+    if (grid->dense[i]) {
+      tilemap_tile_hash_destroy_value(grid->dense[i]);
+    }
+  }
+  g_free(grid->dense);
   g_slice_free(struct tilemap_grid, grid);
 }
 
@@ -522,7 +1086,7 @@ void _openslide_grid_tilemap_add_tile(struct _openslide_grid *_grid,
   tile->h = h;
   tile->data = data;
 
-  g_hash_table_replace(grid->tiles, tile, tile);
+  tilemap_insert(grid, tile);
 
   grid->left = MIN(col * grid->base.tile_advance_x + offset_x,
                    grid->left);
@@ -559,6 +1123,26 @@ void _openslide_grid_tilemap_add_tile(struct _openslide_grid *_grid,
   //g_debug("%p: extra_left: %d, extra_right: %d, extra_top: %d, extra_bottom: %d", (void *) grid, grid->extra_tiles_left, grid->extra_tiles_right, grid->extra_tiles_top, grid->extra_tiles_bottom);
 }
 
+static gint snap_enabled;  // must use g_atomic_int!
+
+void _openslide_grid_set_snap_enabled(bool enable) {
+  g_atomic_int_set(&snap_enabled, enable);
+}
+
+bool _openslide_grid_get_snap_enabled(void) {
+  return g_atomic_int_get(&snap_enabled);
+}
+
+// paint tiles at the nearest whole pixel instead of their exact
+// fractional position, trading subpixel accuracy for speed
+void _openslide_grid_tilemap_set_snap(struct _openslide_grid *_grid,
+                                      bool snap) {
+  struct tilemap_grid *grid = (struct tilemap_grid *) _grid;
+  g_assert(grid->base.ops == &tilemap_grid_ops);
+
+  grid->snap = snap;
+}
+
 struct _openslide_grid *_openslide_grid_create_tilemap(openslide_t *osr,
                                                        double tile_advance_x,
                                                        double tile_advance_y,
@@ -577,42 +1161,14 @@ struct _openslide_grid *_openslide_grid_create_tilemap(openslide_t *osr,
   grid->left = INFINITY;
   grid->right = -INFINITY;
 
-  grid->tiles = g_hash_table_new_full(tilemap_tile_hash_func,
-                                      tilemap_tile_hash_key_equal,
-                                      NULL,
-                                      tilemap_tile_hash_destroy_value);
-
   return (struct _openslide_grid *) grid;
 }
 
 
 
-static guint range_bin_address_hash_func(gconstpointer key) {
-  const struct range_bin_address *addr = key;
-
-  // assume 32-bit hash
-  return (guint) ((34369 * (uint64_t) addr->row) + ((uint64_t) addr->col));
-}
-
-static gboolean range_bin_address_hash_key_equal(gconstpointer a,
-                                                 gconstpointer b) {
-  const struct range_bin_address *c_a = a;
-  const struct range_bin_address *c_b = b;
-
-  return (c_a->col == c_b->col) && (c_a->row == c_b->row);
-}
-
-static void range_bin_address_free(void *data) {
-  g_slice_free(struct range_bin_address, data);
-}
-
-static void range_ptr_array_free(void *data) {
-  g_ptr_array_free(data, true);
-}
-
 static int range_compare_tiles(gconstpointer a, gconstpointer b) {
-  const struct range_tile *c_a = a;
-  const struct range_tile *c_b = b;
+  const struct range_tile *c_a = *(struct range_tile * const *) a;
+  const struct range_tile *c_b = *(struct range_tile * const *) b;
 
   if (c_a->y < c_b->y) {
     return 1;
@@ -627,6 +1183,29 @@ static int range_compare_tiles(gconstpointer a, gconstpointer b) {
   }
 }
 
+// read_tiles_callback_fn for the decode threads; tile_col is the tile id
+static bool range_decode_tile(struct _openslide_grid *_grid,
+                              struct region *region G_GNUC_UNUSED,
+                              cairo_t *cr,
+                              struct _openslide_level *level,
+                              int64_t tile_col,
+                              int64_t tile_row G_GNUC_UNUSED,
+                              void *arg,
+                              GError **err) {
+  struct range_grid *grid = (struct range_grid *) _grid;
+  struct range_tile *tile = grid->tiles->pdata[tile_col];
+
+  struct _openslide_trace trace;
+  bool tracing = _openslide_trace_begin(&trace);
+  bool success = grid->read_tile(grid->base.osr, cr, level,
+                                 tile->id, tile->data,
+                                 arg, err);
+  if (tracing) {
+    trace_tile(&trace, _grid, level, tile->id, -1);
+  }
+  return success;
+}
+
 static void range_get_bounds(struct _openslide_grid *_grid,
                              struct bounds *bounds) {
   struct range_grid *grid = (struct range_grid *) _grid;
@@ -647,46 +1226,59 @@ static bool range_paint_region(struct _openslide_grid *_grid,
                                int32_t w, int32_t h,
                                GError **err) {
   struct range_grid *grid = (struct range_grid *) _grid;
-  GList *tiles = NULL;
+  GPtrArray *tiles = g_ptr_array_new();
+  struct decode_batch *batch = NULL;
   bool result = false;
 
   // ensure _openslide_grid_range_finish_adding_tiles() was called
-  g_assert(grid->bins_runtime);
+  g_assert(grid->bin_starts);
+
+  // tiles may overlap, so always composite
+  if (take_blit(cr) == BLIT_UNCLEARED) {
+    clear_target(cr);
+  }
 
   // save
   cairo_matrix_t matrix;
   cairo_get_matrix(cr, &matrix);
 
   // accumulate relevant tiles
-  struct range_bin_address addr;
-  for (addr.row = y / grid->bin_height;
-       addr.row < (int64_t) (y + h + grid->bin_height - 1) / grid->bin_height;
-       addr.row++) {
-    for (addr.col = x / grid->bin_width;
-         addr.col < (int64_t) (x + w + grid->bin_width - 1) / grid->bin_width;
-         addr.col++) {
-      struct range_tile **cur = g_hash_table_lookup(grid->bins_runtime,
-                                                    &addr);
-      if (cur) {
-        for (; *cur; cur++) {
-          struct range_tile *tile = *cur;
-          // skip tile if it's outside the requested region
-          if (tile->x + tile->w <= x ||
-              tile->y + tile->h <= y ||
-              tile->x >= x + w ||
-              tile->y >= y + h) {
-            //g_debug("skip x %g w %g y %g h %g, region x %g w %d y %g h %d", tile->x, tile->w, tile->y, tile->h, x, w, y, h);
-            continue;
-          }
-          tiles = g_list_prepend(tiles, tile);
+  // a tile is taken from the first bin it shares with the region, so
+  // each one is found once
+  int64_t start_col = MAX((int64_t) (x / grid->bin_width), grid->bin_col0);
+  int64_t start_row = MAX((int64_t) (y / grid->bin_height), grid->bin_row0);
+  int64_t end_col = MIN((int64_t) (x + w + grid->bin_width - 1) / grid->bin_width,
+                        grid->bin_col0 + grid->bin_cols);
+  int64_t end_row = MIN((int64_t) (y + h + grid->bin_height - 1) / grid->bin_height,
+                        grid->bin_row0 + grid->bin_rows);
+  for (int64_t row = start_row; row < end_row; row++) {
+    for (int64_t col = start_col; col < end_col; col++) {
+      int64_t bin = (row - grid->bin_row0) * grid->bin_cols +
+                    (col - grid->bin_col0);
+      for (int64_t i = grid->bin_starts[bin];
+           i < grid->bin_starts[bin + 1]; i++) {
+        struct range_tile *tile = grid->bin_tiles[i];
+        if (MAX(tile->col, start_col) != col ||
+            MAX(tile->row, start_row) != row) {
+          // found in another bin
+          continue;
+        }
+        // skip tile if it's outside the requested region
+        if (tile->x + tile->w <= x ||
+            tile->y + tile->h <= y ||
+            tile->x >= x + w ||
+            tile->y >= y + h) {
+          //g_debug("skip x %g w %g y %g h %g, region x %g w %d y %g h %d", tile->x, tile->w, tile->y, tile->h, x, w, y, h);
+          continue;
         }
+        g_ptr_array_add(tiles, tile);
       }
       if (_openslide_debug(OPENSLIDE_DEBUG_TILES)) {
         char *coordinates = g_strdup_printf("%"PRId64", %"PRId64,
-                                            addr.col, addr.row);
+                                            col, row);
         cairo_translate(cr,
-                        addr.col * grid->bin_width - x,
-                        addr.row * grid->bin_height - y);
+                        col * grid->bin_width - x,
+                        row * grid->bin_height - y);
         label_tile(cr, COLOR_BIN,
                    grid->bin_width, grid->bin_height,
                    coordinates);
@@ -695,25 +1287,43 @@ static bool range_paint_region(struct _openslide_grid *_grid,
       }
     }
   }
-  tiles = g_list_sort(tiles, range_compare_tiles);
+  g_ptr_array_sort(tiles, range_compare_tiles);
+
+  // decode in parallel, then draw below from the cache
+  double tile_bytes = 0;
+  for (uint32_t i = 0; i < tiles->len; i++) {
+    struct range_tile *tile = tiles->pdata[i];
+    tile_bytes += tile->w * tile->h * 4;
+  }
+  batch =
+    decode_batch_begin(_grid, NULL, level, range_decode_tile,
+                       tiles->len, tile_bytes);
+  if (batch) {
+    for (uint32_t i = 0; i < tiles->len; i++) {
+      struct range_tile *tile = tiles->pdata[i];
+      decode_batch_add(batch, tile->id, 0);
+    }
+    if (!decode_batch_finish(batch, err)) {
+      goto DONE;
+    }
+  }
 
   // draw tiles
-  struct range_tile *prev_tile = NULL;
-  for (GList *cur = tiles; cur; cur = cur->next) {
+  for (uint32_t i = 0; i < tiles->len; i++) {
     // get tile struct
-    struct range_tile *tile = cur->data;
-    if (tile == prev_tile) {
-      //g_debug("skipping repeated tile");
-      continue;
-    }
-    prev_tile = tile;
+    struct range_tile *tile = tiles->pdata[i];
 
     // draw
     //g_debug("tile x %g y %g", tile->x, tile->y);
     cairo_translate(cr, tile->x - x, tile->y - y);
+    struct _openslide_trace trace;
+    bool tracing = _openslide_trace_begin(&trace);
     bool success = grid->read_tile(grid->base.osr, cr, level,
                                    tile->id, tile->data,
                                    arg, err);
+    if (tracing) {
+      trace_tile(&trace, _grid, level, tile->id, -1);
+    }
     if (success && _openslide_debug(OPENSLIDE_DEBUG_TILES)) {
       char *coordinates = g_strdup_printf("%"PRId64, tile->id);
       label_tile(cr, COLOR_TILE, tile->w, tile->h, coordinates);
@@ -729,19 +1339,16 @@ static bool range_paint_region(struct _openslide_grid *_grid,
   result = true;
 
 DONE:
-  g_list_free(tiles);
+  decode_batch_destroy(batch);
+  g_ptr_array_free(tiles, true);
   return result;
 }
 
 static void range_destroy(struct _openslide_grid *_grid) {
   struct range_grid *grid = (struct range_grid *) _grid;
 
-  if (grid->bins_init) {
-    g_hash_table_destroy(grid->bins_init);
-  }
-  if (grid->bins_runtime) {
-    g_hash_table_destroy(grid->bins_runtime);
-  }
+  g_free(grid->bin_starts);
+  g_free(grid->bin_tiles);
   for (uint64_t cur = 0; cur < grid->tiles->len; cur++) {
     struct range_tile *tile = grid->tiles->pdata[cur];
     if (grid->destroy_tile && tile->data) {
@@ -765,7 +1372,7 @@ void _openslide_grid_range_add_tile(struct _openslide_grid *_grid,
                                     void *data) {
   struct range_grid *grid = (struct range_grid *) _grid;
   g_assert(grid->base.ops == &range_grid_ops);
-  g_assert(grid->bins_init);
+  g_assert(!grid->bin_starts);
 
   struct range_tile *tile = g_slice_new0(struct range_tile);
   tile->id = grid->tiles->len;
@@ -774,59 +1381,71 @@ void _openslide_grid_range_add_tile(struct _openslide_grid *_grid,
   tile->y = y;
   tile->w = w;
   tile->h = h;
+  tile->col = x / grid->bin_width;
+  tile->row = y / grid->bin_height;
+  tile->end_col = (int64_t) (x + w + grid->bin_width - 1) / grid->bin_width;
+  tile->end_row = (int64_t) (y + h + grid->bin_height - 1) / grid->bin_height;
   g_ptr_array_add(grid->tiles, tile);
 
-  struct range_bin_address addr;
-  for (addr.row = y / grid->bin_height;
-       addr.row < (int64_t) (y + h + grid->bin_height - 1) / grid->bin_height;
-       addr.row++) {
-    for (addr.col = x / grid->bin_width;
-         addr.col < (int64_t) (x + w + grid->bin_width - 1) / grid->bin_width;
-         addr.col++) {
-      GPtrArray *bin = g_hash_table_lookup(grid->bins_init, &addr);
-      if (!bin) {
-        bin = g_ptr_array_new();
-        struct range_bin_address *addr2 =
-          g_slice_new(struct range_bin_address);
-        addr2->col = addr.col;
-        addr2->row = addr.row;
-        g_hash_table_insert(grid->bins_init, addr2, bin);
-      }
-      g_ptr_array_add(bin, tile);
-    }
-  }
-
   grid->left = MIN(x, grid->left);
   grid->top = MIN(y, grid->top);
   grid->right = MAX(x + w, grid->right);
   grid->bottom = MAX(y + h, grid->bottom);
 }
 
-static void range_postprocess_bin(void *key, void *value, void *data) {
-  struct range_grid *grid = data;
-  GPtrArray *tiles = value;
-
-  struct range_tile **tile_array = g_new(struct range_tile *, tiles->len + 1);
-  memcpy(tile_array, tiles->pdata, tiles->len * sizeof(struct range_tile *));
-  tile_array[tiles->len] = NULL;
-  g_ptr_array_free(tiles, true);
-
-  g_hash_table_replace(grid->bins_runtime, key, tile_array);
-}
-
 void _openslide_grid_range_finish_adding_tiles(struct _openslide_grid *_grid) {
   struct range_grid *grid = (struct range_grid *) _grid;
   g_assert(grid->base.ops == &range_grid_ops);
-  g_assert(grid->bins_init);
-
-  grid->bins_runtime = g_hash_table_new_full(range_bin_address_hash_func,
-                                             range_bin_address_hash_key_equal,
-                                             range_bin_address_free,
-                                             g_free);
-  g_hash_table_foreach(grid->bins_init, range_postprocess_bin, grid);
-  g_hash_table_steal_all(grid->bins_init);
-  g_hash_table_destroy(grid->bins_init);
-  grid->bins_init = NULL;
+  g_assert(!grid->bin_starts);
+
+  // extent of the bins
+  int64_t end_col = 0;
+  int64_t end_row = 0;
+  for (uint32_t i = 0; i < grid->tiles->len; i++) {
+    struct range_tile *tile = grid->tiles->pdata[i];
+    if (i == 0) {
+      grid->bin_col0 = tile->col;
+      grid->bin_row0 = tile->row;
+      end_col = tile->end_col;
+      end_row = tile->end_row;
+    }
+    grid->bin_col0 = MIN(grid->bin_col0, tile->col);
+    grid->bin_row0 = MIN(grid->bin_row0, tile->row);
+    end_col = MAX(end_col, tile->end_col);
+    end_row = MAX(end_row, tile->end_row);
+  }
+  grid->bin_cols = MAX(end_col - grid->bin_col0, 0);
+  grid->bin_rows = MAX(end_row - grid->bin_row0, 0);
+  int64_t bin_count = grid->bin_cols * grid->bin_rows;
+
+  // count the tiles of each bin, then place them
+  int64_t *starts = g_new0(int64_t, bin_count + 1);
+  for (uint32_t i = 0; i < grid->tiles->len; i++) {
+    struct range_tile *tile = grid->tiles->pdata[i];
+    for (int64_t row = tile->row; row < tile->end_row; row++) {
+      for (int64_t col = tile->col; col < tile->end_col; col++) {
+        starts[(row - grid->bin_row0) * grid->bin_cols +
+               (col - grid->bin_col0) + 1]++;
+      }
+    }
+  }
+  for (int64_t bin = 0; bin < bin_count; bin++) {
+    starts[bin + 1] += starts[bin];
+  }
+  grid->bin_tiles = g_new(struct range_tile *, starts[bin_count]);
+  int64_t *next = g_memdup(starts, bin_count * sizeof(*starts));
+  for (uint32_t i = 0; i < grid->tiles->len; i++) {
+    struct range_tile *tile = grid->tiles->pdata[i];
+    for (int64_t row = tile->row; row < tile->end_row; row++) {
+      for (int64_t col = tile->col; col < tile->end_col; col++) {
+        int64_t bin = (row - grid->bin_row0) * grid->bin_cols +
+                      (col - grid->bin_col0);
+        grid->bin_tiles[next[bin]++] = tile;
+      }
+    }
+  }
+  g_free(next);
+  grid->bin_starts = starts;
 }
 
 struct _openslide_grid *_openslide_grid_create_range(openslide_t *osr,
@@ -842,10 +1461,6 @@ struct _openslide_grid *_openslide_grid_create_range(openslide_t *osr,
   grid->bin_width = typical_tile_width * RANGE_BIN_SIZE_MULTIPLIER;
   grid->bin_height = typical_tile_height * RANGE_BIN_SIZE_MULTIPLIER;
   grid->tiles = g_ptr_array_new();
-  grid->bins_init = g_hash_table_new_full(range_bin_address_hash_func,
-                                          range_bin_address_hash_key_equal,
-                                          range_bin_address_free,
-                                          range_ptr_array_free);
   grid->read_tile = read_tile;
   grid->destroy_tile = destroy_tile;
 
@@ -879,6 +1494,114 @@ void _openslide_grid_get_bounds(struct _openslide_grid *grid,
   }
 }
 
+void _openslide_grid_run_jobs(openslide_t *osr,
+                              _openslide_grid_job_fn fn,
+                              void **jobs, int32_t count) {
+  int32_t threads = _openslide_grid_get_tile_decode_threads(osr);
+  GThreadPool *pool = NULL;
+  if (threads > 1 && count > 1) {
+    pool = get_decode_pool(threads);
+  }
+  if (!pool) {
+    for (int32_t i = 0; i < count; i++) {
+      fn(jobs[i]);
+    }
+    return;
+  }
+
+  // the calling thread runs the first job itself
+  struct decode_batch batch = {
+    .pool = pool,
+    .mutex = g_mutex_new(),
+    .cond = g_cond_new(),
+    .pending = count - 1,
+  };
+  for (int32_t i = 1; i < count; i++) {
+    struct decode_task *task = g_slice_new0(struct decode_task);
+    task->batch = &batch;
+    task->job_fn = fn;
+    task->job = jobs[i];
+    g_thread_pool_push(pool, task, NULL);
+  }
+  fn(jobs[0]);
+
+  g_mutex_lock(batch.mutex);
+  while (batch.pending) {
+    g_cond_wait(batch.cond, batch.mutex);
+  }
+  g_mutex_unlock(batch.mutex);
+  g_cond_free(batch.cond);
+  g_mutex_free(batch.mutex);
+}
+
+// the decode threads already decode one tile each, so only foreground
+// reads spread a tile over the configured decode threads
+int32_t _openslide_grid_get_tile_decode_threads(openslide_t *osr) {
+  if (decode_worker && g_private_get(decode_worker)) {
+    return 1;
+  }
+  openslide_t *owner = osr->owner ? osr->owner : osr;
+  return MAX(g_atomic_int_get(&owner->decode_threads), 1);
+}
+
+void _openslide_grid_enable_parallel_decode(struct _openslide_grid *grid,
+                                            _openslide_grid_get_arg_fn get_arg,
+                                            _openslide_grid_put_arg_fn put_arg,
+                                            void *arg_data) {
+  grid->parallel_decode = true;
+  grid->get_arg = get_arg;
+  grid->put_arg = put_arg;
+  grid->arg_data = arg_data;
+}
+
+void _openslide_grid_simple_enable_coalesced_reads(struct _openslide_grid *_grid,
+                                                   _openslide_grid_simple_fetch_fn fetch_tiles,
+                                                   void *fetch_data) {
+  struct simple_grid *grid = (struct simple_grid *) _grid;
+  g_assert(_grid->ops == &simple_grid_ops);
+
+  grid->fetch_tiles = fetch_tiles;
+  grid->fetch_data = fetch_data;
+}
+
+void _openslide_grid_begin_blit(cairo_t *cr, bool cleared) {
+  enum blit_mark mark = cleared ? BLIT_CLEARED : BLIT_UNCLEARED;
+  cairo_set_user_data(cr, &blit_key, GINT_TO_POINTER(mark), NULL);
+}
+
+void _openslide_grid_end_blit(cairo_t *cr) {
+  // nothing was painted
+  if (take_blit(cr) == BLIT_UNCLEARED) {
+    clear_target(cr);
+  }
+  cairo_set_user_data(cr, &blit_key, NULL, NULL);
+}
+
+uint32_t *_openslide_grid_get_tile_dest(cairo_t *cr,
+                                        int64_t tile_w, int64_t tile_h) {
+  if (!cairo_get_user_data(cr, &direct_key)) {
+    return NULL;
+  }
+
+  // the target must be exactly the tile, at the origin
+  cairo_matrix_t m;
+  cairo_get_matrix(cr, &m);
+  if (m.xx != 1 || m.yy != 1 || m.xy != 0 || m.yx != 0 ||
+      m.x0 != 0 || m.y0 != 0) {
+    return NULL;
+  }
+  cairo_surface_t *target = cairo_get_target(cr);
+  if (cairo_surface_get_type(target) != CAIRO_SURFACE_TYPE_IMAGE ||
+      cairo_image_surface_get_format(target) != CAIRO_FORMAT_ARGB32 ||
+      cairo_image_surface_get_width(target) != tile_w ||
+      cairo_image_surface_get_height(target) != tile_h ||
+      cairo_image_surface_get_stride(target) != tile_w * 4) {
+    return NULL;
+  }
+  cairo_surface_flush(target);
+  return (uint32_t *) cairo_image_surface_get_data(target);
+}
+
 bool _openslide_grid_paint_region(struct _openslide_grid *grid,
                                   cairo_t *cr,
                                   void *arg,
@@ -50,8 +50,9 @@ bool _openslide_hash_file_part(struct _openslide_hash *hash,
 // lockout
 void _openslide_hash_disable(struct _openslide_hash *hash);
 
-// accessor
+// accessors
 const char *_openslide_hash_get_string(struct _openslide_hash *hash);
+char *_openslide_hash_peek_string(struct _openslide_hash *hash);
 
 // destructor
 void _openslide_hash_destroy(struct _openslide_hash *hash);
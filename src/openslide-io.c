@@ -0,0 +1,444 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2007-2014 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "openslide-private.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#ifdef HAVE_POSIX_FADVISE
+#include <fcntl.h>
+#endif
+
+// ranges are cached in blocks of this size
+#define BLOCK_SIZE (64 * 1024)
+// a read missing from the cache also fetches up to this many following
+// blocks, stopping at the first cached one
+#define READAHEAD_BLOCKS 7
+// ranges at most this far apart are read together, along with the gap
+#define MAX_COALESCE_GAP (64 * 1024)
+#define MAX_COALESCED_READ (16 * 1024 * 1024)
+// in scan mode, the OS is asked to read this far past each read
+#define SCAN_READAHEAD (4 * 1024 * 1024)
+
+struct block {
+  const char *filename;  // interned
+  int64_t index;
+  uint8_t *data;         // NULL while being fetched
+  int32_t len;           // less than BLOCK_SIZE at the end of the file
+  GList *link;           // in the LRU queue, once fetched
+  int pins;              // reads that haven't copied it yet
+};
+
+// blocks are spread over shards by hash, so reads of different blocks
+// rarely wait for one another.  Each shard holds an equal part of the
+// capacity, and its lock is never held along with another's.
+#define BLOCK_SHARDS 16
+
+struct block_shard {
+  GMutex *mutex;
+  GCond *cond;           // a fetch has finished
+  GHashTable *blocks;    // struct block -> itself
+  GQueue *lru;           // fetched blocks, most recently used first
+  int64_t capacity;
+  int64_t size;
+};
+
+struct io_state {
+  struct block_shard shards[BLOCK_SHARDS];
+
+  GMutex *mutex;         // protects the settings below
+  int64_t capacity;
+  openslide_range_reader_t reader;
+  void *reader_data;
+};
+
+static guint block_hash(gconstpointer key) {
+  const struct block *b = key;
+  return g_direct_hash(b->filename) ^ _openslide_int64_hash(&b->index);
+}
+
+static gboolean block_equal(gconstpointer a, gconstpointer b) {
+  const struct block *ba = a;
+  const struct block *bb = b;
+  return ba->filename == bb->filename && ba->index == bb->index;
+}
+
+static gpointer io_init(gpointer data G_GNUC_UNUSED) {
+  struct io_state *io = g_slice_new0(struct io_state);
+  for (int i = 0; i < BLOCK_SHARDS; i++) {
+    struct block_shard *shard = &io->shards[i];
+    shard->mutex = g_mutex_new();
+    shard->cond = g_cond_new();
+    shard->blocks = g_hash_table_new(block_hash, block_equal);
+    shard->lru = g_queue_new();
+  }
+  io->mutex = g_mutex_new();
+  return io;
+}
+
+static struct io_state *get_io(void) {
+  static GOnce once = G_ONCE_INIT;
+  return g_once(&once, io_init, NULL);
+}
+
+static struct block_shard *get_shard(struct io_state *io,
+                                     const struct block *key) {
+  // mix the bits, since the hash tables use the low ones too
+  guint hash = block_hash(key) * 2654435761u;
+  return &io->shards[(hash >> 16) % BLOCK_SHARDS];
+}
+
+// caller holds the shard mutex
+static void remove_block(struct block_shard *shard, struct block *b) {
+  g_hash_table_remove(shard->blocks, b);
+  if (b->link) {
+    g_queue_delete_link(shard->lru, b->link);
+    shard->size -= BLOCK_SIZE;
+  }
+  g_free(b->data);
+  g_slice_free(struct block, b);
+}
+
+// caller holds the shard mutex
+static void evict(struct block_shard *shard) {
+  GList *link = shard->lru->tail;
+  while (shard->size > shard->capacity && link) {
+    GList *prev = link->prev;
+    struct block *b = link->data;
+    if (!b->pins) {
+      remove_block(shard, b);
+    }
+    link = prev;
+  }
+}
+
+// read without the cache; returns the number of bytes read, or -1
+static int64_t fetch(const char *filename, int64_t offset,
+                     void *buf, int64_t len,
+                     openslide_range_reader_t reader, void *reader_data,
+                     GError **err) {
+  if (reader) {
+    struct _openslide_stats_timer timer;
+    _openslide_stats_begin(&timer);
+    int64_t total = 0;
+    while (total < len) {
+      int64_t count = reader(filename, offset + total,
+                             (uint8_t *) buf + total, len - total,
+                             reader_data);
+      if (count < 0) {
+        g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                    "Couldn't read %s at %"PRId64, filename, offset + total);
+        total = -1;
+        break;
+      } else if (count == 0) {
+        break;
+      }
+      total += count;
+    }
+    _openslide_stats_end(&timer, OPENSLIDE_STAT_READ_TIME);
+    _openslide_stats_bytes_read(MAX(total, 0));
+    return total;
+  }
+
+  // don't leave the file handle open between calls
+  // also ensures FD_CLOEXEC is set
+  FILE *f = _openslide_fopen(filename, "rb", err);
+  if (f == NULL) {
+    return -1;
+  }
+  if (fseeko(f, offset, SEEK_SET)) {
+    _openslide_io_error(err, "Couldn't seek %s", filename);
+    fclose(f);
+    return -1;
+  }
+#ifdef HAVE_POSIX_FADVISE
+  if (_openslide_stats_get_scan()) {
+    // a scan reads the file in order, so have the OS read ahead while we
+    // decode.  Only hints; ignore errors.
+    int fd = fileno(f);
+    posix_fadvise(fd, offset, len, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd, offset + len, SCAN_READAHEAD, POSIX_FADV_WILLNEED);
+  }
+#endif
+  int64_t count = _openslide_fread(f, buf, len);
+  if (count < len && ferror(f)) {
+    _openslide_io_error(err, "Couldn't read %s", filename);
+    count = -1;
+  }
+  fclose(f);
+  return count;
+}
+
+// fetch the missing blocks from first, with readahead past last, in one
+// read, without holding any shard mutex.
+// the fetched blocks up to last are pinned until the caller unpins them.
+// returns the index after the last pinned block, or -1 on error.
+static int64_t fetch_blocks(struct io_state *io,
+                            const char *filename,
+                            int64_t first, int64_t last,
+                            int64_t capacity,
+                            openslide_range_reader_t reader,
+                            void *reader_data,
+                            GError **err) {
+  // don't read ahead further than the cache can hold
+  int64_t readahead = MIN(READAHEAD_BLOCKS,
+                          MAX(capacity / BLOCK_SIZE - (last - first + 1),
+                              0));
+
+  // claim the blocks, so concurrent reads wait for this fetch
+  int64_t end = first;
+  while (end <= last + readahead) {
+    struct block key = {
+      .filename = filename,
+      .index = end,
+    };
+    struct block_shard *shard = get_shard(io, &key);
+    g_mutex_lock(shard->mutex);
+    bool claimed = false;
+    if (!g_hash_table_lookup(shard->blocks, &key)) {
+      struct block *b = g_slice_new0(struct block);
+      b->filename = filename;
+      b->index = end;
+      g_hash_table_insert(shard->blocks, b, b);
+      claimed = true;
+    }
+    g_mutex_unlock(shard->mutex);
+    if (!claimed) {
+      break;
+    }
+    end++;
+  }
+  int64_t count = end - first;
+  if (!count) {
+    // another thread claimed the first block since our lookup
+    return first;
+  }
+
+  uint8_t *buf = g_malloc(count * BLOCK_SIZE);
+  int64_t len = fetch(filename, first * BLOCK_SIZE, buf, count * BLOCK_SIZE,
+                      reader, reader_data, err);
+
+  for (int64_t i = 0; i < count; i++) {
+    struct block key = {
+      .filename = filename,
+      .index = first + i,
+    };
+    struct block_shard *shard = get_shard(io, &key);
+    g_mutex_lock(shard->mutex);
+    struct block *b = g_hash_table_lookup(shard->blocks, &key);
+    g_assert(b && !b->data);
+    // keep an empty first block to record the end of the file
+    if (len < 0 || (i > 0 && i * BLOCK_SIZE >= len)) {
+      remove_block(shard, b);
+    } else {
+      b->len = CLAMP(len - i * BLOCK_SIZE, 0, BLOCK_SIZE);
+      b->data = g_memdup(buf + i * BLOCK_SIZE, MAX(b->len, 1));
+      if (first + i <= last) {
+        b->pins++;
+      }
+      g_queue_push_head(shard->lru, b);
+      b->link = g_queue_peek_head_link(shard->lru);
+      shard->size += BLOCK_SIZE;
+      evict(shard);
+    }
+    g_cond_broadcast(shard->cond);
+    g_mutex_unlock(shard->mutex);
+  }
+  g_free(buf);
+  return len >= 0 ? MIN(end, last + 1) : -1;
+}
+
+int64_t _openslide_read_range(const char *filename,
+                              int64_t offset,
+                              void *buf, int64_t len,
+                              GError **err) {
+  struct io_state *io = get_io();
+
+  g_mutex_lock(io->mutex);
+  int64_t capacity = io->capacity;
+  openslide_range_reader_t reader = io->reader;
+  void *reader_data = io->reader_data;
+  g_mutex_unlock(io->mutex);
+
+  // scans bypass the block cache, leaving it to interactive reads
+  if (!capacity || _openslide_stats_get_scan()) {
+    return fetch(filename, offset, buf, len, reader, reader_data, err);
+  }
+
+  const char *name = g_intern_string(filename);
+  int64_t done = 0;
+  // blocks before this were pinned by a fetch for this read.  blocks are
+  // copied in order, and past the end of the file they aren't kept, so
+  // each one is unpinned when copied.
+  int64_t pinned_end = 0;
+  while (done < len) {
+    int64_t pos = offset + done;
+    struct block key = {
+      .filename = name,
+      .index = pos / BLOCK_SIZE,
+    };
+    struct block_shard *shard = get_shard(io, &key);
+    g_mutex_lock(shard->mutex);
+    struct block *b = g_hash_table_lookup(shard->blocks, &key);
+    if (!b) {
+      g_mutex_unlock(shard->mutex);
+      pinned_end = fetch_blocks(io, name, key.index,
+                                (offset + len - 1) / BLOCK_SIZE,
+                                capacity, reader, reader_data, err);
+      if (pinned_end < 0) {
+        done = -1;
+        break;
+      }
+      continue;
+    }
+    if (!b->data) {
+      // another thread is fetching it
+      g_cond_wait(shard->cond, shard->mutex);
+      g_mutex_unlock(shard->mutex);
+      continue;
+    }
+
+    // pinned, the block can be copied without the mutex
+    if (b->index >= pinned_end) {
+      b->pins++;
+    }
+    g_queue_unlink(shard->lru, b->link);
+    g_queue_push_head_link(shard->lru, b->link);
+    g_mutex_unlock(shard->mutex);
+
+    int64_t start = pos - b->index * BLOCK_SIZE;
+    int64_t count = MIN(b->len - start, len - done);
+    if (count > 0) {
+      memcpy((uint8_t *) buf + done, b->data + start, count);
+      done += count;
+    }
+    bool eof = b->len < BLOCK_SIZE;
+
+    g_mutex_lock(shard->mutex);
+    g_assert(b->pins > 0);
+    b->pins--;
+    // pinned blocks may have kept the shard over capacity
+    evict(shard);
+    g_mutex_unlock(shard->mutex);
+    if (eof) {
+      break;
+    }
+  }
+  return done;
+}
+
+static int range_request_compare(const void *a, const void *b) {
+  const struct _openslide_range_request *ra =
+    *(const struct _openslide_range_request * const *) a;
+  const struct _openslide_range_request *rb =
+    *(const struct _openslide_range_request * const *) b;
+  return (ra->offset > rb->offset) - (ra->offset < rb->offset);
+}
+
+void _openslide_read_ranges(const char *filename,
+                            struct _openslide_range_request *requests,
+                            int64_t count) {
+  // in file order
+  struct _openslide_range_request **sorted =
+    g_new(struct _openslide_range_request *, count);
+  for (int64_t i = 0; i < count; i++) {
+    sorted[i] = &requests[i];
+  }
+  qsort(sorted, count, sizeof(*sorted), range_request_compare);
+
+  int64_t i = 0;
+  while (i < count) {
+    // extend the run while the next range starts close to its end
+    int64_t start = sorted[i]->offset;
+    int64_t end = start + sorted[i]->len;
+    int64_t j = i + 1;
+    while (j < count &&
+           sorted[j]->offset <= end + MAX_COALESCE_GAP &&
+           MAX(end, sorted[j]->offset + sorted[j]->len) - start <=
+           MAX_COALESCED_READ) {
+      end = MAX(end, sorted[j]->offset + sorted[j]->len);
+      j++;
+    }
+
+    if (j == i + 1) {
+      sorted[i]->result = _openslide_read_range(filename, start,
+                                                sorted[i]->buf,
+                                                sorted[i]->len, NULL);
+    } else {
+      uint8_t *buf = g_malloc(end - start);
+      int64_t len = _openslide_read_range(filename, start, buf, end - start,
+                                          NULL);
+      for (int64_t k = i; k < j; k++) {
+        struct _openslide_range_request *r = sorted[k];
+        if (len < 0) {
+          r->result = -1;
+          continue;
+        }
+        r->result = CLAMP(len - (r->offset - start), 0, r->len);
+        memcpy(r->buf, buf + (r->offset - start), r->result);
+      }
+      g_free(buf);
+    }
+    i = j;
+  }
+  g_free(sorted);
+}
+
+bool _openslide_read_range_enabled(void) {
+  struct io_state *io = get_io();
+
+  g_mutex_lock(io->mutex);
+  bool enabled = io->capacity || io->reader;
+  g_mutex_unlock(io->mutex);
+  return enabled;
+}
+
+void _openslide_read_range_set_capacity(int64_t capacity) {
+  struct io_state *io = get_io();
+
+  g_mutex_lock(io->mutex);
+  io->capacity = MAX(capacity, 0);
+  int64_t shard_capacity = (io->capacity + BLOCK_SHARDS - 1) / BLOCK_SHARDS;
+  g_mutex_unlock(io->mutex);
+
+  for (int i = 0; i < BLOCK_SHARDS; i++) {
+    struct block_shard *shard = &io->shards[i];
+    g_mutex_lock(shard->mutex);
+    shard->capacity = shard_capacity;
+    evict(shard);
+    g_mutex_unlock(shard->mutex);
+  }
+}
+
+void _openslide_read_range_set_reader(openslide_range_reader_t reader,
+                                      void *data) {
+  struct io_state *io = get_io();
+
+  g_mutex_lock(io->mutex);
+  io->reader = reader;
+  io->reader_data = data;
+  g_mutex_unlock(io->mutex);
+}
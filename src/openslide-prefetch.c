@@ -0,0 +1,338 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2007-2014 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "openslide-private.h"
+
+#include <glib.h>
+#include <cairo.h>
+
+// background threads per openslide_t
+#define PREFETCH_THREADS 2
+// a hint is read in square chunks of this many level pixels, and yields
+// to foreground reads between chunks
+#define PREFETCH_CHUNK_SIZE 1024
+// warm start reads and pins at most this many of the smallest levels
+#define WARM_START_MAX_LEVELS 3
+// with at most this many pixels in all
+#define WARM_START_MAX_PIXELS (4096 * 4096)
+
+struct _openslide_prefetch {
+  GMutex *mutex;
+  GCond *cond;        // foreground reads or jobs have finished
+  GThreadPool *pool;  // created by the first hint
+  GHashTable *jobs;   // id -> struct prefetch_job, queued or running
+  int next_id;
+  gint foreground;    // running foreground reads; must use g_atomic_int!
+  gint active;        // set before the first job; must use g_atomic_int!
+  GThread *warm_start_thread;
+  GSList *warm_start_jobs;  // owned by the warm start thread
+};
+
+struct prefetch_job {
+  int id;
+  int64_t x;
+  int64_t y;
+  int32_t level;
+  int64_t w;
+  int64_t h;
+  bool cancelled;     // protected by the prefetch mutex
+};
+
+static gint warm_start_enabled;  // must use g_atomic_int!
+
+// returns false if the job was cancelled while waiting
+static bool wait_for_foreground(struct _openslide_prefetch *pf,
+                                struct prefetch_job *job) {
+  g_mutex_lock(pf->mutex);
+  while (g_atomic_int_get(&pf->foreground) && !job->cancelled) {
+    g_cond_wait(pf->cond, pf->mutex);
+  }
+  bool cancelled = job->cancelled;
+  g_mutex_unlock(pf->mutex);
+  return !cancelled;
+}
+
+// fetch the tiles of one chunk into the cache
+static bool prefetch_chunk(openslide_t *osr,
+                           struct _openslide_level *l,
+                           int64_t x, int64_t y,
+                           int32_t w, int32_t h,
+                           GError **err) {
+  // nothing is drawn, but the backend still reads every tile it would draw
+  cairo_surface_t *surface =
+    cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 0, 0);
+  cairo_t *cr = cairo_create(surface);
+  cairo_surface_destroy(surface);
+
+  bool success = _openslide_paint_region(osr, cr, x, y, l, w, h, err);
+  cairo_destroy(cr);
+  return success;
+}
+
+// frees the job
+static void run_job(openslide_t *osr, struct prefetch_job *job) {
+  struct _openslide_prefetch *pf = osr->prefetch;
+  struct _openslide_level *l = _openslide_get_level(osr, job->level);
+  GError *tmp_err = NULL;
+
+  const int64_t d = PREFETCH_CHUNK_SIZE;
+  double ds = l->downsample;
+  for (int64_t row = 0; row < (job->h + d - 1) / d; row++) {
+    for (int64_t col = 0; col < (job->w + d - 1) / d; col++) {
+      if (!wait_for_foreground(pf, job)) {
+        goto DONE;
+      }
+      if (!prefetch_chunk(osr, l,
+                          job->x + col * d * ds,
+                          job->y + row * d * ds,
+                          MIN(job->w - col * d, d),
+                          MIN(job->h - row * d, d),
+                          &tmp_err)) {
+        // a foreground read will report the error, if it matters
+        //g_debug("prefetch %d failed: %s", job->id, tmp_err->message);
+        g_clear_error(&tmp_err);
+        goto DONE;
+      }
+    }
+  }
+
+DONE:
+  g_mutex_lock(pf->mutex);
+  g_hash_table_remove(pf->jobs, GINT_TO_POINTER(job->id));
+  g_cond_broadcast(pf->cond);
+  g_mutex_unlock(pf->mutex);
+}
+
+static void prefetch_job_run(gpointer data, gpointer user_data) {
+  run_job(user_data, data);
+}
+
+// warm start has its own thread, so that hints don't wait for it
+static gpointer warm_start_thread_func(gpointer data) {
+  openslide_t *osr = data;
+  struct _openslide_prefetch *pf = osr->prefetch;
+
+  for (GSList *cur = pf->warm_start_jobs; cur; cur = cur->next) {
+    run_job(osr, cur->data);
+  }
+  g_slist_free(pf->warm_start_jobs);
+  pf->warm_start_jobs = NULL;
+  return NULL;
+}
+
+// most recent hints first, since they are closest to what will be viewed
+static gint prefetch_job_compare(gconstpointer a, gconstpointer b,
+                                 gpointer user_data G_GNUC_UNUSED) {
+  const struct prefetch_job *ja = a;
+  const struct prefetch_job *jb = b;
+  return jb->id - ja->id;
+}
+
+static void prefetch_job_free(gpointer data) {
+  g_slice_free(struct prefetch_job, data);
+}
+
+struct _openslide_prefetch *_openslide_prefetch_create(void) {
+  struct _openslide_prefetch *pf = g_slice_new0(struct _openslide_prefetch);
+  pf->mutex = g_mutex_new();
+  pf->cond = g_cond_new();
+  pf->jobs = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                   NULL, prefetch_job_free);
+  pf->next_id = 1;
+  return pf;
+}
+
+// must be called before the backend is destroyed
+void _openslide_prefetch_destroy(struct _openslide_prefetch *pf) {
+  // cancel everything
+  g_mutex_lock(pf->mutex);
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, pf->jobs);
+  while (g_hash_table_iter_next(&iter, NULL, &value)) {
+    struct prefetch_job *job = value;
+    job->cancelled = true;
+  }
+  g_cond_broadcast(pf->cond);
+  g_mutex_unlock(pf->mutex);
+
+  // let the queued jobs notice, and wait for them
+  if (pf->warm_start_thread) {
+    g_thread_join(pf->warm_start_thread);
+  }
+  if (pf->pool) {
+    g_thread_pool_free(pf->pool, false, true);
+  }
+  g_assert(g_hash_table_size(pf->jobs) == 0);
+
+  g_hash_table_unref(pf->jobs);
+  g_cond_free(pf->cond);
+  g_mutex_free(pf->mutex);
+  g_slice_free(struct _openslide_prefetch, pf);
+}
+
+int _openslide_prefetch_hint(openslide_t *osr,
+                             int64_t x, int64_t y,
+                             int32_t level,
+                             int64_t w, int64_t h,
+                             GError **err) {
+  struct _openslide_prefetch *pf = osr->prefetch;
+
+  // offset if given negative coordinates, like read_region()
+  double ds = _openslide_get_level(osr, level)->downsample;
+  if (x < 0) {
+    w -= (-x) / ds;
+    x = 0;
+  }
+  if (y < 0) {
+    h -= (-y) / ds;
+    y = 0;
+  }
+
+  struct prefetch_job *job = g_slice_new0(struct prefetch_job);
+  job->x = x;
+  job->y = y;
+  job->level = level;
+  job->w = MAX(w, 0);
+  job->h = MAX(h, 0);
+
+  g_mutex_lock(pf->mutex);
+  if (!pf->pool) {
+    pf->pool = g_thread_pool_new(prefetch_job_run, osr,
+                                 PREFETCH_THREADS, false, err);
+    if (!pf->pool) {
+      g_mutex_unlock(pf->mutex);
+      g_prefix_error(err, "Couldn't start prefetch threads: ");
+      g_slice_free(struct prefetch_job, job);
+      return -1;
+    }
+    g_thread_pool_set_sort_function(pf->pool, prefetch_job_compare, NULL);
+    g_atomic_int_set(&pf->active, 1);
+  }
+  job->id = pf->next_id++;
+  g_hash_table_insert(pf->jobs, GINT_TO_POINTER(job->id), job);
+  g_thread_pool_push(pf->pool, job, NULL);
+  int id = job->id;
+  g_mutex_unlock(pf->mutex);
+
+  return id;
+}
+
+void _openslide_prefetch_set_warm_start(bool enable) {
+  g_atomic_int_set(&warm_start_enabled, enable);
+}
+
+// read the smallest levels in the background, and pin them in the cache.
+// must be called before the slide is used by other threads.
+void _openslide_prefetch_warm_start(openslide_t *osr) {
+  struct _openslide_prefetch *pf = osr->prefetch;
+  if (!g_atomic_int_get(&warm_start_enabled)) {
+    return;
+  }
+
+  // smallest first, for the first view of the slide
+  void *planes[WARM_START_MAX_LEVELS];
+  int32_t plane_count = 0;
+  int64_t pixels = 0;
+  GSList *jobs = NULL;
+  for (int32_t i = _openslide_get_level_count(osr) - 1;
+       i >= 0 && plane_count < WARM_START_MAX_LEVELS; i--) {
+    struct _openslide_level *l = _openslide_get_level(osr, i);
+    pixels += l->w * l->h;
+    if (pixels > WARM_START_MAX_PIXELS) {
+      break;
+    }
+    planes[plane_count++] = l;
+
+    struct prefetch_job *job = g_slice_new0(struct prefetch_job);
+    job->level = i;
+    job->w = l->w;
+    job->h = l->h;
+    jobs = g_slist_append(jobs, job);
+  }
+  if (!plane_count) {
+    return;
+  }
+  _openslide_cache_binding_pin(osr->cache, planes, plane_count);
+
+  g_mutex_lock(pf->mutex);
+  for (GSList *cur = jobs; cur; cur = cur->next) {
+    struct prefetch_job *job = cur->data;
+    job->id = pf->next_id++;
+    g_hash_table_insert(pf->jobs, GINT_TO_POINTER(job->id), job);
+  }
+  pf->warm_start_jobs = jobs;
+  g_atomic_int_set(&pf->active, 1);
+  GError *tmp_err = NULL;
+  pf->warm_start_thread = g_thread_create(warm_start_thread_func, osr,
+                                          true, &tmp_err);
+  if (!pf->warm_start_thread) {
+    // pinned tiles are still kept when they are read
+    g_debug("Couldn't start warm start thread: %s", tmp_err->message);
+    g_clear_error(&tmp_err);
+    for (GSList *cur = jobs; cur; cur = cur->next) {
+      struct prefetch_job *job = cur->data;
+      g_hash_table_remove(pf->jobs, GINT_TO_POINTER(job->id));
+    }
+    g_slist_free(jobs);
+    pf->warm_start_jobs = NULL;
+  }
+  g_mutex_unlock(pf->mutex);
+}
+
+void _openslide_prefetch_cancel(openslide_t *osr, int id) {
+  struct _openslide_prefetch *pf = osr->prefetch;
+
+  g_mutex_lock(pf->mutex);
+  struct prefetch_job *job = g_hash_table_lookup(pf->jobs,
+                                                 GINT_TO_POINTER(id));
+  if (job) {
+    // the job removes itself when it notices
+    job->cancelled = true;
+    g_cond_broadcast(pf->cond);
+  }
+  g_mutex_unlock(pf->mutex);
+}
+
+// prefetching pauses while foreground reads are running.  Reads only take
+// the mutex to wake paused jobs, so slides without hints or warm start
+// don't pay for it.
+void _openslide_prefetch_foreground_begin(openslide_t *osr) {
+  struct _openslide_prefetch *pf = osr->prefetch;
+
+  g_atomic_int_inc(&pf->foreground);
+}
+
+void _openslide_prefetch_foreground_end(openslide_t *osr) {
+  struct _openslide_prefetch *pf = osr->prefetch;
+
+  g_assert(g_atomic_int_get(&pf->foreground) > 0);
+  // jobs only wait once active is set, and check the count under the
+  // mutex, so broadcasting under it can't be missed
+  if (g_atomic_int_dec_and_test(&pf->foreground) &&
+      g_atomic_int_get(&pf->active)) {
+    g_mutex_lock(pf->mutex);
+    g_cond_broadcast(pf->cond);
+    g_mutex_unlock(pf->mutex);
+  }
+}
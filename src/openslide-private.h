@@ -49,9 +49,18 @@ struct _openslide_associated_image_ops {
   bool (*get_argb_data)(struct _openslide_associated_image *img,
                         uint32_t *dest,
                         GError **err);
+  // optional; dest is ceil(w / scale_denom) x ceil(h / scale_denom), for
+  // scale_denom 2, 4 or 8
+  bool (*get_argb_data_scaled)(struct _openslide_associated_image *img,
+                               uint32_t *dest,
+                               int32_t scale_denom,
+                               GError **err);
   void (*destroy)(struct _openslide_associated_image *img);
 };
 
+// number of OPENSLIDE_PLANE_* dimensions
+#define _OPENSLIDE_PLANE_DIMENSIONS 3
+
 /* the main structure */
 struct _openslide {
   const struct _openslide_ops *ops;
@@ -67,11 +76,42 @@ struct _openslide {
   GHashTable *properties; // created automatically
   const char **property_names; // filled in automatically from hashtable
 
+  // quickhash1, computed when first requested by reopening the slide
+  char *filename;
+  const struct _openslide_format *format;
+  GMutex *quickhash1_lock;
+  bool quickhash1_done;  // protected by quickhash1_lock
+  char *quickhash1;      // NULL if unhashable, protected by quickhash1_lock
+
   // cache
-  struct _openslide_cache *cache;
+  struct _openslide_cache_binding *cache;
+
+  // background reads
+  struct _openslide_prefetch *prefetch;
+
+  // per-handle statistics
+  struct _openslide_stats *stats;
+
+  // levels synthesized between the backend's, shared with duplicates;
+  // NULL if none
+  struct _openslide_synth *synth;
+
+  // plane read by this handle, selected by openslide_set_plane()
+  int32_t plane[_OPENSLIDE_PLANE_DIMENSIONS];
+
+  // parallel tile decode, disabled if < 2
+  gint decode_threads; // must use g_atomic_int!
+
+  // asynchronous reads, created by the first one
+  gpointer async_pool; // must use g_atomic_pointer!
 
   // error handling, NULL if no error
   gpointer error; // must use g_atomic_pointer!
+
+  // openslide_dup() handles share ops, levels, data and cache with the
+  // handle that opened the slide, which lives until all of them are closed
+  openslide_t *owner;  // NULL for the handle that opened the slide
+  gint refcount;       // on the owner only; must use g_atomic_int!
 };
 
 struct _openslide_level {
@@ -84,6 +124,9 @@ struct _openslide_level {
   // all levels must set these, or none
   int64_t tile_w;
   int64_t tile_h;
+
+  // read_raw_tile() returns JPEGs of tile_w x tile_h for this level
+  bool raw_tiles;
 };
 
 /* the function pointer structure for backends */
@@ -93,6 +136,30 @@ struct _openslide_ops {
 		       struct _openslide_level *level,
 		       int32_t w, int32_t h,
 		       GError **err);
+  // optional; *buf is NULL if the tile is missing, else freed with g_free
+  bool (*read_raw_tile)(openslide_t *osr,
+                        struct _openslide_level *level,
+                        int64_t tile_col, int64_t tile_row,
+                        void **buf, int32_t *len,
+                        GError **err);
+  // optional; false if the slide has no native samples
+  bool (*get_native_format)(openslide_t *osr,
+                            int32_t *sample_type, int32_t *channels);
+  // required with get_native_format; dest is already cleared, and the
+  // channels are valid
+  bool (*read_native_region)(openslide_t *osr, void *dest,
+                             const int32_t *channels, int32_t channel_count,
+                             int64_t x, int64_t y,
+                             struct _openslide_level *level,
+                             int64_t w, int64_t h,
+                             GError **err);
+  // optional; at least 1 for every OPENSLIDE_PLANE_* dimension
+  int32_t (*get_plane_count)(openslide_t *osr, int32_t dimension);
+  // required with get_plane_count; prepares reading plane, which has one
+  // index in range for every dimension.  Other handles may still read
+  // their own plane, so the selected one is osr->plane and not backend
+  // state
+  bool (*set_plane)(openslide_t *osr, const int32_t *plane, GError **err);
   void (*destroy)(openslide_t *osr);
 };
 
@@ -149,6 +216,47 @@ GKeyFile *_openslide_read_key_file(const char *filename, int32_t max_size,
 OPENSLIDE_PUBLIC()
 FILE *_openslide_fopen(const char *path, const char *mode, GError **err);
 
+/* Ranged reads of slide files, through the block cache and the range
+   reader if configured.  Returns the number of bytes read, which is short
+   only at the end of the file, or -1 on error. */
+int64_t _openslide_read_range(const char *filename,
+                              int64_t offset,
+                              void *buf, int64_t len,
+                              GError **err);
+
+// true if ranged reads should be preferred to reading through a FILE
+bool _openslide_read_range_enabled(void);
+
+// read many ranges of a file, merging ones that are close together into
+// single reads; result is the number of bytes read, or -1 on error
+struct _openslide_range_request {
+  int64_t offset;
+  int64_t len;
+  void *buf;
+  int64_t result;
+};
+
+void _openslide_read_ranges(const char *filename,
+                            struct _openslide_range_request *requests,
+                            int64_t count);
+
+void _openslide_read_range_set_capacity(int64_t capacity);
+
+void _openslide_read_range_set_reader(openslide_range_reader_t reader,
+                                      void *data);
+
+/* Pool of open FILE handles for one file, for multithreaded access */
+struct _openslide_filecache;
+
+struct _openslide_filecache *_openslide_filecache_create(const char *path);
+
+FILE *_openslide_filecache_get(struct _openslide_filecache *fc,
+                               GError **err);
+
+void _openslide_filecache_put(struct _openslide_filecache *fc, FILE *f);
+
+void _openslide_filecache_destroy(struct _openslide_filecache *fc);
+
 /* Parse string to double, returning NAN on failure.  Accept both comma
    and period as decimal separator. */
 double _openslide_parse_double(const char *value);
@@ -220,6 +328,14 @@ void _openslide_grid_tilemap_add_tile(struct _openslide_grid *grid,
                                       double w, double h,
                                       void *data);
 
+void _openslide_grid_tilemap_set_snap(struct _openslide_grid *grid,
+                                      bool snap);
+
+// whether backends should snap the tilemaps of slides opened from now on
+void _openslide_grid_set_snap_enabled(bool enable);
+
+bool _openslide_grid_get_snap_enabled(void);
+
 struct _openslide_grid *_openslide_grid_create_range(openslide_t *osr,
                                                      int typical_tile_width,
                                                      int typical_tile_height,
@@ -237,6 +353,57 @@ void _openslide_grid_get_bounds(struct _openslide_grid *grid,
                                 double *x, double *y,
                                 double *w, double *h);
 
+// per-thread read argument for the decode threads
+typedef void *(*_openslide_grid_get_arg_fn)(void *arg_data, GError **err);
+typedef void (*_openslide_grid_put_arg_fn)(void *arg_data, void *arg);
+
+// allow the tiles of the grid to be decoded by the shared decode threads
+// read_tile must then be thread safe; each thread gets its own read
+// argument from get_arg, or NULL if get_arg is NULL
+void _openslide_grid_enable_parallel_decode(struct _openslide_grid *grid,
+                                            _openslide_grid_get_arg_fn get_arg,
+                                            _openslide_grid_put_arg_fn put_arg,
+                                            void *arg_data);
+
+// before a simple grid reads the tiles of a region, pass their (col, row)
+// pairs to fetch_tiles, so that it can read their data in a few large
+// reads rather than one per tile; level and arg are those of the paint.
+// The tile reads report any failures.
+typedef void (*_openslide_grid_simple_fetch_fn)(openslide_t *osr,
+                                                struct _openslide_level *level,
+                                                void *arg,
+                                                void *fetch_data,
+                                                const int64_t *tiles,
+                                                int64_t count);
+void _openslide_grid_simple_enable_coalesced_reads(struct _openslide_grid *grid,
+                                                   _openslide_grid_simple_fetch_fn fetch_tiles,
+                                                   void *fetch_data);
+
+// threads a decoder may use within a single tile
+int32_t _openslide_grid_get_tile_decode_threads(openslide_t *osr);
+
+// run the parts of one tile decode, on the decode threads if the
+// calling thread may use them
+typedef void (*_openslide_grid_job_fn)(void *job);
+void _openslide_grid_run_jobs(openslide_t *osr,
+                              _openslide_grid_job_fn fn,
+                              void **jobs, int32_t count);
+
+// mark a new context on an image surface that is painted only by grids,
+// so that the simple grid can copy tiles instead of compositing
+// if !cleared, the first grid clears what its tiles won't cover, and
+// _openslide_grid_end_blit() clears the target if no grid painted it
+// simple grid read_tile functions must then paint their whole cell
+void _openslide_grid_begin_blit(cairo_t *cr, bool cleared);
+
+void _openslide_grid_end_blit(cairo_t *cr);
+
+// in a simple grid read_tile, get the target pixels if the request is
+// exactly this tile, so that it can be decoded in place instead of being
+// cached and painted; NULL otherwise
+uint32_t *_openslide_grid_get_tile_dest(cairo_t *cr,
+                                        int64_t tile_w, int64_t tile_h);
+
 bool _openslide_grid_paint_region(struct _openslide_grid *grid,
                                   cairo_t *cr,
                                   void *arg,
@@ -257,38 +424,314 @@ void _openslide_set_bounds_props_from_grid(openslide_t *osr,
 
 /* Cache */
 #define _OPENSLIDE_USEFUL_CACHE_SIZE 1024*1024*64
+#define _OPENSLIDE_USEFUL_COMPRESSED_CACHE_SIZE 1024*1024*16
 
 struct _openslide_cache_entry;
+struct _openslide_cache_binding;
 
-// constructor/destructor
-struct _openslide_cache *_openslide_cache_create(int capacity_in_bytes);
+enum _openslide_cache_policy {
+  _OPENSLIDE_CACHE_POLICY_LRU = OPENSLIDE_CACHE_POLICY_LRU,
+  _OPENSLIDE_CACHE_POLICY_SEGMENTED_LRU = OPENSLIDE_CACHE_POLICY_SEGMENTED_LRU,
+};
+
+// constructor/refcounting
+struct _openslide_cache *_openslide_cache_create(uint64_t capacity_in_bytes);
+
+struct _openslide_cache *_openslide_cache_ref(struct _openslide_cache *cache);
+
+void _openslide_cache_unref(struct _openslide_cache *cache);
+
+// binding of an openslide_t to a possibly shared cache
+struct _openslide_cache_binding *_openslide_cache_binding_create(struct _openslide_cache *cache);
+
+void _openslide_cache_binding_set(struct _openslide_cache_binding *binding,
+                                  struct _openslide_cache *cache);
+
+struct _openslide_cache *_openslide_cache_binding_get(struct _openslide_cache_binding *binding);
 
-void _openslide_cache_destroy(struct _openslide_cache *cache);
+void _openslide_cache_binding_destroy(struct _openslide_cache_binding *binding);
+
+// keep the decoded tiles of the listed planes in the disk cache too, if
+// they are put with _openslide_cache_put_tile().  The key identifies the
+// slide, and the plane's position in the list identifies it within the
+// slide, so the list must not depend on settings such as synthesized
+// levels.  Must be called before the binding is used by other threads.
+void _openslide_cache_binding_enable_disk(struct _openslide_cache_binding *binding,
+                                          const char *slide_key,
+                                          void * const *planes,
+                                          int32_t plane_count);
+
+// keep the decoded tiles of the listed planes for the lifetime of the
+// binding, whatever cache it uses.  Must be called before the binding is
+// used by other threads.
+void _openslide_cache_binding_pin(struct _openslide_cache_binding *binding,
+                                  void * const *planes,
+                                  int32_t plane_count);
 
 // cache size
-int _openslide_cache_get_capacity(struct _openslide_cache *cache);
+uint64_t _openslide_cache_get_capacity(struct _openslide_cache *cache);
 
 void _openslide_cache_set_capacity(struct _openslide_cache *cache,
-				   int capacity_in_bytes);
+				   uint64_t capacity_in_bytes);
+
+// compressed tier size
+uint64_t _openslide_cache_get_compressed_capacity(struct _openslide_cache *cache);
+
+void _openslide_cache_set_compressed_capacity(struct _openslide_cache *cache,
+                                              uint64_t capacity_in_bytes);
+
+// eviction policy
+enum _openslide_cache_policy _openslide_cache_get_policy(struct _openslide_cache *cache);
+
+void _openslide_cache_set_policy(struct _openslide_cache *cache,
+                                 enum _openslide_cache_policy policy);
+
+// statistics
+void _openslide_cache_get_stats(struct _openslide_cache *cache,
+                                uint64_t *hits,
+                                uint64_t *misses,
+                                uint64_t *evictions,
+                                uint64_t *size_in_bytes);
 
 // put and get
-void _openslide_cache_put(struct _openslide_cache *cache,
+void _openslide_cache_put(struct _openslide_cache_binding *binding,
 			  void *plane,  // coordinate plane (level or grid)
 			  int64_t x,
 			  int64_t y,
-			  void *data,
+			  void *data,  // from _openslide_tile_buffer_alloc()
 			  int size_in_bytes,
 			  struct _openslide_cache_entry **entry);
 
-void *_openslide_cache_get(struct _openslide_cache *cache,
+void *_openslide_cache_get(struct _openslide_cache_binding *binding,
 			   void *plane,
 			   int64_t x,
 			   int64_t y,
 			   struct _openslide_cache_entry **entry);
 
+// put and get for tiles of w x h pixels of a cairo format, which are also
+// kept in the disk cache
+void _openslide_cache_put_tile(struct _openslide_cache_binding *binding,
+                               void *plane,
+                               int64_t x,
+                               int64_t y,
+                               int32_t w,
+                               int32_t h,
+                               cairo_format_t format,
+                               void *data,  // w * h * 4 bytes
+                               struct _openslide_cache_entry **entry);
+
+void *_openslide_cache_get_tile(struct _openslide_cache_binding *binding,
+                                void *plane,
+                                int64_t x,
+                                int64_t y,
+                                int32_t w,
+                                int32_t h,
+                                cairo_format_t format,
+                                struct _openslide_cache_entry **entry);
+
+// whether a decoded tile is in memory, without counting a hit or miss
+bool _openslide_cache_contains(struct _openslide_cache_binding *binding,
+                               void *plane,
+                               int64_t x,
+                               int64_t y);
+
+// put and get for the compressed tier
+void _openslide_cache_put_compressed(struct _openslide_cache_binding *binding,
+                                     void *plane,
+                                     int64_t x,
+                                     int64_t y,
+                                     void *data,  // from g_slice_alloc()
+                                     int size_in_bytes,
+                                     struct _openslide_cache_entry **entry);
+
+void *_openslide_cache_get_compressed(struct _openslide_cache_binding *binding,
+                                      void *plane,
+                                      int64_t x,
+                                      int64_t y,
+                                      int *size_in_bytes,
+                                      struct _openslide_cache_entry **entry);
+
 // value unref
 void _openslide_cache_entry_unref(struct _openslide_cache_entry *entry);
 
+// while set, the calling thread adds a reference to each decoded-tile
+// entry it gets or puts to the array, or NULL to stop
+void _openslide_cache_hold_entries(GPtrArray *held);
+
+// unref the held entries and empty the array
+void _openslide_cache_release_held_entries(GPtrArray *held);
+
+// buffers for decoded tiles, recycled when the cache releases them
+void *_openslide_tile_buffer_alloc(int size);
+
+void _openslide_tile_buffer_free(void *data, int size);
+
+
+/* Disk cache, shared by processes */
+void _openslide_diskcache_set(const char *dir, int64_t capacity);
+
+bool _openslide_diskcache_enabled(void);
+
+// what a cached tile must be to be used
+struct _openslide_diskcache_tile {
+  int32_t w;
+  int32_t h;
+  cairo_format_t format;
+};
+
+// data of w * h * 4 bytes from _openslide_tile_buffer_alloc(), or NULL if
+// no tile of this geometry is cached
+void *_openslide_diskcache_get(const char *slide_key, int32_t plane_id,
+                               int64_t x, int64_t y,
+                               const struct _openslide_diskcache_tile *tile);
+
+void _openslide_diskcache_put(const char *slide_key, int32_t plane_id,
+                              int64_t x, int64_t y,
+                              const struct _openslide_diskcache_tile *tile,
+                              const void *data);
+
+
+/* Prefetch */
+struct _openslide_prefetch *_openslide_prefetch_create(void);
+
+void _openslide_prefetch_destroy(struct _openslide_prefetch *pf);
+
+int _openslide_prefetch_hint(openslide_t *osr,
+                             int64_t x, int64_t y,
+                             int32_t level,
+                             int64_t w, int64_t h,
+                             GError **err);
+
+void _openslide_prefetch_cancel(openslide_t *osr, int id);
+
+void _openslide_prefetch_set_warm_start(bool enable);
+
+void _openslide_prefetch_warm_start(openslide_t *osr);
+
+void _openslide_prefetch_foreground_begin(openslide_t *osr);
+
+void _openslide_prefetch_foreground_end(openslide_t *osr);
+
+
+/* Statistics */
+// one past the last OPENSLIDE_STAT_*
+#define _OPENSLIDE_STAT_COUNT 15
+
+struct _openslide_stats;
+
+struct _openslide_stats *_openslide_stats_create(void);
+
+int64_t _openslide_stats_get(struct _openslide_stats *stats, int32_t stat);
+
+void _openslide_stats_reset(struct _openslide_stats *stats);
+
+void _openslide_stats_destroy(struct _openslide_stats *stats);
+
+// statistics are collected for the calling thread's current stats, if any;
+// returns the previous ones, to be restored afterward
+struct _openslide_stats *_openslide_stats_set_current(struct _openslide_stats *stats);
+
+struct _openslide_stats *_openslide_stats_get_current(void);
+
+// whether the calling thread is reading for a handle in scan mode
+void _openslide_stats_set_scan(struct _openslide_stats *stats, bool scan);
+bool _openslide_stats_get_scan(void);
+
+void _openslide_stats_add(int32_t stat, int64_t value);
+
+// times a phase, excluding the time of phases nested within it
+struct _openslide_stats_timer {
+  int64_t start;   // -1 if not collecting
+  int64_t nested;  // nested time of the enclosing phase
+};
+
+void _openslide_stats_begin(struct _openslide_stats_timer *timer);
+
+// stat < 0 discards the time, but still excludes it from the enclosing phase
+void _openslide_stats_end(struct _openslide_stats_timer *timer, int32_t stat);
+
+// fread() of size bytes, counted as I/O; returns the number of bytes read
+size_t _openslide_fread(FILE *f, void *buf, size_t size);
+
+// count bytes read from slide files by other means
+void _openslide_stats_bytes_read(int64_t count);
+
+
+/* Tracing */
+struct _openslide_trace {
+  int64_t start;
+  int64_t bytes;  // read by the thread before the event
+  int32_t codec;  // of the enclosing event so far
+};
+
+void _openslide_trace_set_callback(openslide_trace_callback_t callback,
+                                   void *data);
+
+// returns false, at the cost of one load, if tracing is disabled;
+// otherwise _openslide_trace_end() must be called on the same thread
+bool _openslide_trace_begin(struct _openslide_trace *trace);
+
+// fills in the bytes, codec and duration of the event, and reports it
+void _openslide_trace_end(struct _openslide_trace *trace,
+                          openslide_trace_event_t *event);
+
+
+/* Synthesized levels */
+struct _openslide_synth;
+
+void _openslide_synth_set_enabled(bool enable);
+
+// also lets backends add levels of their own between sparse levels
+bool _openslide_synth_get_enabled(void);
+
+// NULL if disabled or not needed
+struct _openslide_synth *_openslide_synth_create(openslide_t *osr);
+
+void _openslide_synth_destroy(struct _openslide_synth *synth);
+
+// the levels seen through the API, including synthesized ones
+int32_t _openslide_get_level_count(openslide_t *osr);
+
+struct _openslide_level *_openslide_get_level(openslide_t *osr,
+                                              int32_t level);
+
+bool _openslide_level_is_synthesized(openslide_t *osr,
+                                     struct _openslide_level *level);
+
+// paint a region of any level, with the backend or from a larger level
+bool _openslide_paint_region(openslide_t *osr, cairo_t *cr,
+                             int64_t x, int64_t y,
+                             struct _openslide_level *level,
+                             int32_t w, int32_t h,
+                             GError **err);
+
+
+/* Area-averaging downscaler */
+struct _openslide_scale_weights;
+
+// scale is source pixels per output pixel
+struct _openslide_scale_weights *_openslide_scale_weights_create(int64_t count,
+                                                                 double scale);
+
+int64_t _openslide_scale_weights_get_start(struct _openslide_scale_weights *sw,
+                                           int64_t start);
+
+int64_t _openslide_scale_weights_get_end(struct _openslide_scale_weights *sw,
+                                         int64_t end);
+
+void _openslide_scale_weights_destroy(struct _openslide_scale_weights *sw);
+
+void _openslide_scale_area(const uint32_t *src,
+                           int64_t src_stride,
+                           int64_t src_x, int64_t src_y,
+                           int64_t src_h,
+                           uint32_t *dest,
+                           int64_t dest_stride,
+                           int64_t dest_x, int64_t dest_y,
+                           int64_t dest_w, int64_t dest_h,
+                           struct _openslide_scale_weights *xw,
+                           struct _openslide_scale_weights *yw);
+
 
 /* Internal error propagation */
 enum OpenSlideError {
@@ -318,6 +761,20 @@ void _openslide_debug_init(void);
 
 bool _openslide_debug(enum _openslide_debug_flag flag);
 
+/* Path for a file of derived data, in a subdirectory of the directory
+   given by OPENSLIDE_CACHE_DIR.  NULL if the variable is unset. */
+char *_openslide_get_cache_path(const char *subdir, const char *name);
+
+/* Whether OPENSLIDE_CACHE_DIR is set, so derived data can be saved */
+bool _openslide_have_cache_dir(void);
+
+/* Whether slide files may be memory-mapped: OPENSLIDE_MMAP=1 */
+bool _openslide_mmap_enabled(void);
+
+/* SHA-256 of a file's absolute path, size and modification time, or NULL
+   if the file can't be examined */
+char *_openslide_get_file_key(const char *filename);
+
 #define _openslide_performance_warn(...) \
       _openslide_performance_warn_once(NULL, __VA_ARGS__)
 
@@ -344,19 +801,6 @@ extern const int32_t _openslide_G_Cb[256];
 extern const int32_t _openslide_G_Cr[256];
 extern const int16_t _openslide_B_Cb[256];
 
-// deprecated prefetch stuff (maybe we'll undeprecate it someday),
-// still needs these declarations for ABI compat
-// TODO: remove if soname bump
-#undef openslide_give_prefetch_hint
-OPENSLIDE_PUBLIC()
-int openslide_give_prefetch_hint(openslide_t *osr,
-				 int64_t x, int64_t y,
-				 int32_t level,
-				 int64_t w, int64_t h);
-#undef openslide_cancel_prefetch_hint
-OPENSLIDE_PUBLIC()
-void openslide_cancel_prefetch_hint(openslide_t *osr, int prefetch_id);
-
 /* Prevent use of dangerous functions and functions with mandatory wrappers.
    Every @p replacement must be unique to avoid conflicting-type errors. */
 #define _OPENSLIDE_POISON(replacement) error__use_ ## replacement ## _instead
@@ -0,0 +1,161 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2007-2014 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "openslide-private.h"
+
+#include <glib.h>
+#include <string.h>
+#include <math.h>
+
+// weights are 16.16 fixed point and sum to one for every output pixel
+#define WEIGHT_ONE 65536
+
+// for each output pixel along one axis, the source pixels it covers and
+// how much of it each of them covers
+struct _openslide_scale_weights {
+  int64_t count;
+  int32_t stride;     // max source pixels per output pixel
+  int64_t *first;     // first source pixel
+  int32_t *len;       // number of source pixels
+  uint32_t *weights;  // stride weights per output pixel
+};
+
+struct _openslide_scale_weights *_openslide_scale_weights_create(int64_t count,
+                                                                 double scale) {
+  struct _openslide_scale_weights *sw =
+    g_slice_new0(struct _openslide_scale_weights);
+  sw->count = count;
+  sw->stride = ceil(scale) + 1;
+  sw->first = g_new(int64_t, count);
+  sw->len = g_new(int32_t, count);
+  sw->weights = g_new0(uint32_t, count * sw->stride);
+
+  for (int64_t i = 0; i < count; i++) {
+    // output pixel i covers [a, b) in the source
+    double a = i * scale;
+    double b = (i + 1) * scale;
+    int64_t first = floor(a);
+    int64_t end = MAX(ceil(b), first + 1);
+    int32_t len = MIN(end - first, sw->stride);
+    uint32_t *w = sw->weights + i * sw->stride;
+
+    uint32_t sum = 0;
+    for (int32_t j = 0; j < len - 1; j++) {
+      double overlap = MIN(b, first + j + 1) - MAX(a, first + j);
+      w[j] = MAX(overlap, 0) / scale * WEIGHT_ONE;
+      sum += w[j];
+    }
+    // rounding error goes to the last pixel
+    w[len - 1] = WEIGHT_ONE - MIN(sum, WEIGHT_ONE);
+
+    sw->first[i] = first;
+    sw->len[i] = len;
+  }
+  return sw;
+}
+
+// first source pixel used by output pixels [start, end)
+int64_t _openslide_scale_weights_get_start(struct _openslide_scale_weights *sw,
+                                           int64_t start) {
+  g_assert(start >= 0 && start < sw->count);
+  return sw->first[start];
+}
+
+// one past the last source pixel used by output pixels [start, end)
+int64_t _openslide_scale_weights_get_end(struct _openslide_scale_weights *sw,
+                                         int64_t end) {
+  g_assert(end > 0 && end <= sw->count);
+  return sw->first[end - 1] + sw->len[end - 1];
+}
+
+void _openslide_scale_weights_destroy(struct _openslide_scale_weights *sw) {
+  g_free(sw->first);
+  g_free(sw->len);
+  g_free(sw->weights);
+  g_slice_free(struct _openslide_scale_weights, sw);
+}
+
+// Average the premultiplied ARGB source pixels under output pixels
+// [dest_x, dest_x + dest_w) x [dest_y, dest_y + dest_h).  src holds the
+// source pixels starting at (src_x, src_y), which must include all of
+// them.  The inner loops are plain fixed-point multiply-adds over
+// contiguous memory, which the compiler vectorizes.
+void _openslide_scale_area(const uint32_t *src,
+                           int64_t src_stride,
+                           int64_t src_x, int64_t src_y,
+                           int64_t src_h,
+                           uint32_t *dest,
+                           int64_t dest_stride,
+                           int64_t dest_x, int64_t dest_y,
+                           int64_t dest_w, int64_t dest_h,
+                           struct _openslide_scale_weights *xw,
+                           struct _openslide_scale_weights *yw) {
+  // horizontal pass, into channels with 8 fractional bits
+  uint32_t *tmp = g_new(uint32_t, dest_w * src_h * 4);
+  for (int64_t row = 0; row < src_h; row++) {
+    const uint32_t *in = src + row * src_stride;
+    uint32_t *out = tmp + row * dest_w * 4;
+    for (int64_t col = 0; col < dest_w; col++) {
+      int64_t i = dest_x + col;
+      const uint32_t *p = in + (xw->first[i] - src_x);
+      const uint32_t *w = xw->weights + i * xw->stride;
+      uint32_t a = 0, r = 0, g = 0, b = 0;
+      for (int32_t j = 0; j < xw->len[i]; j++) {
+        uint32_t px = p[j];
+        a += (px >> 24) * w[j];
+        r += ((px >> 16) & 0xff) * w[j];
+        g += ((px >> 8) & 0xff) * w[j];
+        b += (px & 0xff) * w[j];
+      }
+      out[col * 4 + 0] = (a + 128) >> 8;
+      out[col * 4 + 1] = (r + 128) >> 8;
+      out[col * 4 + 2] = (g + 128) >> 8;
+      out[col * 4 + 3] = (b + 128) >> 8;
+    }
+  }
+
+  // vertical pass; 0xff00 * WEIGHT_ONE still fits in 32 bits
+  uint32_t *acc = g_new(uint32_t, dest_w * 4);
+  for (int64_t row = 0; row < dest_h; row++) {
+    int64_t i = dest_y + row;
+    const uint32_t *w = yw->weights + i * yw->stride;
+    memset(acc, 0, dest_w * 4 * sizeof(*acc));
+    for (int32_t j = 0; j < yw->len[i]; j++) {
+      const uint32_t *in = tmp + (yw->first[i] - src_y + j) * dest_w * 4;
+      for (int64_t k = 0; k < dest_w * 4; k++) {
+        acc[k] += in[k] * w[j];
+      }
+    }
+    uint32_t *out = dest + i * dest_stride + dest_x;
+    for (int64_t col = 0; col < dest_w; col++) {
+      const uint32_t *c = acc + col * 4;
+      out[col] = ((c[0] + (1 << 23)) >> 24) << 24 |
+                 ((c[1] + (1 << 23)) >> 24) << 16 |
+                 ((c[2] + (1 << 23)) >> 24) << 8 |
+                 ((c[3] + (1 << 23)) >> 24);
+    }
+  }
+
+  g_free(acc);
+  g_free(tmp);
+}
@@ -0,0 +1,249 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2007-2014 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "openslide-private.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+struct _openslide_stats {
+  GMutex *mutex;
+  int64_t values[_OPENSLIDE_STAT_COUNT];  // protected by mutex
+
+  // the stats follow the handle's reads onto other threads, so they also
+  // carry its access pattern
+  gint scan;  // must use g_atomic_int!
+};
+
+// what the calling thread is collecting for
+struct thread_stats {
+  struct _openslide_stats *stats;
+  int64_t nested;  // time of finished phases within the current one
+
+  // tracing
+  int tracing;          // running trace events
+  int64_t bytes_read;   // by the thread, ever
+  int32_t codec;        // last decode stat, or -1
+};
+
+static GPrivate *thread_stats;
+
+// tracing is enabled if trace_callback is set
+static volatile gint trace_enabled;
+static openslide_trace_callback_t trace_callback;
+static void *trace_data;
+G_LOCK_DEFINE_STATIC(trace_callback);
+
+// indexed by OPENSLIDE_STAT_DECODE_TIME_*
+static const char * const codec_names[] = {
+  [OPENSLIDE_STAT_DECODE_TIME_JPEG] = "jpeg",
+  [OPENSLIDE_STAT_DECODE_TIME_JPEG2000] = "jpeg2000",
+  [OPENSLIDE_STAT_DECODE_TIME_PNG] = "png",
+  [OPENSLIDE_STAT_DECODE_TIME_BMP] = "bmp",
+  [OPENSLIDE_STAT_DECODE_TIME_JPEGXR] = "jpegxr",
+  [OPENSLIDE_STAT_DECODE_TIME_TIFF] = "tiff",
+  [OPENSLIDE_STAT_DECODE_TIME_OTHER] = "other",
+};
+
+static void thread_stats_free(gpointer data) {
+  g_slice_free(struct thread_stats, data);
+}
+
+static gpointer thread_stats_init(gpointer data G_GNUC_UNUSED) {
+  thread_stats = g_private_new(thread_stats_free);
+  return NULL;
+}
+
+// called on every read and decode, so avoid taking a lock
+static struct thread_stats *get_thread_stats(void) {
+  static GOnce once = G_ONCE_INIT;
+  g_once(&once, thread_stats_init, NULL);
+
+  struct thread_stats *ts = g_private_get(thread_stats);
+  if (!ts) {
+    ts = g_slice_new0(struct thread_stats);
+    ts->codec = -1;
+    g_private_set(thread_stats, ts);
+  }
+  return ts;
+}
+
+// microseconds
+static int64_t get_time(void) {
+#if GLIB_CHECK_VERSION(2,28,0)
+  return g_get_monotonic_time();
+#else
+  GTimeVal tv;
+  g_get_current_time(&tv);
+  return (int64_t) tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec;
+#endif
+}
+
+struct _openslide_stats *_openslide_stats_create(void) {
+  struct _openslide_stats *stats = g_slice_new0(struct _openslide_stats);
+  stats->mutex = g_mutex_new();
+  return stats;
+}
+
+int64_t _openslide_stats_get(struct _openslide_stats *stats, int32_t stat) {
+  if (stat < 0 || stat >= _OPENSLIDE_STAT_COUNT) {
+    return -1;
+  }
+  g_mutex_lock(stats->mutex);
+  int64_t value = stats->values[stat];
+  g_mutex_unlock(stats->mutex);
+  return value;
+}
+
+void _openslide_stats_reset(struct _openslide_stats *stats) {
+  g_mutex_lock(stats->mutex);
+  memset(stats->values, 0, sizeof(stats->values));
+  g_mutex_unlock(stats->mutex);
+}
+
+void _openslide_stats_destroy(struct _openslide_stats *stats) {
+  g_mutex_free(stats->mutex);
+  g_slice_free(struct _openslide_stats, stats);
+}
+
+struct _openslide_stats *_openslide_stats_set_current(struct _openslide_stats *stats) {
+  struct thread_stats *ts = get_thread_stats();
+  struct _openslide_stats *prev = ts->stats;
+  ts->stats = stats;
+  return prev;
+}
+
+struct _openslide_stats *_openslide_stats_get_current(void) {
+  return get_thread_stats()->stats;
+}
+
+void _openslide_stats_set_scan(struct _openslide_stats *stats, bool scan) {
+  g_atomic_int_set(&stats->scan, scan);
+}
+
+bool _openslide_stats_get_scan(void) {
+  struct thread_stats *ts = get_thread_stats();
+  return ts->stats && g_atomic_int_get(&ts->stats->scan);
+}
+
+static void add(struct _openslide_stats *stats, int32_t stat, int64_t value) {
+  g_mutex_lock(stats->mutex);
+  stats->values[stat] += value;
+  g_mutex_unlock(stats->mutex);
+}
+
+void _openslide_stats_add(int32_t stat, int64_t value) {
+  struct thread_stats *ts = get_thread_stats();
+  if (ts->stats) {
+    add(ts->stats, stat, value);
+  }
+}
+
+void _openslide_stats_begin(struct _openslide_stats_timer *timer) {
+  struct thread_stats *ts = get_thread_stats();
+  if (!ts->stats && !ts->tracing) {
+    timer->start = -1;
+    return;
+  }
+  timer->nested = ts->nested;
+  ts->nested = 0;
+  timer->start = get_time();
+}
+
+void _openslide_stats_end(struct _openslide_stats_timer *timer, int32_t stat) {
+  if (timer->start < 0) {
+    return;
+  }
+  struct thread_stats *ts = get_thread_stats();
+  int64_t elapsed = get_time() - timer->start;
+  if (stat >= OPENSLIDE_STAT_DECODE_TIME_JPEG &&
+      stat <= OPENSLIDE_STAT_DECODE_TIME_OTHER) {
+    ts->codec = stat;
+  }
+  if (stat >= 0 && ts->stats) {
+    add(ts->stats, stat, MAX(elapsed - ts->nested, 0));
+  }
+  // the whole phase is nested within the enclosing one
+  ts->nested = timer->nested + elapsed;
+}
+
+size_t _openslide_fread(FILE *f, void *buf, size_t size) {
+  struct _openslide_stats_timer timer;
+  _openslide_stats_begin(&timer);
+  size_t count = fread(buf, 1, size, f);
+  _openslide_stats_end(&timer, OPENSLIDE_STAT_READ_TIME);
+  _openslide_stats_bytes_read(count);
+  return count;
+}
+
+void _openslide_stats_bytes_read(int64_t count) {
+  struct thread_stats *ts = get_thread_stats();
+  ts->bytes_read += count;
+  if (ts->stats) {
+    add(ts->stats, OPENSLIDE_STAT_BYTES_READ, count);
+  }
+}
+
+void _openslide_trace_set_callback(openslide_trace_callback_t callback,
+                                   void *data) {
+  G_LOCK(trace_callback);
+  trace_callback = callback;
+  trace_data = data;
+  g_atomic_int_set(&trace_enabled, callback != NULL);
+  G_UNLOCK(trace_callback);
+}
+
+bool _openslide_trace_begin(struct _openslide_trace *trace) {
+  if (G_LIKELY(!g_atomic_int_get(&trace_enabled))) {
+    return false;
+  }
+  struct thread_stats *ts = get_thread_stats();
+  ts->tracing++;
+  trace->codec = ts->codec;
+  ts->codec = -1;
+  trace->bytes = ts->bytes_read;
+  trace->start = get_time();
+  return true;
+}
+
+void _openslide_trace_end(struct _openslide_trace *trace,
+                          openslide_trace_event_t *event) {
+  struct thread_stats *ts = get_thread_stats();
+  event->duration = get_time() - trace->start;
+  event->bytes = ts->bytes_read - trace->bytes;
+  event->codec = ts->codec >= 0 ? codec_names[ts->codec] : NULL;
+  if (ts->codec < 0) {
+    ts->codec = trace->codec;
+  }
+  ts->tracing--;
+
+  // the callback may have changed since the event began
+  G_LOCK(trace_callback);
+  openslide_trace_callback_t callback = trace_callback;
+  void *data = trace_data;
+  G_UNLOCK(trace_callback);
+  if (callback) {
+    callback(event, data);
+  }
+}
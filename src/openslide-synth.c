@@ -0,0 +1,273 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2007-2014 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "openslide-private.h"
+
+#include <string.h>
+#include <math.h>
+
+#include <glib.h>
+#include <cairo.h>
+
+// each synthesized level is this many times smaller than its source
+#define SYNTH_FACTOR 4
+// levels are synthesized between backend levels further apart than this
+#define MAX_LEVEL_GAP 8
+// and after the last backend level, until it fits in this many pixels
+// on a side
+#define MAX_LAST_LEVEL_SIZE 2048
+#define SYNTH_TILE_SIZE 256
+
+struct synth_level {
+  struct _openslide_level base;
+  struct _openslide_level *source;    // SYNTH_FACTOR times larger
+  struct _openslide_grid *grid;
+  struct _openslide_scale_weights *weights;  // for a tile, either axis
+};
+
+struct _openslide_synth {
+  struct _openslide_level **levels;   // backend and synthesized, in order
+  bool *synthesized;
+  int32_t level_count;
+};
+
+static gint enabled;  // must use g_atomic_int!
+
+void _openslide_synth_set_enabled(bool enable) {
+  g_atomic_int_set(&enabled, enable);
+}
+
+bool _openslide_synth_get_enabled(void) {
+  return g_atomic_int_get(&enabled);
+}
+
+int32_t _openslide_get_level_count(openslide_t *osr) {
+  return osr->synth ? osr->synth->level_count : osr->level_count;
+}
+
+struct _openslide_level *_openslide_get_level(openslide_t *osr,
+                                              int32_t level) {
+  g_assert(level >= 0 && level < _openslide_get_level_count(osr));
+  return osr->synth ? osr->synth->levels[level] : osr->levels[level];
+}
+
+static struct synth_level *get_synth_level(openslide_t *osr,
+                                           struct _openslide_level *level) {
+  struct _openslide_synth *synth = osr->synth;
+  if (!synth) {
+    return NULL;
+  }
+  for (int32_t i = 0; i < synth->level_count; i++) {
+    if (synth->levels[i] == level) {
+      return synth->synthesized[i] ? (struct synth_level *) level : NULL;
+    }
+  }
+  return NULL;
+}
+
+bool _openslide_level_is_synthesized(openslide_t *osr,
+                                     struct _openslide_level *level) {
+  return get_synth_level(osr, level) != NULL;
+}
+
+bool _openslide_paint_region(openslide_t *osr, cairo_t *cr,
+                             int64_t x, int64_t y,
+                             struct _openslide_level *level,
+                             int32_t w, int32_t h,
+                             GError **err) {
+  struct synth_level *l = get_synth_level(osr, level);
+  if (!l) {
+    return osr->ops->paint_region(osr, cr, x, y, level, w, h, err);
+  }
+  return _openslide_grid_paint_region(l->grid, cr, NULL,
+                                      x / l->base.downsample,
+                                      y / l->base.downsample,
+                                      level, w, h, err);
+}
+
+// downsample the source region under the tile
+static bool render_tile(openslide_t *osr,
+                        struct synth_level *l,
+                        uint32_t *dest,
+                        int64_t tile_col, int64_t tile_row,
+                        GError **err) {
+  const int64_t ts = SYNTH_TILE_SIZE;
+  const int64_t ss = ts * SYNTH_FACTOR;
+  struct _openslide_level *source = l->source;
+
+  uint32_t *buf = g_new0(uint32_t, ss * ss);
+  cairo_surface_t *surface =
+    cairo_image_surface_create_for_data((unsigned char *) buf,
+                                        CAIRO_FORMAT_ARGB32,
+                                        ss, ss, ss * 4);
+  cairo_t *cr = cairo_create(surface);
+  cairo_surface_destroy(surface);
+  // like read_region(), to hide seams between source tiles
+  cairo_set_operator(cr, CAIRO_OPERATOR_SATURATE);
+  bool success =
+    _openslide_paint_region(osr, cr,
+                            tile_col * ss * source->downsample,
+                            tile_row * ss * source->downsample,
+                            source, ss, ss, err) &&
+    _openslide_check_cairo_status(cr, err);
+  cairo_destroy(cr);
+
+  if (success) {
+    struct _openslide_stats_timer timer;
+    _openslide_stats_begin(&timer);
+    _openslide_scale_area(buf, ss, 0, 0, ss,
+                          dest, ts, 0, 0, ts, ts,
+                          l->weights, l->weights);
+    _openslide_stats_end(&timer, OPENSLIDE_STAT_CONVERT_TIME);
+  }
+  g_free(buf);
+  return success;
+}
+
+static bool read_tile(openslide_t *osr,
+                      cairo_t *cr,
+                      struct _openslide_level *level,
+                      int64_t tile_col, int64_t tile_row,
+                      void *arg G_GNUC_UNUSED,
+                      GError **err) {
+  struct synth_level *l = (struct synth_level *) level;
+  const int64_t ts = SYNTH_TILE_SIZE;
+
+  // cache
+  struct _openslide_cache_entry *cache_entry;
+  uint32_t *tiledata = _openslide_cache_get(osr->cache,
+                                            level, tile_col, tile_row,
+                                            &cache_entry);
+  if (!tiledata) {
+    tiledata = _openslide_tile_buffer_alloc(ts * ts * 4);
+    if (!render_tile(osr, l, tiledata, tile_col, tile_row, err)) {
+      _openslide_tile_buffer_free(tiledata, ts * ts * 4);
+      return false;
+    }
+
+    // put it in the cache
+    _openslide_cache_put(osr->cache, level, tile_col, tile_row,
+                         tiledata, ts * ts * 4,
+                         &cache_entry);
+  }
+
+  // draw it
+  cairo_surface_t *surface = cairo_image_surface_create_for_data((unsigned char *) tiledata,
+                                                                 CAIRO_FORMAT_ARGB32,
+                                                                 ts, ts,
+                                                                 ts * 4);
+  cairo_set_source_surface(cr, surface, 0, 0);
+  cairo_surface_destroy(surface);
+  cairo_paint(cr);
+
+  // done with the cache entry, release it
+  _openslide_cache_entry_unref(cache_entry);
+
+  return true;
+}
+
+static struct synth_level *create_level(openslide_t *osr,
+                                        struct _openslide_level *source) {
+  struct synth_level *l = g_slice_new0(struct synth_level);
+  l->source = source;
+  l->base.downsample = source->downsample * SYNTH_FACTOR;
+  l->base.w = (source->w + SYNTH_FACTOR - 1) / SYNTH_FACTOR;
+  l->base.h = (source->h + SYNTH_FACTOR - 1) / SYNTH_FACTOR;
+  // keep the tile geometry hints consistent across levels
+  if (osr->levels[0]->tile_w > 0 && osr->levels[0]->tile_h > 0) {
+    l->base.tile_w = SYNTH_TILE_SIZE;
+    l->base.tile_h = SYNTH_TILE_SIZE;
+  }
+
+  l->grid = _openslide_grid_create_simple(osr,
+                                          (l->base.w + SYNTH_TILE_SIZE - 1) /
+                                          SYNTH_TILE_SIZE,
+                                          (l->base.h + SYNTH_TILE_SIZE - 1) /
+                                          SYNTH_TILE_SIZE,
+                                          SYNTH_TILE_SIZE,
+                                          SYNTH_TILE_SIZE,
+                                          read_tile);
+  l->weights = _openslide_scale_weights_create(SYNTH_TILE_SIZE,
+                                               SYNTH_FACTOR);
+  return l;
+}
+
+struct _openslide_synth *_openslide_synth_create(openslide_t *osr) {
+  if (!_openslide_synth_get_enabled() || !osr->level_count) {
+    return NULL;
+  }
+  // synthesized tiles aren't keyed by plane
+  for (int32_t i = 0; osr->ops->get_plane_count &&
+                      i < _OPENSLIDE_PLANE_DIMENSIONS; i++) {
+    if (osr->ops->get_plane_count(osr, i) > 1) {
+      return NULL;
+    }
+  }
+
+  GPtrArray *levels = g_ptr_array_new();
+  GArray *synthesized = g_array_new(false, false, sizeof(bool));
+  bool any = false;
+  for (int32_t i = 0; i < osr->level_count; i++) {
+    struct _openslide_level *cur = osr->levels[i];
+    bool no = false;
+    g_ptr_array_add(levels, cur);
+    g_array_append_val(synthesized, no);
+
+    // fill the gap to the next level
+    bool last = i == osr->level_count - 1;
+    while (last ? MAX(cur->w, cur->h) > MAX_LAST_LEVEL_SIZE :
+           osr->levels[i + 1]->downsample / cur->downsample > MAX_LEVEL_GAP) {
+      bool yes = true;
+      cur = (struct _openslide_level *) create_level(osr, cur);
+      g_ptr_array_add(levels, cur);
+      g_array_append_val(synthesized, yes);
+      any = true;
+    }
+  }
+  if (!any) {
+    g_ptr_array_free(levels, true);
+    g_array_free(synthesized, true);
+    return NULL;
+  }
+
+  struct _openslide_synth *synth = g_slice_new0(struct _openslide_synth);
+  synth->level_count = levels->len;
+  synth->levels = (struct _openslide_level **)
+    g_ptr_array_free(levels, false);
+  synth->synthesized = (bool *) g_array_free(synthesized, false);
+  return synth;
+}
+
+void _openslide_synth_destroy(struct _openslide_synth *synth) {
+  for (int32_t i = 0; i < synth->level_count; i++) {
+    if (synth->synthesized[i]) {
+      struct synth_level *l = (struct synth_level *) synth->levels[i];
+      _openslide_grid_destroy(l->grid);
+      _openslide_scale_weights_destroy(l->weights);
+      g_slice_free(struct synth_level, l);
+    }
+  }
+  g_free(synth->levels);
+  g_free(synth->synthesized);
+  g_slice_free(struct _openslide_synth, synth);
+}
@@ -29,7 +29,9 @@
 #include <string.h>
 #include <math.h>
 #include <errno.h>
+#include <sys/stat.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <cairo.h>
 
 #ifdef HAVE_FCNTL
@@ -39,7 +41,12 @@
 
 #define KEY_FILE_HARD_MAX_SIZE (100 << 20)
 
+// idle handles kept per filecache
+#define FILECACHE_MAX 32
+
 static const char DEBUG_ENV_VAR[] = "OPENSLIDE_DEBUG";
+static const char CACHE_DIR_ENV_VAR[] = "OPENSLIDE_CACHE_DIR";
+static const char MMAP_ENV_VAR[] = "OPENSLIDE_MMAP";
 
 static const struct debug_option {
   const char *kw;
@@ -198,9 +205,21 @@ static FILE *do_fopen(const char *path, const char *mode, GError **err) {
 
 FILE *_openslide_fopen(const char *path, const char *mode, GError **err)
 {
+  struct _openslide_trace trace;
+  bool tracing = _openslide_trace_begin(&trace);
   char *m = g_strconcat(mode, FOPEN_CLOEXEC_FLAG, NULL);
   FILE *f = do_fopen(path, m, err);
   g_free(m);
+  if (tracing) {
+    openslide_trace_event_t event = {
+      .type = OPENSLIDE_TRACE_FILE_OPEN,
+      .filename = path,
+      .level = -1,
+      .tile_col = -1,
+      .tile_row = -1,
+    };
+    _openslide_trace_end(&trace, &event);
+  }
   if (f == NULL) {
     return NULL;
   }
@@ -231,6 +250,66 @@ FILE *_openslide_fopen(const char *path, const char *mode, GError **err)
   return f;
 }
 
+/* FILE handles are not thread-safe, but reopening a file for every read
+   is slow on network filesystems, so we have a handle cache */
+struct _openslide_filecache {
+  char *path;
+  GQueue *cache;
+  GMutex *lock;
+};
+
+struct _openslide_filecache *_openslide_filecache_create(const char *path) {
+  struct _openslide_filecache *fc = g_slice_new0(struct _openslide_filecache);
+  fc->path = g_strdup(path);
+  fc->cache = g_queue_new();
+  fc->lock = g_mutex_new();
+  return fc;
+}
+
+// the handle's position is not preserved, so callers must seek
+FILE *_openslide_filecache_get(struct _openslide_filecache *fc,
+                               GError **err) {
+  g_mutex_lock(fc->lock);
+  FILE *f = g_queue_pop_head(fc->cache);
+  g_mutex_unlock(fc->lock);
+
+  if (f == NULL) {
+    f = _openslide_fopen(fc->path, "rb", err);
+  }
+  return f;
+}
+
+void _openslide_filecache_put(struct _openslide_filecache *fc, FILE *f) {
+  if (f == NULL) {
+    return;
+  }
+
+  g_mutex_lock(fc->lock);
+  if (g_queue_get_length(fc->cache) < FILECACHE_MAX) {
+    g_queue_push_head(fc->cache, f);
+    f = NULL;
+  }
+  g_mutex_unlock(fc->lock);
+
+  if (f) {
+    fclose(f);
+  }
+}
+
+void _openslide_filecache_destroy(struct _openslide_filecache *fc) {
+  if (fc == NULL) {
+    return;
+  }
+  FILE *f;
+  while ((f = g_queue_pop_head(fc->cache)) != NULL) {
+    fclose(f);
+  }
+  g_queue_free(fc->cache);
+  g_mutex_free(fc->lock);
+  g_free(fc->path);
+  g_slice_free(struct _openslide_filecache, fc);
+}
+
 #undef g_ascii_strtod
 double _openslide_parse_double(const char *value) {
   // Canonicalize comma to decimal point, since the locale of the
@@ -359,31 +438,23 @@ void _openslide_set_bounds_props_from_grid(openslide_t *osr,
 bool _openslide_clip_tile(uint32_t *tiledata,
                           int64_t tile_w, int64_t tile_h,
                           int64_t clip_w, int64_t clip_h,
-                          GError **err) {
+                          GError **err G_GNUC_UNUSED) {
   if (clip_w >= tile_w && clip_h >= tile_h) {
     return true;
   }
+  clip_w = CLAMP(clip_w, 0, tile_w);
+  clip_h = CLAMP(clip_h, 0, tile_h);
+
+  // clear the tail of the visible rows, then the rows below them, which
+  // are contiguous
+  if (clip_w < tile_w) {
+    for (int64_t y = 0; y < clip_h; y++) {
+      memset(tiledata + y * tile_w + clip_w, 0, (tile_w - clip_w) * 4);
+    }
+  }
+  memset(tiledata + clip_h * tile_w, 0, (tile_h - clip_h) * tile_w * 4);
 
-  cairo_surface_t *surface =
-    cairo_image_surface_create_for_data((unsigned char *) tiledata,
-                                        CAIRO_FORMAT_ARGB32,
-                                        tile_w, tile_h,
-                                        tile_w * 4);
-  cairo_t *cr = cairo_create(surface);
-  cairo_surface_destroy(surface);
-
-  cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
-
-  cairo_rectangle(cr, clip_w, 0, tile_w - clip_w, tile_h);
-  cairo_fill(cr);
-
-  cairo_rectangle(cr, 0, clip_h, tile_w, tile_h - clip_h);
-  cairo_fill(cr);
-
-  bool success = _openslide_check_cairo_status(cr, err);
-  cairo_destroy(cr);
-
-  return success;
+  return true;
 }
 
 // note: g_getenv() is not reentrant
@@ -420,6 +491,55 @@ bool _openslide_debug(enum _openslide_debug_flag flag) {
   return !!(debug_flags & (1 << flag));
 }
 
+// path for data derived from slides, or NULL if no cache dir is configured
+char *_openslide_get_cache_path(const char *subdir, const char *name) {
+  const char *dir = g_getenv(CACHE_DIR_ENV_VAR);
+  if (!dir || !*dir) {
+    return NULL;
+  }
+  return g_build_filename(dir, subdir, name, NULL);
+}
+
+static gpointer mmap_init(gpointer data G_GNUC_UNUSED) {
+  const char *str = g_getenv(MMAP_ENV_VAR);
+  return GINT_TO_POINTER(str && !strcmp(str, "1"));
+}
+
+// mapped files turn I/O errors, and files truncated or changed on a
+// network filesystem, into SIGBUS, so mapping is opt-in
+bool _openslide_mmap_enabled(void) {
+  static GOnce once = G_ONCE_INIT;
+  return GPOINTER_TO_INT(g_once(&once, mmap_init, NULL));
+}
+
+bool _openslide_have_cache_dir(void) {
+  const char *dir = g_getenv(CACHE_DIR_ENV_VAR);
+  return dir && *dir;
+}
+
+// identifies a version of a file by its path, size and modification time
+char *_openslide_get_file_key(const char *filename) {
+  struct stat st;
+  if (g_stat(filename, &st)) {
+    return NULL;
+  }
+
+  char *abs_filename;
+  if (g_path_is_absolute(filename)) {
+    abs_filename = g_strdup(filename);
+  } else {
+    char *cwd = g_get_current_dir();
+    abs_filename = g_build_filename(cwd, filename, NULL);
+    g_free(cwd);
+  }
+  char *str = g_strdup_printf("%s\n%"PRId64"\n%"PRId64, abs_filename,
+                              (int64_t) st.st_size, (int64_t) st.st_mtime);
+  char *key = g_compute_checksum_for_string(G_CHECKSUM_SHA256, str, -1);
+  g_free(str);
+  g_free(abs_filename);
+  return key;
+}
+
 void _openslide_performance_warn_once(gint *warned_flag,
                                       const char *str, ...) {
   if (_openslide_debug(OPENSLIDE_DEBUG_PERFORMANCE)) {
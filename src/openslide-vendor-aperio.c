@@ -57,6 +57,11 @@ struct level {
   struct level *prev;
   GHashTable *missing_tiles;
   uint16_t compression;
+
+  // reduced-resolution levels decode the tiles of their source level,
+  // discarding reduce JP2K resolution levels
+  struct level *source;
+  int32_t reduce;
 };
 
 static void destroy_data(struct aperio_ops_data *data,
@@ -133,7 +138,8 @@ static bool render_missing_tile(struct level *l,
   return success;
 }
 
-static bool decode_tile(struct level *l,
+static bool decode_tile(openslide_t *osr,
+                        struct level *l,
                         TIFF *tiff,
                         uint32_t *dest,
                         int64_t tile_col, int64_t tile_row,
@@ -159,15 +165,17 @@ static bool decode_tile(struct level *l,
     break;
   default:
     // not for us? fallback
-    return _openslide_tiff_read_tile(tiffl, tiff, dest,
+    return _openslide_tiff_read_tile(osr, tiffl, tiff, dest,
                                      tile_col, tile_row,
                                      err);
   }
 
   // read raw tile
+  struct _openslide_tiff_level *src_tiffl =
+    l->source ? &l->source->tiffl : tiffl;
   void *buf;
   int32_t buflen;
-  if (!_openslide_tiff_read_tile_data(tiffl, tiff,
+  if (!_openslide_tiff_read_tile_data(osr, src_tiffl, tiff,
                                       &buf, &buflen,
                                       tile_col, tile_row,
                                       err)) {
@@ -175,10 +183,11 @@ static bool decode_tile(struct level *l,
   }
 
   // decompress
+  int32_t threads = _openslide_grid_get_tile_decode_threads(osr);
   bool success = _openslide_jp2k_decode_buffer(dest,
                                                tiffl->tile_w, tiffl->tile_h,
                                                buf, buflen,
-                                               space,
+                                               space, l->reduce, threads,
                                                err);
 
   // clean up
@@ -203,13 +212,23 @@ static bool read_tile(openslide_t *osr,
 
   // cache
   struct _openslide_cache_entry *cache_entry;
-  uint32_t *tiledata = _openslide_cache_get(osr->cache,
-                                            level, tile_col, tile_row,
-                                            &cache_entry);
+  uint32_t *tiledata = _openslide_cache_get_tile(osr->cache,
+                                                 level, tile_col, tile_row,
+                                                 tw, th, CAIRO_FORMAT_ARGB32,
+                                                 &cache_entry);
   if (!tiledata) {
-    tiledata = g_slice_alloc(tw * th * 4);
-    if (!decode_tile(l, tiff, tiledata, tile_col, tile_row, err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+    // the request is exactly this tile; decode it in place, uncached
+    uint32_t *dest = _openslide_grid_get_tile_dest(cr, tw, th);
+    if (dest) {
+      return decode_tile(osr, l, tiff, dest, tile_col, tile_row, err) &&
+             _openslide_tiff_clip_tile(tiffl, dest,
+                                       tile_col, tile_row,
+                                       err);
+    }
+
+    tiledata = _openslide_tile_buffer_alloc(tw * th * 4);
+    if (!decode_tile(osr, l, tiff, tiledata, tile_col, tile_row, err)) {
+      _openslide_tile_buffer_free(tiledata, tw * th * 4);
       return false;
     }
 
@@ -217,14 +236,14 @@ static bool read_tile(openslide_t *osr,
     if (!_openslide_tiff_clip_tile(tiffl, tiledata,
                                    tile_col, tile_row,
                                    err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+      _openslide_tile_buffer_free(tiledata, tw * th * 4);
       return false;
     }
 
     // put it in the cache
-    _openslide_cache_put(osr->cache, level, tile_col, tile_row,
-			 tiledata, tw * th * 4,
-			 &cache_entry);
+    _openslide_cache_put_tile(osr->cache, level, tile_col, tile_row,
+			       tw, th, CAIRO_FORMAT_ARGB32, tiledata,
+			       &cache_entry);
   }
 
   // draw it
@@ -265,8 +284,39 @@ static bool paint_region(openslide_t *osr, cairo_t *cr,
   return success;
 }
 
+static bool read_raw_tile(openslide_t *osr,
+                          struct _openslide_level *level,
+                          int64_t tile_col, int64_t tile_row,
+                          void **buf, int32_t *len,
+                          GError **err) {
+  struct aperio_ops_data *data = osr->data;
+  struct level *l = (struct level *) level;
+
+  // rendered from the previous level
+  int64_t tile_no = tile_row * l->tiffl.tiles_across + tile_col;
+  if (g_hash_table_lookup_extended(l->missing_tiles, &tile_no, NULL, NULL)) {
+    *buf = NULL;
+    *len = 0;
+    return true;
+  }
+
+  TIFF *tiff = _openslide_tiffcache_get(data->tc, err);
+  if (tiff == NULL) {
+    return false;
+  }
+
+  bool success = _openslide_tiff_read_raw_jpeg_tile(osr, &l->tiffl, tiff,
+                                                    buf, len,
+                                                    tile_col, tile_row,
+                                                    err);
+  _openslide_tiffcache_put(data->tc, tiff);
+
+  return success;
+}
+
 static const struct _openslide_ops aperio_ops = {
   .paint_region = paint_region,
+  .read_raw_tile = read_raw_tile,
   .destroy = destroy,
 };
 
@@ -409,7 +459,8 @@ static void propagate_missing_tile(void *key, void *value G_GNUC_UNUSED,
 
 // check for OpenJPEG CVE-2013-6045 breakage
 // (see openslide-decode-jp2k.c)
-static bool test_tile_decoding(struct level *l,
+static bool test_tile_decoding(openslide_t *osr,
+                               struct level *l,
                                TIFF *tiff,
                                GError **err) {
   // only for JP2K slides.
@@ -423,11 +474,136 @@ static bool test_tile_decoding(struct level *l,
   int64_t th = l->tiffl.tile_h;
 
   uint32_t *dest = g_slice_alloc(tw * th * 4);
-  bool ok = decode_tile(l, tiff, dest, 0, 0, err);
+  bool ok = decode_tile(osr, l, tiff, dest, 0, 0, err);
   g_slice_free1(tw * th * 4, dest);
   return ok;
 }
 
+// how many JP2K resolution levels the tiles of a level can discard
+static int32_t get_level_reductions(openslide_t *osr,
+                                    struct level *l,
+                                    TIFF *tiff) {
+  if (l->compression != APERIO_COMPRESSION_JP2K_YCBCR &&
+      l->compression != APERIO_COMPRESSION_JP2K_RGB) {
+    return 0;
+  }
+  int64_t tile_no = 0;
+  if (g_hash_table_lookup_extended(l->missing_tiles, &tile_no, NULL, NULL)) {
+    return 0;
+  }
+
+  // every tile of a level is encoded alike, so check the first one
+  void *buf;
+  int32_t buflen;
+  int32_t reductions = 0;
+  GError *tmp_err = NULL;
+  if (!_openslide_tiff_read_tile_data(osr, &l->tiffl, tiff,
+                                      &buf, &buflen, 0, 0, &tmp_err)) {
+    g_debug("Couldn't read JP2K tile: %s", tmp_err->message);
+    g_clear_error(&tmp_err);
+    return 0;
+  }
+  if (!_openslide_jp2k_get_resolution_reductions(buf, buflen,
+                                                 &reductions, &tmp_err)) {
+    g_debug("Couldn't read JP2K resolutions: %s", tmp_err->message);
+    g_clear_error(&tmp_err);
+    reductions = 0;
+  }
+  g_free(buf);
+  return reductions;
+}
+
+static struct level *create_reduced_level(openslide_t *osr,
+                                          struct level *source,
+                                          int32_t reduce,
+                                          struct _openslide_tiffcache *tc) {
+  struct level *l = g_slice_new0(struct level);
+  struct _openslide_tiff_level *tiffl = &l->tiffl;
+  l->source = source;
+  l->reduce = reduce;
+  l->compression = source->compression;
+
+  // same tiles, each 1 << reduce times smaller
+  *tiffl = source->tiffl;
+  tiffl->tile_read_direct = false;
+  tiffl->warned_read_indirect = 0;
+  tiffl->image_w = (tiffl->image_w + (1 << reduce) - 1) >> reduce;
+  tiffl->image_h = (tiffl->image_h + (1 << reduce) - 1) >> reduce;
+  tiffl->tile_w >>= reduce;
+  tiffl->tile_h >>= reduce;
+  l->base.w = tiffl->image_w;
+  l->base.h = tiffl->image_h;
+  l->base.tile_w = tiffl->tile_w;
+  l->base.tile_h = tiffl->tile_h;
+
+  l->grid = _openslide_grid_create_simple(osr,
+                                          tiffl->tiles_across,
+                                          tiffl->tiles_down,
+                                          tiffl->tile_w,
+                                          tiffl->tile_h,
+                                          read_tile);
+  _openslide_tiff_grid_enable_parallel_decode(l->grid, tc);
+  // reads the source tiles
+  _openslide_tiff_grid_enable_coalesced_reads(l->grid, &source->tiffl);
+
+  // the same tiles are missing
+  l->missing_tiles = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                           g_free, NULL);
+  GHashTableIter iter;
+  gpointer key;
+  g_hash_table_iter_init(&iter, source->missing_tiles);
+  while (g_hash_table_iter_next(&iter, &key, NULL)) {
+    int64_t *p_tile_no = g_new(int64_t, 1);
+    *p_tile_no = *(int64_t *) key;
+    g_hash_table_insert(l->missing_tiles, p_tile_no, NULL);
+  }
+  return l;
+}
+
+// Sparse JP2K pyramids can have 4x-16x between levels.  Fill the gaps
+// with levels decoded from the finer level at reduced resolution, so
+// that low-magnification reads don't decode far more pixels than they
+// return.  This renumbers the levels, so like synthesized levels it is
+// opt-in.
+static void add_reduced_levels(openslide_t *osr,
+                               struct _openslide_tiffcache *tc,
+                               TIFF *tiff,
+                               struct level ***_levels,
+                               int32_t *_level_count) {
+  struct level **levels = *_levels;
+  int32_t level_count = *_level_count;
+  GPtrArray *result = g_ptr_array_new();
+
+  for (int32_t i = 0; i < level_count; i++) {
+    struct level *l = levels[i];
+    g_ptr_array_add(result, l);
+    if (i == level_count - 1) {
+      break;
+    }
+    struct level *next = levels[i + 1];
+
+    int32_t reductions = get_level_reductions(osr, l, tiff);
+    for (int32_t r = 1; r <= reductions; r++) {
+      // keep at least 2x from the next real level, and whole tiles
+      if (l->tiffl.image_w / (double) (1 << (r + 1)) <
+          next->tiffl.image_w * 0.99 ||
+          l->tiffl.tile_w % (1 << r) || l->tiffl.tile_h % (1 << r)) {
+        break;
+      }
+      //g_debug("reduced level %d from level %d", r, i);
+      g_ptr_array_add(result, create_reduced_level(osr, l, r, tc));
+    }
+  }
+
+  for (uint32_t i = 1; i < result->len; i++) {
+    struct level *l = result->pdata[i];
+    l->prev = result->pdata[i - 1];
+  }
+  g_free(levels);
+  *_level_count = result->len;
+  *_levels = (struct level **) g_ptr_array_free(result, false);
+}
+
 static bool aperio_open(openslide_t *osr,
                         const char *filename,
                         struct _openslide_tifflike *tl,
@@ -523,12 +699,15 @@ static bool aperio_open(openslide_t *osr,
         goto FAIL;
       }
 
+      // JPEG tiles can be returned without decoding
+      l->base.raw_tiles = tiffl->tile_read_direct;
       l->grid = _openslide_grid_create_simple(osr,
                                               tiffl->tiles_across,
                                               tiffl->tiles_down,
                                               tiffl->tile_w,
                                               tiffl->tile_h,
                                               read_tile);
+      _openslide_tiff_grid_enable_parallel_decode(l->grid, tc);
 
       // get compression
       if (!TIFFGetField(tiff, TIFFTAG_COMPRESSION, &l->compression)) {
@@ -537,6 +716,13 @@ static bool aperio_open(openslide_t *osr,
         goto FAIL;
       }
 
+      // tiles we read raw can be fetched together
+      if (tiffl->tile_read_direct ||
+          l->compression == APERIO_COMPRESSION_JP2K_YCBCR ||
+          l->compression == APERIO_COMPRESSION_JP2K_RGB) {
+        _openslide_tiff_grid_enable_coalesced_reads(l->grid, tiffl);
+      }
+
       // some Aperio slides have some zero-length tiles, apparently due to
       // an encoder bug
       toff_t *tile_sizes;
@@ -573,10 +759,16 @@ static bool aperio_open(openslide_t *osr,
   }
 
   // check for OpenJPEG CVE-2013-6045 breakage
-  if (!test_tile_decoding(levels[0], tiff, err)) {
+  if (!test_tile_decoding(osr, levels[0], tiff, err)) {
     goto FAIL;
   }
 
+  // properties and hash come from the directories of the real levels
+  tdir_t lowest_dir = levels[level_count - 1]->tiffl.dir;
+  if (_openslide_synth_get_enabled()) {
+    add_reduced_levels(osr, tc, tiff, &levels, &level_count);
+  }
+
   // read properties
   if (!_openslide_tiff_set_dir(tiff, 0, err)) {
     goto FAIL;
@@ -593,7 +785,7 @@ static bool aperio_open(openslide_t *osr,
 
   // set hash and properties
   if (!_openslide_tifflike_init_properties_and_hash(osr, tl, quickhash1,
-                                                    levels[level_count - 1]->tiffl.dir,
+                                                    lowest_dir,
                                                     0,
                                                     err)) {
     goto FAIL;
@@ -77,15 +77,27 @@ static bool read_tile(openslide_t *osr,
 
   // cache
   struct _openslide_cache_entry *cache_entry;
-  uint32_t *tiledata = _openslide_cache_get(osr->cache,
-                                            level, tile_col, tile_row,
-                                            &cache_entry);
+  uint32_t *tiledata = _openslide_cache_get_tile(osr->cache,
+                                                 level, tile_col, tile_row,
+                                                 tw, th, CAIRO_FORMAT_ARGB32,
+                                                 &cache_entry);
   if (!tiledata) {
-    tiledata = g_slice_alloc(tw * th * 4);
-    if (!_openslide_tiff_read_tile(tiffl, tiff,
+    // the request is exactly this tile; decode it in place, uncached
+    uint32_t *dest = _openslide_grid_get_tile_dest(cr, tw, th);
+    if (dest) {
+      return _openslide_tiff_read_tile(osr, tiffl, tiff,
+                                       dest, tile_col, tile_row,
+                                       err) &&
+             _openslide_tiff_clip_tile(tiffl, dest,
+                                       tile_col, tile_row,
+                                       err);
+    }
+
+    tiledata = _openslide_tile_buffer_alloc(tw * th * 4);
+    if (!_openslide_tiff_read_tile(osr, tiffl, tiff,
                                    tiledata, tile_col, tile_row,
                                    err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+      _openslide_tile_buffer_free(tiledata, tw * th * 4);
       return false;
     }
 
@@ -93,14 +105,14 @@ static bool read_tile(openslide_t *osr,
     if (!_openslide_tiff_clip_tile(tiffl, tiledata,
                                    tile_col, tile_row,
                                    err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+      _openslide_tile_buffer_free(tiledata, tw * th * 4);
       return false;
     }
 
     // put it in the cache
-    _openslide_cache_put(osr->cache, level, tile_col, tile_row,
-                         tiledata, tw * th * 4,
-                         &cache_entry);
+    _openslide_cache_put_tile(osr->cache, level, tile_col, tile_row,
+                               tw, th, CAIRO_FORMAT_ARGB32, tiledata,
+                               &cache_entry);
   }
 
   // draw it
@@ -141,8 +153,31 @@ static bool paint_region(openslide_t *osr, cairo_t *cr,
   return success;
 }
 
+static bool read_raw_tile(openslide_t *osr,
+                          struct _openslide_level *level,
+                          int64_t tile_col, int64_t tile_row,
+                          void **buf, int32_t *len,
+                          GError **err) {
+  struct generic_tiff_ops_data *data = osr->data;
+  struct level *l = (struct level *) level;
+
+  TIFF *tiff = _openslide_tiffcache_get(data->tc, err);
+  if (tiff == NULL) {
+    return false;
+  }
+
+  bool success = _openslide_tiff_read_raw_jpeg_tile(osr, &l->tiffl, tiff,
+                                                    buf, len,
+                                                    tile_col, tile_row,
+                                                    err);
+  _openslide_tiffcache_put(data->tc, tiff);
+
+  return success;
+}
+
 static const struct _openslide_ops generic_tiff_ops = {
   .paint_region = paint_region,
+  .read_raw_tile = read_raw_tile,
   .destroy = destroy,
 };
 
@@ -236,12 +271,18 @@ static bool generic_tiff_open(openslide_t *osr,
       g_slice_free(struct level, l);
       goto FAIL;
     }
+    // JPEG tiles can be returned without decoding
+    l->base.raw_tiles = tiffl->tile_read_direct;
     l->grid = _openslide_grid_create_simple(osr,
                                             tiffl->tiles_across,
                                             tiffl->tiles_down,
                                             tiffl->tile_w,
                                             tiffl->tile_h,
                                             read_tile);
+    _openslide_tiff_grid_enable_parallel_decode(l->grid, tc);
+    if (tiffl->tile_read_direct) {
+      _openslide_tiff_grid_enable_coalesced_reads(l->grid, tiffl);
+    }
 
     // add to array
     g_ptr_array_add(level_array, l);
@@ -113,6 +113,10 @@ struct jpeg {
 
   int64_t sof_position;
   int64_t header_stop_position;
+
+  // from start_in_file to header_stop_position, read once at open
+  uint8_t *header;
+  struct _openslide_filecache *fc;
 };
 
 struct jpeg_level {
@@ -146,6 +150,14 @@ struct hamamatsu_jpeg_ops_data {
   bool restart_marker_thread_throttle;
   bool restart_marker_thread_stop;
   GError *restart_marker_thread_error;
+
+  // persisted restart marker offsets, NULL if not enabled
+  char *mcu_index_path;
+  bool mcu_index_loaded;
+
+  // idle decompressors, reused across tile reads
+  GMutex *decompressors_mutex;
+  GQueue *decompressors;
 };
 
 struct ngr_level {
@@ -171,9 +183,12 @@ static GQuark _openslide_hamamatsu_error_quark(void) {
 /*
  * Source manager for reading a run of MCUs between two restart markers
  * as a complete JPEG.  Originally based on jdatasrc.c from IJG libjpeg.
+ * If header is non-NULL, it is used instead of reading the header from
+ * the file.
  */
 static bool jpeg_random_access_src(j_decompress_ptr cinfo,
                                    FILE *infile,
+                                   const uint8_t *header,
                                    int64_t header_start_position,
                                    int64_t sof_position,
                                    int64_t header_stop_position,
@@ -212,15 +227,19 @@ static bool jpeg_random_access_src(j_decompress_ptr cinfo,
 
   // read in the 2 parts
   //  g_debug("reading header from %"PRId64, header_start_position);
-  if (fseeko(infile, header_start_position, SEEK_SET)) {
-    _openslide_io_error(err, "Couldn't seek to header start");
-    return false;
-  }
-  if (!fread(buffer, header_length, 1, infile)) {
-    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                "Cannot read header in JPEG at %"PRId64,
-                header_start_position);
-    return false;
+  if (header) {
+    memcpy(buffer, header, header_length);
+  } else {
+    if (fseeko(infile, header_start_position, SEEK_SET)) {
+      _openslide_io_error(err, "Couldn't seek to header start");
+      return false;
+    }
+    if (!fread(buffer, header_length, 1, infile)) {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Cannot read header in JPEG at %"PRId64,
+                  header_start_position);
+      return false;
+    }
   }
 
   if (data_length) {
@@ -285,6 +304,8 @@ static void jpeg_destroy_data(int32_t num_jpegs, struct jpeg **jpegs,
     g_free(jpeg->filename);
     g_free(jpeg->mcu_starts);
     g_free(jpeg->unreliable_mcu_starts);
+    g_free(jpeg->header);
+    _openslide_filecache_destroy(jpeg->fc);
     g_slice_free(struct jpeg, jpeg);
   }
 
@@ -582,6 +603,40 @@ static bool compute_mcu_start_volatile(openslide_t *osr,
   return true;
 }
 
+static bool read_jpeg_header(struct jpeg *jpeg, GError **err) {
+  int64_t len = jpeg->header_stop_position - jpeg->start_in_file;
+  if (len <= 0) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Bad JPEG header length %"PRId64, len);
+    return false;
+  }
+
+  FILE *f = _openslide_filecache_get(jpeg->fc, err);
+  if (f == NULL) {
+    return false;
+  }
+  bool success = false;
+  uint8_t *header = g_malloc(len);
+  if (fseeko(f, jpeg->start_in_file, SEEK_SET)) {
+    _openslide_io_error(err, "Couldn't seek to header start");
+    goto DONE;
+  }
+  if (fread(header, len, 1, f) != 1) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Cannot read header in JPEG at %"PRId64,
+                jpeg->start_in_file);
+    goto DONE;
+  }
+  jpeg->header = header;
+  header = NULL;
+  success = true;
+
+DONE:
+  g_free(header);
+  _openslide_filecache_put(jpeg->fc, f);
+  return success;
+}
+
 static bool read_from_jpeg(openslide_t *osr,
                            struct jpeg *jpeg,
                            int32_t tileno,
@@ -589,18 +644,27 @@ static bool read_from_jpeg(openslide_t *osr,
                            uint32_t *dest,
                            int32_t w, int32_t h,
                            GError **err) {
+  struct hamamatsu_jpeg_ops_data *data = osr->data;
   volatile bool success = false;
 
-  // open file
-  FILE *f = _openslide_fopen(jpeg->filename, "rb", err);
+  // get a file handle
+  FILE *f = _openslide_filecache_get(jpeg->fc, err);
   if (f == NULL) {
     return false;
   }
 
-  // begin decompress
+  // begin decompress, with an idle decompressor if there is one
   struct jpeg_decompress_struct *cinfo;
+  g_mutex_lock(data->decompressors_mutex);
   struct _openslide_jpeg_decompress *dc =
-    _openslide_jpeg_decompress_create(&cinfo);
+    g_queue_pop_head(data->decompressors);
+  g_mutex_unlock(data->decompressors_mutex);
+  bool reused = dc != NULL;
+  if (reused) {
+    cinfo = _openslide_jpeg_decompress_get_cinfo(dc);
+  } else {
+    dc = _openslide_jpeg_decompress_create(&cinfo);
+  }
   jmp_buf env;
 
   // figure out where to start the data stream
@@ -616,9 +680,13 @@ static bool read_from_jpeg(openslide_t *osr,
 
   if (setjmp(env) == 0) {
     // start decompressing
-    _openslide_jpeg_decompress_init(dc, &env);
+    if (reused) {
+      _openslide_jpeg_decompress_reinit(dc, &env);
+    } else {
+      _openslide_jpeg_decompress_init(dc, &env);
+    }
 
-    if (!jpeg_random_access_src(cinfo, f,
+    if (!jpeg_random_access_src(cinfo, f, jpeg->header,
                                 jpeg->start_in_file,
                                 jpeg->sof_position,
                                 jpeg->header_stop_position,
@@ -644,6 +712,9 @@ static bool read_from_jpeg(openslide_t *osr,
     if (!_openslide_jpeg_decompress_run(dc, dest, false, w, h, err)) {
       goto OPENSLIDE_LABEL_OUT;
     }
+
+    // release the image memory, but keep the object for the next tile
+    jpeg_abort_decompress(cinfo);
     success = true;
   } else {
     // setjmp returns again
@@ -651,8 +722,15 @@ static bool read_from_jpeg(openslide_t *osr,
   }
 
 OPENSLIDE_LABEL_OUT:
-  _openslide_jpeg_decompress_destroy(dc);
-  fclose(f);
+  if (success) {
+    g_mutex_lock(data->decompressors_mutex);
+    g_queue_push_head(data->decompressors, dc);
+    g_mutex_unlock(data->decompressors_mutex);
+  } else {
+    // don't trust its state
+    _openslide_jpeg_decompress_destroy(dc);
+  }
+  _openslide_filecache_put(jpeg->fc, f);
   return success;
 }
 
@@ -683,26 +761,27 @@ static bool read_jpeg_tile(openslide_t *osr,
 
   // get the jpeg data, possibly from cache
   struct _openslide_cache_entry *cache_entry;
-  uint32_t *tiledata = _openslide_cache_get(osr->cache,
-                                            level, tile_col, tile_row,
-                                            &cache_entry);
+  uint32_t *tiledata = _openslide_cache_get_tile(osr->cache,
+                                                 level, tile_col, tile_row,
+                                                 tw, th, CAIRO_FORMAT_RGB24,
+                                                 &cache_entry);
 
   if (!tiledata) {
-    tiledata = g_slice_alloc(tw * th * 4);
+    tiledata = _openslide_tile_buffer_alloc(tw * th * 4);
     if (!read_from_jpeg(osr,
                         jp, tileno,
                         l->scale_denom,
                         tiledata, tw, th,
                         err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+      _openslide_tile_buffer_free(tiledata, tw * th * 4);
       return false;
     }
 
-    _openslide_cache_put(osr->cache,
-			 level, tile_col, tile_row,
-			 tiledata,
-			 tw * th * 4,
-			 &cache_entry);
+    _openslide_cache_put_tile(osr->cache,
+			      level, tile_col, tile_row,
+			      tw, th, CAIRO_FORMAT_RGB24,
+			      tiledata,
+			      &cache_entry);
   }
 
   // draw it
@@ -780,6 +859,14 @@ static void jpeg_do_destroy(openslide_t *osr) {
   jpeg_destroy_data(data->jpeg_count, data->all_jpegs,
                     osr->level_count, (struct jpeg_level **) osr->levels);
 
+  // idle decompressors
+  struct _openslide_jpeg_decompress *dc;
+  while ((dc = g_queue_pop_head(data->decompressors)) != NULL) {
+    _openslide_jpeg_decompress_destroy(dc);
+  }
+  g_queue_free(data->decompressors);
+  g_mutex_free(data->decompressors_mutex);
+
   // the background stuff
   g_mutex_lock(data->restart_marker_cond_mutex);
   if (data->restart_marker_thread_error) {
@@ -790,6 +877,7 @@ static void jpeg_do_destroy(openslide_t *osr) {
   g_timer_destroy(data->restart_marker_timer);
   g_cond_free(data->restart_marker_cond);
   g_mutex_free(data->restart_marker_cond_mutex);
+  g_free(data->mcu_index_path);
 
   // the structure
   g_slice_free(struct hamamatsu_jpeg_ops_data, data);
@@ -899,6 +987,148 @@ static bool verify_mcu_starts(int32_t num_jpegs, struct jpeg **jpegs,
   return true;
 }
 
+/*
+ * The restart marker offsets found by the background thread can be
+ * saved, so that reopening a slide doesn't need to scan it again.
+ * Little-endian:
+ *   magic, jpeg count (uint32)
+ *   for each jpeg: tile count (uint32), end_in_file (int64),
+ *                  tile count MCU starts (int64, -1 if unknown)
+ */
+static const char MCU_INDEX_MAGIC[] = "OSMCUIX1";
+#define MCU_INDEX_MAGIC_LEN 8
+
+static void append_uint32(GByteArray *ba, uint32_t val) {
+  val = GUINT32_TO_LE(val);
+  g_byte_array_append(ba, (const guint8 *) &val, sizeof(val));
+}
+
+static void append_int64(GByteArray *ba, int64_t val) {
+  uint64_t le = GUINT64_TO_LE((uint64_t) val);
+  g_byte_array_append(ba, (const guint8 *) &le, sizeof(le));
+}
+
+static bool read_uint32(const char **p, const char *end, uint32_t *val) {
+  if (end - *p < (ptrdiff_t) sizeof(*val)) {
+    return false;
+  }
+  memcpy(val, *p, sizeof(*val));
+  *val = GUINT32_FROM_LE(*val);
+  *p += sizeof(*val);
+  return true;
+}
+
+static bool read_int64(const char **p, const char *end, int64_t *val) {
+  uint64_t le;
+  if (end - *p < (ptrdiff_t) sizeof(le)) {
+    return false;
+  }
+  memcpy(&le, *p, sizeof(le));
+  *val = (int64_t) GUINT64_FROM_LE(le);
+  *p += sizeof(le);
+  return true;
+}
+
+// fills in mcu_starts only if the whole index matches the slide
+static bool load_mcu_index(struct hamamatsu_jpeg_ops_data *data) {
+  char *buf;
+  gsize len;
+  if (!g_file_get_contents(data->mcu_index_path, &buf, &len, NULL)) {
+    return false;
+  }
+
+  const char *p = buf;
+  const char *end = buf + len;
+  int64_t **starts = g_new0(int64_t *, data->jpeg_count);
+  bool success = false;
+
+  uint32_t jpeg_count;
+  if (len < MCU_INDEX_MAGIC_LEN ||
+      memcmp(p, MCU_INDEX_MAGIC, MCU_INDEX_MAGIC_LEN)) {
+    goto DONE;
+  }
+  p += MCU_INDEX_MAGIC_LEN;
+  if (!read_uint32(&p, end, &jpeg_count) ||
+      jpeg_count != (uint32_t) data->jpeg_count) {
+    goto DONE;
+  }
+  for (int32_t i = 0; i < data->jpeg_count; i++) {
+    struct jpeg *jp = data->all_jpegs[i];
+    uint32_t tile_count;
+    int64_t end_in_file;
+    if (!read_uint32(&p, end, &tile_count) ||
+        tile_count != (uint32_t) jp->tile_count ||
+        !read_int64(&p, end, &end_in_file) ||
+        end_in_file != jp->end_in_file) {
+      goto DONE;
+    }
+    starts[i] = g_new(int64_t, jp->tile_count);
+    for (int32_t j = 0; j < jp->tile_count; j++) {
+      int64_t offset;
+      if (!read_int64(&p, end, &offset) ||
+          (offset != -1 &&
+           (offset < jp->start_in_file || offset >= jp->end_in_file))) {
+        goto DONE;
+      }
+      starts[i][j] = offset;
+    }
+  }
+  if (p != end) {
+    goto DONE;
+  }
+
+  // all good; the background thread isn't running yet
+  for (int32_t i = 0; i < data->jpeg_count; i++) {
+    struct jpeg *jp = data->all_jpegs[i];
+    g_free(jp->mcu_starts);
+    jp->mcu_starts = starts[i];
+    starts[i] = NULL;
+  }
+  success = true;
+
+DONE:
+  if (!success) {
+    g_debug("Ignoring invalid MCU index %s", data->mcu_index_path);
+  }
+  for (int32_t i = 0; i < data->jpeg_count; i++) {
+    g_free(starts[i]);
+  }
+  g_free(starts);
+  g_free(buf);
+  return success;
+}
+
+static void save_mcu_index(struct hamamatsu_jpeg_ops_data *data) {
+  GByteArray *ba = g_byte_array_new();
+  g_byte_array_append(ba, (const guint8 *) MCU_INDEX_MAGIC,
+                      MCU_INDEX_MAGIC_LEN);
+  append_uint32(ba, data->jpeg_count);
+  g_mutex_lock(data->restart_marker_mutex);
+  for (int32_t i = 0; i < data->jpeg_count; i++) {
+    struct jpeg *jp = data->all_jpegs[i];
+    append_uint32(ba, jp->tile_count);
+    append_int64(ba, jp->end_in_file);
+    for (int32_t j = 0; j < jp->tile_count; j++) {
+      append_int64(ba, jp->mcu_starts[j]);
+    }
+  }
+  g_mutex_unlock(data->restart_marker_mutex);
+
+  // failing to save is harmless, the slide is just scanned again
+  GError *tmp_err = NULL;
+  char *dir = g_path_get_dirname(data->mcu_index_path);
+  if (g_mkdir_with_parents(dir, 0700)) {
+    g_debug("Couldn't create %s", dir);
+  } else if (!g_file_set_contents(data->mcu_index_path,
+                                  (const char *) ba->data, ba->len,
+                                  &tmp_err)) {
+    g_debug("Couldn't save MCU index: %s", tmp_err->message);
+    g_clear_error(&tmp_err);
+  }
+  g_free(dir);
+  g_byte_array_free(ba, true);
+}
+
 static gpointer restart_marker_thread_func(gpointer d) {
   openslide_t *osr = d;
   struct hamamatsu_jpeg_ops_data *data = osr->data;
@@ -989,6 +1219,10 @@ static gpointer restart_marker_thread_func(gpointer d) {
     g_mutex_lock(data->restart_marker_cond_mutex);
     data->restart_marker_thread_error = tmp_err;
     g_mutex_unlock(data->restart_marker_cond_mutex);
+  } else if (current_jpeg == data->jpeg_count &&
+             data->mcu_index_path && !data->mcu_index_loaded) {
+    // every marker is known; keep them for next time
+    save_mcu_index(data);
   }
 
   //  g_debug("restart_marker_thread_func done!");
@@ -1021,7 +1255,7 @@ static bool validate_jpeg_header(FILE *f, bool use_jpeg_dimensions,
 
   if (setjmp(env) == 0) {
     _openslide_jpeg_decompress_init(dc, &env);
-    if (!jpeg_random_access_src(cinfo, f,
+    if (!jpeg_random_access_src(cinfo, f, NULL,
                                 header_start, *sof_position,
                                 *header_stop_position, -1, -1, err)) {
       goto DONE;
@@ -1262,6 +1496,7 @@ static void create_scaled_jpeg_levels(openslide_t *osr,
                                                  sd_l->tile_width,
                                                  sd_l->tile_height,
                                                  read_jpeg_tile);
+      _openslide_grid_enable_parallel_decode(sd_l->grid, NULL, NULL, NULL);
 
       key = g_slice_new(int64_t);
       *key = sd_l->base.w;
@@ -1309,13 +1544,26 @@ static bool init_jpeg_ops(openslide_t *osr,
                           int32_t level_count, struct jpeg_level **levels,
                           int32_t num_jpegs, struct jpeg **jpegs,
                           bool background_thread,
+                          const char *index_key,
                           GError **err) {
+  // keep the JPEG headers and open files around for tile reads
+  for (int32_t i = 0; i < num_jpegs; i++) {
+    struct jpeg *jp = jpegs[i];
+    jp->fc = _openslide_filecache_create(jp->filename);
+    if (!read_jpeg_header(jp, err)) {
+      jpeg_destroy_data(num_jpegs, jpegs, level_count, levels);
+      return false;
+    }
+  }
+
   // allocate private data
   g_assert(osr->data == NULL);
   struct hamamatsu_jpeg_ops_data *data =
     g_slice_new0(struct hamamatsu_jpeg_ops_data);
   data->jpeg_count = num_jpegs;
   data->all_jpegs = jpegs;
+  data->decompressors_mutex = g_mutex_new();
+  data->decompressors = g_queue_new();
   osr->data = data;
 
   // create scale_denom levels
@@ -1333,6 +1581,18 @@ static bool init_jpeg_ops(openslide_t *osr,
   data->restart_marker_cond_mutex = g_mutex_new();
   data->restart_marker_thread_throttle =
     !_openslide_debug(OPENSLIDE_DEBUG_JPEG_MARKERS);
+
+  // skip the scan if a previous open already did it
+  if (background_thread && index_key) {
+    char *name = g_strdup_printf("%s.idx", index_key);
+    data->mcu_index_path = _openslide_get_cache_path("hamamatsu-mcu", name);
+    g_free(name);
+    if (data->mcu_index_path) {
+      data->mcu_index_loaded = load_mcu_index(data);
+      background_thread = !data->mcu_index_loaded;
+    }
+  }
+
   if (background_thread) {
     data->restart_marker_thread = g_thread_create(restart_marker_thread_func,
                                                   osr,
@@ -1346,7 +1606,7 @@ static bool init_jpeg_ops(openslide_t *osr,
     if (background_thread) {
       g_thread_join(data->restart_marker_thread);
       data->restart_marker_thread = NULL;
-    } else {
+    } else if (!data->mcu_index_loaded) {
       restart_marker_thread_func(osr);
     }
 
@@ -1415,6 +1675,7 @@ static struct jpeg_level *create_jpeg_level(openslide_t *osr,
                                           l->tiles_across, l->tiles_down,
                                           l->tile_width, l->tile_height,
                                           read_jpeg_tile);
+  _openslide_grid_enable_parallel_decode(l->grid, NULL, NULL, NULL);
 
   return l;
 }
@@ -1423,6 +1684,7 @@ static bool hamamatsu_vms_part2(openslide_t *osr,
 				int num_jpegs, char **image_filenames,
 				int num_jpeg_cols, int num_jpeg_rows,
 				FILE *optimisation_file,
+				const char *index_key,
 				GError **err) {
   struct jpeg_level **levels = NULL;
   int32_t level_count = 0;
@@ -1570,7 +1832,7 @@ static bool hamamatsu_vms_part2(openslide_t *osr,
   return init_jpeg_ops(osr,
                        level_count, levels,
                        num_jpegs, jpegs,
-                       true, err);
+                       true, index_key, err);
 
 FAIL:
   jpeg_destroy_data(num_jpegs, jpegs, level_count, levels);
@@ -1600,8 +1862,10 @@ static bool ngr_read_tile(openslide_t *osr,
   int tilesize = tw * th * 4;
   struct _openslide_cache_entry *cache_entry;
   // look up tile in cache
-  uint32_t *tiledata = _openslide_cache_get(osr->cache, level, tile_x, tile_y,
-                                            &cache_entry);
+  uint32_t *tiledata = _openslide_cache_get_tile(osr->cache,
+                                                 level, tile_x, tile_y,
+                                                 tw, th, CAIRO_FORMAT_RGB24,
+                                                 &cache_entry);
 
   if (!tiledata) {
     // read the tile data
@@ -1635,7 +1899,7 @@ static bool ngr_read_tile(openslide_t *osr,
     fclose(f);
 
     // got the data, now convert to 8-bit xRGB
-    tiledata = g_slice_alloc(tilesize);
+    tiledata = _openslide_tile_buffer_alloc(tilesize);
     for (int i = 0; i < tw * th; i++) {
       // scale down from 12 bits
       uint8_t r = GINT16_FROM_LE(buf[(i * 3)]) >> 4;
@@ -1647,10 +1911,10 @@ static bool ngr_read_tile(openslide_t *osr,
     g_slice_free1(buf_size, buf);
 
     // put it in the cache
-    _openslide_cache_put(osr->cache, level, tile_x, tile_y,
-                         tiledata,
-                         tilesize,
-                         &cache_entry);
+    _openslide_cache_put_tile(osr->cache, level, tile_x, tile_y,
+                              tw, th, CAIRO_FORMAT_RGB24,
+                              tiledata,
+                              &cache_entry);
   }
 
   // draw it
@@ -1770,6 +2034,7 @@ static bool hamamatsu_vmu_part2(openslide_t *osr,
                                             l->column_width,
                                             NGR_TILE_HEIGHT,
                                             ngr_read_tile);
+    _openslide_grid_enable_parallel_decode(l->grid, NULL, NULL, NULL);
 
     // tile size hints
     l->base.tile_w = l->column_width;
@@ -1809,6 +2074,14 @@ static bool hamamatsu_vms_vmu_open(openslide_t *osr, const char *filename,
   char **image_filenames = NULL;
   bool success = false;
 
+  // the key and map files also identify the restart marker index, so
+  // hash them even if the caller doesn't want the quickhash, if the index
+  // can be saved
+  struct _openslide_hash *index_hash = NULL;
+  if (!quickhash1 && _openslide_have_cache_dir()) {
+    quickhash1 = index_hash = _openslide_hash_quickhash1_create();
+  }
+
   // first, see if it's a VMS/VMU file
   GKeyFile *key_file = _openslide_read_key_file(filename, KEY_FILE_MAX_SIZE,
                                                 G_KEY_FILE_NONE, err);
@@ -2034,12 +2307,17 @@ static bool hamamatsu_vms_vmu_open(openslide_t *osr, const char *filename,
       _openslide_performance_warn("Missing optimisation file");
     }
 
+    // the key and map files identify the slide's restart marker index
+    char *index_key = _openslide_hash_peek_string(quickhash1);
+
     // do all the jpeg stuff
     success = hamamatsu_vms_part2(osr,
 				  num_images, image_filenames,
 				  num_cols, num_rows,
 				  optimisation_file,
+				  index_key,
 				  err);
+    g_free(index_key);
 
     // clean up
     if (optimisation_file) {
@@ -2090,6 +2368,9 @@ static bool hamamatsu_vms_vmu_open(openslide_t *osr, const char *filename,
   if (key_file) {
     g_key_file_free(key_file);
   }
+  if (index_hash) {
+    _openslide_hash_destroy(index_hash);
+  }
 
   return success;
 }
@@ -2446,7 +2727,7 @@ FAIL:
   return init_jpeg_ops(osr,
                        level_count, levels,
                        num_jpegs, jpegs,
-                       restart_marker_scan, err);
+                       restart_marker_scan, NULL, err);
 }
 
 const struct _openslide_format _openslide_format_hamamatsu_ndpi = {
@@ -162,11 +162,11 @@ static bool read_tile(openslide_t *osr,
                                             args->area, tile_col, tile_row,
                                             &cache_entry);
   if (!tiledata) {
-    tiledata = g_slice_alloc(tw * th * 4);
-    if (!_openslide_tiff_read_tile(tiffl, args->tiff,
+    tiledata = _openslide_tile_buffer_alloc(tw * th * 4);
+    if (!_openslide_tiff_read_tile(osr, tiffl, args->tiff,
                                    tiledata, tile_col, tile_row,
                                    err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+      _openslide_tile_buffer_free(tiledata, tw * th * 4);
       return false;
     }
 
@@ -174,7 +174,7 @@ static bool read_tile(openslide_t *osr,
     if (!_openslide_tiff_clip_tile(tiffl, tiledata,
                                    tile_col, tile_row,
                                    err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+      _openslide_tile_buffer_free(tiledata, tw * th * 4);
       return false;
     }
 
@@ -271,22 +271,35 @@ static bool leica_detect(const char *filename G_GNUC_UNUSED,
     return false;
   }
 
-  // try to parse the xml
-  xmlDoc *doc = _openslide_xml_parse(image_desc, err);
-  if (doc == NULL) {
+  // read the xml only as far as the root element
+  xmlTextReader *reader = _openslide_xml_reader_create(image_desc, err);
+  if (reader == NULL) {
+    return false;
+  }
+  GError *tmp_err = NULL;
+  if (!_openslide_xml_reader_next_element(reader, false, &tmp_err)) {
+    if (tmp_err) {
+      g_propagate_error(err, tmp_err);
+    } else {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "No root element");
+    }
+    xmlFreeTextReader(reader);
     return false;
   }
 
   // check default namespace
-  if (!_openslide_xml_has_default_namespace(doc, LEICA_XMLNS_1) &&
-      !_openslide_xml_has_default_namespace(doc, LEICA_XMLNS_2)) {
+  const xmlChar *ns = xmlTextReaderConstNamespaceUri(reader);
+  if (!ns ||
+      (xmlStrcmp(ns, BAD_CAST LEICA_XMLNS_1) &&
+       xmlStrcmp(ns, BAD_CAST LEICA_XMLNS_2))) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "Unexpected XML namespace");
-    xmlFreeDoc(doc);
+    xmlFreeTextReader(reader);
     return false;
   }
 
-  xmlFreeDoc(doc);
+  xmlFreeTextReader(reader);
   return true;
 }
 
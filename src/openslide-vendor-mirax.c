@@ -31,7 +31,7 @@
 #include <config.h>
 
 #include "openslide-private.h"
-#include "openslide-decode-gdkpixbuf.h"
+#include "openslide-decode-bmp.h"
 #include "openslide-decode-jpeg.h"
 #include "openslide-decode-png.h"
 
@@ -203,6 +203,7 @@ struct level {
 
 struct mirax_ops_data {
   gchar **datafile_paths;
+  struct _openslide_filecache **datafiles;  // one per datafile path
 };
 
 static void image_unref(struct image *image) {
@@ -223,36 +224,63 @@ static uint32_t *read_image(openslide_t *osr,
                             int w, int h,
                             GError **err) {
   struct mirax_ops_data *data = osr->data;
+  struct _openslide_filecache *fc = data->datafiles[image->fileno];
   bool result = false;
 
-  uint32_t *dest = g_slice_alloc(w * h * 4);
+  if (format == FORMAT_JPEG && _openslide_read_range_enabled()) {
+    // one ranged read, rather than many small ones from libjpeg
+    void *buf = g_malloc(image->length);
+    uint32_t *dest = NULL;
+    int64_t len = _openslide_read_range(data->datafile_paths[image->fileno],
+                                        image->start_in_file,
+                                        buf, image->length, err);
+    if (len >= 0) {
+      dest = _openslide_tile_buffer_alloc(w * h * 4);
+      if (!_openslide_jpeg_decode_buffer(buf, len, dest, w, h, err)) {
+        _openslide_tile_buffer_free(dest, w * h * 4);
+        dest = NULL;
+      }
+    }
+    g_free(buf);
+    return dest;
+  }
+
+  const char *path = data->datafile_paths[image->fileno];
+  FILE *f = _openslide_filecache_get(fc, err);
+  if (!f) {
+    return NULL;
+  }
+
+  uint32_t *dest = _openslide_tile_buffer_alloc(w * h * 4);
 
   switch (format) {
   case FORMAT_JPEG:
-    result = _openslide_jpeg_read(data->datafile_paths[image->fileno],
-                                  image->start_in_file,
-                                  dest, w, h,
-                                  err);
+    result = _openslide_jpeg_read_file(f,
+                                       image->start_in_file,
+                                       dest, w, h,
+                                       err);
     break;
   case FORMAT_PNG:
-    result = _openslide_png_read(data->datafile_paths[image->fileno],
-                                 image->start_in_file,
-                                 dest, w, h,
-                                 err);
+    result = _openslide_png_read_file(f, path,
+                                      image->start_in_file,
+                                      dest, w, h,
+                                      err);
     break;
   case FORMAT_BMP:
-    result = _openslide_gdkpixbuf_read("bmp",
-                                       data->datafile_paths[image->fileno],
-                                       image->start_in_file, image->length,
-                                       dest, w, h,
-                                       err);
+    result = _openslide_bmp_read_file(f, path,
+                                      image->start_in_file,
+                                      image->length,
+                                      dest, w, h,
+                                      err);
     break;
   default:
     g_assert_not_reached();
   }
 
+  _openslide_filecache_put(fc, f);
+
   if (!result) {
-    g_slice_free1(w * h * 4, dest);
+    _openslide_tile_buffer_free(dest, w * h * 4);
     return NULL;
   }
   return dest;
@@ -268,7 +296,6 @@ static bool read_tile(openslide_t *osr,
                       GError **err) {
   struct level *l = (struct level *) level;
   struct tile *tile = data;
-  bool success = true;
 
   int iw = l->image_width;
   int ih = l->image_height;
@@ -277,11 +304,12 @@ static bool read_tile(openslide_t *osr,
 
   // get the image data, possibly from cache
   struct _openslide_cache_entry *cache_entry;
-  uint32_t *tiledata = _openslide_cache_get(osr->cache,
-                                            level,
-                                            tile->image->imageno,
-                                            0,
-                                            &cache_entry);
+  uint32_t *tiledata = _openslide_cache_get_tile(osr->cache,
+                                                 level,
+                                                 tile->image->imageno,
+                                                 0,
+                                                 iw, ih, CAIRO_FORMAT_RGB24,
+                                                 &cache_entry);
 
   if (!tiledata) {
     tiledata = read_image(osr, tile->image, l->image_format, iw, ih, err);
@@ -289,49 +317,49 @@ static bool read_tile(openslide_t *osr,
       return false;
     }
 
-    _openslide_cache_put(osr->cache,
-                         level, tile->image->imageno, 0,
-                         tiledata,
-                         iw * ih * 4,
-                         &cache_entry);
+    _openslide_cache_put_tile(osr->cache,
+                              level, tile->image->imageno, 0,
+                              iw, ih, CAIRO_FORMAT_RGB24,
+                              tiledata,
+                              &cache_entry);
   }
 
   // draw it
-  cairo_surface_t *surface = cairo_image_surface_create_for_data((unsigned char *) tiledata,
-                                                                 CAIRO_FORMAT_RGB24,
-                                                                 iw, ih,
-                                                                 iw * 4);
-
-  // if we are drawing a subregion of the tile, we must do an additional copy,
-  // because cairo lacks source clipping
   if ((l->image_width > l->tile_w) ||
       (l->image_height > l->tile_h)) {
-    cairo_surface_t *surface2 = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
-                                                           ceil(l->tile_w),
-                                                           ceil(l->tile_h));
-    cairo_t *cr2 = cairo_create(surface2);
-    cairo_set_source_surface(cr2, surface, -tile->src_x, -tile->src_y);
-
-    // replace original image surface
+    // we are drawing a subregion of the image.  cairo lacks source
+    // clipping, so point a surface at the subregion's pixels in the
+    // cached image, extended to whole pixels, and clip the destination
+    int64_t sx = floor(tile->src_x);
+    int64_t sy = floor(tile->src_y);
+    int64_t sw = MIN(iw, ceil(tile->src_x + ceil(l->tile_w))) - sx;
+    int64_t sh = MIN(ih, ceil(tile->src_y + ceil(l->tile_h))) - sy;
+    cairo_surface_t *surface =
+      cairo_image_surface_create_for_data((unsigned char *) (tiledata + sy * iw + sx),
+                                          CAIRO_FORMAT_RGB24,
+                                          sw, sh,
+                                          iw * 4);
+    cairo_set_source_surface(cr, surface,
+                             sx - tile->src_x, sy - tile->src_y);
     cairo_surface_destroy(surface);
-    surface = surface2;
-
-    cairo_rectangle(cr2, 0, 0,
+    cairo_rectangle(cr, 0, 0,
                     ceil(l->tile_w),
                     ceil(l->tile_h));
-    cairo_fill(cr2);
-    success = _openslide_check_cairo_status(cr2, err);
-    cairo_destroy(cr2);
+    cairo_fill(cr);
+  } else {
+    cairo_surface_t *surface = cairo_image_surface_create_for_data((unsigned char *) tiledata,
+                                                                   CAIRO_FORMAT_RGB24,
+                                                                   iw, ih,
+                                                                   iw * 4);
+    cairo_set_source_surface(cr, surface, 0, 0);
+    cairo_surface_destroy(surface);
+    cairo_paint(cr);
   }
 
-  cairo_set_source_surface(cr, surface, 0, 0);
-  cairo_surface_destroy(surface);
-  cairo_paint(cr);
-
   // done with the cache entry, release it
   _openslide_cache_entry_unref(cache_entry);
 
-  return success;
+  return true;
 }
 
 static bool paint_region(openslide_t *osr G_GNUC_UNUSED, cairo_t *cr,
@@ -362,6 +390,10 @@ static void destroy(openslide_t *osr) {
   g_free(osr->levels);
 
   // the ops data
+  for (int i = 0; data->datafile_paths[i]; i++) {
+    _openslide_filecache_destroy(data->datafiles[i]);
+  }
+  g_free(data->datafiles);
   g_strfreev(data->datafile_paths);
   g_slice_free(struct mirax_ops_data, data);
 }
@@ -976,7 +1008,7 @@ static void *read_record_data(const char *path,
   }
 
   buffer = g_malloc(size);
-  if (fread(buffer, sizeof(char), size, f) != (size_t) size) {
+  if (_openslide_fread(f, buffer, size) != (size_t) size) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "Error while reading data");
     g_free(buffer);
@@ -1931,6 +1963,7 @@ static bool mirax_open(openslide_t *osr, const char *filename,
                                              lp->tile_advance_x,
                                              lp->tile_advance_y,
                                              read_tile, tile_free);
+    _openslide_grid_enable_parallel_decode(l->grid, NULL, NULL, NULL);
 
     //g_debug("level %d tile advance %.10g %.10g, dim %"PRId64" %"PRId64", image size %d %d, tile %g %g, image_concat %d, tile_count_divisor %d, positions_per_tile %d", i, lp->tile_advance_x, lp->tile_advance_y, l->base.w, l->base.h, l->image_width, l->image_height, l->tile_w, l->tile_h, lp->image_concat, lp->tile_count_divisor, lp->positions_per_tile);
   }
@@ -2009,6 +2042,10 @@ static bool mirax_open(openslide_t *osr, const char *filename,
   struct mirax_ops_data *data = g_slice_new0(struct mirax_ops_data);
   data->datafile_paths = datafile_paths;
   datafile_paths = NULL;
+  data->datafiles = g_new(struct _openslide_filecache *, datafile_count);
+  for (int i = 0; i < datafile_count; i++) {
+    data->datafiles[i] = _openslide_filecache_create(data->datafile_paths[i]);
+  }
   osr->data = data;
 
   // set ops
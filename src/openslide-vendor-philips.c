@@ -47,6 +47,12 @@ static const char XML_ROOT_TYPE_VALUE[] = "DPUfsImport";
 static const char XML_NAME_ATTR[] = "Name";
 static const char XML_SCANNED_IMAGES_NAME[] = "PIM_DP_SCANNED_IMAGES";
 static const char XML_DATA_REPRESENTATION_NAME[] = "PIIM_PIXEL_DATA_REPRESENTATION_SEQUENCE";
+static const char XML_ATTRIBUTE[] = "Attribute";
+static const char XML_IMAGE_TYPE_NAME[] = "PIM_DP_IMAGE_TYPE";
+static const char XML_IMAGE_DATA_NAME[] = "PIM_DP_IMAGE_DATA";
+
+// base64 characters decoded at a time while looking for a JPEG header
+#define B64_HEADER_CHUNK 65536
 
 static const char LABEL_DESCRIPTION[] = "Label";
 static const char MACRO_DESCRIPTION[] = "Macro";
@@ -62,6 +68,8 @@ static const char MAIN_IMAGE_XPATH[] = SCANNED_IMAGE_XPATH("WSI");
   "/Attribute[@Name='PIM_DP_IMAGE_DATA']/text()"
 static const char LABEL_DATA_XPATH[] = ASSOCIATED_IMAGE_DATA_XPATH("LABELIMAGE");
 static const char MACRO_DATA_XPATH[] = ASSOCIATED_IMAGE_DATA_XPATH("MACROIMAGE");
+static const char LABEL_IMAGE_TYPE[] = "LABELIMAGE";
+static const char MACRO_IMAGE_TYPE[] = "MACROIMAGE";
 
 struct philips_ops_data {
   struct _openslide_tiffcache *tc;
@@ -76,7 +84,7 @@ struct level {
 struct xml_associated_image {
   struct _openslide_associated_image base;
   struct _openslide_tiffcache *tc;
-  const char *xpath;  // static string; do not free
+  const char *image_type;  // static string; do not free
 };
 
 static void destroy(openslide_t *osr) {
@@ -108,9 +116,10 @@ static bool read_tile(openslide_t *osr,
 
   // cache
   struct _openslide_cache_entry *cache_entry;
-  uint32_t *tiledata = _openslide_cache_get(osr->cache,
-                                            level, tile_col, tile_row,
-                                            &cache_entry);
+  uint32_t *tiledata = _openslide_cache_get_tile(osr->cache,
+                                                 level, tile_col, tile_row,
+                                                 tw, th, CAIRO_FORMAT_ARGB32,
+                                                 &cache_entry);
   if (!tiledata) {
     // slides with multiple ROIs are sparse
     bool is_missing;
@@ -120,16 +129,35 @@ static bool read_tile(openslide_t *osr,
       return false;
     }
 
+    // the request is exactly this tile; decode it in place, uncached
+    uint32_t *dest = _openslide_grid_get_tile_dest(cr, tw, th);
+    if (dest) {
+      if (is_missing) {
+        // fill with transparent
+        memset(dest, 0, tw * th * 4);
+        return true;
+      }
+      return _openslide_tiff_read_tile(osr, tiffl, tiff,
+                                       dest, tile_col, tile_row,
+                                       err) &&
+             _openslide_clip_tile(dest,
+                                  tw, th,
+                                  l->base.w - tile_col * tw,
+                                  l->base.h - tile_row * th,
+                                  err);
+    }
+
     if (is_missing) {
       // fill with transparent
-      tiledata = g_slice_alloc0(tw * th * 4);
+      tiledata = _openslide_tile_buffer_alloc(tw * th * 4);
+      memset(tiledata, 0, tw * th * 4);
 
     } else {
-      tiledata = g_slice_alloc(tw * th * 4);
-      if (!_openslide_tiff_read_tile(tiffl, tiff,
+      tiledata = _openslide_tile_buffer_alloc(tw * th * 4);
+      if (!_openslide_tiff_read_tile(osr, tiffl, tiff,
                                      tiledata, tile_col, tile_row,
                                      err)) {
-        g_slice_free1(tw * th * 4, tiledata);
+        _openslide_tile_buffer_free(tiledata, tw * th * 4);
         return false;
       }
 
@@ -139,15 +167,15 @@ static bool read_tile(openslide_t *osr,
                                 l->base.w - tile_col * tw,
                                 l->base.h - tile_row * th,
                                 err)) {
-        g_slice_free1(tw * th * 4, tiledata);
+        _openslide_tile_buffer_free(tiledata, tw * th * 4);
         return false;
       }
     }
 
     // put it in the cache
-    _openslide_cache_put(osr->cache, level, tile_col, tile_row,
-                         tiledata, tw * th * 4,
-                         &cache_entry);
+    _openslide_cache_put_tile(osr->cache, level, tile_col, tile_row,
+                               tw, th, CAIRO_FORMAT_ARGB32, tiledata,
+                               &cache_entry);
   }
 
   // draw it
@@ -188,8 +216,31 @@ static bool paint_region(openslide_t *osr, cairo_t *cr,
   return success;
 }
 
+static bool read_raw_tile(openslide_t *osr,
+                          struct _openslide_level *level,
+                          int64_t tile_col, int64_t tile_row,
+                          void **buf, int32_t *len,
+                          GError **err) {
+  struct philips_ops_data *data = osr->data;
+  struct level *l = (struct level *) level;
+
+  TIFF *tiff = _openslide_tiffcache_get(data->tc, err);
+  if (tiff == NULL) {
+    return false;
+  }
+
+  bool success = _openslide_tiff_read_raw_jpeg_tile(osr, &l->tiffl, tiff,
+                                                    buf, len,
+                                                    tile_col, tile_row,
+                                                    err);
+  _openslide_tiffcache_put(data->tc, tiff);
+
+  return success;
+}
+
 static const struct _openslide_ops philips_ops = {
   .paint_region = paint_region,
+  .read_raw_tile = read_raw_tile,
   .destroy = destroy,
 };
 
@@ -223,37 +274,49 @@ static bool philips_detect(const char *filename G_GNUC_UNUSED,
     return false;
   }
 
-  // try to parse the XML
-  xmlDoc *doc = _openslide_xml_parse(image_desc, err);
-  if (doc == NULL) {
+  // read only as far as the root element; the description can be
+  // megabytes of embedded associated images
+  xmlTextReader *reader = _openslide_xml_reader_create(image_desc, err);
+  if (reader == NULL) {
+    return false;
+  }
+  GError *tmp_err = NULL;
+  if (!_openslide_xml_reader_next_element(reader, false, &tmp_err)) {
+    if (tmp_err) {
+      g_propagate_error(err, tmp_err);
+    } else {
+      g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "No root element");
+    }
+    xmlFreeTextReader(reader);
     return false;
   }
 
   // check root tag name
-  xmlNode *root = xmlDocGetRootElement(doc);
-  if (xmlStrcmp(root->name, BAD_CAST XML_ROOT)) {
+  if (xmlStrcmp(xmlTextReaderConstName(reader), BAD_CAST XML_ROOT)) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "Root tag not %s", XML_ROOT);
-    xmlFreeDoc(doc);
+    xmlFreeTextReader(reader);
     return false;
   }
 
   // check root tag type
-  xmlChar *type = xmlGetProp(root, BAD_CAST XML_ROOT_TYPE_ATTR);
+  xmlChar *type = xmlTextReaderGetAttribute(reader,
+                                            BAD_CAST XML_ROOT_TYPE_ATTR);
   if (!type || xmlStrcmp(type, BAD_CAST XML_ROOT_TYPE_VALUE)) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "Root %s not \"%s\"", XML_ROOT_TYPE_ATTR, XML_ROOT_TYPE_VALUE);
     xmlFree(type);
-    xmlFreeDoc(doc);
+    xmlFreeTextReader(reader);
     return false;
   }
   xmlFree(type);
 
-  xmlFreeDoc(doc);
+  xmlFreeTextReader(reader);
   return true;
 }
 
-static xmlDoc *parse_xml(TIFF *tiff, GError **err) {
+static const char *get_image_desc(TIFF *tiff, GError **err) {
   if (!_openslide_tiff_set_dir(tiff, 0, err)) {
     return NULL;
   }
@@ -264,25 +327,84 @@ static xmlDoc *parse_xml(TIFF *tiff, GError **err) {
                 "Couldn't read ImageDescription");
     return NULL;
   }
+  return image_desc;
+}
+
+static xmlDoc *parse_xml(TIFF *tiff, GError **err) {
+  const char *image_desc = get_image_desc(tiff, err);
+  if (!image_desc) {
+    return NULL;
+  }
   return _openslide_xml_parse(image_desc, err);
 }
 
-static bool get_compressed_xml_associated_image_data(xmlDoc *doc,
-                                                     const char *xpath,
-                                                     void **out_data,
-                                                     gsize *out_len,
-                                                     GError **err) {
-  xmlXPathContext *ctx = _openslide_xml_xpath_create(doc);
-  char *b64_data = _openslide_xml_xpath_get_string(ctx, xpath);
-  if (b64_data) {
-    *out_data = g_base64_decode(b64_data, out_len);
-  } else {
+// stream through the XML for the base64 data of the first scanned image
+// of the specified type, rather than building a tree of the whole
+// description for one attribute
+static xmlChar *read_xml_associated_image_data(const char *xml,
+                                               const char *image_type,
+                                               GError **err) {
+  xmlTextReader *reader = _openslide_xml_reader_create(xml, err);
+  if (!reader) {
+    return NULL;
+  }
+
+  // /DataObject/Attribute[@Name='PIM_DP_SCANNED_IMAGES']/Array
+  //   /DataObject/Attribute
+  xmlChar *type = NULL;
+  xmlChar *data = NULL;
+  xmlChar *result = NULL;
+  bool skip = false;
+  GError *tmp_err = NULL;
+  while (!result &&
+         _openslide_xml_reader_next_element(reader, skip, &tmp_err)) {
+    int depth = xmlTextReaderDepth(reader);
+    const xmlChar *tag = xmlTextReaderConstName(reader);
+    skip = false;
+    if (depth <= 3) {
+      // next scanned image, if any
+      xmlFree(type);
+      xmlFree(data);
+      type = NULL;
+      data = NULL;
+    }
+    if (depth != 1 && depth != 4) {
+      continue;
+    }
+
+    xmlChar *name = xmlTextReaderGetAttribute(reader, BAD_CAST XML_NAME_ATTR);
+    if (depth == 1) {
+      skip = xmlStrcmp(tag, BAD_CAST XML_ATTRIBUTE) ||
+             xmlStrcmp(name, BAD_CAST XML_SCANNED_IMAGES_NAME);
+    } else {
+      if (!xmlStrcmp(tag, BAD_CAST XML_ATTRIBUTE) && name) {
+        if (!type && !xmlStrcmp(name, BAD_CAST XML_IMAGE_TYPE_NAME)) {
+          type = xmlTextReaderReadString(reader);
+        } else if (!data && !xmlStrcmp(name, BAD_CAST XML_IMAGE_DATA_NAME)) {
+          data = xmlTextReaderReadString(reader);
+        }
+      }
+      if (type && data && !xmlStrcmp(type, BAD_CAST image_type)) {
+        result = data;
+        data = NULL;
+      }
+      skip = true;
+    }
+    xmlFree(name);
+  }
+  xmlFree(type);
+  xmlFree(data);
+  xmlFreeTextReader(reader);
+
+  if (tmp_err) {
+    g_propagate_error(err, tmp_err);
+    xmlFree(result);
+    return NULL;
+  } else if (!result) {
     g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                 "Couldn't read associated image data");
   }
-  g_free(b64_data);
-  xmlXPathFreeContext(ctx);
-  return b64_data != NULL;
+  return result;
 }
 
 static bool get_xml_associated_image_data(struct _openslide_associated_image *_img,
@@ -297,25 +419,27 @@ static bool get_xml_associated_image_data(struct _openslide_associated_image *_i
     return false;
   }
 
-  xmlDoc *doc = parse_xml(tiff, err);
-  if (!doc) {
+  const char *image_desc = get_image_desc(tiff, err);
+  if (!image_desc) {
     goto DONE;
   }
 
-  gsize len;
-  if (!get_compressed_xml_associated_image_data(doc, img->xpath,
-                                                &data, &len, err)) {
+  // the base64 data is decoded only now that the image is wanted
+  xmlChar *b64_data = read_xml_associated_image_data(image_desc,
+                                                     img->image_type,
+                                                     err);
+  if (!b64_data) {
     goto DONE;
   }
+  gsize len;
+  data = g_base64_decode((char *) b64_data, &len);
+  xmlFree(b64_data);
 
   success = _openslide_jpeg_decode_buffer(data, len, dest,
                                           img->base.w, img->base.h, err);
 
 DONE:
   g_free(data);
-  if (doc) {
-    xmlFreeDoc(doc);
-  }
   _openslide_tiffcache_put(img->tc, tiff);
   return success;
 }
@@ -331,31 +455,67 @@ static const struct _openslide_associated_image_ops philips_xml_associated_ops =
   .destroy = destroy_xml_associated_image,
 };
 
-// xpath is not copied (must be a static string)
+// only the JPEG header is needed for the dimensions, so decode just
+// enough of the base64 data to include it
+static bool get_b64_jpeg_dimensions(const char *b64,
+                                    int32_t *w, int32_t *h,
+                                    GError **err) {
+  gsize b64_len = strlen(b64);
+  guchar *buf = g_malloc(b64_len / 4 * 3 + 3);
+  gsize len = 0;
+  gsize pos = 0;
+  gsize chunk = B64_HEADER_CHUNK;
+  gint state = 0;
+  guint save = 0;
+  bool success = false;
+
+  while (true) {
+    gsize count = MIN(chunk, b64_len - pos);
+    len += g_base64_decode_step(b64 + pos, count, buf + len, &state, &save);
+    pos += count;
+
+    GError *tmp_err = NULL;
+    if (_openslide_jpeg_decode_buffer_dimensions(buf, len, w, h, &tmp_err)) {
+      success = true;
+      break;
+    }
+    if (pos == b64_len) {
+      g_propagate_error(err, tmp_err);
+      break;
+    }
+    // probably truncated before the frame header
+    g_clear_error(&tmp_err);
+    chunk *= 2;
+  }
+
+  g_free(buf);
+  return success;
+}
+
+// xpath and image_type are not copied (must be static strings)
 static bool maybe_add_xml_associated_image(openslide_t *osr,
                                            struct _openslide_tiffcache *tc,
-                                           xmlDoc *doc,
+                                           xmlXPathContext *ctx,
                                            const char *name,
                                            const char *xpath,
+                                           const char *image_type,
                                            GError **err) {
   if (g_hash_table_lookup(osr->associated_images, name)) {
     // already added from TIFF directory
     return true;
   }
 
-  void *data;
-  gsize len;
-  if (!get_compressed_xml_associated_image_data(doc, xpath,
-                                                &data, &len, err)) {
-    g_prefix_error(err, "Can't locate %s associated image: ", name);
+  // use the text in the tree, without copying it
+  xmlNode *node = _openslide_xml_xpath_get_node(ctx, xpath);
+  if (!node || !node->content) {
+    g_set_error(err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Can't locate %s associated image: "
+                "Couldn't read associated image data", name);
     return false;
   }
 
   int32_t w, h;
-  bool success =
-    _openslide_jpeg_decode_buffer_dimensions(data, len, &w, &h, err);
-  g_free(data);
-  if (!success) {
+  if (!get_b64_jpeg_dimensions((const char *) node->content, &w, &h, err)) {
     g_prefix_error(err, "Can't decode %s associated image: ", name);
     return false;
   }
@@ -366,7 +526,7 @@ static bool maybe_add_xml_associated_image(openslide_t *osr,
   img->base.w = w;
   img->base.h = h;
   img->tc = tc;
-  img->xpath = xpath;
+  img->image_type = image_type;
 
   g_hash_table_insert(osr->associated_images, g_strdup(name), img);
 
@@ -623,12 +783,18 @@ static bool philips_open(openslide_t *osr,
         g_slice_free(struct level, l);
         goto FAIL;
       }
+      // JPEG tiles can be returned without decoding
+      l->base.raw_tiles = tiffl->tile_read_direct;
       l->grid = _openslide_grid_create_simple(osr,
                                               tiffl->tiles_across,
                                               tiffl->tiles_down,
                                               tiffl->tile_w,
                                               tiffl->tile_h,
                                               read_tile);
+      _openslide_tiff_grid_enable_parallel_decode(l->grid, tc);
+      if (tiffl->tile_read_direct) {
+        _openslide_tiff_grid_enable_coalesced_reads(l->grid, tiffl);
+      }
 
       // add to array
       g_ptr_array_add(level_array, l);
@@ -687,14 +853,14 @@ static bool philips_open(openslide_t *osr,
   xmlXPathContext *ctx = _openslide_xml_xpath_create(doc);
   add_properties(osr, ctx, "philips", "/DataObject/Attribute");
   add_mpp_properties(osr);
-  xmlXPathFreeContext(ctx);
 
   // add associated images from XML
   // errors are non-fatal
-  maybe_add_xml_associated_image(osr, tc, doc,
-                                 "label", LABEL_DATA_XPATH, NULL);
-  maybe_add_xml_associated_image(osr, tc, doc,
-                                 "macro", MACRO_DATA_XPATH, NULL);
+  maybe_add_xml_associated_image(osr, tc, ctx, "label",
+                                 LABEL_DATA_XPATH, LABEL_IMAGE_TYPE, NULL);
+  maybe_add_xml_associated_image(osr, tc, ctx, "macro",
+                                 MACRO_DATA_XPATH, MACRO_IMAGE_TYPE, NULL);
+  xmlXPathFreeContext(ctx);
 
   // unwrap level array
   int32_t level_count = level_array->len;
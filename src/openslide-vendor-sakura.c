@@ -94,6 +94,9 @@ struct sakura_ops_data {
   char *data_sql;
   int32_t tile_size;
   int32_t focal_plane;
+
+  // data_sql statements, one per reading thread
+  struct _openslide_sqlite_stmtcache *sc;
 };
 
 struct level {
@@ -184,6 +187,7 @@ static void destroy_level(struct level *l) {
 
 static void destroy(openslide_t *osr) {
   struct sakura_ops_data *data = osr->data;
+  _openslide_sqlite_stmtcache_destroy(data->sc);
   g_free(data->filename);
   g_free(data->data_sql);
   g_slice_free(struct sakura_ops_data, data);
@@ -320,44 +324,104 @@ FAIL:
   return false;
 }
 
-static bool read_image(uint32_t *tiledata,
+// one color channel of a tile, possibly decoded on a decode thread
+struct channel_job {
+  uint8_t *channeldata;
+  int64_t tile_col;
+  int64_t tile_row;
+  int64_t downsample;
+  enum color_index color;
+  int32_t focal_plane;
+  int32_t tile_size;
+  sqlite3_stmt *stmt;                        // or NULL to use one from sc
+  struct _openslide_sqlite_stmtcache *sc;
+  GError *err;
+};
+
+static void channel_job_run(void *_job) {
+  struct channel_job *job = _job;
+
+  // the blob returned by a statement is only valid until it is stepped
+  // again, so concurrent channels need their own statements
+  sqlite3_stmt *stmt = job->stmt;
+  if (!stmt) {
+    stmt = _openslide_sqlite_stmtcache_get(job->sc, &job->err);
+    if (!stmt) {
+      return;
+    }
+  }
+  read_channel(job->channeldata, job->tile_col, job->tile_row,
+               job->downsample, job->color, job->focal_plane,
+               job->tile_size, stmt, &job->err);
+  if (!job->stmt) {
+    _openslide_sqlite_stmtcache_put(job->sc, stmt);
+  }
+}
+
+static bool read_image(openslide_t *osr,
+                       uint32_t *tiledata,
                        int64_t tile_col, int64_t tile_row,
                        int64_t downsample,
                        int32_t focal_plane,
                        int32_t tile_size,
                        sqlite3_stmt *stmt,
                        GError **err) {
-  uint8_t *red_channel = g_slice_alloc(tile_size * tile_size);
-  uint8_t *green_channel = g_slice_alloc(tile_size * tile_size);
-  uint8_t *blue_channel = g_slice_alloc(tile_size * tile_size);
-  bool success = false;
-
-  if (!read_channel(red_channel, tile_col, tile_row, downsample,
-                    INDEX_RED, focal_plane, tile_size, stmt, err)) {
-    goto OPENSLIDE_LABEL_OUT;
-  }
-  if (!read_channel(green_channel, tile_col, tile_row, downsample,
-                    INDEX_GREEN, focal_plane, tile_size, stmt, err)) {
-    goto OPENSLIDE_LABEL_OUT;
-  }
-  if (!read_channel(blue_channel, tile_col, tile_row, downsample,
-                    INDEX_BLUE, focal_plane, tile_size, stmt, err)) {
-    goto OPENSLIDE_LABEL_OUT;
+  struct sakura_ops_data *data = osr->data;
+  const enum color_index colors[] = {INDEX_RED, INDEX_GREEN, INDEX_BLUE};
+  struct channel_job jobs[G_N_ELEMENTS(colors)];
+  void *job_ptrs[G_N_ELEMENTS(colors)];
+  bool parallel = _openslide_grid_get_tile_decode_threads(osr) > 1;
+  bool success = true;
+
+  for (uint32_t i = 0; i < G_N_ELEMENTS(colors); i++) {
+    struct channel_job *job = &jobs[i];
+    job->channeldata = g_slice_alloc(tile_size * tile_size);
+    job->tile_col = tile_col;
+    job->tile_row = tile_row;
+    job->downsample = downsample;
+    job->color = colors[i];
+    job->focal_plane = focal_plane;
+    job->tile_size = tile_size;
+    // the first channel is read by the calling thread
+    job->stmt = (i == 0 || !parallel) ? stmt : NULL;
+    job->sc = data->sc;
+    job->err = NULL;
+    job_ptrs[i] = job;
   }
 
-  for (int32_t i = 0; i < tile_size * tile_size; i++) {
-    tiledata[i] = 0xff000000 |
-                  (red_channel[i] << 16) |
-                  (green_channel[i] << 8) |
-                  blue_channel[i];
+  // the three channels are independent JPEGs; decode them concurrently
+  // when the caller may use the decode threads
+  _openslide_grid_run_jobs(osr, channel_job_run,
+                           job_ptrs, G_N_ELEMENTS(jobs));
+
+  for (uint32_t i = 0; i < G_N_ELEMENTS(jobs); i++) {
+    if (jobs[i].err) {
+      if (success) {
+        g_propagate_error(err, jobs[i].err);
+        success = false;
+      } else {
+        g_error_free(jobs[i].err);
+      }
+    }
   }
 
-  success = true;
+  if (success) {
+    // plain loop over separate planes, which the compiler vectorizes
+    const uint8_t *red = jobs[0].channeldata;
+    const uint8_t *green = jobs[1].channeldata;
+    const uint8_t *blue = jobs[2].channeldata;
+    int32_t count = tile_size * tile_size;
+    for (int32_t i = 0; i < count; i++) {
+      tiledata[i] = 0xff000000 |
+                    ((uint32_t) red[i] << 16) |
+                    ((uint32_t) green[i] << 8) |
+                    blue[i];
+    }
+  }
 
-OPENSLIDE_LABEL_OUT:
-  g_slice_free1(tile_size * tile_size, red_channel);
-  g_slice_free1(tile_size * tile_size, green_channel);
-  g_slice_free1(tile_size * tile_size, blue_channel);
+  for (uint32_t i = 0; i < G_N_ELEMENTS(jobs); i++) {
+    g_slice_free1(tile_size * tile_size, jobs[i].channeldata);
+  }
   return success;
 }
 
@@ -375,23 +439,48 @@ static bool read_tile(openslide_t *osr,
 
   // cache
   struct _openslide_cache_entry *cache_entry;
-  uint32_t *tiledata = _openslide_cache_get(osr->cache,
-                                            level, tile_col, tile_row,
-                                            &cache_entry);
+  uint32_t *tiledata = _openslide_cache_get_tile(osr->cache,
+                                                 level, tile_col, tile_row,
+                                                 tile_size, tile_size,
+                                                 CAIRO_FORMAT_ARGB32,
+                                                 &cache_entry);
   if (!tiledata) {
-    tiledata = g_slice_alloc(tile_size * tile_size * 4);
+    // the request is exactly this tile; decode it in place, uncached
+    uint32_t *dest = _openslide_grid_get_tile_dest(cr, tile_size, tile_size);
+    if (dest) {
+      if (!read_image(osr, dest, tile_col, tile_row, l->base.downsample,
+                      data->focal_plane, tile_size, stmt, &tmp_err)) {
+        if (g_error_matches(tmp_err, OPENSLIDE_ERROR,
+                            OPENSLIDE_ERROR_NO_VALUE)) {
+          // no such tile
+          g_clear_error(&tmp_err);
+          memset(dest, 0, tile_size * tile_size * 4);
+          return true;
+        }
+        g_propagate_error(err, tmp_err);
+        return false;
+      }
+      return _openslide_clip_tile(dest,
+                                  tile_size, tile_size,
+                                  l->base.w - tile_col * tile_size,
+                                  l->base.h - tile_row * tile_size,
+                                  err);
+    }
+
+    tiledata = _openslide_tile_buffer_alloc(tile_size * tile_size * 4);
 
     // read tile
-    if (!read_image(tiledata, tile_col, tile_row, l->base.downsample,
+    if (!read_image(osr, tiledata, tile_col, tile_row, l->base.downsample,
                     data->focal_plane, tile_size, stmt, &tmp_err)) {
       if (g_error_matches(tmp_err, OPENSLIDE_ERROR,
                           OPENSLIDE_ERROR_NO_VALUE)) {
-        // no such tile
+        // no such tile; fill with transparent, since the cell must
+        // still be painted
         g_clear_error(&tmp_err);
-        return true;
+        memset(tiledata, 0, tile_size * tile_size * 4);
       } else {
         g_propagate_error(err, tmp_err);
-        g_slice_free1(tile_size * tile_size * 4, tiledata);
+        _openslide_tile_buffer_free(tiledata, tile_size * tile_size * 4);
         return false;
       }
     }
@@ -402,15 +491,16 @@ static bool read_tile(openslide_t *osr,
                               l->base.w - tile_col * tile_size,
                               l->base.h - tile_row * tile_size,
                               err)) {
-      g_slice_free1(tile_size * tile_size * 4, tiledata);
+      _openslide_tile_buffer_free(tiledata, tile_size * tile_size * 4);
       return false;
     }
 
     // put it in the cache
-    _openslide_cache_put(osr->cache,
-			 level, tile_col, tile_row,
-			 tiledata, tile_size * tile_size * 4,
-			 &cache_entry);
+    _openslide_cache_put_tile(osr->cache,
+			      level, tile_col, tile_row,
+			      tile_size, tile_size, CAIRO_FORMAT_ARGB32,
+			      tiledata,
+			      &cache_entry);
   }
 
   // draw it
@@ -428,6 +518,14 @@ static bool read_tile(openslide_t *osr,
   return true;
 }
 
+static void *stmtcache_get_arg(void *arg_data, GError **err) {
+  return _openslide_sqlite_stmtcache_get(arg_data, err);
+}
+
+static void stmtcache_put_arg(void *arg_data, void *arg) {
+  _openslide_sqlite_stmtcache_put(arg_data, arg);
+}
+
 static bool paint_region(openslide_t *osr, cairo_t *cr,
                          int64_t x, int64_t y,
                          struct _openslide_level *level,
@@ -435,24 +533,18 @@ static bool paint_region(openslide_t *osr, cairo_t *cr,
                          GError **err) {
   struct sakura_ops_data *data = osr->data;
   struct level *l = (struct level *) level;
-  sqlite3_stmt *stmt = NULL;
-  bool success = false;
 
-  sqlite3 *db = _openslide_sqlite_open(data->filename, err);
-  if (!db) {
+  sqlite3_stmt *stmt = _openslide_sqlite_stmtcache_get(data->sc, err);
+  if (!stmt) {
     return false;
   }
-  PREPARE_OR_FAIL(stmt, db, data->data_sql);
-
-  success = _openslide_grid_paint_region(l->grid, cr, stmt,
-                                         x / l->base.downsample,
-                                         y / l->base.downsample,
-                                         level, w, h,
-                                         err);
 
-FAIL:
-  sqlite3_finalize(stmt);
-  _openslide_sqlite_close(db);
+  bool success = _openslide_grid_paint_region(l->grid, cr, stmt,
+                                              x / l->base.downsample,
+                                              y / l->base.downsample,
+                                              level, w, h,
+                                              err);
+  _openslide_sqlite_stmtcache_put(data->sc, stmt);
   return success;
 }
 
@@ -800,6 +892,11 @@ static void compute_quickhash1(struct _openslide_hash *quickhash1,
                                sqlite3 *db,
                                const char *unique_table_name,
                                GQueue *tileids) {
+  if (!quickhash1) {
+    // the caller doesn't want the hash
+    return;
+  }
+
   if (!hash_columns(quickhash1, db, "SELECT SlideId, Date, Creator, "
                     "Description, Keywords FROM SVSlideDataXPO "
                     "ORDER BY OID", NULL)) {
@@ -997,6 +1094,15 @@ static bool sakura_open(openslide_t *osr, const char *filename,
     g_strdup_printf("SELECT data FROM %s WHERE id=?", unique_table_name);
   data->tile_size = tile_size;
   data->focal_plane = chosen_focal_plane;
+  data->sc = _openslide_sqlite_stmtcache_create(filename, data->data_sql);
+
+  // each decode thread reads through its own connection
+  for (int32_t i = 0; i < level_count; i++) {
+    _openslide_grid_enable_parallel_decode(levels[i]->grid,
+                                           stmtcache_get_arg,
+                                           stmtcache_put_arg,
+                                           data->sc);
+  }
 
   // commit
   g_assert(osr->data == NULL);
@@ -96,15 +96,16 @@ static bool read_tile(openslide_t *osr,
 
   // cache
   struct _openslide_cache_entry *cache_entry;
-  uint32_t *tiledata = _openslide_cache_get(osr->cache,
-                                            level, tile_col, tile_row,
-                                            &cache_entry);
+  uint32_t *tiledata = _openslide_cache_get_tile(osr->cache,
+                                                 level, tile_col, tile_row,
+                                                 tw, th, CAIRO_FORMAT_ARGB32,
+                                                 &cache_entry);
   if (!tiledata) {
-    tiledata = g_slice_alloc(tw * th * 4);
-    if (!_openslide_tiff_read_tile(tiffl, tiff,
+    tiledata = _openslide_tile_buffer_alloc(tw * th * 4);
+    if (!_openslide_tiff_read_tile(osr, tiffl, tiff,
                                    tiledata, tile_col, tile_row,
                                    err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+      _openslide_tile_buffer_free(tiledata, tw * th * 4);
       return false;
     }
 
@@ -112,14 +113,14 @@ static bool read_tile(openslide_t *osr,
     if (!_openslide_tiff_clip_tile(tiffl, tiledata,
                                    tile_col, tile_row,
                                    err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+      _openslide_tile_buffer_free(tiledata, tw * th * 4);
       return false;
     }
 
     // put it in the cache
-    _openslide_cache_put(osr->cache, level, tile_col, tile_row,
-                         tiledata, tw * th * 4,
-                         &cache_entry);
+    _openslide_cache_put_tile(osr->cache, level, tile_col, tile_row,
+                               tw, th, CAIRO_FORMAT_ARGB32, tiledata,
+                               &cache_entry);
   }
 
   // draw it
@@ -381,6 +382,7 @@ static bool trestle_open(openslide_t *osr, const char *filename,
                                              tiffl->tile_w - overlap_x,
                                              tiffl->tile_h - overlap_y,
                                              read_tile, NULL);
+    _openslide_tiff_grid_enable_parallel_decode(l->grid, tc);
 
     // add tiles
     for (int64_t y = 0; y < tiffl->tiles_down; y++) {
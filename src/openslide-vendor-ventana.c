@@ -170,15 +170,16 @@ static bool read_subtile(openslide_t *osr,
 
   // get tile data, possibly from cache
   struct _openslide_cache_entry *cache_entry;
-  uint32_t *tiledata = _openslide_cache_get(osr->cache,
-                                            level, tile_col, tile_row,
-                                            &cache_entry);
+  uint32_t *tiledata = _openslide_cache_get_tile(osr->cache,
+                                                 level, tile_col, tile_row,
+                                                 tw, th, CAIRO_FORMAT_ARGB32,
+                                                 &cache_entry);
   if (!tiledata) {
-    tiledata = g_slice_alloc(tw * th * 4);
-    if (!_openslide_tiff_read_tile(tiffl, tiff,
+    tiledata = _openslide_tile_buffer_alloc(tw * th * 4);
+    if (!_openslide_tiff_read_tile(osr, tiffl, tiff,
                                    tiledata, tile_col, tile_row,
                                    err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+      _openslide_tile_buffer_free(tiledata, tw * th * 4);
       return false;
     }
 
@@ -186,14 +187,14 @@ static bool read_subtile(openslide_t *osr,
     if (!_openslide_tiff_clip_tile(tiffl, tiledata,
                                    tile_col, tile_row,
                                    err)) {
-      g_slice_free1(tw * th * 4, tiledata);
+      _openslide_tile_buffer_free(tiledata, tw * th * 4);
       return false;
     }
 
     // put it in the cache
-    _openslide_cache_put(osr->cache, level, tile_col, tile_row,
-                         tiledata, tw * th * 4,
-                         &cache_entry);
+    _openslide_cache_put_tile(osr->cache, level, tile_col, tile_row,
+                               tw, th, CAIRO_FORMAT_ARGB32, tiledata,
+                               &cache_entry);
   }
 
   // draw
@@ -323,19 +324,47 @@ static bool ventana_detect(const char *filename G_GNUC_UNUSED,
     return false;
   }
 
-  // parse
-  xmlDoc *doc = _openslide_xml_parse(xml, err);
-  if (!doc) {
+  // stream through the top of the document for the iScan element,
+  // without parsing all of it
+  xmlTextReader *reader = _openslide_xml_reader_create(xml, err);
+  if (!reader) {
     return false;
   }
+  GError *tmp_err = NULL;
+  bool found = false;
+  if (_openslide_xml_reader_next_element(reader, false, &tmp_err)) {
+    const xmlChar *root = xmlTextReaderConstName(reader);
+    if (!xmlStrcmp(root, BAD_CAST INITIAL_XML_ISCAN)) {
+      // /iScan
+      found = true;
+    } else if (!xmlStrcmp(root, BAD_CAST INITIAL_XML_ALT_ROOT)) {
+      // /Metadata/iScan, found in some slides
+      bool skip = false;
+      while (!found &&
+             _openslide_xml_reader_next_element(reader, skip, &tmp_err) &&
+             xmlTextReaderDepth(reader) == 1) {
+        found = !xmlStrcmp(xmlTextReaderConstName(reader),
+                           BAD_CAST INITIAL_XML_ISCAN);
+        skip = true;
+      }
+      if (!found && !tmp_err) {
+        g_set_error(&tmp_err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                    "Couldn't find iScan element in initial XML");
+      }
+    } else {
+      g_set_error(&tmp_err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "Unrecognized root element in initial XML");
+    }
+  } else if (!tmp_err) {
+    g_set_error(&tmp_err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "No root element in initial XML");
+  }
+  xmlFreeTextReader(reader);
 
-  // check for iScan element
-  if (!get_initial_xml_iscan(doc, err)) {
-    xmlFreeDoc(doc);
+  if (!found) {
+    g_propagate_error(err, tmp_err);
     return false;
   }
-
-  xmlFreeDoc(doc);
   return true;
 }
 
@@ -739,6 +768,9 @@ static struct _openslide_grid *create_bif_grid(openslide_t *osr,
                                    bif->tile_advance_x / downsample,
                                    bif->tile_advance_y / downsample,
                                    read_subtile_tilemap, NULL);
+  // area offsets and tile advances are fractional, especially in the
+  // downsampled levels, and resampling every tile is slow; snap if asked
+  _openslide_grid_tilemap_set_snap(grid, _openslide_grid_get_snap_enabled());
 
   for (int32_t i = 0; i < bif->num_areas; i++) {
     struct area *area = bif->areas[i];
@@ -930,7 +962,11 @@ static bool ventana_open(openslide_t *osr, const char *filename,
                                                 tiffl->tile_h,
                                                 read_subtile);
         l->subtiles_per_tile = 1;
+        if (tiffl->tile_read_direct) {
+          _openslide_tiff_grid_enable_coalesced_reads(l->grid, tiffl);
+        }
       }
+      _openslide_tiff_grid_enable_parallel_decode(l->grid, tc);
       //g_debug("level %"PRId64": magnification %g, downsample %g, size %"PRId64" %"PRId64, level, magnification, downsample, l->base.w, l->base.h);
 
       // add to array
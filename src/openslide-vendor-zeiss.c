@@ -58,6 +58,17 @@
 #include <errno.h>                                      // file handling error
 #include <string.h>                                       // string comparison
 #include <sys/types.h>                                   // int MIN/MAX values
+#ifdef HAVE_MMAP
+#include <sys/mman.h>                                     // mapped sources
+#include <sys/stat.h>                                     // mapped sources
+#endif
+// SSSE3 BGR_24 expansion, selected at runtime as in openslide-decode-jpeg.c
+#if defined(__GNUC__) && !defined(__clang__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define CZI_HAVE_SSSE3_EXPAND 1
+#include <tmmintrin.h>                                     // SSSE3 shuffles
+#endif
 //----------------------------------------------------------------------------
 
 //============================================================================
@@ -71,6 +82,19 @@
 //#define CZI_WRITE_TILE_DATA         1
 //#define CZI_WRITE_XML               1
 
+// Maximum number of lowest resolution tiles sampled to estimate the dynamic
+// of 16 bits and float slides
+#define CZI_RESCALE_SAMPLE_TILES    64
+
+// Dimensions of the planes that can be selected, in OPENSLIDE_PLANE_* order
+#define CZI_PLANE_DIMENSION_IDS     "CZT"
+
+// Size of the chunks tiles and dimensions are allocated from
+#define CZI_ARENA_CHUNK_SIZE        (1 << 20)
+
+// Maximum number of idle read handles kept per source
+#define CZI_STREAM_CACHE_MAX        32
+
 // key:PARSING-TOP
 //////////////////////////////////////////////////////////////////////////////
 ///                                                                        ///
@@ -143,6 +167,7 @@ enum czi_roi_covering_mode_t {
 // Its characteristics should be hidden to the user.
 typedef struct _czi _openslide_czi;
 typedef struct _czi_roi _openslide_roi; // Temporary, this is to allow later renaming
+struct _czi_rescale_info;
 
 // Tile descriptive structure
 // Made for the user to choose tiles to load.
@@ -169,6 +194,14 @@ struct _openslide_czi_uncompressor {
                       uint32_t *dest,
                       int32_t width, int32_t height,
                       GError **err );                     // Uncompress method
+
+  bool (*uncompress_cairo)( const void *data, uint32_t data_size,
+                            uint32_t *dest,
+                            int32_t width, int32_t height,
+                            GError **err );               // Uncompress to the
+                                                          // CAIRO_FORMAT_RGB24
+                                                          // pixels of a BGR_24
+                                                          // tile, may be NULL
 };
 
 const struct _openslide_czi_uncompressor _openslide_uncompressor_jpeg = {
@@ -181,6 +214,7 @@ const struct _openslide_czi_uncompressor _openslide_uncompressor_jpeg = {
 const struct _openslide_czi_uncompressor _openslide_uncompressor_jxr = {
   .name   = "jpegxr",
   .uncompress = _openslide_jxr_decode_buffer,
+  .uncompress_cairo = _openslide_jxr_decode_buffer_bgrx32,
 };
 
 #endif
@@ -232,17 +266,20 @@ static bool               _openslide_czi_get_level_offset( _openslide_czi * czi,
 static bool               _openslide_czi_get_level_size( _openslide_czi * czi, int32_t level, int32_t * w, int32_t * h, GError ** err );
 static struct _czi_tile * _openslide_czi_get_level_tile( _openslide_czi * czi, int32_t level, int64_t uid, GError **err );
 static bool               _openslide_czi_get_level_tile_size( _openslide_czi * czi, int32_t level, int32_t * w, int32_t * h, GError ** err );
-static uint8_t *          _openslide_czi_get_level_tile_data( _openslide_czi * czi, int32_t level, int64_t uid, int32_t * buffer_size, GError **err );
-static GList   *          _openslide_czi_get_level_tiles( _openslide_czi * czi, int32_t level, GError **err );
-static bool               _openslide_czi_free_level_tile_data( _openslide_czi * czi, int32_t level, int64_t uid, GError **err );
+static uint8_t *          _openslide_czi_get_level_tile_data( _openslide_czi * czi, int32_t level, int64_t uid, int32_t * buffer_size, bool * mapped, GError **err );
+static GList   *          _openslide_czi_get_level_tiles( _openslide_czi * czi, int32_t level, const int32_t * plane, GError **err );
+static void               _openslide_czi_free_level_tile_data( uint8_t * data, int32_t buffer_size );
 
 
 // Tile
 static int64_t            _openslide_czi_generate_tile_uid( _openslide_czi * czi, int32_t x, int32_t y );
 static void               _openslide_czi_free_list_tiles( GList * list );
 static uint8_t *          _openslide_czi_uncompress_tile( struct _openslide_czi_tile_descriptor * tile_desc, uint8_t * data, int32_t data_size, int32_t * uncompressed_data_size, GError ** err);
-static uint8_t *          _openslide_czi_load_tile( _openslide_czi * czi, int32_t level, int64_t uid, int32_t * buffer_size, GError **err );
-static uint8_t *          _openslide_czi_data_convert_to_rgba32( enum czi_pixel_t pixel_type, uint8_t * tile_data, int32_t tile_data_size, int32_t * converted_tile_data_size, GError ** err);
+static const struct _openslide_czi_uncompressor * czi_cairo_uncompressor( const struct _openslide_czi_tile_descriptor * tile_desc );
+static uint8_t *          _openslide_czi_load_tile( _openslide_czi * czi, int32_t level, int64_t uid, int32_t * buffer_size, bool * mapped, GError **err );
+static uint8_t *          _openslide_czi_data_convert_to_rgba32( enum czi_pixel_t pixel_type, const struct _czi_rescale_info * rescale_info, uint8_t * tile_data, int32_t tile_data_size, int32_t * converted_tile_data_size, GError ** err);
+static const struct _czi_rescale_info * _openslide_czi_get_rescale_info( _openslide_czi * czi, enum czi_pixel_t pixel_type );
+static struct _czi_rescale_info * czi_estimate_rescale_info( struct _czi * czi, enum czi_pixel_t pixel_type, GError ** err );
 static uint8_t            _openslide_czi_pixel_type_size( enum czi_pixel_t );
 static uint8_t            _openslide_czi_pixel_type_channel_count( enum czi_pixel_t type );
 static bool               _openslide_czi_destroy_tile( _openslide_czi * czi, int32_t level, int64_t uid, GError **err ) G_GNUC_UNUSED;
@@ -339,15 +376,33 @@ struct _czi_segment_header {
 // - a stream (for a czi embedded as attachment for example), in which case
 //   'filename' is NULL, 'begin' specifies the stream start position from
 //   SEEK_SET, and 'size' specifies the number of usable bytes for our stream.
+// 'stream' is only used while parsing the file at open time. Tile data is
+// read later from any thread, either directly from 'map' when mapping is
+// enabled with OPENSLIDE_MMAP=1 and the file could be mapped, or through handles taken from 'stream_cache'
+// (see czi_source_get_stream/czi_source_put_stream).
 struct _czi_source {
   char    * filename;
   FILE    * stream;
   int64_t   begin;
   int64_t   size;
+  const uint8_t * map;                      // read-only mapping, or NULL
+  int64_t         map_size;
+  GQueue  * stream_cache;                   // idle FILE * opened on filename
+  GMutex  * stream_lock;                    // protects stream_cache
+  int       outstanding;                    // handles currently in use
+};
+
+// Tiles and their dimensions are numerous and live as long as the slide,
+// so they are carved out of large chunks, freed all at once with the slide.
+struct _czi_arena {
+  GSList      * chunks;                             // uint8_t[]
+  uint8_t     * next;                               // free space in chunk
+  size_t        left;                               // ""
 };
 
 struct _czi {
   GPtrArray   * sources;                            // struct _czi_source
+  struct _czi_arena arena;                          // tiles and dimensions
   bool          is_multi_view;                      // precomputed information
   bool          is_multi_phase;                     // ""
   bool          is_multi_block;                     // ""
@@ -368,8 +423,12 @@ struct _czi {
   GPtrArray   * rois;                               // struct _czi_roi
   GPtrArray   * metadata;                           // struct _czi_metadata
   GHashTable  * attachments;                        // key: guid - value: struct _czi_attachment
-  GHashTable  * grids;                              // key: downsample - value: openslide_grid
+  GHashTable  * plane_grids;                        // key: plane key - value: grids of the plane, by downsample
+  GMutex      * plane_lock;                         // protects plane_grids
   GHashTable  * tileuid_counts;                     // key: guid - value: int32_t
+  GMutex      * rescale_lock;                       // protects rescale_*
+  bool          rescale_estimated;                  // rescale_info was computed
+  struct _czi_rescale_info * rescale_info;          // slide wide, may be NULL
 
 #ifdef CZI_DEBUG
   GHashTable  * tileread_counts;                    // key: guid - value: int64_t
@@ -419,6 +478,7 @@ struct _czi_level {
   GHashTable            * size;   // key: char * XYCZTRSIBMHV - value: int32_t
   GHashTable            * start;  // key: char * XYCZTRSIBMHV - value: int32_t
   GHashTable            * tiles;  // key: guid - value: struct _czi_tile
+  GPtrArray             * tile_array; // struct _czi_tile, sorted by position
 };
 
 // Each tile is stored in a subblock segment, even though we only used headers
@@ -433,18 +493,19 @@ struct _czi_tile {                    // subblock_segment + directory_entry_dv
   enum czi_pixel_t        pixel_type;
   enum czi_compression_t  compression;
   enum czi_pyramid_t      pyramid_type;
-  GHashTable            * dimensions;   // key: char * - struct _czi_dimension
+  struct _czi_dimension * dimensions;   // dimension_count, in the arena
+  int32_t                 dimension_count;
   int32_t                 directory_size;
   int32_t                 metadata_size;
   int32_t                 data_size;
   int32_t                 attachment_size;
+  int64_t                 data_offset;  // absolute, resolved at open time
   char                  * metadata_buf;              // only loaded when asked
   uint8_t               * data_buf;                  // only loaded when asked
   uint8_t               * attachment_buf;            // only loaded when asked
 };
 
 struct _czi_dimension {                                  // dimension_entry_dv
-  struct _czi_tile * tile;
   char               dimension_id[5];
   int32_t            start;
   int32_t            size;
@@ -562,6 +623,9 @@ struct _czi_channel_converter {
 // Structure used to convert a buffer from a pixel type to another.
 // It uses dynamic information to rescale dynamic of the data if needed (i.e.
 // when destination type is less precise than source type).
+// 'convert' processes a single pixel, 'convert_buffer' a whole buffer of
+// pixel_count pixels in one call. When 'convert_buffer' is available it is
+// preferred, 'convert' may then be NULL.
 struct _czi_pixel_converter {
   //--- methods ----------------------------------------------------------------
   void (*convert)(const struct _czi_pixel_converter       * cpc,
@@ -569,6 +633,11 @@ struct _czi_pixel_converter {
                   uint8_t                                 * src_buffer,
                   uint8_t                                 * dest_buffer,
                   GError                                 ** err);
+  void (*convert_buffer)(const struct _czi_pixel_converter * cpc,
+                  const struct _czi_rescale_info          * cri,
+                  const uint8_t                           * src_buffer,
+                  uint8_t                                 * dest_buffer,
+                  uint64_t                                  pixel_count);
   
   //--- attributes -------------------------------------------------------------
   enum czi_pixel_t      src_pixel_type;
@@ -715,8 +784,8 @@ static struct _czi_level                        * czi_new_level( struct _czi * c
 static struct _czi_roi                          * czi_new_roi( struct _czi * czi, GError ** err );
 static struct _czi_metadata                     * czi_new_metadata( struct _czi * czi, GError ** err );
 static struct _czi_attachment                   * czi_new_attachment( struct _czi * czi, GError ** err );
-static struct _czi_tile                         * czi_new_tile( GError ** err );
-static struct _czi_dimension                    * czi_new_dimension( struct _czi_tile * tile, GError ** err );
+static struct _czi_tile                         * czi_new_tile( struct _czi * czi );
+static void                                     * czi_arena_alloc0( struct _czi_arena * arena, size_t size );
 static int16_t                                  * czi_new_S16( int16_t integer, GError ** err ) G_GNUC_UNUSED;
 static int32_t                                  * czi_new_S32( int32_t integer, GError ** err );
 static int64_t                                  * czi_new_S64( int64_t integer, GError ** err );
@@ -732,8 +801,7 @@ static void czi_free_file_header(          struct _czi_file_header
 static void czi_free_level(                struct _czi_level                     * ptr );
 static void czi_free_metadata(             struct _czi_metadata                  * ptr );
 static void czi_free_attachment(           struct _czi_attachment                * ptr );
-static void czi_free_tile(                 struct _czi_tile                      * ptr );
-static void czi_free_dimension(            struct _czi_dimension                 * ptr );
+static void czi_free_arena(                struct _czi_arena                     * ptr );
 static void czi_free_roi(                  struct _czi_roi                       * ptr );
 static void czi_free_S16(                  int16_t                               * ptr ) G_GNUC_UNUSED;
 static void czi_free_S32(                  int32_t                               * ptr );
@@ -748,9 +816,21 @@ static bool czi_parse_directory(  struct _czi_source * source, struct _czi
 static bool czi_parse_attdir(     struct _czi_source * source, struct _czi             * czi,         GError ** err );
 static bool czi_read_file_header( struct _czi_source * source, struct _czi_file_header * file_header, GError ** err );
 static bool czi_read_metadata(    struct _czi_source * source, struct _czi_metadata    * metadata,    GError ** err );
-static bool czi_read_tile(        struct _czi_source * source, struct _czi_tile        * tile,        GError ** err );
+static bool czi_read_tile(        struct _czi_source * source, struct _czi             * czi, struct _czi_tile * tile, GError ** err );
 static bool czi_read_dimension(   struct _czi_source * source, struct _czi_dimension   * dimension,   GError ** err );
 static bool czi_read_attachment(  struct _czi_source * source, struct _czi_attachment  * attachment,  GError ** err );
+static bool czi_resolve_tile_data( struct _czi_source * source, GPtrArray * tiles, GError ** err );
+static gint czi_cmp_tile_offset( gconstpointer a, gconstpointer b );
+static gint czi_cmp_tile_position( gconstpointer a, gconstpointer b );
+static struct _czi_dimension * czi_tile_get_dimension( struct _czi_tile * tile, char id );
+static bool czi_tile_in_plane( struct _czi_level * level, struct _czi_tile * tile, const int32_t * plane );
+static uint8_t * czi_read_tile_data( FILE * stream, struct _czi_tile * tile, int32_t * buffer_size, GError ** err );
+
+//--- source streams ---------------------------------------------------------
+static FILE * czi_source_get_stream( struct _czi_source * source, GError ** err );
+static void   czi_source_put_stream( struct _czi_source * source, FILE * stream );
+static void   czi_source_map( struct _czi_source * source );
+static const uint8_t * czi_map_tile_data( struct _czi_tile * tile, int32_t * buffer_size );
 
 //--- enum string conversion ------------------------------------------------------
 static const char * czi_compression_t_string(       enum czi_compression_t compression_type );
@@ -1125,6 +1205,48 @@ static void czi_pixel_convert_BGR_192_COMPLEX_FLOAT_to_BGRA_32(
                         uint8_t                              * dest_buffer,
                         GError                              ** err);
 
+//--- buffer pixel conversion --------------------------------------------------
+// Whole buffer conversion loops. They give the same results as the per pixel
+// converters, without the indirect calls for each pixel and channel, and
+// are simple enough to be vectorized by the compiler.
+static uint8_t * czi_rescale_lut_U16_to_U8(
+                        const struct _czi_rescale_info       * cri);
+
+static void czi_pixel_convert_buffer_GRAY_8_to_BGRA_32(
+                        const struct _czi_pixel_converter    * cpc,
+                        const struct _czi_rescale_info       * cri,
+                        const uint8_t                        * src_buffer,
+                        uint8_t                              * dest_buffer,
+                        uint64_t                               pixel_count);
+
+static void czi_pixel_convert_buffer_GRAY_16_to_BGRA_32(
+                        const struct _czi_pixel_converter    * cpc,
+                        const struct _czi_rescale_info       * cri,
+                        const uint8_t                        * src_buffer,
+                        uint8_t                              * dest_buffer,
+                        uint64_t                               pixel_count);
+
+static void czi_pixel_convert_buffer_BGR_24_to_BGRA_32(
+                        const struct _czi_pixel_converter    * cpc,
+                        const struct _czi_rescale_info       * cri,
+                        const uint8_t                        * src_buffer,
+                        uint8_t                              * dest_buffer,
+                        uint64_t                               pixel_count);
+
+static void czi_pixel_convert_buffer_BGR_48_to_BGRA_32(
+                        const struct _czi_pixel_converter    * cpc,
+                        const struct _czi_rescale_info       * cri,
+                        const uint8_t                        * src_buffer,
+                        uint8_t                              * dest_buffer,
+                        uint64_t                               pixel_count);
+
+static void czi_pixel_convert_buffer_BGR_96_FLOAT_to_BGRA_32(
+                        const struct _czi_pixel_converter    * cpc,
+                        const struct _czi_rescale_info       * cri,
+                        const uint8_t                        * src_buffer,
+                        uint8_t                              * dest_buffer,
+                        uint64_t                               pixel_count);
+
 // key:PARSING-PUB-DEF
 //============================================================================
 //
@@ -1182,7 +1304,7 @@ bool read_items(
 {
   g_assert( stream );
   uint64_t len;
-  len = fread( items, size, count, stream );
+  len = _openslide_fread( stream, items, size * count ) / size;
   if( len != count ) {
     char * out;
     if( feof(stream) )
@@ -1250,6 +1372,7 @@ bool czi_find_sources(
   source->size = 0;
   source->stream = _openslide_fopen( filename, "rb", err );
   if( !source->stream ) return false;
+  czi_source_map( source );
 
   // Look for eventual part files
   int32_t i = 1;
@@ -1269,6 +1392,7 @@ bool czi_find_sources(
       g_free( base );
       return false;
     }
+    czi_source_map( source );
   }
   g_free( partname );
   g_free( base );
@@ -1497,7 +1621,7 @@ bool czi_add_tile(
   struct _czi_level * level = NULL;
   struct _czi_dimension * dimension;
   gpointer has_key;
-  GList * list_keys, * current_key;
+  char key[2] = { 0, 0 };
   int32_t start, size;
   int32_t * cur_start, * cur_size;
   uint32_t i;
@@ -1522,30 +1646,31 @@ bool czi_add_tile(
     g_ptr_array_add( czi->levels, level );
   }
 
-  g_hash_table_insert( level->tiles, czi_new_S64(tile->uid,0), tile );
-  list_keys = g_hash_table_get_keys( tile->dimensions );
-  current_key = list_keys;
-  while( current_key )
+  // The key is the uid stored in the tile itself
+  g_hash_table_insert( level->tiles, &tile->uid, tile );
+  g_ptr_array_add( level->tile_array, tile );
+  for( int32_t d = 0; d < tile->dimension_count; ++d )
   {
-    dimension = ((struct _czi_dimension*)g_hash_table_lookup( tile->dimensions, (char*) current_key->data ));
+    dimension = &tile->dimensions[d];
     start = dimension->start;
     size  = dimension->size;
+    key[0] = dimension->dimension_id[0];
 
-    has_key = g_hash_table_lookup( level->size, (char*) current_key->data );
+    has_key = g_hash_table_lookup( level->size, key );
     if( !has_key ) {
       cur_size = czi_new_S32( size, err );
       if( !cur_size ) return false;
-      g_hash_table_insert( level->size, g_strdup( (char*)current_key->data ), cur_size );
+      g_hash_table_insert( level->size, g_strdup( key ), cur_size );
       cur_start = czi_new_S32( start, err );
       if( !cur_start ) return false;
-      g_hash_table_insert( level->start, g_strdup( (char*)current_key->data ), cur_start);
+      g_hash_table_insert( level->start, g_strdup( key ), cur_start);
       //g_debug("key: %s, cur_start: %d, cur_size: %d, start: %d, size: %d", 
-      //        (char*) current_key->data, *cur_start, *cur_size, start, size);
+      //        key, *cur_start, *cur_size, start, size);
     } else {
-      cur_start = (int32_t*) g_hash_table_lookup( level->start, (char*) current_key->data );
-      cur_size  = (int32_t*) g_hash_table_lookup( level->size, (char*) current_key->data );
+      cur_start = (int32_t*) g_hash_table_lookup( level->start, key );
+      cur_size  = (int32_t*) g_hash_table_lookup( level->size, key );
       //g_debug("key: %s, cur_start: %d, cur_size: %d, start: %d, size: %d", 
-      //        (char*) current_key->data, *cur_start, *cur_size, start, size);
+      //        key, *cur_start, *cur_size, start, size);
       // Update start and size for the level dimension
       if( start < *cur_start ) {
           *cur_size = *cur_size + *cur_start - start;
@@ -1554,16 +1679,14 @@ bool czi_add_tile(
       if( ( start + size - *cur_start ) > *cur_size ) 
           *cur_size = (start + size - *cur_start);
       //g_debug("key: %s, cur_start: %d, cur_size: %d, start: %d, size: %d", 
-      //        (char*) current_key->data, *cur_start, *cur_size, start, size);
+      //        key, *cur_start, *cur_size, start, size);
     }
-    if( !czi_update_bool_dimension( czi, ((char*)current_key->data)[0], *cur_size, err ) )
+    if( !czi_update_bool_dimension( czi, key[0], *cur_size, err ) )
       return false;
-    current_key = g_list_next( current_key );
   }
   if( !czi_update_bool_compression( czi, tile->compression, err ) )
     return false;
 
-  g_list_free( list_keys );
   return true;
 }
 
@@ -1867,6 +1990,76 @@ bool czi_skip_segment(
   return true;
 }
 
+FILE * czi_source_get_stream( struct _czi_source * source, GError ** err )
+{
+  g_assert( source );
+
+  if( !source->filename ) {
+    g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                 "Need a file to read tile data" );
+    return NULL;
+  }
+
+  g_mutex_lock( source->stream_lock );
+  source->outstanding++;
+  FILE * stream = g_queue_pop_head( source->stream_cache );
+  g_mutex_unlock( source->stream_lock );
+
+  if( !stream )
+    stream = _openslide_fopen( source->filename, "rb", err );
+  if( !stream ) {
+    g_mutex_lock( source->stream_lock );
+    source->outstanding--;
+    g_mutex_unlock( source->stream_lock );
+  }
+  return stream;
+}
+
+void czi_source_put_stream( struct _czi_source * source, FILE * stream )
+{
+  g_assert( source );
+  if( !stream )
+    return;
+
+  g_mutex_lock( source->stream_lock );
+  g_assert( source->outstanding );
+  source->outstanding--;
+  if( g_queue_get_length( source->stream_cache ) < CZI_STREAM_CACHE_MAX ) {
+    g_queue_push_head( source->stream_cache, stream );
+    stream = NULL;
+  }
+  g_mutex_unlock( source->stream_lock );
+
+  if( stream )
+    fclose( stream );
+}
+
+void czi_source_map( struct _czi_source * source )
+{
+  g_assert( source );
+#ifdef HAVE_MMAP
+  // Mapping is optional: unless enabled, or on failure, tile data is
+  // read through the stream cache
+  if( !_openslide_mmap_enabled() )
+    return;
+  struct stat st;
+  int fd = fileno( source->stream );
+  if( fd == -1 || fstat( fd, &st ) || st.st_size <= 0 ||
+      (uint64_t) st.st_size > SIZE_MAX )
+    return;
+
+  void * map = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+  if( map == MAP_FAILED ) {
+    g_debug( "Unable to map %s: %s", source->filename, g_strerror(errno) );
+    return;
+  }
+  source->map = map;
+  source->map_size = st.st_size;
+#else
+  (void) source;
+#endif
+}
+
 bool czi_is_zisraw( FILE * stream, GError ** err )
 {
   //g_debug( "czi_is_zisraw" );
@@ -1918,16 +2111,18 @@ struct _czi * czi_new( GError ** err )
                         &g_int64_equal,
                         (void(*)(gpointer)) &czi_free_S64,
                         (void(*)(gpointer)) &czi_free_attachment );
-  czi->grids        = g_hash_table_new_full(
-                            &g_int_hash,
-                            &g_int_equal,
-                            (void(*)(gpointer)) &czi_free_S32,
-                            (void(*)(gpointer)) &_openslide_grid_destroy );
+  czi->plane_grids  = g_hash_table_new_full(
+                            &g_int64_hash,
+                            &g_int64_equal,
+                            (void(*)(gpointer)) &czi_free_S64,
+                            (void(*)(gpointer)) &g_hash_table_destroy );
+  czi->plane_lock   = g_mutex_new();
   czi->tileuid_counts  = g_hash_table_new_full(
                             &g_int64_hash,
                             &g_int64_equal,
                             (void(*)(gpointer)) &czi_free_S64,
                             (void(*)(gpointer)) &czi_free_S16 );
+  czi->rescale_lock = g_mutex_new();
 #ifdef CZI_DEBUG
   czi->tileread_counts = g_hash_table_new_full(
                             &g_int64_hash,
@@ -1960,6 +2155,8 @@ struct _czi_source * czi_new_source( GError ** err )
                  "Failed to allocate %ld bytes", sizeof(struct _czi_source) );
     return NULL;
   }
+  source->stream_cache = g_queue_new();
+  source->stream_lock = g_mutex_new();
   return source;
 }
 
@@ -1984,13 +2181,11 @@ struct _czi_level * czi_new_level( struct _czi * czi, GError ** err )
                   &g_str_equal,
                   &g_free,
                   (void(*)(gpointer)) &czi_free_S32 );
-  level->tiles = g_hash_table_new_full(
-                  &g_int64_hash,
-                  &g_int64_equal,
-                  (void(*)(gpointer)) &czi_free_S64,
-                  (void(*)(gpointer)) &czi_free_tile );
+  // Tiles are owned by the arena
+  level->tiles = g_hash_table_new( &g_int64_hash, &g_int64_equal );
+  level->tile_array = g_ptr_array_new();
 
-  if( !level->size  || !level->start || !level->tiles ) {
+  if( !level->size  || !level->start || !level->tiles || !level->tile_array ) {
     czi_free_level( level );
     g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                  "Failed to initiate _czi_level structure" );
@@ -2063,40 +2258,27 @@ struct _czi_attachment * czi_new_attachment(
   return attachment;
 }
 
-struct _czi_tile * czi_new_tile( GError ** err )
+void * czi_arena_alloc0( struct _czi_arena * arena, size_t size )
 {
-  struct _czi_tile * tile = (struct _czi_tile*) g_slice_alloc0( sizeof(struct _czi_tile) );
-  if( !tile ) {
-    g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                 "Failed to allocate %ld bytes", sizeof(struct _czi_tile) );
-    return NULL;
-  }
+  g_assert( arena );
 
-  tile->dimensions = g_hash_table_new_full( &g_str_hash, &g_str_equal,
-                      &g_free, (void(*)(gpointer)) &czi_free_dimension );
-  if( !tile->dimensions ) {
-    g_slice_free( struct _czi_tile, tile );
-    g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                 "Failed to initiate _czi_tile structure" );
-    return NULL;
+  size = ( size + 7 ) & ~(size_t) 7;
+  if( size > arena->left ) {
+    size_t chunk_size = MAX( size, CZI_ARENA_CHUNK_SIZE );
+    arena->next = g_malloc0( chunk_size );
+    arena->left = chunk_size;
+    arena->chunks = g_slist_prepend( arena->chunks, arena->next );
   }
-
-  return tile;
+  void * ptr = arena->next;
+  arena->next += size;
+  arena->left -= size;
+  return ptr;
 }
 
-struct _czi_dimension * czi_new_dimension( struct _czi_tile * tile, GError ** err )
+struct _czi_tile * czi_new_tile( struct _czi * czi )
 {
-  g_assert( tile );
-
-  struct _czi_dimension * dimension = (struct _czi_dimension*) g_slice_alloc0( sizeof(struct _czi_dimension) );
-  if( !dimension ) {
-    g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                 "Failed to allocate %ld bytes", sizeof(struct _czi_dimension) );
-    return NULL;
-  }
-  dimension->tile = tile;
-  dimension->dimension_id[4] = '\0';
-  return dimension;
+  g_assert( czi );
+  return czi_arena_alloc0( &czi->arena, sizeof(struct _czi_tile) );
 }
 
 int16_t * czi_new_S16( int16_t shortint, GError ** err )
@@ -2149,7 +2331,7 @@ struct _openslide_czi_tile_descriptor * czi_new_tile_descriptor(
   tile_desc->compression = tile->compression;
   tile_desc->pyramid_type = tile->pyramid_type;
 
-  dim = (struct _czi_dimension*) g_hash_table_lookup( tile->dimensions, "X" );
+  dim = czi_tile_get_dimension( tile, 'X' );
   if( !dim ) {
     g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                "Tile without X dimension." );
@@ -2160,7 +2342,7 @@ struct _openslide_czi_tile_descriptor * czi_new_tile_descriptor(
   tile_desc->size_x = dim->size;
   tile_desc->start_x = dim->start;
 
-  dim = (struct _czi_dimension*) g_hash_table_lookup( tile->dimensions, "Y" );
+  dim = czi_tile_get_dimension( tile, 'Y' );
   if( !dim ) {
     g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                "Tile without Y dimension." );
@@ -2270,8 +2452,12 @@ void czi_free( struct _czi * ptr )
     if( ptr->metadata )        g_ptr_array_free( ptr->metadata, true );
     if( ptr->rois )            g_ptr_array_free( ptr->rois, true );
     if( ptr->attachments )     g_hash_table_destroy( ptr->attachments );
-    if( ptr->grids )           g_hash_table_destroy( ptr->grids );
+    if( ptr->plane_grids )     g_hash_table_destroy( ptr->plane_grids );
+    if( ptr->plane_lock )      g_mutex_free( ptr->plane_lock );
     if( ptr->tileuid_counts )  g_hash_table_destroy( ptr->tileuid_counts );
+    if( ptr->rescale_lock )    g_mutex_free( ptr->rescale_lock );
+    czi_free_arena( &ptr->arena );
+    czi_free_rescale_info( ptr->rescale_info );
 #ifdef CZI_DEBUG
     if( ptr->tileread_counts ) {
         g_hash_table_destroy( ptr->tileread_counts );
@@ -2290,6 +2476,17 @@ void czi_free_source( struct _czi_source * ptr )
   if( ptr ) {
     if( ptr->filename ) g_free( ptr->filename );
     if( ptr->stream )   fclose( ptr->stream );
+    if( ptr->stream_cache ) {
+      FILE * stream;
+      while( ( stream = g_queue_pop_head( ptr->stream_cache ) ) != NULL )
+        fclose( stream );
+      g_assert( ptr->outstanding == 0 );
+      g_queue_free( ptr->stream_cache );
+    }
+    if( ptr->stream_lock ) g_mutex_free( ptr->stream_lock );
+#ifdef HAVE_MMAP
+    if( ptr->map )      munmap( (void *) ptr->map, ptr->map_size );
+#endif
     g_slice_free( struct _czi_source, ptr );
   }
 }
@@ -2307,6 +2504,7 @@ void czi_free_level( struct _czi_level * ptr )
     if( ptr->size )       g_hash_table_destroy( ptr->size );
     if( ptr->start )      g_hash_table_destroy( ptr->start );
     if( ptr->tiles )      g_hash_table_destroy( ptr->tiles );
+    if( ptr->tile_array ) g_ptr_array_free( ptr->tile_array, true );
     g_slice_free( struct _czi_level, ptr );
   }
 }
@@ -2332,20 +2530,17 @@ void czi_free_attachment( struct _czi_attachment * ptr )
   if( ptr ) g_slice_free( struct _czi_attachment, ptr );
 }
 
-void czi_free_tile( struct _czi_tile * ptr )
+void czi_free_arena( struct _czi_arena * ptr )
 {
-  // g_debug( "czi_free_tile" );
+  // g_debug( "czi_free_arena" );
   if( ptr ) {
-    if( ptr->dimensions )  g_hash_table_destroy( ptr->dimensions );
-    g_slice_free( struct _czi_tile, ptr );
+    while( ptr->chunks ) {
+      g_free( ptr->chunks->data );
+      ptr->chunks = g_slist_delete_link( ptr->chunks, ptr->chunks );
+    }
+    ptr->next = NULL;
+    ptr->left = 0;
   }
-  return;
-}
-
-void czi_free_dimension( struct _czi_dimension * ptr )
-{
-  // g_debug( "czi_free_dimension" );
-  if( ptr ) g_slice_free( struct _czi_dimension, ptr );
 }
 
 void czi_free_tile_descriptor( struct _openslide_czi_tile_descriptor * ptr )
@@ -2434,38 +2629,37 @@ bool czi_parse_directory(
   TRY_READ_ITEMS( &entry_count, 1, 4, stream, err, "Failed to parse directory: " );
   fseeko( stream, 124, SEEK_CUR );                       // 124 bytes reserved
   //g_debug( "czi_parse_directory: entry count %d", entry_count );
+
+  // tiles read from this directory, owned by the levels
+  GPtrArray * source_tiles = g_ptr_array_sized_new( MAX(entry_count, 0) );
   
+  // Tiles are allocated from the arena, and so are never freed here
   for( int32_t i=0; i<entry_count; ++i )
   {
-    new_tile = czi_new_tile( err );
-    if( !new_tile ) return false;
-    if( !czi_read_tile( source, new_tile, err ) ) {
-      czi_free_tile( new_tile );
-      return false;
-    }
+    new_tile = czi_new_tile( czi );
+    if( !czi_read_tile( source, czi, new_tile, err ) )
+      goto FAIL;
 
     int32_t dim_size_x, dim_stored_size_x,
             dim_size_y, dim_stored_size_y,
             dim_start_x, dim_start_y;
     
-    dim = (struct _czi_dimension*) g_hash_table_lookup( new_tile->dimensions, "X" );
+    dim = czi_tile_get_dimension( new_tile, 'X' );
     if( !dim ) {
       g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                  "Tile without X dimension." );
-      czi_free_tile( new_tile );
-      return false;
+      goto FAIL;
     }
     dim_start_x = dim->start;
     dim_size_x = dim->size;
     dim_stored_size_x = dim->stored_size;    
     ss_x = dim_size_x / dim_stored_size_x;
     
-    dim = (struct _czi_dimension*) g_hash_table_lookup( new_tile->dimensions, "Y" );
+    dim = czi_tile_get_dimension( new_tile, 'Y' );
     if( !dim ) {
       g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                  "Tile without Y dimension." );
-      czi_free_tile( new_tile );
-      return false;
+      goto FAIL;
     }
     dim_start_y = dim->start;
     dim_size_y = dim->size;
@@ -2483,17 +2677,141 @@ bool czi_parse_directory(
 //        ss_x, ss_y
 //     );
     
-    if( !czi_add_tile( czi, new_tile, ss_x, ss_y, err ) ) {
-      czi_free_tile( new_tile );
-      return false;
-    }
+    if( !czi_add_tile( czi, new_tile, ss_x, ss_y, err ) )
+      goto FAIL;
+    g_ptr_array_add( source_tiles, new_tile );
     new_tile = NULL;
   }
 
+  // Locate tile payloads once, so that loading a tile is a single read
+  if( !czi_resolve_tile_data( source, source_tiles, err ) ) {
+    g_prefix_error( err, "Failed to parse directory: " );
+    goto FAIL;
+  }
+  g_ptr_array_free( source_tiles, true );
+
+  // Keep level tiles in row major order
+  for( uint32_t i=0; i<czi->levels->len; ++i ) {
+    struct _czi_level * level = g_ptr_array_index( czi->levels, i );
+    g_ptr_array_sort( level->tile_array, czi_cmp_tile_position );
+  }
+
   g_ptr_array_sort(
     czi->levels,
     (gint(*)(gconstpointer,gconstpointer)) czi_cmp_level );
   return true;
+
+FAIL:
+  g_ptr_array_free( source_tiles, true );
+  return false;
+}
+
+struct _czi_dimension * czi_tile_get_dimension(
+  struct _czi_tile  * tile,
+  char                id
+)
+{
+  for( int32_t i=0; i<tile->dimension_count; ++i )
+    if( tile->dimensions[i].dimension_id[0] == id )
+      return &tile->dimensions[i];
+  return NULL;
+}
+
+gint czi_cmp_tile_position( gconstpointer a, gconstpointer b )
+{
+  struct _czi_tile * t1 = *(struct _czi_tile * const *) a;
+  struct _czi_tile * t2 = *(struct _czi_tile * const *) b;
+  // Tiles were checked for X and Y dimensions when added to their level
+  struct _czi_dimension * x1 = czi_tile_get_dimension( t1, 'X' );
+  struct _czi_dimension * y1 = czi_tile_get_dimension( t1, 'Y' );
+  struct _czi_dimension * x2 = czi_tile_get_dimension( t2, 'X' );
+  struct _czi_dimension * y2 = czi_tile_get_dimension( t2, 'Y' );
+  if( y1->start != y2->start ) return y1->start < y2->start ? -1 : 1;
+  if( x1->start != x2->start ) return x1->start < x2->start ? -1 : 1;
+  return 0;
+}
+
+gint czi_cmp_tile_offset( gconstpointer a, gconstpointer b )
+{
+  const struct _czi_tile * t1 = *(struct _czi_tile * const *) a;
+  const struct _czi_tile * t2 = *(struct _czi_tile * const *) b;
+  if( t1->tile_offset < t2->tile_offset ) return -1;
+  if( t1->tile_offset > t2->tile_offset ) return 1;
+  return 0;
+}
+
+bool czi_resolve_tile_data(
+  struct _czi_source  * source,
+  GPtrArray           * tiles,
+  GError             ** err
+)
+{
+  g_assert( source );
+  g_assert( source->stream );
+  g_assert( tiles );
+
+  // Visit subblocks in file order, so that reads move forward
+  g_ptr_array_sort( tiles, czi_cmp_tile_offset );
+
+  for( uint32_t i=0; i<tiles->len; ++i )
+  {
+    struct _czi_tile * tile = g_ptr_array_index( tiles, i );
+
+    // The SubBlockSegment starts with a 32 bytes segment header, followed
+    // by MetadataSize (4), AttachmentSize (4) and DataSize (8)
+    uint8_t header[48];
+    if( source->map ) {
+      if( tile->tile_offset < 0 ||
+          tile->tile_offset + (int64_t) sizeof(header) > source->map_size ) {
+        g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                     "Tile %ld header is out of file bounds", tile->uid );
+        return false;
+      }
+      memcpy( header, source->map + tile->tile_offset, sizeof(header) );
+    } else {
+      TRY_FSEEKO( source->stream, tile->tile_offset, SEEK_SET, err,
+                  "Failed to read tile header: " );
+      TRY_READ_ITEMS( header, sizeof(header), 1, source->stream, err,
+                      "Failed to read tile header: " );
+    }
+    if( strncmp( (const char *) header, CZI_SUBBLOCK, 16 ) ) {
+      g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                   "Tile %ld header is not a subblock segment", tile->uid );
+      return false;
+    }
+
+    int32_t metadata_size, attachment_size;
+    int64_t data_size;
+    memcpy( &metadata_size,   header + 32, 4 );
+    memcpy( &attachment_size, header + 36, 4 );
+    memcpy( &data_size,       header + 40, 8 );
+    metadata_size   = GINT32_FROM_LE( metadata_size );
+    attachment_size = GINT32_FROM_LE( attachment_size );
+    data_size       = GINT64_FROM_LE( data_size );
+
+    // Data offset = MAX(256, DimensionEntries offset + DimensionCount * 20) + Metada size
+    // from the start of the segment data, where DimensionEntries offset = 48
+    int64_t data_offset = tile->tile_offset + 32
+                        + MAX(256, 48 + 20 * (int64_t) tile->dimension_count)
+                        + metadata_size;
+    if( metadata_size < 0 || data_size <= 0 || data_size > INT32_MAX ) {
+      g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                   "Bad data size %ld for tile %ld", data_size, tile->uid );
+      return false;
+    }
+    if( source->map && data_offset + data_size > source->map_size ) {
+      g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                   "Tile %ld data is out of file bounds", tile->uid );
+      return false;
+    }
+
+    tile->metadata_size   = metadata_size;
+    tile->attachment_size = attachment_size;
+    tile->data_size       = data_size;
+    tile->data_offset     = data_offset;
+  }
+
+  return true;
 }
 
 bool czi_parse_attdir(
@@ -2596,6 +2914,7 @@ bool czi_read_metadata(
 
 bool czi_read_tile(
   struct _czi_source  * source,
+  struct _czi         * czi,
   struct _czi_tile    * tile,
   GError             ** err
 )
@@ -2637,6 +2956,15 @@ bool czi_read_tile(
     tile->pyramid_type = PYR_UNKNOWN;
   TRY_FSEEKO( stream, 5, SEEK_CUR, err, "Failed to read tile: " );                          // Reserved
   TRY_READ_ITEMS( &dimension_count,     1, 4, stream, err, "Failed to read tile: " );
+  if( dimension_count < 0 || dimension_count > 64 ) {
+    g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                 "Failed to read tile: bad dimension count %d",
+                 dimension_count );
+    return false;
+  }
+  tile->dimension_count = dimension_count;
+  tile->dimensions = czi_arena_alloc0( &czi->arena,
+                         dimension_count * sizeof(struct _czi_dimension) );
   
 #if CZI_DEBUG_STRUCTURE
   czi_display_tile(tile, CZI_DISPLAY_INDENT * 2);
@@ -2644,14 +2972,8 @@ bool czi_read_tile(
     
   for( int32_t i=0; i<dimension_count; ++i )
   {
-    struct _czi_dimension * new_dimension = czi_new_dimension( tile, err );
-    if( !czi_read_dimension( source, new_dimension, err ) ) {
-      czi_free_tile( tile );
+    if( !czi_read_dimension( source, &tile->dimensions[i], err ) )
       return false;
-    }
-
-    g_hash_table_insert( tile->dimensions,
-                         g_strndup( new_dimension->dimension_id, 1 ), new_dimension );
   }
 
   return true;
@@ -3343,8 +3665,21 @@ const struct _czi_channel_converter _czi_channel_converter_CFLOAT_to_U8 = {
 };
 
 //--- pixel converter ----------------------------------------------------------
+const struct _czi_pixel_converter _czi_pixel_converter_GRAY_8_to_BGRA_32 = {
+  .convert_buffer = czi_pixel_convert_buffer_GRAY_8_to_BGRA_32,
+  .src_pixel_type = GRAY_8,
+  .dest_pixel_type = BGRA_32,
+};
+
+const struct _czi_pixel_converter _czi_pixel_converter_GRAY_16_to_BGRA_32 = {
+  .convert_buffer = czi_pixel_convert_buffer_GRAY_16_to_BGRA_32,
+  .src_pixel_type = GRAY_16,
+  .dest_pixel_type = BGRA_32,
+};
+
 const struct _czi_pixel_converter _czi_pixel_converter_BGR_24_to_BGRA_32 = {
   .convert = czi_pixel_convert_BGR_24_to_BGRA_32,
+  .convert_buffer = czi_pixel_convert_buffer_BGR_24_to_BGRA_32,
   .src_pixel_type = BGR_24,
   .dest_pixel_type = BGRA_32,
 };
@@ -3357,12 +3692,14 @@ const struct _czi_pixel_converter _czi_pixel_converter_BGRA_32_to_BGRA_32 = {
 
 const struct _czi_pixel_converter _czi_pixel_converter_BGR_48_to_BGRA_32 = {
   .convert = czi_pixel_convert_BGR_48_to_BGRA_32,
+  .convert_buffer = czi_pixel_convert_buffer_BGR_48_to_BGRA_32,
   .src_pixel_type = BGR_48,
   .dest_pixel_type = BGRA_32,
 };
 
 const struct _czi_pixel_converter _czi_pixel_converter_BGR_96_FLOAT_to_BGRA_32 = {
   .convert = czi_pixel_convert_BGR_96_FLOAT_to_BGRA_32,
+  .convert_buffer = czi_pixel_convert_buffer_BGR_96_FLOAT_to_BGRA_32,
   .src_pixel_type = BGR_96_FLOAT,
   .dest_pixel_type = BGRA_32,
 };
@@ -3968,13 +4305,13 @@ void czi_pixel_dynamic_info_update(
     
     struct _czi_accumulator * min_accumulator = czi_new_accumulator(
                                             MIN_ACCUMULATOR,
-                                            pdi->type,
+                                            czi_data_type(pdi->type),
                                             (uint64_t)pdi->channel_count,
                                             err
                                         );
     struct _czi_accumulator * max_accumulator = czi_new_accumulator(
                                             MAX_ACCUMULATOR,
-                                            pdi->type,
+                                            czi_data_type(pdi->type),
                                             (uint64_t)pdi->channel_count,
                                             err
                                         );
@@ -4366,6 +4703,22 @@ GHashTable * czi_pixel_converter_hash_table(GError           ** err) {
         );
 
         // Insert each convert into converters g_hash_table
+        g_hash_table_insert(
+            _czi_converter_hash_table,
+            czi_new_S32(
+                czi_pixel_converter_uid(GRAY_8, BGRA_32),
+                err),
+            (gpointer)&_czi_pixel_converter_GRAY_8_to_BGRA_32
+        );
+
+        g_hash_table_insert(
+            _czi_converter_hash_table,
+            czi_new_S32(
+                czi_pixel_converter_uid(GRAY_16, BGRA_32),
+                err),
+            (gpointer)&_czi_pixel_converter_GRAY_16_to_BGRA_32
+        );
+
         g_hash_table_insert(
             _czi_converter_hash_table,
             czi_new_S32(
@@ -4416,13 +4769,11 @@ const struct _czi_pixel_converter * czi_get_pixel_converter(
     enum czi_pixel_t dest_pixel_type
 ) {
      GHashTable * converters = czi_pixel_converter_hash_table(0);
-     
+     int32_t uid = czi_pixel_converter_uid(src_pixel_type, dest_pixel_type);
+
      return (const struct _czi_pixel_converter *)g_hash_table_lookup(
                                     converters,
-                                    czi_new_S32(
-                                        czi_pixel_converter_uid(src_pixel_type,
-                                                                dest_pixel_type),
-                                        0)
+                                    &uid
                                   );
 }
 
@@ -4597,6 +4948,205 @@ void czi_pixel_convert_BGR_192_COMPLEX_FLOAT_to_BGRA_32(
     *(dest_buffer + 3) = 255;
 }
 
+//--- buffer pixel conversion --------------------------------------------------
+// Minimum number of 16 bits samples for which a lookup table is cheaper
+// than computing each sample
+#define CZI_LUT_MIN_SAMPLES_U16     65536
+
+uint8_t * czi_rescale_lut_U16_to_U8(
+                        const struct _czi_rescale_info       * cri) {
+    double shift = (cri ? cri->shift : 0),
+           slope = (cri ? cri->slope : 1);
+    uint8_t * lut = g_malloc(USHRT_MAX + 1);
+    for (uint32_t v = 0; v <= USHRT_MAX; ++v) {
+        // Values absent from the buffer may fall outside of the range, clamp
+        // them rather than relying on an undefined conversion
+        double d = (v + shift) * slope;
+        lut[v] = (d <= 0 ? 0 : (d >= UCHAR_MAX ? UCHAR_MAX : (uint8_t)d));
+    }
+    return lut;
+}
+
+void czi_pixel_convert_buffer_GRAY_8_to_BGRA_32(
+                        const struct _czi_pixel_converter    * cpc           G_GNUC_UNUSED,
+                        const struct _czi_rescale_info       * cri,
+                        const uint8_t                        * src_buffer,
+                        uint8_t                              * dest_buffer,
+                        uint64_t                               pixel_count) {
+    double shift = (cri ? cri->shift : 0),
+           slope = (cri ? cri->slope : 1);
+    for (uint64_t i = 0; i < pixel_count; ++i) {
+        uint8_t value = (cri ? (uint8_t)((src_buffer[i] + shift) * slope)
+                             : src_buffer[i]);
+        dest_buffer[0] = value;
+        dest_buffer[1] = value;
+        dest_buffer[2] = value;
+        dest_buffer[3] = 255;
+        dest_buffer += 4;
+    }
+}
+
+void czi_pixel_convert_buffer_GRAY_16_to_BGRA_32(
+                        const struct _czi_pixel_converter    * cpc           G_GNUC_UNUSED,
+                        const struct _czi_rescale_info       * cri,
+                        const uint8_t                        * src_buffer,
+                        uint8_t                              * dest_buffer,
+                        uint64_t                               pixel_count) {
+    const uint16_t * src = (const uint16_t *) src_buffer;
+    if (pixel_count >= CZI_LUT_MIN_SAMPLES_U16) {
+        uint8_t * lut = czi_rescale_lut_U16_to_U8(cri);
+        for (uint64_t i = 0; i < pixel_count; ++i) {
+            uint8_t value = lut[src[i]];
+            dest_buffer[0] = value;
+            dest_buffer[1] = value;
+            dest_buffer[2] = value;
+            dest_buffer[3] = 255;
+            dest_buffer += 4;
+        }
+        g_free(lut);
+    } else {
+        double shift = (cri ? cri->shift : 0),
+               slope = (cri ? cri->slope : 1);
+        for (uint64_t i = 0; i < pixel_count; ++i) {
+            uint8_t value = (uint8_t)((src[i] + shift) * slope);
+            dest_buffer[0] = value;
+            dest_buffer[1] = value;
+            dest_buffer[2] = value;
+            dest_buffer[3] = 255;
+            dest_buffer += 4;
+        }
+    }
+}
+
+typedef void (*czi_expand_BGR_24_fn)(const uint8_t * src_buffer,
+                                     uint8_t       * dest_buffer,
+                                     uint64_t        pixel_count);
+
+static GOnce czi_expand_BGR_24_selector = G_ONCE_INIT;
+
+static void czi_expand_BGR_24_to_BGRA_32(
+                        const uint8_t                        * src_buffer,
+                        uint8_t                              * dest_buffer,
+                        uint64_t                               pixel_count) {
+    for (uint64_t i = 0; i < pixel_count; ++i) {
+        dest_buffer[0] = src_buffer[0];
+        dest_buffer[1] = src_buffer[1];
+        dest_buffer[2] = src_buffer[2];
+        dest_buffer[3] = 255;
+        src_buffer += 3;
+        dest_buffer += 4;
+    }
+}
+
+#ifdef CZI_HAVE_SSSE3_EXPAND
+__attribute__((target("ssse3")))
+static void czi_expand_BGR_24_to_BGRA_32_ssse3(
+                        const uint8_t                        * src_buffer,
+                        uint8_t                              * dest_buffer,
+                        uint64_t                               pixel_count) {
+    // B, G, R to B, G, R, A, 4 pixels at a time
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+                                          6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32(0xFF000000);
+    uint64_t i = 0;
+    // each load reads 16 bytes for 4 pixels, so stop before overrunning
+    for (; i + 6 <= pixel_count; i += 4) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(src_buffer + i * 3));
+        __m128i out = _mm_or_si128(_mm_shuffle_epi8(in, shuffle), alpha);
+        _mm_storeu_si128((__m128i *)(dest_buffer + i * 4), out);
+    }
+    czi_expand_BGR_24_to_BGRA_32(src_buffer + i * 3, dest_buffer + i * 4,
+                                 pixel_count - i);
+}
+#endif
+
+static void * czi_select_expand_BGR_24(void * arg G_GNUC_UNUSED) {
+#ifdef CZI_HAVE_SSSE3_EXPAND
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) {
+        return (void *)czi_expand_BGR_24_to_BGRA_32_ssse3;
+    }
+#endif
+    return (void *)czi_expand_BGR_24_to_BGRA_32;
+}
+
+void czi_pixel_convert_buffer_BGR_24_to_BGRA_32(
+                        const struct _czi_pixel_converter    * cpc           G_GNUC_UNUSED,
+                        const struct _czi_rescale_info       * cri,
+                        const uint8_t                        * src_buffer,
+                        uint8_t                              * dest_buffer,
+                        uint64_t                               pixel_count) {
+    if (!cri) {
+        czi_expand_BGR_24_fn expand =
+            (czi_expand_BGR_24_fn) g_once(&czi_expand_BGR_24_selector,
+                                          czi_select_expand_BGR_24, NULL);
+        expand(src_buffer, dest_buffer, pixel_count);
+        return;
+    }
+
+    double shift = cri->shift,
+           slope = cri->slope;
+    for (uint64_t i = 0; i < pixel_count; ++i) {
+        dest_buffer[0] = (uint8_t)((src_buffer[0] + shift) * slope);
+        dest_buffer[1] = (uint8_t)((src_buffer[1] + shift) * slope);
+        dest_buffer[2] = (uint8_t)((src_buffer[2] + shift) * slope);
+        dest_buffer[3] = 255;
+        src_buffer += 3;
+        dest_buffer += 4;
+    }
+}
+
+void czi_pixel_convert_buffer_BGR_48_to_BGRA_32(
+                        const struct _czi_pixel_converter    * cpc           G_GNUC_UNUSED,
+                        const struct _czi_rescale_info       * cri,
+                        const uint8_t                        * src_buffer,
+                        uint8_t                              * dest_buffer,
+                        uint64_t                               pixel_count) {
+    const uint16_t * src = (const uint16_t *) src_buffer;
+    if (pixel_count * 3 >= CZI_LUT_MIN_SAMPLES_U16) {
+        uint8_t * lut = czi_rescale_lut_U16_to_U8(cri);
+        for (uint64_t i = 0; i < pixel_count; ++i) {
+            dest_buffer[0] = lut[src[0]];
+            dest_buffer[1] = lut[src[1]];
+            dest_buffer[2] = lut[src[2]];
+            dest_buffer[3] = 255;
+            src += 3;
+            dest_buffer += 4;
+        }
+        g_free(lut);
+    } else {
+        double shift = (cri ? cri->shift : 0),
+               slope = (cri ? cri->slope : 1);
+        for (uint64_t i = 0; i < pixel_count; ++i) {
+            dest_buffer[0] = (uint8_t)((src[0] + shift) * slope);
+            dest_buffer[1] = (uint8_t)((src[1] + shift) * slope);
+            dest_buffer[2] = (uint8_t)((src[2] + shift) * slope);
+            dest_buffer[3] = 255;
+            src += 3;
+            dest_buffer += 4;
+        }
+    }
+}
+
+void czi_pixel_convert_buffer_BGR_96_FLOAT_to_BGRA_32(
+                        const struct _czi_pixel_converter    * cpc           G_GNUC_UNUSED,
+                        const struct _czi_rescale_info       * cri,
+                        const uint8_t                        * src_buffer,
+                        uint8_t                              * dest_buffer,
+                        uint64_t                               pixel_count) {
+    const float * src = (const float *) src_buffer;
+    double shift = (cri ? cri->shift : 0),
+           slope = (cri ? cri->slope : 1);
+    for (uint64_t i = 0; i < pixel_count; ++i) {
+        dest_buffer[0] = (uint8_t)((src[0] + shift) * slope);
+        dest_buffer[1] = (uint8_t)((src[1] + shift) * slope);
+        dest_buffer[2] = (uint8_t)((src[2] + shift) * slope);
+        dest_buffer[3] = 255;
+        src += 3;
+        dest_buffer += 4;
+    }
+}
+
 //--- check ------------------------------------------------------------------
 bool _openslide_czi_is_zisraw( const char * filename, GError ** err )
 {
@@ -4920,56 +5470,38 @@ bool _openslide_czi_get_level_tile_size(
                  "Failed to find level %d", level );
     return false;
   }
-  GList * keys = g_hash_table_get_keys( s_level->tiles );
-  if( !keys ) {
+  if( !s_level->tile_array->len ) {
     g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                  "No key in level %d", level );
     return false;
   }
-  g_list_free( keys );
 
   // Goes through level tiles to find maximum width and height
   *w = 0;
   *h = 0;
 
-  struct _czi_tile  * tile;
-  GList * current_tile = g_hash_table_get_values( s_level->tiles );
-
-  while( current_tile )
+  for( uint32_t i = 0; i < s_level->tile_array->len; ++i )
   {
-    tile = (struct _czi_tile *) current_tile->data;
-    if( !tile ) {
+    struct _czi_tile * tile = g_ptr_array_index( s_level->tile_array, i );
+    struct _czi_dimension * dim;
+
+    dim = czi_tile_get_dimension( tile, 'X' );
+    if( !dim ) {
       g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                   "Failed to load tile from level %d", level );
-      g_list_free( current_tile );
+                   "Failed to load X dimension from level %d", level );
       return false;
     }
-    else {
-      struct _czi_dimension * dim;
+    *w = MAX(dim->stored_size, *w);
 
-      dim = (struct _czi_dimension *) g_hash_table_lookup( tile->dimensions, "X" );
-      if( !dim ) {
-        g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                     "Failed to load X dimension from level %d", level );
-        g_list_free( current_tile );
-        return false;
-      }
-      *w = MAX(dim->stored_size, *w);
-
-      dim = (struct _czi_dimension *) g_hash_table_lookup( tile->dimensions, "Y" );
-      if( !dim ) {
-        g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                     "Failed to load Y dimension from level %d", level );
-        g_list_free( current_tile );
-        return false;
-      }
-      *h = MAX(dim->stored_size, *h);
+    dim = czi_tile_get_dimension( tile, 'Y' );
+    if( !dim ) {
+      g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                   "Failed to load Y dimension from level %d", level );
+      return false;
     }
-    current_tile = g_list_next( current_tile );
+    *h = MAX(dim->stored_size, *h);
   }
 
-  g_list_free( current_tile );
-
   return true;
 }
 
@@ -4996,7 +5528,7 @@ struct _czi_tile * _openslide_czi_get_level_tile( _openslide_czi * czi, int32_t
   return tile;
 }
 
-uint8_t * _openslide_czi_get_level_tile_data( _openslide_czi * czi, int32_t level, int64_t uid, int32_t * buffer_size, GError **err )
+uint8_t * _openslide_czi_get_level_tile_data( _openslide_czi * czi, int32_t level, int64_t uid, int32_t * buffer_size, bool * mapped, GError **err )
 {
   //   g_debug("_openslide_czi_get_level_tile_data:: level: %d, level_count: %d", level, czi->levels->len);
 
@@ -5007,41 +5539,44 @@ uint8_t * _openslide_czi_get_level_tile_data( _openslide_czi * czi, int32_t leve
     return NULL;
   }
 
-  if(!(tile->data_buf)) {
-    // Try to load data for tile
-    _openslide_czi_load_tile(czi, level, uid, buffer_size, err);
-  }
-  else {
-    // Data was already loaded for tile
-    if( buffer_size ) (*buffer_size) = tile->data_size;
-  }
-
-  return tile->data_buf;
+  // The returned buffer is owned by the caller, so that concurrent reads of
+  // the same tile do not share it, unless it points into the file mapping
+  // (*mapped set to true), in which case it must not be freed
+  return _openslide_czi_load_tile(czi, level, uid, buffer_size, mapped, err);
 }
 
-bool _openslide_czi_free_level_tile_data( _openslide_czi * czi, int32_t level, int64_t uid, GError **err )
+void _openslide_czi_free_level_tile_data( uint8_t * data, int32_t buffer_size )
 {
-  // Get czi tile
-  struct _czi_tile * tile = _openslide_czi_get_level_tile( czi, level, uid, err);
-  if( !tile ) {
-    return false;
+  if (data) {
+    g_slice_free1( buffer_size, data );
   }
+}
 
-  if (tile->data_buf) {
-    //g_debug( "_openslide_czi_free_level_tile_data:: level: %d, uid: %ld", level, uid );
-    g_slice_free1( tile->data_size, tile->data_buf );
-    tile->data_buf = NULL;
-  }
-  else {
-    return false;
+// Whether a tile belongs to a plane, given as indices from the start of
+// the level along CZI_PLANE_DIMENSION_IDS. A tile without one of these
+// dimensions belongs to every plane along it.
+bool czi_tile_in_plane(
+  struct _czi_level * level,
+  struct _czi_tile  * tile,
+  const int32_t     * plane
+)
+{
+  char key[2] = { 0, 0 };
+  for( int32_t i = 0; i < _OPENSLIDE_PLANE_DIMENSIONS; ++i ) {
+    key[0] = CZI_PLANE_DIMENSION_IDS[i];
+    struct _czi_dimension * dim = czi_tile_get_dimension( tile, key[0] );
+    int32_t * start = (int32_t *) g_hash_table_lookup( level->start, key );
+    if( dim && start && dim->start - *start != plane[i] )
+      return false;
   }
-
   return true;
 }
 
+// Tiles of a level, only those of a plane unless it is NULL
 GList * _openslide_czi_get_level_tiles(
   _openslide_czi  * czi,
   int32_t           i,
+  const int32_t   * plane,
   GError         ** err
 )
 {
@@ -5049,30 +5584,165 @@ GList * _openslide_czi_get_level_tiles(
   struct _czi_level * level;
   struct _czi_tile * tile;
   struct _openslide_czi_tile_descriptor * tile_desc;
-  GList * intern_list, * intern_list_current, * extern_list = NULL;
+  GList * extern_list = NULL;
 
+  // Built backwards, so that the list is in row major order
   level = (struct _czi_level *) g_ptr_array_index( czi->levels, i );
-  intern_list = g_hash_table_get_values( level->tiles );
-  intern_list_current = intern_list;
-  while( intern_list_current )
+  for( uint32_t t = level->tile_array->len; t > 0; --t )
   {
-    tile = (struct _czi_tile *) intern_list_current->data;
+    tile = (struct _czi_tile *) g_ptr_array_index( level->tile_array, t - 1 );
+    if( plane && !czi_tile_in_plane( level, tile, plane ) )
+      continue;
     tile_desc = czi_new_tile_descriptor( tile, err );
     if( !tile_desc ) {
       _openslide_czi_free_list_tiles( extern_list );
       return NULL;
     }
 
-    extern_list = g_list_insert_before( extern_list, extern_list, tile_desc );
-    intern_list_current = g_list_next( intern_list_current );
+    extern_list = g_list_prepend( extern_list, tile_desc );
   }
-  g_list_free( intern_list );
 
   return extern_list;
 }
 
+// Estimate the dynamic of a slide from a sample of the tiles of its lowest
+// resolution level, rather than from full resolution data.
+// Returns NULL if no rescale is needed or if it could not be estimated.
+struct _czi_rescale_info * czi_estimate_rescale_info(
+  struct _czi       * czi,
+  enum czi_pixel_t    pixel_type,
+  GError           ** err
+)
+{
+  const struct _czi_rescale_info_func * rif = czi_get_rescale_info_func(
+                                                  czi_data_type(pixel_type),
+                                                  U8_TYPE
+                                              );
+  if( !rif )
+    return NULL;
+
+  // Find the lowest resolution level
+  int32_t l = -1;
+  struct _czi_level * level = NULL;
+  for( uint32_t i = 0; i < czi->levels->len; ++i ) {
+    struct _czi_level * cur = g_ptr_array_index( czi->levels, i );
+    if( !level || cur->subsampling_x > level->subsampling_x ) {
+      level = cur;
+      l = i;
+    }
+  }
+  if( !level )
+    return NULL;
+
+  // Take up to CZI_RESCALE_SAMPLE_TILES tiles evenly spread in the level
+  uint32_t tile_count = level->tile_array->len;
+  uint32_t step = MAX( 1, tile_count / CZI_RESCALE_SAMPLE_TILES );
+  uint32_t pixel_size = _openslide_czi_pixel_type_channel_count( pixel_type )
+                      * czi_data_type_size( czi_data_type( pixel_type ) );
+
+  // Per tile minimum and maximum values are gathered as pixels of a
+  // buffer, whose own dynamic is the dynamic of the sample
+  GByteArray * extrema = g_byte_array_new();
+  uint32_t t = 0;
+  while( t < tile_count ) {
+    struct _czi_tile * tile = g_ptr_array_index( level->tile_array, t );
+    if( ( t++ % step ) || tile->pixel_type != pixel_type )
+      continue;
+
+    int32_t data_size = 0;
+    bool mapped = false;
+    uint8_t * data = _openslide_czi_load_tile( czi, l, tile->uid,
+                                               &data_size, &mapped, err );
+    if( !data )
+      goto FAIL;
+
+    if( tile->compression != UNCOMPRESSED ) {
+      struct _openslide_czi_tile_descriptor * tile_desc =
+                              czi_new_tile_descriptor( tile, err );
+      if( !tile_desc ) {
+        if( !mapped ) _openslide_czi_free_level_tile_data( data, data_size );
+        goto FAIL;
+      }
+      int32_t uncompressed_size = 0;
+      uint8_t * uncompressed = _openslide_czi_uncompress_tile( tile_desc,
+                                                               data,
+                                                               data_size,
+                                                               &uncompressed_size,
+                                                               err );
+      czi_free_tile_descriptor( tile_desc );
+      if( !mapped ) _openslide_czi_free_level_tile_data( data, data_size );
+      if( !uncompressed )
+        goto FAIL;
+      data = uncompressed;
+      data_size = uncompressed_size;
+      mapped = false;
+    }
+
+    struct _czi_pixel_dynamic_info * pdi = czi_new_pixel_dynamic_info(
+                                                pixel_type, err );
+    if( pdi ) {
+      pdi->update( pdi, data, data_size, err );
+      g_byte_array_append( extrema, pdi->min_per_channel, pixel_size );
+      g_byte_array_append( extrema, pdi->max_per_channel, pixel_size );
+      czi_free_pixel_dynamic_info( pdi );
+    }
+    if( !mapped ) _openslide_czi_free_level_tile_data( data, data_size );
+    if( !pdi )
+      goto FAIL;
+  }
+
+  if( !extrema->len ) {
+    g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                 "No tile to estimate dynamic from" );
+    goto FAIL;
+  }
+
+  struct _czi_pixel_dynamic_info * pdi = czi_new_pixel_dynamic_info(
+                                              pixel_type, err );
+  if( !pdi )
+    goto FAIL;
+  pdi->update( pdi, extrema->data, extrema->len, err );
+  struct _czi_rescale_info * ri = rif->rescale_info( pdi, err );
+  czi_free_pixel_dynamic_info( pdi );
+
+  g_debug( "Estimated %s dynamic from %d tiles of level %d: "
+           "shift %lf and slope %lf",
+           czi_pixel_t_string( pixel_type ),
+           (int) ( extrema->len / ( 2 * pixel_size ) ),
+           l, ri->shift, ri->slope );
+  g_byte_array_free( extrema, true );
+  return ri;
+
+FAIL:
+  g_byte_array_free( extrema, true );
+  return NULL;
+}
+
+const struct _czi_rescale_info * _openslide_czi_get_rescale_info(
+  _openslide_czi    * czi,
+  enum czi_pixel_t    pixel_type
+)
+{
+  // Estimated once on first use, then kept for the lifetime of the slide
+  g_mutex_lock( czi->rescale_lock );
+  if( !czi->rescale_estimated ) {
+    GError * tmp_err = NULL;
+    czi->rescale_info = czi_estimate_rescale_info( czi, pixel_type,
+                                                   &tmp_err );
+    if( tmp_err ) {
+      // Tiles will be rescaled using their own dynamic
+      g_debug( "Unable to estimate slide dynamic: %s", tmp_err->message );
+      g_clear_error( &tmp_err );
+    }
+    czi->rescale_estimated = true;
+  }
+  g_mutex_unlock( czi->rescale_lock );
+  return czi->rescale_info;
+}
+
 uint8_t * _openslide_czi_data_convert_to_rgba32(
   enum czi_pixel_t            pixel_type,
+  const struct _czi_rescale_info * rescale_info,
   uint8_t                   * tile_data,
   int32_t                     tile_data_size,
   int32_t                   * converted_tile_data_size,
@@ -5099,12 +5769,6 @@ uint8_t * _openslide_czi_data_convert_to_rgba32(
   }
 
   (*converted_tile_data_size) = tile_data_size * output_pixel_type_size / czi_pixel_type_size;
-  uint8_t * converted_tile_data = g_slice_alloc0( *converted_tile_data_size );
-  if (!converted_tile_data) {
-    g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                 "Unable to allocate converted tile data" );
-    return NULL;
-  }
 
   // g_debug( "_openslide_czi_data_convert_to_rgba32::tile_data_size: %d"
   //          ", converted_tile_data_size: %d"
@@ -5121,25 +5785,47 @@ uint8_t * _openslide_czi_data_convert_to_rgba32(
     return NULL;
   }
 
+  // Every output byte is written by the converter
+  uint8_t * converted_tile_data = _openslide_tile_buffer_alloc(
+                                      *converted_tile_data_size );
+
   struct _czi_rescale_info * ri = NULL;
   const struct _czi_rescale_info_func * rif = czi_get_rescale_info_func(
-                                                  czi_data_type(pixel_type), 
+                                                  czi_data_type(pixel_type),
                                                   U8_TYPE
                                               );
-  if (rif) {
+  if (rif && rescale_info) {
+    // Use the slide wide dynamic, so that all tiles are rescaled alike
+    ri = czi_new_rescale_info(err);
+    ri->shift = rescale_info->shift;
+    ri->slope = rescale_info->slope;
+  }
+  else if (rif) {
     g_debug("Rescaling dynamic while converting %s to %s",
             czi_pixel_t_string(pixel_type),
             czi_pixel_t_string(BGRA_32));
     // In cases where precision is lost we try to resize data the best using
     // an automatically pre calculated slope.
     struct _czi_pixel_dynamic_info * pdi = czi_new_pixel_dynamic_info(pixel_type, err);
-    pdi->update(pdi, tile_data, tile_data_size, err);    
+    pdi->update(pdi, tile_data, tile_data_size, err);
     ri = rif->rescale_info(pdi, err);
-    g_debug("Rescale using shift %lf and slope %lf", 
+    czi_free_pixel_dynamic_info(pdi);
+    g_debug("Rescale using shift %lf and slope %lf",
             ri->shift,
-            ri->slope);    
+            ri->slope);
   }
-  
+
+  if (converter->convert_buffer) {
+    // Convert the whole buffer at once
+    converter->convert_buffer(converter,
+                              ri,
+                              tile_data,
+                              converted_tile_data,
+                              tile_data_size / czi_pixel_type_size);
+    czi_free_rescale_info(ri);
+    return converted_tile_data;
+  }
+
   for (uint32_t i = 0, j = 0;
        i < (uint32_t)tile_data_size;
        i += czi_pixel_type_size,
@@ -5207,6 +5893,21 @@ uint8_t * _openslide_czi_uncompress( const struct _openslide_czi_uncompressor *
   return dest;
 }
 
+// Uncompressor able to write the cairo pixels of a tile itself, without
+// an intermediate buffer in the CZI pixel type
+const struct _openslide_czi_uncompressor * czi_cairo_uncompressor(
+  const struct _openslide_czi_tile_descriptor  * tile_desc
+)
+{
+#if defined(HAVE_LIBJXR) && G_BYTE_ORDER == G_LITTLE_ENDIAN
+  if (tile_desc->compression == JPEGXR && tile_desc->pixel_type == BGR_24)
+    return &_openslide_uncompressor_jxr;
+#else
+  (void) tile_desc;
+#endif
+  return NULL;
+}
+
 uint8_t * _openslide_czi_uncompress_tile(
   struct _openslide_czi_tile_descriptor  * tile_desc,
   uint8_t                                * data,
@@ -5290,10 +5991,12 @@ uint8_t * _openslide_czi_load_tile(
   int32_t           level,
   int64_t           uid,
   int32_t         * buffer_size,
+  bool            * mapped,
   GError         ** err
 )
 {
   //g_debug("_openslide_czi_load_tile");
+  if( mapped ) (*mapped) = false;
   
   struct _czi_level * s_level = g_ptr_array_index( czi->levels, level );
   if( !s_level ) {
@@ -5309,81 +6012,80 @@ uint8_t * _openslide_czi_load_tile(
   }
 
   g_assert( tile->source );
-  if( !tile->source->stream ) {
-    tile->source->stream = _openslide_fopen( tile->source->filename, "rb", err );
-    if( !tile->source->stream ) return NULL;
+  uint8_t * data;
+  if( tile->source->map && mapped ) {
+    // Zero-copy: data is never written to, so it can point to the mapping
+    data = (uint8_t *) czi_map_tile_data( tile, buffer_size );
+    (*mapped) = true;
+  } else {
+    FILE * stream = czi_source_get_stream( tile->source, err );
+    if( !stream ) return NULL;
+
+    data = czi_read_tile_data( stream, tile, buffer_size, err );
+    czi_source_put_stream( tile->source, stream );
   }
 
-  FILE * stream = tile->source->stream;
+#ifdef CZI_WRITE_TILE_DATA
+  if (data) {
+    char * filename = g_strdup_printf( "tile_%d_%ld", level, tile->uid);
+    g_debug( "Writing tile %ld: %s", tile->uid, filename );
+    FILE * outstream = _openslide_fopen( filename, "w+", err );
+    if (outstream) {
+      uint64_t len;
+      len = fwrite( data, 1, tile->data_size, outstream );
+      if( len != (uint64_t)tile->data_size ) {
+        g_debug( "Unable to write tile %ld data to file %s", tile->uid, filename );
+      }
+    }
+  }
+#endif
 
-  // Seek to the beginning of SubBlockSegment for the tile
-  TRY_FSEEKO( stream, tile->tile_offset, SEEK_SET, err, "Failed to load tile" );
+  return data;
+}
 
-  // Read SubBlockSegment header
-  struct _czi_segment_header * header = (struct _czi_segment_header*) g_slice_alloc0( sizeof(struct _czi_segment_header) );
-  if(!czi_read_next_segment_header(tile->source, header, err))
-  {
-    g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                 "Failed to read tile %ld header", uid );
+const uint8_t * czi_map_tile_data(
+  struct _czi_tile  * tile,
+  int32_t           * buffer_size
+)
+{
+  // Bounds were checked against the mapping by czi_resolve_tile_data
+  const struct _czi_source * source = tile->source;
+  g_assert( tile->data_offset + tile->data_size <= source->map_size );
 
-    g_slice_free( struct _czi_segment_header, header );
-    return NULL;
+  if( buffer_size )  (*buffer_size) = tile->data_size;
 
-  }
-  g_slice_free( struct _czi_segment_header, header );
+  return source->map + tile->data_offset;
+}
 
-  TRY_READ_ITEMS( &(tile->metadata_size),       1, 4, stream, err, "Failed to read metadata_size for tile" );      // MetaDataSize
-  TRY_READ_ITEMS( &(tile->attachment_size),     1, 4, stream, err, "Failed to read attachment_size for tile" );    // AttachmentSize
-  TRY_READ_ITEMS( &(tile->data_size),           1, 8, stream, err, "Failed to read data_size for tile" );          // DataSize
+uint8_t * czi_read_tile_data(
+  FILE              * stream,
+  struct _czi_tile  * tile,
+  int32_t           * buffer_size,
+  GError           ** err
+)
+{
+  // Payload position and size were resolved when parsing the directory
+  TRY_FSEEKO( stream, tile->data_offset, SEEK_SET, err, "Failed to seek to start data position of tile" );
 
-  // Read DimensionCount integer
-  int32_t dimension_count;
-  int64_t position = ftello(stream);
-  TRY_FSEEKO( stream, position + 28, SEEK_SET, err, "Failed to get dimension count for tile" );
-  TRY_READ_ITEMS( &dimension_count,             1, 4, stream, err, "Failed to read dimension_count for tile" );    // DimensionCount
-
-  // Seek to data offset
-  // Data offset = MAX(256, DimensionEntries offset + DimensionCount * 20) + Metada size
-  // Data offset = MAX(256, 32 + 16 + DimensionCount * 20) + Metada size
-  // DimensionEntries offset = 32 + 16
-  // Data offset = DimensionEntries offset + MAX(256 - 32 - 16, DimensionCount * 20) + Metada size
-  // Data offset = DimensionEntries offset + MAX(208, DimensionCount * 20)
-  position = ftello(stream) + MAX(208, (20 * dimension_count)) + tile->metadata_size;
-  TRY_FSEEKO( stream, position, SEEK_SET, err, "Failed to seek to start data positioni of tile" );
-
-  //g_debug("_openslide_czi_load_tile:: tile:%ld, data_size:%d", uid, tile->data_size);
+  //g_debug("czi_read_tile_data:: tile:%ld, data_size:%d", tile->uid, tile->data_size);
   
   // Allocate a buffer to read tile data from file without decompression
-  tile->data_buf = g_slice_alloc0( tile->data_size );
-  if( !tile->data_buf ) {
+  uint8_t * data = g_slice_alloc( tile->data_size );
+  if( !data ) {
     g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                  "Failed to allocate %d bytes", tile->data_size );
     return NULL;
   }
   
-  if( !read_items( tile->data_buf, 1, tile->data_size, stream, err ) ) {
+  if( !read_items( data, tile->data_size, 1, stream, err ) ) {
     g_prefix_error( err, "Failed to load tile: " );
-    g_slice_free1( tile->data_size, tile->data_buf );
-    tile->data_buf = NULL;
+    g_slice_free1( tile->data_size, data );
     return NULL;
   }
 
-#ifdef CZI_WRITE_TILE_DATA
-  char * filename = g_strdup_printf( "tile_%d_%ld", level, tile->uid);
-  g_debug( "Writing tile %ld: %s", tile->uid, filename );
-  FILE * outstream = _openslide_fopen( filename, "w+", err );
-  if (outstream) {
-    uint64_t len;
-    len = fwrite( tile->data_buf, 1, tile->data_size, outstream );
-    if( len != (uint64_t)tile->data_size ) {
-      g_debug( "Unable to write tile %ld data to file %s", tile->uid, filename );
-    }
-  }
-#endif
-
   if( buffer_size )  (*buffer_size) = tile->data_size;
 
-  return tile->data_buf;
+  return data;
 }
 
 bool _openslide_czi_destroy_tile(
@@ -5682,6 +6384,36 @@ static bool zeiss_tileread(
   GError                   ** err
 );
 
+static bool zeiss_get_native_format(
+  openslide_t               * osr,
+  int32_t                   * sample_type,
+  int32_t                   * channels
+);
+
+static bool zeiss_read_native_region(
+  openslide_t               * osr,
+  void                      * dest,
+  const int32_t             * channels,
+  int32_t                     channel_count,
+  int64_t                     x,
+  int64_t                     y,
+  struct _openslide_level   * level,
+  int64_t                     w,
+  int64_t                     h,
+  GError                   ** err
+);
+
+static int32_t zeiss_get_plane_count(
+  openslide_t               * osr,
+  int32_t                     dimension
+);
+
+static bool zeiss_set_plane(
+  openslide_t               * osr,
+  const int32_t             * plane,
+  GError                   ** err
+);
+
 //============================================================================
 //   STRUCTURE
 //============================================================================
@@ -5693,8 +6425,12 @@ const struct _openslide_format _openslide_format_zeiss = {
 };
 
 static const struct _openslide_ops _openslide_ops_zeiss = {
-  .paint_region = zeiss_paint_region,
-  .destroy      = zeiss_destroy,
+  .paint_region       = zeiss_paint_region,
+  .get_native_format  = zeiss_get_native_format,
+  .read_native_region = zeiss_read_native_region,
+  .get_plane_count    = zeiss_get_plane_count,
+  .set_plane          = zeiss_set_plane,
+  .destroy            = zeiss_destroy,
 };
 
 // key:DRIVER-PRI-DECL
@@ -5711,7 +6447,7 @@ static bool zeiss_set_properties( openslide_t * osr, _openslide_czi * czi, GErro
 static bool zeiss_check_level( openslide_t * osr, _openslide_czi * czi, int32_t level, GError ** err);
 static bool zeiss_set_levels( openslide_t * osr, _openslide_czi * czi, GError ** err );
 static bool zeiss_set_rois( openslide_t * osr, _openslide_czi * czi, GError ** err ) G_GNUC_UNUSED;
-static bool zeiss_set_grids( openslide_t * osr, _openslide_czi * czi, GError ** err );
+static bool zeiss_set_grids( openslide_t * osr, _openslide_czi * czi, const int32_t * plane, GError ** err );
 
 //============================================================================
 //   ZEISS PROPERTIES
@@ -5946,21 +6682,8 @@ bool zeiss_check(
                  "Multiple rotations not supported" );
     return false;
   }
-  if( _openslide_czi_is_multi_time( czi ) ) {
-    g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                 "Multiple time points not supported" );
-    return false;
-  }
-  if( _openslide_czi_is_multi_zslice( czi ) ) {
-    g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                 "Z stacks not supported" );
-    return false;
-  }
-  if( _openslide_czi_is_multi_channel( czi ) ) {
-    g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
-                 "Multiple channels not supported" );
-    return false;
-  }
+  // Time points, Z slices and channels are selected with
+  // openslide_set_plane()
 
 #ifndef HAVE_LIBJXR
   if( _openslide_czi_has_data_jpgxr( czi ) ) {
@@ -6463,13 +7186,11 @@ bool zeiss_check_level(
                  "Failed to find level %d", level );
     return false;
   }
-  GList * keys = g_hash_table_get_keys( s_level->tiles );
-  if( !keys ) {
+  if( !s_level->tile_array->len ) {
     g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
                  "No key in level %d", level );
     return false;
   }
-  g_list_free( keys );
 
   int32_t block_count = 0;
   int32_t roi_count = 0;
@@ -6507,7 +7228,7 @@ bool zeiss_check_level(
   }
 
   // Goes through level tiles
-  GList * roi_tile, * start_tile = _openslide_czi_get_level_tiles(czi, level, err);
+  GList * roi_tile, * start_tile = _openslide_czi_get_level_tiles(czi, level, NULL, err);
  
   // Iterate trough acquisition blocks to check that tile cover some of part 
   // of the roi
@@ -6778,8 +7499,17 @@ bool zeiss_set_rois(
   return true;
 }
 
+// Key of a plane in plane_grids
+static int64_t czi_plane_key( const int32_t * plane )
+{
+  return ((int64_t) plane[0] << 42) | ((int64_t) plane[1] << 21) | plane[2];
+}
+
+// Create the grids of a plane, painted for the handles that select it.
+// Plane lock must be held once the slide is open.
 bool zeiss_set_grids( openslide_t     * osr,
                       _openslide_czi  * czi,
+                      const int32_t   * plane,
                       GError         ** err)
 {
 
@@ -6788,6 +7518,11 @@ bool zeiss_set_grids( openslide_t     * osr,
   int32_t level_count = osr->level_count;
   int32_t * downsample;
   int32_t offset_x, offset_y;
+  GHashTable * grids = g_hash_table_new_full(
+                            &g_int_hash,
+                            &g_int_equal,
+                            (void(*)(gpointer)) &czi_free_S32,
+                            (void(*)(gpointer)) &_openslide_grid_destroy );
 
   //g_debug("zeiss_set_grids::level_count: %d", level_count);
 
@@ -6807,9 +7542,10 @@ bool zeiss_set_grids( openslide_t     * osr,
                                          level->tile_h / level->downsample,
                                          zeiss_tileread,
                                          (GDestroyNotify) czi_free_tile_descriptor );
+    _openslide_grid_enable_parallel_decode( grid, NULL, NULL, NULL );
 
     // Get tiles for the level
-    GList * level_tiles = _openslide_czi_get_level_tiles(czi, l, err);
+    GList * level_tiles = _openslide_czi_get_level_tiles(czi, l, plane, err);
     GList * current_tile = level_tiles;
     //g_debug( "zeiss_set_grids::list of %d tiles for level %d", g_list_length( current_tile ), l );
 
@@ -6836,12 +7572,16 @@ bool zeiss_set_grids( openslide_t     * osr,
     _openslide_grid_range_finish_adding_tiles(grid);
 
     downsample = czi_new_S32(level->downsample, err);
-    g_hash_table_insert( czi->grids,
+    g_hash_table_insert( grids,
                          downsample,
                          grid );
 
   }
 
+  g_hash_table_insert( czi->plane_grids,
+                       czi_new_S64( czi_plane_key( plane ), err ),
+                       grids );
+
   return true;
 }
 
@@ -6907,7 +7647,13 @@ bool zeiss_paint_region(
 
   //g_debug( "zeiss_paint_region::d: %d, x: %ld, y: %ld, w: %d, h: %d, offset_x: %d, offset_y: %d", d, x, y, w, h, offset_x, offset_y );
 
-  grid = g_hash_table_lookup(czi->grids, &d);
+  // Every handle reads the plane it selected, whose grids were created by
+  // zeiss_set_plane() and live as long as the slide
+  int64_t key = czi_plane_key( osr->plane );
+  g_mutex_lock(czi->plane_lock);
+  GHashTable * grids = g_hash_table_lookup( czi->plane_grids, &key );
+  grid = grids ? g_hash_table_lookup( grids, &d ) : NULL;
+  g_mutex_unlock(czi->plane_lock);
   if(!grid) {
     // No matching grid found for the downsampling
     g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
@@ -6942,6 +7688,7 @@ bool zeiss_tileread(
   struct _openslide_czi_tile_descriptor * tile_desc;
   int32_t data_size = 0, internal_data_size = 0;
   uint8_t * tile_data, * internal_tile_data;
+  bool mapped = false;
   int32_t l = _openslide_get_level_index(osr, level);
   cairo_format_t format = CAIRO_FORMAT_ARGB32;
 
@@ -6953,6 +7700,13 @@ bool zeiss_tileread(
                  "Unable to get tile descriptor: %ld", tile_unique_id );
     return false;
   }
+
+  // Tiles that can be uncompressed straight to cairo pixels are cached
+  // without alpha
+  const struct _openslide_czi_uncompressor * cairo_uncompressor =
+                                      czi_cairo_uncompressor( tile_desc );
+  if (cairo_uncompressor)
+    format = CAIRO_FORMAT_RGB24;
   
 //   g_debug("zeiss_tileread::trying to get tile %ld at %d %d from cache",
 //          tile_desc->uid,
@@ -6994,6 +7748,7 @@ bool zeiss_tileread(
                                                     l,
                                                     tile_desc->uid,
                                                     &data_size,
+                                                    &mapped,
                                                     err );
 //     g_debug( "zeiss_tileread:: uid: %ld"
 //              ", data_size: %d"
@@ -7018,6 +7773,28 @@ bool zeiss_tileread(
       return false;
     }
 
+    if (cairo_uncompressor) {
+      // Uncompress tile data to the buffer that is used in cairo
+      int32_t w = tile_desc->size_x / tile_desc->subsampling_x;
+      int32_t h = tile_desc->size_y / tile_desc->subsampling_y;
+      internal_data_size = w * h * 4;
+      internal_tile_data = _openslide_tile_buffer_alloc( internal_data_size );
+      bool ok = cairo_uncompressor->uncompress_cairo( tile_data,
+                                                      (uint32_t)data_size,
+                                                      (uint32_t *)internal_tile_data,
+                                                      w, h,
+                                                      err );
+      if (!mapped)
+        _openslide_czi_free_level_tile_data( tile_data, data_size );
+      if (!ok) {
+        _openslide_tile_buffer_free( internal_tile_data, internal_data_size );
+        g_prefix_error( err, "Failed to uncompress tile data using "
+                        "uncompressor %s: ", cairo_uncompressor->name );
+        return false;
+      }
+      goto CONVERTED;
+    }
+
     // Uncompress tile data if needed
     if (tile_desc->compression != UNCOMPRESSED) {
       internal_tile_data = _openslide_czi_uncompress_tile( tile_desc,
@@ -7026,14 +7803,15 @@ bool zeiss_tileread(
                                                            &internal_data_size,
                                                            err );
       //g_debug("zeiss_tileread:: uncompressed data size %d", internal_data_size);
-      if (!internal_tile_data)
+      if (!internal_tile_data) {
+        if (!mapped)
+          _openslide_czi_free_level_tile_data( tile_data, data_size );
         return false;
+      }
 
       // Free loaded tile data
-      _openslide_czi_free_level_tile_data( czi,
-                                           l,
-                                           tile_desc->uid,
-                                           err );
+      if (!mapped)
+        _openslide_czi_free_level_tile_data( tile_data, data_size );
 
       // Set uncompressed tile data information
       tile_data = internal_tile_data;
@@ -7047,6 +7825,8 @@ bool zeiss_tileread(
     // Convert tile data to RGBA_32 buffer that is used in cairo
     internal_tile_data = _openslide_czi_data_convert_to_rgba32(
                                       tile_desc->pixel_type,
+                                      _openslide_czi_get_rescale_info(
+                                          czi, tile_desc->pixel_type),
                                       tile_data,
                                       data_size,
                                       &internal_data_size,
@@ -7067,12 +7847,9 @@ bool zeiss_tileread(
       // Free uncompressed tile data
       g_slice_free1( data_size, tile_data );
     }
-    else {
+    else if (!mapped) {
       // Free loaded tile data
-      _openslide_czi_free_level_tile_data( czi,
-                                           l,
-                                           tile_desc->uid,
-                                           err );
+      _openslide_czi_free_level_tile_data( tile_data, data_size );
     }
     /*
     g_debug("zeiss_tileread:: converted tile data after free %d, %d, %d, %d",
@@ -7090,6 +7867,7 @@ bool zeiss_tileread(
       return false;
     }
 
+CONVERTED:
     // Set RGBA_32 converted tile data information
     tile_data = internal_tile_data;
     data_size = internal_data_size;
@@ -7153,6 +7931,267 @@ bool zeiss_tileread(
   return true;
 }
 
+bool zeiss_get_native_format(
+  openslide_t               * osr,
+  int32_t                   * sample_type,
+  int32_t                   * channels
+)
+{
+  struct _czi * czi = (struct _czi *)osr->data;
+  struct _czi_level * s_level = g_ptr_array_index( czi->levels, 0 );
+
+  // Only advertise native samples if czi_read_native_tile() can read
+  // every tile: JPEG XR tiles are only decoded to BGR_24, and other
+  // compressions not at all
+  if( czi->has_data_jpg || czi->has_data_lzw ||
+      czi->has_data_cameraspec || czi->has_data_systemspec )
+    return false;
+  if( czi->has_data_jpgxr ) {
+#ifdef HAVE_LIBJXR
+    if( s_level->pixel_type != BGR_24 )
+      return false;
+#else
+    return false;
+#endif
+  }
+
+  switch( czi_data_type( s_level->pixel_type ) ) {
+    case U8_TYPE:
+      *sample_type = OPENSLIDE_SAMPLE_TYPE_UINT8;
+      break;
+    case U16_TYPE:
+      *sample_type = OPENSLIDE_SAMPLE_TYPE_UINT16;
+      break;
+    case FLOAT_TYPE:
+      *sample_type = OPENSLIDE_SAMPLE_TYPE_FLOAT32;
+      break;
+    default:
+      return false;
+  }
+  *channels = _openslide_czi_pixel_type_channel_count( s_level->pixel_type );
+  return true;
+}
+
+// Native samples of a tile, w x h pixels of its pixel type. They are
+// cached apart from the cairo pixels of the tile, using the CZI level as
+// plane. Uncompressed tiles of a mapped file are read from the mapping,
+// and *cache_entry is then NULL.
+static uint8_t * czi_read_native_tile(
+  openslide_t                   * osr,
+  int32_t                         l,
+  struct _czi_tile              * tile,
+  int32_t                         w,
+  int32_t                         h,
+  struct _openslide_cache_entry ** cache_entry,
+  GError                       ** err
+)
+{
+  struct _czi * czi = (struct _czi *)osr->data;
+  struct _czi_level * s_level = g_ptr_array_index( czi->levels, l );
+  int32_t size = w * h * _openslide_czi_pixel_type_size( tile->pixel_type );
+
+  uint8_t * native = (uint8_t *)_openslide_cache_get( osr->cache,
+                                                      s_level,
+                                                      tile->uid,
+                                                      0,
+                                                      cache_entry );
+  if (native)
+    return native;
+
+  if (tile->compression != UNCOMPRESSED
+#ifdef HAVE_LIBJXR
+      && !(tile->compression == JPEGXR && tile->pixel_type == BGR_24)
+#endif
+     ) {
+    g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                 "Native samples of %s tiles are not supported",
+                 czi_compression_t_string(tile->compression) );
+    return NULL;
+  }
+
+  int32_t data_size = 0;
+  bool mapped = false;
+  uint8_t * data = _openslide_czi_get_level_tile_data( czi, l, tile->uid,
+                                                       &data_size, &mapped,
+                                                       err );
+  if (!data)
+    return NULL;
+
+  bool ok = true;
+  if (tile->compression == UNCOMPRESSED) {
+    if (data_size < size) {
+      g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                   "Tile %ld has %d bytes of data, expected %d",
+                   tile->uid, data_size, size );
+      ok = false;
+    } else if (mapped) {
+      // Nothing to decode, the mapping is as good as the cache
+      return data;
+    } else {
+      native = _openslide_tile_buffer_alloc( size );
+      memcpy( native, data, size );
+    }
+  }
+#ifdef HAVE_LIBJXR
+  else {
+    native = _openslide_tile_buffer_alloc( size );
+    ok = _openslide_uncompressor_jxr.uncompress( data, (uint32_t)data_size,
+                                                 (uint32_t *)native,
+                                                 w, h, err );
+    if (!ok)
+      _openslide_tile_buffer_free( native, size );
+  }
+#endif
+
+  if (!mapped)
+    _openslide_czi_free_level_tile_data( data, data_size );
+  if (!ok)
+    return NULL;
+
+  _openslide_cache_put( osr->cache, s_level, tile->uid, 0,
+                        native, size, cache_entry );
+  return native;
+}
+
+bool zeiss_read_native_region(
+  openslide_t               * osr,
+  void                      * dest,
+  const int32_t             * channels,
+  int32_t                     channel_count,
+  int64_t                     x,
+  int64_t                     y,
+  struct _openslide_level   * level,
+  int64_t                     w,
+  int64_t                     h,
+  GError                   ** err
+)
+{
+  struct _czi * czi = (struct _czi *)osr->data;
+
+  int32_t l = _openslide_get_level_index(osr, level);
+  if (l < 0) {
+    g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                 "Failed to find level for downsampling: %d", (int32_t)level->downsample );
+    return false;
+  }
+
+  int32_t offset_x, offset_y;
+  if (!_openslide_czi_get_level_offset(czi, l, &offset_x, &offset_y, err)) {
+    return false;
+  }
+
+  struct _czi_level * s_level = g_ptr_array_index( czi->levels, l );
+  struct _czi_level * s_level0 = g_ptr_array_index( czi->levels, 0 );
+  enum czi_pixel_t pixel_type = s_level0->pixel_type;
+  int32_t sample_size = czi_data_type_size( czi_data_type( pixel_type ) );
+  int32_t tile_channels = _openslide_czi_pixel_type_channel_count( pixel_type );
+  int32_t pixel_size = tile_channels * sample_size;
+  int32_t dest_pixel_size = channel_count * sample_size;
+
+  // Whole pixels can be copied when all channels are read in order
+  bool all_channels = channel_count == tile_channels;
+  for (int32_t c = 0; c < channel_count && all_channels; ++c)
+    all_channels = channels[c] == c;
+
+  const int32_t * plane = osr->plane;
+
+  // Region in the level referential
+  int32_t d = (int32_t)level->downsample;
+  int64_t rx = x / d;
+  int64_t ry = y / d;
+
+  // Tiles are sorted by top, then left
+  for (uint32_t i = 0; i < s_level->tile_array->len; ++i) {
+    struct _czi_tile * tile = g_ptr_array_index( s_level->tile_array, i );
+    struct _czi_dimension * dim_x = czi_tile_get_dimension( tile, 'X' );
+    struct _czi_dimension * dim_y = czi_tile_get_dimension( tile, 'Y' );
+    int64_t tx = (dim_x->start - offset_x) / d;
+    int64_t ty = (dim_y->start - offset_y) / d;
+    int32_t tw = dim_x->stored_size;
+    int32_t th = dim_y->stored_size;
+
+    if (ty >= ry + h)
+      break;
+    if (ty + th <= ry || tx + tw <= rx || tx >= rx + w ||
+        !czi_tile_in_plane( s_level, tile, plane ))
+      continue;
+
+    if (tile->pixel_type != pixel_type) {
+      g_set_error( err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                   "Tile %ld has pixel type %s, expected %s",
+                   tile->uid, czi_pixel_t_string(tile->pixel_type),
+                   czi_pixel_t_string(pixel_type) );
+      return false;
+    }
+
+    struct _openslide_cache_entry * cache_entry = NULL;
+    uint8_t * native = czi_read_native_tile( osr, l, tile, tw, th,
+                                             &cache_entry, err );
+    if (!native)
+      return false;
+
+    // Copy the intersection, later tiles covering earlier ones
+    int64_t x0 = MAX(tx, rx), x1 = MIN(tx + tw, rx + w);
+    int64_t y0 = MAX(ty, ry), y1 = MIN(ty + th, ry + h);
+    for (int64_t row = y0; row < y1; ++row) {
+      const uint8_t * src = native
+                          + ((row - ty) * tw + (x0 - tx)) * pixel_size;
+      uint8_t * out = (uint8_t *)dest
+                    + ((row - ry) * w + (x0 - rx)) * dest_pixel_size;
+      if (all_channels) {
+        memcpy( out, src, (x1 - x0) * pixel_size );
+        continue;
+      }
+      for (int64_t col = x0; col < x1; ++col) {
+        for (int32_t c = 0; c < channel_count; ++c)
+          memcpy( out + c * sample_size,
+                  src + channels[c] * sample_size,
+                  sample_size );
+        src += pixel_size;
+        out += dest_pixel_size;
+      }
+    }
+
+    if (cache_entry)
+      _openslide_cache_entry_unref(cache_entry);
+  }
+
+  return true;
+}
+
+int32_t zeiss_get_plane_count(
+  openslide_t               * osr,
+  int32_t                     dimension
+)
+{
+  struct _czi * czi = (struct _czi *)osr->data;
+  struct _czi_level * s_level = g_ptr_array_index( czi->levels, 0 );
+  char key[2] = { CZI_PLANE_DIMENSION_IDS[dimension], 0 };
+
+  int32_t * size = (int32_t *) g_hash_table_lookup( s_level->size, key );
+  return size ? MAX(*size, 1) : 1;
+}
+
+bool zeiss_set_plane(
+  openslide_t               * osr,
+  const int32_t             * plane,
+  GError                   ** err
+)
+{
+  struct _czi * czi = (struct _czi *)osr->data;
+  bool success = true;
+
+  // Grids of a plane are created when a handle first selects it, from its
+  // tiles only, and are shared by every handle selecting it
+  g_mutex_lock(czi->plane_lock);
+  int64_t key = czi_plane_key( plane );
+  if (!g_hash_table_lookup( czi->plane_grids, &key ))
+    success = zeiss_set_grids( osr, czi, plane, err );
+  g_mutex_unlock(czi->plane_lock);
+
+  return success;
+}
+
 bool zeiss_detect(
   const char                  * filename,
   struct _openslide_tifflike  * tl G_GNUC_UNUSED,
@@ -7202,7 +8241,8 @@ bool zeiss_open(
     return false;
   }
 #endif
-  if( !zeiss_set_grids( osr, czi_descriptor, err)){
+  const int32_t first_plane[_OPENSLIDE_PLANE_DIMENSIONS] = { 0 };
+  if( !zeiss_set_grids( osr, czi_descriptor, first_plane, err)){
     _openslide_czi_free( czi_descriptor );
     return false;
   }
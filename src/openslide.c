@@ -26,8 +26,10 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <glib-object.h>
 #include <libxml/parser.h>
 
@@ -86,62 +88,303 @@ static bool level_in_range(openslide_t *osr, int32_t level) {
     return false;
   }
 
-  if (level > osr->level_count - 1) {
+  if (level > _openslide_get_level_count(osr) - 1) {
     return false;
   }
 
   return true;
 }
 
-static openslide_t *create_osr(void) {
+static openslide_t *create_osr(int cache_capacity) {
   openslide_t *osr = g_slice_new0(openslide_t);
+  osr->refcount = 1;
   osr->properties = g_hash_table_new_full(g_str_hash, g_str_equal,
                                           g_free, g_free);
   osr->associated_images = g_hash_table_new_full(g_str_hash, g_str_equal,
                                                  g_free,
                                                  destroy_associated_image);
+
+  // start cache
+  // backends may already use it while opening the slide
+  struct _openslide_cache *cache = _openslide_cache_create(cache_capacity);
+  if (cache_capacity) {
+    _openslide_cache_set_compressed_capacity(cache,
+                                             _OPENSLIDE_USEFUL_COMPRESSED_CACHE_SIZE);
+  }
+  osr->cache = _openslide_cache_binding_create(cache);
+  _openslide_cache_unref(cache);
+
+  osr->prefetch = _openslide_prefetch_create();
+  osr->stats = _openslide_stats_create();
+  osr->quickhash1_lock = g_mutex_new();
   return osr;
 }
 
+// Only the name of the format that opened a file is remembered in the
+// cache dir, keyed by path, size and modification time, so that reopening
+// it doesn't run the detectors of the formats before it.  Levels,
+// properties and tile indexes are not saved; the backend still opens the
+// slide from scratch.  Records from another library version, or another
+// format table, are ignored.
+struct detect_record {
+  char *path;   // NULL if no cache dir is configured
+  int64_t size;
+  int64_t mtime;
+};
+
+static gpointer detect_table_key_init(gpointer data G_GNUC_UNUSED) {
+  GString *str = g_string_new(SUFFIXED_VERSION);
+  for (const struct _openslide_format **cur = formats; *cur; cur++) {
+    g_string_append_printf(str, " %s", (*cur)->name);
+  }
+  char *key = g_compute_checksum_for_string(G_CHECKSUM_SHA256,
+                                            str->str, str->len);
+  g_string_free(str, true);
+  return key;
+}
+
+// the library version and format table that wrote a record
+static const char *get_detect_table_key(void) {
+  static GOnce once = G_ONCE_INIT;
+  return g_once(&once, detect_table_key_init, NULL);
+}
+
+static bool detect_record_init(struct detect_record *rec,
+                               const char *filename) {
+  rec->path = NULL;
+
+  struct stat st;
+  if (g_stat(filename, &st) || !S_ISREG(st.st_mode)) {
+    return false;
+  }
+  rec->size = st.st_size;
+  rec->mtime = st.st_mtime;
+
+  char *abs_filename;
+  if (g_path_is_absolute(filename)) {
+    abs_filename = g_strdup(filename);
+  } else {
+    char *cwd = g_get_current_dir();
+    abs_filename = g_build_filename(cwd, filename, NULL);
+    g_free(cwd);
+  }
+  char *hash = g_compute_checksum_for_string(G_CHECKSUM_SHA256,
+                                             abs_filename, -1);
+  rec->path = _openslide_get_cache_path("detect", hash);
+  g_free(hash);
+  g_free(abs_filename);
+  return rec->path != NULL;
+}
+
+static const struct _openslide_format *detect_record_load(struct detect_record *rec) {
+  char *buf;
+  if (!g_file_get_contents(rec->path, &buf, NULL, NULL)) {
+    return NULL;
+  }
+
+  // "<table key> <size> <mtime> <format name>"
+  const struct _openslide_format *result = NULL;
+  char **fields = g_strsplit(g_strstrip(buf), " ", 4);
+  if (g_strv_length(fields) == 4 &&
+      !strcmp(fields[0], get_detect_table_key()) &&
+      g_ascii_strtoll(fields[1], NULL, 10) == rec->size &&
+      g_ascii_strtoll(fields[2], NULL, 10) == rec->mtime) {
+    for (const struct _openslide_format **cur = formats; *cur; cur++) {
+      if (!strcmp((*cur)->name, fields[3])) {
+        result = *cur;
+        break;
+      }
+    }
+  }
+  g_strfreev(fields);
+  g_free(buf);
+  return result;
+}
+
+static void detect_record_save(struct detect_record *rec,
+                               const struct _openslide_format *format) {
+  // failing to save is harmless, the formats are just tried again
+  GError *tmp_err = NULL;
+  char *dir = g_path_get_dirname(rec->path);
+  char *contents = g_strdup_printf("%s %"PRId64" %"PRId64" %s\n",
+                                   get_detect_table_key(),
+                                   rec->size, rec->mtime, format->name);
+  if (g_mkdir_with_parents(dir, 0700)) {
+    g_debug("Couldn't create %s", dir);
+  } else if (!g_file_set_contents(rec->path, contents, -1, &tmp_err)) {
+    g_debug("Couldn't save detected format: %s", tmp_err->message);
+    g_clear_error(&tmp_err);
+  }
+  g_free(contents);
+  g_free(dir);
+}
+
+// Detection first reads a few bytes from the start of the file, and only
+// runs the detectors of the formats whose files can start that way.  Most
+// detectors do their own I/O, so this keeps probing a file that isn't a
+// slide, or is a slide of a later format, down to one open.
+#define DETECT_HEADER_SIZE 16
+
+enum detect_file_kind {
+  DETECT_FILE_TIFF = 1 << 0,    // TIFF or BigTIFF
+  DETECT_FILE_SQLITE = 1 << 1,  // SQLite database
+  DETECT_FILE_CZI = 1 << 2,     // ZISRAW segment
+  DETECT_FILE_TEXT = 1 << 3,    // anything else, without NUL bytes
+  DETECT_FILE_BINARY = 1 << 4,  // anything else
+};
+
+#define DETECT_FILE_NOT_TIFF (~DETECT_FILE_TIFF)
+
+// formats not listed here are tried on every file
+static const struct detect_hint {
+  const struct _openslide_format *format;
+  int kinds;        // mask of enum detect_file_kind
+  const char *ext;  // required filename suffix, or NULL
+} detect_hints[] = {
+  { &_openslide_format_mirax, DETECT_FILE_NOT_TIFF, ".mrxs" },
+  { &_openslide_format_hamamatsu_vms_vmu, DETECT_FILE_TEXT, NULL },
+  { &_openslide_format_hamamatsu_ndpi, DETECT_FILE_TIFF, NULL },
+#ifdef HAVE_SQLITE3
+  { &_openslide_format_sakura, DETECT_FILE_SQLITE, NULL },
+#endif
+  { &_openslide_format_trestle, DETECT_FILE_TIFF, NULL },
+  { &_openslide_format_aperio, DETECT_FILE_TIFF, NULL },
+  { &_openslide_format_leica, DETECT_FILE_TIFF, NULL },
+  { &_openslide_format_philips, DETECT_FILE_TIFF, NULL },
+  { &_openslide_format_ventana, DETECT_FILE_TIFF, NULL },
+  { &_openslide_format_generic_tiff, DETECT_FILE_TIFF, NULL },
+  { &_openslide_format_zeiss, DETECT_FILE_CZI, NULL },
+};
+
+static bool detect_file_kind(const char *filename,
+                             enum detect_file_kind *kind_OUT,
+                             GError **err) {
+  FILE *f = _openslide_fopen(filename, "rb", err);
+  if (!f) {
+    return false;
+  }
+  char buf[DETECT_HEADER_SIZE];
+  size_t len = fread(buf, 1, sizeof(buf), f);
+  fclose(f);
+
+  // classic or BigTIFF, either byte order
+  if (len >= 4 && (!memcmp(buf, "II*\0", 4) || !memcmp(buf, "II+\0", 4) ||
+                   !memcmp(buf, "MM\0*", 4) || !memcmp(buf, "MM\0+", 4))) {
+    *kind_OUT = DETECT_FILE_TIFF;
+  } else if (len == 16 && !memcmp(buf, "SQLite format 3", 16)) {
+    *kind_OUT = DETECT_FILE_SQLITE;
+  } else if (len >= 10 && !memcmp(buf, "ZISRAWFILE", 10)) {
+    *kind_OUT = DETECT_FILE_CZI;
+  } else if (memchr(buf, 0, len)) {
+    *kind_OUT = DETECT_FILE_BINARY;
+  } else {
+    *kind_OUT = DETECT_FILE_TEXT;
+  }
+  return true;
+}
+
+static bool is_candidate(const struct _openslide_format *format,
+                         const char *filename,
+                         enum detect_file_kind kind) {
+  for (unsigned i = 0; i < G_N_ELEMENTS(detect_hints); i++) {
+    const struct detect_hint *hint = &detect_hints[i];
+    if (hint->format != format) {
+      continue;
+    }
+    if (!(hint->kinds & kind)) {
+      if (_openslide_debug(OPENSLIDE_DEBUG_DETECTION)) {
+        g_message("%s: Skipped, file header doesn't match", format->name);
+      }
+      return false;
+    }
+    if (hint->ext && !g_str_has_suffix(filename, hint->ext)) {
+      if (_openslide_debug(OPENSLIDE_DEBUG_DETECTION)) {
+        g_message("%s: Skipped, file does not have %s extension",
+                  format->name, hint->ext);
+      }
+      return false;
+    }
+    break;
+  }
+  return true;
+}
+
+static bool try_format(const struct _openslide_format *format,
+                       const char *filename,
+                       struct _openslide_tifflike *tl) {
+  GError *tmp_err = NULL;
+
+  g_assert(format->name && format->vendor &&
+           format->detect && format->open);
+
+  if (format->detect(filename, tl, &tmp_err)) {
+    return true;
+  }
+  if (_openslide_debug(OPENSLIDE_DEBUG_DETECTION)) {
+    g_message("%s: %s", format->name, tmp_err->message);
+  }
+  g_clear_error(&tmp_err);
+  return false;
+}
+
 static const struct _openslide_format *detect_format(const char *filename,
                                                      struct _openslide_tifflike **tl_OUT) {
   GError *tmp_err = NULL;
 
-  struct _openslide_tifflike *tl = _openslide_tifflike_create(filename,
-                                                              &tmp_err);
-  if (!tl) {
+  enum detect_file_kind kind;
+  if (!detect_file_kind(filename, &kind, &tmp_err)) {
     if (_openslide_debug(OPENSLIDE_DEBUG_DETECTION)) {
-      g_message("tifflike: %s", tmp_err->message);
+      g_message("%s", tmp_err->message);
     }
     g_clear_error(&tmp_err);
+    return NULL;
   }
 
-  for (const struct _openslide_format **cur = formats; *cur; cur++) {
-    const struct _openslide_format *format = *cur;
+  // only parse the directory of files that look like TIFFs
+  struct _openslide_tifflike *tl = NULL;
+  if (kind == DETECT_FILE_TIFF) {
+    tl = _openslide_tifflike_create(filename, &tmp_err);
+    if (!tl) {
+      if (_openslide_debug(OPENSLIDE_DEBUG_DETECTION)) {
+        g_message("tifflike: %s", tmp_err->message);
+      }
+      g_clear_error(&tmp_err);
+      // the non-TIFF formats would be tried on it
+      kind = DETECT_FILE_BINARY;
+    }
+  }
 
-    g_assert(format->name && format->vendor &&
-             format->detect && format->open);
+  // try the remembered format first
+  struct detect_record rec;
+  const struct _openslide_format *remembered = NULL;
+  if (detect_record_init(&rec, filename)) {
+    remembered = detect_record_load(&rec);
+  }
 
-    if (format->detect(filename, tl, &tmp_err)) {
-      // success!
-      if (tl_OUT) {
-        *tl_OUT = tl;
-      } else {
-        _openslide_tifflike_destroy(tl);
+  const struct _openslide_format *result = NULL;
+  if (remembered && is_candidate(remembered, filename, kind) &&
+      try_format(remembered, filename, tl)) {
+    result = remembered;
+  } else {
+    for (const struct _openslide_format **cur = formats; *cur; cur++) {
+      if (*cur != remembered && is_candidate(*cur, filename, kind) &&
+          try_format(*cur, filename, tl)) {
+        result = *cur;
+        break;
       }
-      return format;
     }
-
-    // reset for next format
-    if (_openslide_debug(OPENSLIDE_DEBUG_DETECTION)) {
-      g_message("%s: %s", format->name, tmp_err->message);
+    if (result && rec.path) {
+      detect_record_save(&rec, result);
     }
-    g_clear_error(&tmp_err);
   }
+  g_free(rec.path);
 
-  // no match
-  _openslide_tifflike_destroy(tl);
-  return NULL;
+  if (result && tl_OUT) {
+    *tl_OUT = tl;
+  } else {
+    _openslide_tifflike_destroy(tl);
+  }
+  return result;
 }
 
 static bool open_backend(openslide_t *osr,
@@ -198,8 +441,8 @@ bool openslide_can_open(const char *filename) {
     return false;
   }
 
-  // try opening
-  openslide_t *osr = create_osr();
+  // try opening; nothing will be read through the cache
+  openslide_t *osr = create_osr(0);
   bool success = open_backend(osr, format, filename, tl, NULL, NULL);
   _openslide_tifflike_destroy(tl);
   openslide_close(osr);
@@ -250,12 +493,12 @@ openslide_t *openslide_open(const char *filename) {
   }
 
   // alloc memory
-  openslide_t *osr = create_osr();
+  openslide_t *osr = create_osr(_OPENSLIDE_USEFUL_CACHE_SIZE);
 
   // open backend
-  struct _openslide_hash *quickhash1 = NULL;
-  bool success = open_backend(osr, format, filename, tl, &quickhash1,
-                              &tmp_err);
+  // the quickhash reads much of the slide, so it is only computed when
+  // first requested
+  bool success = open_backend(osr, format, filename, tl, NULL, &tmp_err);
   _openslide_tifflike_destroy(tl);
   if (!success) {
     // failed to read slide
@@ -288,19 +531,28 @@ openslide_t *openslide_open(const char *filename) {
       g_warning("Downsampled images not correctly ordered: %g < %g",
 		osr->levels[i]->downsample, osr->levels[i - 1]->downsample);
       openslide_close(osr);
-      _openslide_hash_destroy(quickhash1);
       return NULL;
     }
   }
 
-  // set hash property
-  const char *hash_str = _openslide_hash_get_string(quickhash1);
-  if (hash_str != NULL) {
-    g_hash_table_insert(osr->properties,
-                        g_strdup(OPENSLIDE_PROPERTY_NAME_QUICKHASH1),
-                        g_strdup(hash_str));
+  // remember how to reopen the slide for the quickhash
+  osr->filename = g_strdup(filename);
+  osr->format = format;
+
+  // add levels if the backend's are too far apart
+  osr->synth = _openslide_synth_create(osr);
+
+  // keep the tiles of the levels on disk, for this and other processes.
+  // Only the backend's levels are numbered the same whether or not
+  // levels are synthesized.
+  char *key;
+  if (_openslide_diskcache_enabled() &&
+      (key = _openslide_get_file_key(filename)) != NULL) {
+    _openslide_cache_binding_enable_disk(osr->cache, key,
+                                         (void * const *) osr->levels,
+                                         osr->level_count);
+    g_free(key);
   }
-  _openslide_hash_destroy(quickhash1);
 
   // set other properties
   g_hash_table_insert(osr->properties,
@@ -308,10 +560,10 @@ openslide_t *openslide_open(const char *filename) {
                       g_strdup(format->vendor));
   g_hash_table_insert(osr->properties,
 		      g_strdup(_OPENSLIDE_PROPERTY_NAME_LEVEL_COUNT),
-		      g_strdup_printf("%d", osr->level_count));
+		      g_strdup_printf("%d", _openslide_get_level_count(osr)));
   bool should_have_geometry = false;  // initialize for gcc 4.4
-  for (int32_t i = 0; i < osr->level_count; i++) {
-    struct _openslide_level *l = osr->levels[i];
+  for (int32_t i = 0; i < _openslide_get_level_count(osr); i++) {
+    struct _openslide_level *l = _openslide_get_level(osr, i);
 
     g_hash_table_insert(osr->properties,
 			g_strdup_printf(_OPENSLIDE_PROPERTY_NAME_TEMPLATE_LEVEL_WIDTH, i),
@@ -342,33 +594,167 @@ openslide_t *openslide_open(const char *filename) {
   }
 
   // fill in names
+  // the quickhash property name is added once the hash is known
+  // the quickhash is listed, but not computed until its value is read
   osr->associated_image_names = strv_from_hashtable_keys(osr->associated_images);
-  osr->property_names = strv_from_hashtable_keys(osr->properties);
+  const char **names = strv_from_hashtable_keys(osr->properties);
+  int count = g_strv_length((char **) names);
+  names = g_renew(const char *, names, count + 2);
+  names[count] = OPENSLIDE_PROPERTY_NAME_QUICKHASH1;
+  names[count + 1] = NULL;
+  qsort(names, count + 1, sizeof(*names), cmpstring);
+  osr->property_names = names;
 
-  // start cache
-  osr->cache = _openslide_cache_create(_OPENSLIDE_USEFUL_CACHE_SIZE);
-  //osr->cache = _openslide_cache_create(0);
+  // start reading what the first view will show
+  _openslide_prefetch_warm_start(osr);
 
   return osr;
 }
 
+// open the slide with hashing enabled, and keep only the hash
+// returns NULL without setting err if the slide has no hash
+static char *hash_slide(const struct _openslide_format *format,
+                        const char *filename,
+                        struct _openslide_tifflike *tl,
+                        GError **err) {
+  // nothing will be read through the cache
+  openslide_t *osr = create_osr(0);
+  struct _openslide_hash *quickhash1 = NULL;
+  char *result = NULL;
+  if (open_backend(osr, format, filename, tl, &quickhash1, err)) {
+    result = g_strdup(_openslide_hash_get_string(quickhash1));
+    _openslide_hash_destroy(quickhash1);
+  }
+  openslide_close(osr);
+  return result;
+}
+
+// reopen the slide with hashing enabled
+static char *compute_quickhash1(openslide_t *osr) {
+  struct _openslide_tifflike *tl;
+  const struct _openslide_format *format = detect_format(osr->filename, &tl);
+  if (format != osr->format) {
+    // the file changed under us
+    _openslide_tifflike_destroy(tl);
+    return NULL;
+  }
 
-void openslide_close(openslide_t *osr) {
-  if (osr->ops) {
-    (osr->ops->destroy)(osr);
+  GError *tmp_err = NULL;
+  char *result = hash_slide(format, osr->filename, tl, &tmp_err);
+  if (tmp_err) {
+    g_warning("Couldn't compute quickhash: %s", tmp_err->message);
+    g_clear_error(&tmp_err);
+  }
+  _openslide_tifflike_destroy(tl);
+  return result;
+}
+
+static const char *get_quickhash1(openslide_t *osr) {
+  g_mutex_lock(osr->quickhash1_lock);
+  if (!osr->quickhash1_done) {
+    osr->quickhash1 = compute_quickhash1(osr);
+    osr->quickhash1_done = true;
+  }
+  const char *result = osr->quickhash1;
+  g_mutex_unlock(osr->quickhash1_lock);
+  return result;
+}
+
+
+openslide_t *openslide_dup(openslide_t *osr) {
+  if (openslide_get_error(osr)) {
+    return NULL;
   }
 
+  openslide_t *owner = osr->owner ? osr->owner : osr;
+  g_atomic_int_inc(&owner->refcount);
+
+  openslide_t *dup = g_slice_new0(openslide_t);
+  dup->owner = owner;
+  dup->ops = owner->ops;
+  dup->levels = owner->levels;
+  dup->data = owner->data;
+  dup->level_count = owner->level_count;
+  dup->cache = owner->cache;
+  dup->synth = owner->synth;
+  memcpy(dup->plane, osr->plane, sizeof(dup->plane));
+
+  dup->associated_images = g_hash_table_ref(osr->associated_images);
+  dup->associated_image_names =
+    g_memdup(osr->associated_image_names,
+             (g_strv_length((char **) osr->associated_image_names) + 1) *
+             sizeof(char *));
+  dup->properties = g_hash_table_ref(osr->properties);
+  dup->filename = g_strdup(osr->filename);
+  dup->format = osr->format;
+
+  dup->property_names =
+    g_memdup(osr->property_names,
+             (g_strv_length((char **) osr->property_names) + 1) *
+             sizeof(char *));
+
+  dup->quickhash1_lock = g_mutex_new();
+  g_mutex_lock(osr->quickhash1_lock);
+  dup->quickhash1_done = osr->quickhash1_done;
+  dup->quickhash1 = g_strdup(osr->quickhash1);
+  g_mutex_unlock(osr->quickhash1_lock);
+
+  dup->prefetch = _openslide_prefetch_create();
+  dup->stats = _openslide_stats_create();
+  return dup;
+}
+
+// free the parts of a handle that aren't shared with its duplicates
+static void destroy_handle(openslide_t *osr) {
   g_hash_table_unref(osr->associated_images);
   g_hash_table_unref(osr->properties);
 
   g_free(osr->associated_image_names);
   g_free(osr->property_names);
+  g_free(osr->filename);
+  g_free(osr->quickhash1);
+  g_mutex_free(osr->quickhash1_lock);
+  _openslide_stats_destroy(osr->stats);
 
-  if (osr->cache) {
-    _openslide_cache_destroy(osr->cache);
+  g_free(g_atomic_pointer_get(&osr->error));
+}
+
+void openslide_close(openslide_t *osr) {
+  // background reads use the backend
+  GThreadPool *async_pool = g_atomic_pointer_get(&osr->async_pool);
+  if (async_pool) {
+    // finish outstanding asynchronous reads
+    g_thread_pool_free(async_pool, false, true);
+    g_atomic_pointer_set(&osr->async_pool, NULL);
+  }
+  if (osr->prefetch) {
+    _openslide_prefetch_destroy(osr->prefetch);
+    osr->prefetch = NULL;
   }
 
-  g_free(g_atomic_pointer_get(&osr->error));
+  openslide_t *owner = osr->owner;
+  if (owner) {
+    destroy_handle(osr);
+    g_slice_free(openslide_t, osr);
+    osr = owner;
+  }
+  if (!g_atomic_int_dec_and_test(&osr->refcount)) {
+    // duplicates still use the backend
+    return;
+  }
+
+  if (osr->synth) {
+    _openslide_synth_destroy(osr->synth);
+  }
+  if (osr->ops) {
+    (osr->ops->destroy)(osr);
+  }
+
+  destroy_handle(osr);
+
+  if (osr->cache) {
+    _openslide_cache_binding_destroy(osr->cache);
+  }
 
   g_slice_free(openslide_t, osr);
 }
@@ -392,8 +778,8 @@ void openslide_get_level_dimensions(openslide_t *osr, int32_t level,
     return;
   }
 
-  *w = osr->levels[level]->w;
-  *h = osr->levels[level]->h;
+  *w = _openslide_get_level(osr, level)->w;
+  *h = _openslide_get_level(osr, level)->h;
 }
 
 void openslide_get_layer0_dimensions(openslide_t *osr,
@@ -417,7 +803,7 @@ int32_t openslide_get_level_count(openslide_t *osr) {
     return -1;
   }
 
-  return osr->level_count;
+  return _openslide_get_level_count(osr);
 }
 
 int32_t openslide_get_layer_count(openslide_t *osr) {
@@ -432,19 +818,20 @@ int32_t openslide_get_best_level_for_downsample(openslide_t *osr,
   }
 
   // too small, return first
-  if (downsample < osr->levels[0]->downsample) {
+  if (downsample < _openslide_get_level(osr, 0)->downsample) {
     return 0;
   }
 
   // find where we are in the middle
-  for (int32_t i = 1; i < osr->level_count; i++) {
-    if (downsample < osr->levels[i]->downsample) {
+  int32_t count = _openslide_get_level_count(osr);
+  for (int32_t i = 1; i < count; i++) {
+    if (downsample < _openslide_get_level(osr, i)->downsample) {
       return i - 1;
     }
   }
 
   // too big, return last
-  return osr->level_count - 1;
+  return count - 1;
 }
 
 int32_t openslide_get_best_layer_for_downsample(openslide_t *osr,
@@ -458,55 +845,76 @@ double openslide_get_level_downsample(openslide_t *osr, int32_t level) {
     return -1.0;
   }
 
-  return osr->levels[level]->downsample;
+  return _openslide_get_level(osr, level)->downsample;
 }
 
 double openslide_get_layer_downsample(openslide_t *osr, int32_t level) {
   return openslide_get_level_downsample(osr, level);
 }
 
+// statistics of one region read, collected for osr on the calling thread
+// and the decode threads working for it
+struct read_stats {
+  struct _openslide_stats *prev;
+  struct _openslide_stats_timer timer;
+};
 
-int openslide_give_prefetch_hint(openslide_t *osr G_GNUC_UNUSED,
-				 int64_t x G_GNUC_UNUSED,
-				 int64_t y G_GNUC_UNUSED,
-				 int32_t level G_GNUC_UNUSED,
-				 int64_t w G_GNUC_UNUSED,
-				 int64_t h G_GNUC_UNUSED) {
-  g_warning("openslide_give_prefetch_hint has never been implemented and should not be called");
-  return 0;
+static void read_stats_begin(openslide_t *osr, struct read_stats *rs) {
+  rs->prev = _openslide_stats_set_current(osr->stats);
+  _openslide_stats_begin(&rs->timer);
 }
 
-void openslide_cancel_prefetch_hint(openslide_t *osr G_GNUC_UNUSED,
-				    int prefetch_id G_GNUC_UNUSED) {
-  g_warning("openslide_cancel_prefetch_hint has never been implemented and should not be called");
+static void read_stats_end(struct read_stats *rs) {
+  // whatever isn't I/O, decoding or conversion is compositing
+  _openslide_stats_end(&rs->timer, OPENSLIDE_STAT_COMPOSITE_TIME);
+  _openslide_stats_add(OPENSLIDE_STAT_READS, 1);
+  _openslide_stats_set_current(rs->prev);
 }
 
+// if direct, cr is a new context on an uncleared image surface, so no
+// group is needed and simple grids may copy their tiles straight into the
+// surface, only clearing what they don't cover
 static bool read_region(openslide_t *osr,
 			cairo_t *cr,
 			int64_t x, int64_t y,
 			int32_t level,
 			int64_t w, int64_t h,
+			bool direct,
 			GError **err) {
   bool success = true;
+  cairo_pattern_t *old_source = NULL;
 
-  // save the old pattern, it's the only thing push/pop won't restore
-  cairo_pattern_t *old_source = cairo_get_source(cr);
-  cairo_pattern_reference(old_source);
+  if (!direct) {
+    // save the old pattern, it's the only thing push/pop won't restore
+    old_source = cairo_get_source(cr);
+    cairo_pattern_reference(old_source);
 
-  // push, so that saturate works with all sorts of backends
-  cairo_push_group(cr);
+    // push, so that saturate works with all sorts of backends
+    cairo_push_group(cr);
 
-  // clear to set the bounds of the group (seems to be a recent cairo bug)
-  cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
-  cairo_rectangle(cr, 0, 0, w, h);
-  cairo_fill(cr);
+    // clear to set the bounds of the group (seems to be a recent cairo bug)
+    cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+    cairo_rectangle(cr, 0, 0, w, h);
+    cairo_fill(cr);
+  }
 
   // saturate those seams away!
   cairo_set_operator(cr, CAIRO_OPERATOR_SATURATE);
   
   uint8_t r = 0, g = 0, b = 0;
+  bool background = _openslide_get_background_color_prop(osr, &r, &g, &b);
+
+  if (direct && background) {
+    // saturate needs a transparent start
+    cairo_save(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+    cairo_paint(cr);
+    cairo_restore(cr);
+  } else if (direct) {
+    _openslide_grid_begin_blit(cr, false);
+  }
   
-  if (_openslide_get_background_color_prop(osr, &r, &g, &b))
+  if (background)
   {
     // Draw background using background color
     //g_debug("Drawing background using color %d, %d, %d", r, g, b);
@@ -523,7 +931,7 @@ static bool read_region(openslide_t *osr,
   }
   
   if (level_in_range(osr, level)) {
-    struct _openslide_level *l = osr->levels[level];
+    struct _openslide_level *l = _openslide_get_level(osr, level);
 
     // offset if given negative coordinates
     double ds = l->downsample;
@@ -543,8 +951,18 @@ static bool read_region(openslide_t *osr,
 
     // paint
     if (w > 0 && h > 0) {
-      success = osr->ops->paint_region(osr, cr, x, y, l, w, h, err);
+      _openslide_prefetch_foreground_begin(osr);
+      success = _openslide_paint_region(osr, cr, x, y, l, w, h, err);
+      _openslide_prefetch_foreground_end(osr);
+    }
+  }
+
+  if (direct) {
+    if (!background) {
+      _openslide_grid_end_blit(cr);
     }
+    // the caller clears the surface on failure
+    return success;
   }
 
   cairo_pop_group_to_source(cr);
@@ -573,27 +991,13 @@ static bool ensure_nonnegative_dimensions(openslide_t *osr, int64_t w, int64_t h
   return true;
 }
 
-void openslide_read_region(openslide_t *osr,
-			   uint32_t *dest,
-			   int64_t x, int64_t y,
-			   int32_t level,
-			   int64_t w, int64_t h) {
-  GError *tmp_err = NULL;
-
-  if (!ensure_nonnegative_dimensions(osr, w, h)) {
-    return;
-  }
-
-  // clear the dest
-  if (dest) {
-    memset(dest, 0, w * h * 4);
-  }
-
-  // now that it's cleared, return if an error occurred
-  if (openslide_get_error(osr)) {
-    return;
-  }
-
+// dest need not be cleared
+static bool read_region_to_dest(openslide_t *osr,
+				uint32_t *dest,
+				int64_t x, int64_t y,
+				int32_t level,
+				int64_t w, int64_t h,
+				GError **err) {
   // Break the work into smaller pieces if the region is large, because:
   // 1. Cairo will not allow surfaces larger than 32767 pixels on a side.
   // 2. cairo_push_group() creates an intermediate surface backed by a
@@ -627,125 +1031,1290 @@ void openslide_read_region(openslide_t *osr,
       cairo_surface_destroy(surface);
 
       // paint
-      if (!read_region(osr, cr, sx, sy, level, sw, sh, &tmp_err)) {
+      if (!read_region(osr, cr, sx, sy, level, sw, sh, dest != NULL, err)) {
         cairo_destroy(cr);
-        goto OPENSLIDE_LABEL_OUT;
+        return false;
       }
 
       // done
-      if (!_openslide_check_cairo_status(cr, &tmp_err)) {
+      if (!_openslide_check_cairo_status(cr, err)) {
         cairo_destroy(cr);
-        goto OPENSLIDE_LABEL_OUT;
+        return false;
       }
 
       cairo_destroy(cr);
     }
   }
 
-OPENSLIDE_LABEL_OUT:
-  if (tmp_err) {
+  return true;
+}
+
+void openslide_read_region(openslide_t *osr,
+			   uint32_t *dest,
+			   int64_t x, int64_t y,
+			   int32_t level,
+			   int64_t w, int64_t h) {
+  GError *tmp_err = NULL;
+
+  if (!ensure_nonnegative_dimensions(osr, w, h)) {
+    return;
+  }
+
+  // return if an error occurred, clearing the dest
+  // otherwise painting clears only what no tile covers
+  if (openslide_get_error(osr)) {
+    if (dest) {
+      memset(dest, 0, w * h * 4);
+    }
+    return;
+  }
+
+  struct read_stats rs;
+  read_stats_begin(osr, &rs);
+  if (!read_region_to_dest(osr, dest, x, y, level, w, h, &tmp_err)) {
     _openslide_propagate_error(osr, tmp_err);
     if (dest) {
       // ensure we don't return a partial result
       memset(dest, 0, w * h * 4);
     }
   }
+  read_stats_end(&rs);
 }
 
+// read into a buffer of w * h, from a level 0 position that need not be
+// a whole pixel, so that pieces of a larger region line up
+static bool read_region_at(openslide_t *osr,
+			   uint32_t *dest,
+			   double x, double y,
+			   int32_t level,
+			   int64_t w, int64_t h,
+			   GError **err) {
+  // read from the pixel before, and shift the rest of the way
+  double ds = _openslide_get_level(osr, level)->downsample;
+  int64_t sx = floor(x);
+  int64_t sy = floor(y);
+
+  memset(dest, 0, w * h * 4);
+  cairo_surface_t *surface = cairo_image_surface_create_for_data(
+          (unsigned char *) dest, CAIRO_FORMAT_ARGB32, w, h, w * 4);
+  cairo_t *cr = cairo_create(surface);
+  cairo_surface_destroy(surface);
+  cairo_translate(cr, -(x - sx) / ds, -(y - sy) / ds);
+
+  // paint, with one spare pixel for the shift
+  bool success = read_region(osr, cr, sx, sy, level, w + 1, h + 1,
+                             false, err) &&
+                 _openslide_check_cairo_status(cr, err);
+  cairo_destroy(cr);
+  return success;
+}
 
-void openslide_cairo_read_region(openslide_t *osr,
-				 cairo_t *cr,
-				 int64_t x, int64_t y,
-				 int32_t level,
-				 int64_t w, int64_t h) {
+// scaled reads
+
+// source pixels read at once per side, bounding the intermediate buffers
+#define SCALED_READ_SOURCE_SIZE 2048
+
+static bool read_region_scaled_to_dest(openslide_t *osr,
+				       uint32_t *dest,
+				       int64_t x, int64_t y,
+				       double downsample,
+				       int64_t w, int64_t h,
+				       GError **err) {
+  // read the smallest level at least as detailed as requested
+  int32_t level = openslide_get_best_level_for_downsample(osr, downsample);
+  double ds = _openslide_get_level(osr, level)->downsample;
+  double scale = downsample / ds;
+
+  struct _openslide_scale_weights *xw = _openslide_scale_weights_create(w, scale);
+  struct _openslide_scale_weights *yw = _openslide_scale_weights_create(h, scale);
+  bool success = true;
+
+  // the output is built in blocks, from source blocks of at most
+  // SCALED_READ_SOURCE_SIZE on a side
+  const int64_t d = MAX(1, SCALED_READ_SOURCE_SIZE / (int64_t) ceil(scale));
+  uint32_t *buf = NULL;
+  for (int64_t row = 0; success && row < (h + d - 1) / d; row++) {
+    for (int64_t col = 0; success && col < (w + d - 1) / d; col++) {
+      // output block
+      int64_t ox = col * d;
+      int64_t oy = row * d;
+      int64_t ow = MIN(w - ox, d);
+      int64_t oh = MIN(h - oy, d);
+
+      // source block, in the level plane relative to x, y
+      int64_t src_x = _openslide_scale_weights_get_start(xw, ox);
+      int64_t src_y = _openslide_scale_weights_get_start(yw, oy);
+      int64_t src_w = _openslide_scale_weights_get_end(xw, ox + ow) - src_x;
+      int64_t src_h = _openslide_scale_weights_get_end(yw, oy + oh) - src_y;
+
+      if (!buf) {
+        buf = g_new(uint32_t, (SCALED_READ_SOURCE_SIZE + 2) *
+                              (SCALED_READ_SOURCE_SIZE + 2));
+      }
+      success = read_region_at(osr, buf, x + src_x * ds, y + src_y * ds,
+                               level, src_w, src_h, err);
+      if (success) {
+        struct _openslide_stats_timer timer;
+        _openslide_stats_begin(&timer);
+        _openslide_scale_area(buf, src_w, src_x, src_y, src_h,
+                              dest, w, ox, oy, ow, oh, xw, yw);
+        _openslide_stats_end(&timer, OPENSLIDE_STAT_CONVERT_TIME);
+      }
+    }
+  }
+
+  g_free(buf);
+  _openslide_scale_weights_destroy(xw);
+  _openslide_scale_weights_destroy(yw);
+  return success;
+}
+
+void openslide_read_region_scaled(openslide_t *osr,
+				  uint32_t *dest,
+				  int64_t x, int64_t y,
+				  double downsample,
+				  int64_t w, int64_t h) {
   GError *tmp_err = NULL;
 
   if (!ensure_nonnegative_dimensions(osr, w, h)) {
     return;
   }
 
+  if (!(downsample > 0) && !openslide_get_error(osr)) {
+    GError *tmp_err = g_error_new(OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                                  "downsample (%g) must be positive",
+                                  downsample);
+    _openslide_propagate_error(osr, tmp_err);
+  }
+
+  // return if an error occurred, clearing the dest
+  // otherwise every pixel is written
   if (openslide_get_error(osr)) {
+    if (dest) {
+      memset(dest, 0, w * h * 4);
+    }
     return;
   }
 
-  if (read_region(osr, cr, x, y, level, w, h, &tmp_err)) {
-    _openslide_check_cairo_status(cr, &tmp_err);
+  if (!dest || !w || !h) {
+    return;
   }
 
-  if (tmp_err) {
+  struct read_stats rs;
+  read_stats_begin(osr, &rs);
+  if (!read_region_scaled_to_dest(osr, dest, x, y, downsample, w, h,
+                                  &tmp_err)) {
     _openslide_propagate_error(osr, tmp_err);
+    // ensure we don't return a partial result
+    memset(dest, 0, w * h * 4);
   }
+  read_stats_end(&rs);
 }
 
-
-const char * const *openslide_get_property_names(openslide_t *osr) {
-  if (openslide_get_error(osr)) {
-    return EMPTY_STRING_ARRAY;
+// reads into other pixel formats
+
+// pixels read and converted at once, so the ARGB data is still in cache
+#define FORMAT_READ_STRIP_PIXELS (256 * 1024)
+
+static int32_t pixel_format_size(int32_t format) {
+  switch (format) {
+  case OPENSLIDE_PIXEL_FORMAT_ARGB32:
+  case OPENSLIDE_PIXEL_FORMAT_RGBA32:
+    return 4;
+  case OPENSLIDE_PIXEL_FORMAT_RGB24:
+    return 3;
+  case OPENSLIDE_PIXEL_FORMAT_GRAY8:
+    return 1;
+  default:
+    return 0;
   }
-
-  return osr->property_names;
 }
 
-const char *openslide_get_property_value(openslide_t *osr, const char *name) {
-  if (openslide_get_error(osr)) {
-    return NULL;
+// undo premultiplication of one channel
+static inline uint8_t unpremultiply(uint32_t c, uint32_t a) {
+  if (a == 255) {
+    return c;
+  } else if (a == 0) {
+    return 0;
   }
-
-  return g_hash_table_lookup(osr->properties, name);
+  return (c * 255 + a / 2) / a;
 }
 
-const char * const *openslide_get_associated_image_names(openslide_t *osr) {
-  if (openslide_get_error(osr)) {
-    return EMPTY_STRING_ARRAY;
+static void convert_pixels(const uint32_t *src, int64_t w, int64_t h,
+                           uint8_t *dest, int64_t stride,
+                           int32_t format) {
+  for (int64_t y = 0; y < h; y++) {
+    const uint32_t *in = src + y * w;
+    uint8_t *out = dest + y * stride;
+    switch (format) {
+    case OPENSLIDE_PIXEL_FORMAT_ARGB32:
+      memcpy(out, in, w * 4);
+      break;
+    case OPENSLIDE_PIXEL_FORMAT_RGBA32:
+      for (int64_t x = 0; x < w; x++) {
+        uint32_t px = in[x];
+        uint32_t a = px >> 24;
+        out[0] = unpremultiply((px >> 16) & 0xff, a);
+        out[1] = unpremultiply((px >> 8) & 0xff, a);
+        out[2] = unpremultiply(px & 0xff, a);
+        out[3] = a;
+        out += 4;
+      }
+      break;
+    case OPENSLIDE_PIXEL_FORMAT_RGB24:
+      for (int64_t x = 0; x < w; x++) {
+        uint32_t px = in[x];
+        uint32_t a = px >> 24;
+        out[0] = unpremultiply((px >> 16) & 0xff, a);
+        out[1] = unpremultiply((px >> 8) & 0xff, a);
+        out[2] = unpremultiply(px & 0xff, a);
+        out += 3;
+      }
+      break;
+    case OPENSLIDE_PIXEL_FORMAT_GRAY8:
+      for (int64_t x = 0; x < w; x++) {
+        uint32_t px = in[x];
+        uint32_t a = px >> 24;
+        // Rec. 601 luma
+        uint32_t luma = 77 * ((px >> 16) & 0xff) +
+                        150 * ((px >> 8) & 0xff) +
+                        29 * (px & 0xff);
+        out[x] = unpremultiply((luma + 128) >> 8, a);
+      }
+      break;
+    }
   }
+}
 
-  return osr->associated_image_names;
+static void clear_formatted(uint8_t *dest, int64_t stride,
+                            int64_t w, int64_t h, int32_t format) {
+  for (int64_t y = 0; y < h; y++) {
+    memset(dest + y * stride, 0, w * pixel_format_size(format));
+  }
 }
 
-void openslide_get_associated_image_dimensions(openslide_t *osr, const char *name,
-					       int64_t *w, int64_t *h) {
-  *w = -1;
-  *h = -1;
+void openslide_read_region_format(openslide_t *osr,
+				  void *dest,
+				  int64_t stride,
+				  int32_t format,
+				  int64_t x, int64_t y,
+				  int32_t level,
+				  int64_t w, int64_t h) {
+  GError *tmp_err = NULL;
 
-  if (openslide_get_error(osr)) {
+  if (!ensure_nonnegative_dimensions(osr, w, h)) {
     return;
   }
 
-  struct _openslide_associated_image *img = g_hash_table_lookup(osr->associated_images,
-								name);
-  if (img) {
-    *w = img->w;
-    *h = img->h;
+  int32_t bpp = pixel_format_size(format);
+  if (!openslide_get_error(osr) && (!bpp || stride < w * bpp)) {
+    tmp_err = g_error_new(OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                          "Invalid pixel format %d or stride %"PRId64,
+                          format, stride);
+    _openslide_propagate_error(osr, tmp_err);
+    // don't clear through a bad stride
+    return;
   }
-}
-
-void openslide_read_associated_image(openslide_t *osr,
-				     const char *name,
-				     uint32_t *dest) {
-  GError *tmp_err = NULL;
 
+  // return if an error occurred, clearing the dest
   if (openslide_get_error(osr)) {
+    if (dest) {
+      clear_formatted(dest, stride, w, h, format);
+    }
     return;
   }
 
-  struct _openslide_associated_image *img = g_hash_table_lookup(osr->associated_images,
+  // ARGB with no padding needs no conversion
+  if (format == OPENSLIDE_PIXEL_FORMAT_ARGB32 && stride == w * 4) {
+    openslide_read_region(osr, dest, x, y, level, w, h);
+    return;
+  }
+
+  if (!dest || !w || !h || !level_in_range(osr, level)) {
+    if (dest) {
+      clear_formatted(dest, stride, w, h, format);
+    }
+    return;
+  }
+
+  // read and convert in blocks, which cairo limits in width
+  double ds = _openslide_get_level(osr, level)->downsample;
+  int64_t cols = MIN(w, 4096);
+  int64_t rows = MAX(1, FORMAT_READ_STRIP_PIXELS / cols);
+  uint32_t *buf = g_new(uint32_t, cols * MIN(rows, h));
+  struct read_stats rs;
+  read_stats_begin(osr, &rs);
+  for (int64_t row = 0; row < h; row += rows) {
+    for (int64_t col = 0; col < w; col += cols) {
+      int64_t sw = MIN(w - col, cols);
+      int64_t sh = MIN(h - row, rows);
+      if (!read_region_at(osr, buf, x + col * ds, y + row * ds, level,
+                          sw, sh, &tmp_err)) {
+        _openslide_propagate_error(osr, tmp_err);
+        // ensure we don't return a partial result
+        clear_formatted(dest, stride, w, h, format);
+        goto DONE;
+      }
+      struct _openslide_stats_timer timer;
+      _openslide_stats_begin(&timer);
+      convert_pixels(buf, sw, sh,
+                     (uint8_t *) dest + row * stride + col * bpp, stride,
+                     format);
+      _openslide_stats_end(&timer, OPENSLIDE_STAT_CONVERT_TIME);
+    }
+  }
+DONE:
+  read_stats_end(&rs);
+  g_free(buf);
+}
+
+// batched reads
+
+// regions of a batch are read in this many runs per thread, so that
+// threads finishing early can take more work
+#define READ_REGIONS_RUNS_PER_THREAD 4
+
+struct read_regions_state {
+  const openslide_region_request_t **requests;  // sorted
+
+  GMutex *mutex;
+  GError *err;  // first failure
+};
+
+struct read_regions_run {
+  struct read_regions_state *state;
+  int32_t start;
+  int32_t end;
+};
+
+// nearby regions of a level are read one after the other, so that the
+// tiles they share are still cached
+static gint read_regions_compare(gconstpointer a, gconstpointer b,
+                                 gpointer user_data G_GNUC_UNUSED) {
+  const openslide_region_request_t *ra =
+    *(const openslide_region_request_t * const *) a;
+  const openslide_region_request_t *rb =
+    *(const openslide_region_request_t * const *) b;
+
+  if (ra->level != rb->level) {
+    return ra->level < rb->level ? -1 : 1;
+  } else if (ra->y != rb->y) {
+    return ra->y < rb->y ? -1 : 1;
+  } else if (ra->x != rb->x) {
+    return ra->x < rb->x ? -1 : 1;
+  } else {
+    return 0;
+  }
+}
+
+static void read_regions_run(gpointer data, gpointer user_data) {
+  struct read_regions_run *run = data;
+  struct read_regions_state *state = run->state;
+  openslide_t *osr = user_data;
+  GError *tmp_err = NULL;
+
+  for (int32_t i = run->start; i < run->end; i++) {
+    // stop early if another run failed
+    g_mutex_lock(state->mutex);
+    bool failed = state->err != NULL;
+    g_mutex_unlock(state->mutex);
+    if (failed) {
+      break;
+    }
+
+    const openslide_region_request_t *req = state->requests[i];
+    struct read_stats rs;
+    read_stats_begin(osr, &rs);
+    bool success = read_region_to_dest(osr, req->dest, req->x, req->y,
+                                       req->level, req->w, req->h,
+                                       &tmp_err);
+    read_stats_end(&rs);
+    if (!success) {
+      g_mutex_lock(state->mutex);
+      if (state->err) {
+        g_error_free(tmp_err);
+      } else {
+        state->err = tmp_err;
+      }
+      g_mutex_unlock(state->mutex);
+      break;
+    }
+  }
+}
+
+void openslide_read_regions(openslide_t *osr,
+			    const openslide_region_request_t *requests,
+			    int32_t count) {
+  for (int32_t i = 0; i < count; i++) {
+    if (!ensure_nonnegative_dimensions(osr, requests[i].w, requests[i].h)) {
+      return;
+    }
+  }
+
+  // return if an error occurred, clearing the dests
+  if (openslide_get_error(osr)) {
+    for (int32_t i = 0; i < count; i++) {
+      if (requests[i].dest) {
+        memset(requests[i].dest, 0, requests[i].w * requests[i].h * 4);
+      }
+    }
+    return;
+  }
+  if (count <= 0) {
+    return;
+  }
+
+  struct read_regions_state state = {
+    .requests = g_new(const openslide_region_request_t *, count),
+    .mutex = g_mutex_new(),
+  };
+  for (int32_t i = 0; i < count; i++) {
+    state.requests[i] = &requests[i];
+  }
+  g_qsort_with_data(state.requests, count,
+                    sizeof(*state.requests),
+                    read_regions_compare, NULL);
+
+  // split the sorted regions into runs, read in parallel if enabled
+  openslide_t *owner = osr->owner ? osr->owner : osr;
+  int threads = g_atomic_int_get(&owner->decode_threads);
+  GThreadPool *pool = NULL;
+  if (threads > 1 && count > 1) {
+    pool = g_thread_pool_new(read_regions_run, osr, threads, false, NULL);
+  }
+  int32_t runs = 1;
+  if (pool) {
+    runs = MIN(count, threads * READ_REGIONS_RUNS_PER_THREAD);
+  }
+  struct read_regions_run *run_array = g_new(struct read_regions_run, runs);
+  for (int32_t i = 0; i < runs; i++) {
+    struct read_regions_run *run = &run_array[i];
+    run->state = &state;
+    run->start = (int64_t) count * i / runs;
+    run->end = (int64_t) count * (i + 1) / runs;
+    if (pool) {
+      g_thread_pool_push(pool, run, NULL);
+    } else {
+      read_regions_run(run, osr);
+    }
+  }
+  if (pool) {
+    // wait for the runs
+    g_thread_pool_free(pool, false, true);
+  }
+  g_free(run_array);
+  g_mutex_free(state.mutex);
+  g_free(state.requests);
+
+  if (state.err) {
+    _openslide_propagate_error(osr, state.err);
+    // ensure we don't return a partial result
+    for (int32_t i = 0; i < count; i++) {
+      if (requests[i].dest) {
+        memset(requests[i].dest, 0, requests[i].w * requests[i].h * 4);
+      }
+    }
+  }
+}
+
+
+// asynchronous reads
+
+// threads per openslide_t running asynchronous reads
+#define ASYNC_READ_THREADS 4
+
+struct _openslide_read {
+  openslide_t *osr;
+  uint32_t *dest;
+  int64_t x;
+  int64_t y;
+  int32_t level;
+  int64_t w;
+  int64_t h;
+  openslide_read_callback_t callback;
+  void *data;
+
+  gint refcount;  // caller and worker; atomic ops only
+  GMutex *mutex;
+  GCond *cond;
+  bool done;
+};
+
+static void async_read_unref(openslide_read_t *read) {
+  if (g_atomic_int_dec_and_test(&read->refcount)) {
+    g_cond_free(read->cond);
+    g_mutex_free(read->mutex);
+    g_slice_free(openslide_read_t, read);
+  }
+}
+
+static void async_read_run(gpointer data, gpointer user_data G_GNUC_UNUSED) {
+  openslide_read_t *read = data;
+  openslide_t *osr = read->osr;
+  GError *tmp_err = NULL;
+
+  // a read queued after a failure skips the work
+  if (!openslide_get_error(osr)) {
+    struct read_stats rs;
+    read_stats_begin(osr, &rs);
+    if (!read_region_to_dest(osr, read->dest, read->x, read->y,
+                             read->level, read->w, read->h, &tmp_err)) {
+      _openslide_propagate_error(osr, tmp_err);
+    }
+    read_stats_end(&rs);
+  }
+  if (openslide_get_error(osr) && read->dest) {
+    // ensure we don't return a partial result
+    memset(read->dest, 0, read->w * read->h * 4);
+  }
+
+  g_mutex_lock(read->mutex);
+  read->done = true;
+  g_cond_broadcast(read->cond);
+  g_mutex_unlock(read->mutex);
+
+  if (read->callback) {
+    read->callback(read, read->data);
+  }
+  async_read_unref(read);
+}
+
+static GThreadPool *get_async_pool(openslide_t *osr, GError **err) {
+  GThreadPool *pool = g_atomic_pointer_get(&osr->async_pool);
+  if (pool) {
+    return pool;
+  }
+
+  // non-exclusive, so idle threads are shared with the rest of the process
+  pool = g_thread_pool_new(async_read_run, NULL,
+                           ASYNC_READ_THREADS, false, err);
+  if (!pool) {
+    g_prefix_error(err, "Couldn't start read threads: ");
+    return NULL;
+  }
+  if (!g_atomic_pointer_compare_and_exchange(&osr->async_pool, NULL, pool)) {
+    // another thread won
+    g_thread_pool_free(pool, true, false);
+    pool = g_atomic_pointer_get(&osr->async_pool);
+  }
+  return pool;
+}
+
+openslide_read_t *openslide_read_region_async(openslide_t *osr,
+					      uint32_t *dest,
+					      int64_t x, int64_t y,
+					      int32_t level,
+					      int64_t w, int64_t h,
+					      openslide_read_callback_t callback,
+					      void *data) {
+  GError *tmp_err = NULL;
+
+  if (!ensure_nonnegative_dimensions(osr, w, h)) {
+    return NULL;
+  }
+
+  // return if an error occurred, clearing the dest
+  if (openslide_get_error(osr)) {
+    if (dest) {
+      memset(dest, 0, w * h * 4);
+    }
+    return NULL;
+  }
+
+  GThreadPool *pool = get_async_pool(osr, &tmp_err);
+  if (!pool) {
+    _openslide_propagate_error(osr, tmp_err);
+    return NULL;
+  }
+
+  openslide_read_t *read = g_slice_new0(openslide_read_t);
+  read->osr = osr;
+  read->dest = dest;
+  read->x = x;
+  read->y = y;
+  read->level = level;
+  read->w = w;
+  read->h = h;
+  read->callback = callback;
+  read->data = data;
+  read->mutex = g_mutex_new();
+  read->cond = g_cond_new();
+  g_atomic_int_set(&read->refcount, 2);
+  g_thread_pool_push(pool, read, NULL);
+  return read;
+}
+
+int openslide_read_is_done(openslide_read_t *read) {
+  g_mutex_lock(read->mutex);
+  bool done = read->done;
+  g_mutex_unlock(read->mutex);
+  return done;
+}
+
+void openslide_read_wait(openslide_read_t *read) {
+  g_mutex_lock(read->mutex);
+  while (!read->done) {
+    g_cond_wait(read->cond, read->mutex);
+  }
+  g_mutex_unlock(read->mutex);
+}
+
+void openslide_read_release(openslide_read_t *read) {
+  if (read == NULL) {
+    return;
+  }
+  async_read_unref(read);
+}
+
+
+void openslide_cairo_read_region(openslide_t *osr,
+				 cairo_t *cr,
+				 int64_t x, int64_t y,
+				 int32_t level,
+				 int64_t w, int64_t h) {
+  GError *tmp_err = NULL;
+
+  if (!ensure_nonnegative_dimensions(osr, w, h)) {
+    return;
+  }
+
+  if (openslide_get_error(osr)) {
+    return;
+  }
+
+  struct read_stats rs;
+  read_stats_begin(osr, &rs);
+  if (read_region(osr, cr, x, y, level, w, h, false, &tmp_err)) {
+    _openslide_check_cairo_status(cr, &tmp_err);
+  }
+  read_stats_end(&rs);
+
+  if (tmp_err) {
+    _openslide_propagate_error(osr, tmp_err);
+  }
+}
+
+
+const char * const *openslide_get_property_names(openslide_t *osr) {
+  if (openslide_get_error(osr)) {
+    return EMPTY_STRING_ARRAY;
+  }
+
+  return osr->property_names;
+}
+
+const char *openslide_get_property_value(openslide_t *osr, const char *name) {
+  if (openslide_get_error(osr)) {
+    return NULL;
+  }
+
+  if (!strcmp(name, OPENSLIDE_PROPERTY_NAME_QUICKHASH1)) {
+    return get_quickhash1(osr);
+  }
+  return g_hash_table_lookup(osr->properties, name);
+}
+
+const char * const *openslide_get_associated_image_names(openslide_t *osr) {
+  if (openslide_get_error(osr)) {
+    return EMPTY_STRING_ARRAY;
+  }
+
+  return osr->associated_image_names;
+}
+
+int openslide_give_prefetch_hint(openslide_t *osr,
+				 int64_t x, int64_t y,
+				 int32_t level,
+				 int64_t w, int64_t h) {
+  GError *tmp_err = NULL;
+
+  if (!ensure_nonnegative_dimensions(osr, w, h)) {
+    return -1;
+  }
+
+  if (openslide_get_error(osr)) {
+    return -1;
+  }
+
+  if (!level_in_range(osr, level)) {
+    return -1;
+  }
+
+  int id = _openslide_prefetch_hint(osr, x, y, level, w, h, &tmp_err);
+  if (id < 0) {
+    _openslide_propagate_error(osr, tmp_err);
+  }
+  return id;
+}
+
+void openslide_cancel_prefetch_hint(openslide_t *osr, int prefetch_id) {
+  _openslide_prefetch_cancel(osr, prefetch_id);
+}
+
+void openslide_set_warm_start(bool enabled) {
+  _openslide_prefetch_set_warm_start(enabled);
+}
+
+void openslide_set_decode_threads(openslide_t *osr, int32_t threads) {
+  // grids read the owner's setting
+  openslide_t *owner = osr->owner ? osr->owner : osr;
+  g_atomic_int_set(&owner->decode_threads, MAX(threads, 0));
+}
+
+void openslide_set_scan_mode(openslide_t *osr, bool scan) {
+  // reads carry the handle's stats to the threads doing the work
+  _openslide_stats_set_scan(osr->stats, scan);
+}
+
+int64_t openslide_get_stat(openslide_t *osr, int32_t stat) {
+  if (openslide_get_error(osr)) {
+    return -1;
+  }
+  return _openslide_stats_get(osr->stats, stat);
+}
+
+void openslide_reset_stats(openslide_t *osr) {
+  _openslide_stats_reset(osr->stats);
+}
+
+void openslide_set_trace_callback(openslide_trace_callback_t callback,
+                                  void *data) {
+  _openslide_trace_set_callback(callback, data);
+}
+
+void openslide_set_block_cache_capacity(int64_t capacity) {
+  _openslide_read_range_set_capacity(capacity);
+}
+
+void openslide_set_range_reader(openslide_range_reader_t reader, void *data) {
+  _openslide_read_range_set_reader(reader, data);
+}
+
+void openslide_set_synthesized_levels(bool enabled) {
+  _openslide_synth_set_enabled(enabled);
+}
+
+void openslide_set_tile_snapping(bool enabled) {
+  _openslide_grid_set_snap_enabled(enabled);
+}
+
+// associated images are cached at each size they are read at, keyed by
+// their dimensions
+
+// fit in a square of max_dimension, without enlarging
+static void get_associated_image_scaled_dimensions(struct _openslide_associated_image *img,
+                                                   int64_t max_dimension,
+                                                   int64_t *w, int64_t *h) {
+  int64_t longest = MAX(img->w, img->h);
+  if (longest <= max_dimension) {
+    *w = img->w;
+    *h = img->h;
+    return;
+  }
+  double scale = (double) max_dimension / longest;
+  *w = MAX(1, (int64_t) round(img->w * scale));
+  *h = MAX(1, (int64_t) round(img->h * scale));
+}
+
+static uint32_t *read_associated_image(openslide_t *osr,
+                                       struct _openslide_associated_image *img,
+                                       int64_t w, int64_t h,
+                                       struct _openslide_cache_entry **entry,
+                                       GError **err);
+
+static bool scale_associated_image(openslide_t *osr,
+                                   struct _openslide_associated_image *img,
+                                   uint32_t *dest,
+                                   int64_t w, int64_t h,
+                                   GError **err) {
+  // decode at the smallest DCT scale still at least as large as the output
+  int32_t denom = 1;
+  if (img->ops->get_argb_data_scaled) {
+    while (denom < 8 &&
+           (img->w + denom * 2 - 1) / (denom * 2) >= w &&
+           (img->h + denom * 2 - 1) / (denom * 2) >= h) {
+      denom *= 2;
+    }
+  }
+  int64_t sw = (img->w + denom - 1) / denom;
+  int64_t sh = (img->h + denom - 1) / denom;
+
+  const uint32_t *src;
+  uint32_t *buf = NULL;
+  struct _openslide_cache_entry *src_entry = NULL;
+  if (denom > 1) {
+    buf = g_new(uint32_t, sw * sh);
+    if (!img->ops->get_argb_data_scaled(img, buf, denom, err)) {
+      g_free(buf);
+      return false;
+    }
+    src = buf;
+  } else {
+    // full size, which stays cached for other sizes
+    src = read_associated_image(osr, img, sw, sh, &src_entry, err);
+    if (!src) {
+      return false;
+    }
+  }
+
+  struct _openslide_scale_weights *xw =
+    _openslide_scale_weights_create(w, (double) sw / w);
+  struct _openslide_scale_weights *yw =
+    _openslide_scale_weights_create(h, (double) sh / h);
+
+  // rounding can take the last output pixels one source pixel past the
+  // edge, which then has no weight
+  int64_t stride = MAX(sw, _openslide_scale_weights_get_end(xw, w));
+  int64_t rows = MAX(sh, _openslide_scale_weights_get_end(yw, h));
+  uint32_t *padded = NULL;
+  if (stride > sw || rows > sh) {
+    padded = g_new0(uint32_t, stride * rows);
+    for (int64_t row = 0; row < sh; row++) {
+      memcpy(padded + row * stride, src + row * sw, sw * 4);
+    }
+    src = padded;
+  }
+
+  _openslide_scale_area(src, stride, 0, 0, rows,
+                        dest, w, 0, 0, w, h, xw, yw);
+
+  g_free(padded);
+  _openslide_scale_weights_destroy(xw);
+  _openslide_scale_weights_destroy(yw);
+  g_free(buf);
+  if (src_entry) {
+    _openslide_cache_entry_unref(src_entry);
+  }
+  return true;
+}
+
+// entry must be unreffed when the caller is done with the data
+static uint32_t *read_associated_image(openslide_t *osr,
+                                       struct _openslide_associated_image *img,
+                                       int64_t w, int64_t h,
+                                       struct _openslide_cache_entry **entry,
+                                       GError **err) {
+  uint32_t *data = _openslide_cache_get(osr->cache, img, w, h, entry);
+  if (data) {
+    return data;
+  }
+
+  int size = w * h * 4;
+  data = _openslide_tile_buffer_alloc(size);
+  bool success;
+  if (w == img->w && h == img->h) {
+    success = img->ops->get_argb_data(img, data, err);
+  } else {
+    success = scale_associated_image(osr, img, data, w, h, err);
+  }
+  if (!success) {
+    _openslide_tile_buffer_free(data, size);
+    return NULL;
+  }
+
+  _openslide_cache_put(osr->cache, img, w, h, data, size, entry);
+  return data;
+}
+
+void openslide_get_associated_image_dimensions(openslide_t *osr, const char *name,
+					       int64_t *w, int64_t *h) {
+  *w = -1;
+  *h = -1;
+
+  if (openslide_get_error(osr)) {
+    return;
+  }
+
+  struct _openslide_associated_image *img = g_hash_table_lookup(osr->associated_images,
+								name);
+  if (img) {
+    *w = img->w;
+    *h = img->h;
+  }
+}
+
+void openslide_read_associated_image(openslide_t *osr,
+				     const char *name,
+				     uint32_t *dest) {
+  GError *tmp_err = NULL;
+
+  if (openslide_get_error(osr)) {
+    return;
+  }
+
+  struct _openslide_associated_image *img = g_hash_table_lookup(osr->associated_images,
 								name);
   if (img) {
     // this function is documented to do nothing on failure, so we need an
     // extra memcpy
-    size_t pixels = img->w * img->h;
-    uint32_t *buf = g_new(uint32_t, pixels);
+    struct _openslide_cache_entry *entry;
+    uint32_t *buf = read_associated_image(osr, img, img->w, img->h,
+                                          &entry, &tmp_err);
+    if (buf) {
+      if (dest) {
+        memcpy(dest, buf, img->w * img->h * sizeof(uint32_t));
+      }
+      _openslide_cache_entry_unref(entry);
+    } else {
+      _openslide_propagate_error(osr, tmp_err);
+    }
+  }
+}
+
+void openslide_get_associated_image_scaled_dimensions(openslide_t *osr,
+						      const char *name,
+						      int64_t max_dimension,
+						      int64_t *w, int64_t *h) {
+  *w = -1;
+  *h = -1;
+
+  if (openslide_get_error(osr) || max_dimension <= 0) {
+    return;
+  }
+
+  struct _openslide_associated_image *img = g_hash_table_lookup(osr->associated_images,
+								name);
+  if (img) {
+    get_associated_image_scaled_dimensions(img, max_dimension, w, h);
+  }
+}
+
+void openslide_read_associated_image_scaled(openslide_t *osr,
+					    const char *name,
+					    int64_t max_dimension,
+					    uint32_t *dest) {
+  GError *tmp_err = NULL;
+
+  if (openslide_get_error(osr) || max_dimension <= 0) {
+    return;
+  }
+
+  struct _openslide_associated_image *img = g_hash_table_lookup(osr->associated_images,
+								name);
+  if (img) {
+    int64_t w, h;
+    get_associated_image_scaled_dimensions(img, max_dimension, &w, &h);
 
-    if (img->ops->get_argb_data(img, buf, &tmp_err)) {
+    struct _openslide_cache_entry *entry;
+    uint32_t *buf = read_associated_image(osr, img, w, h, &entry, &tmp_err);
+    if (buf) {
       if (dest) {
-        memcpy(dest, buf, pixels * sizeof(uint32_t));
+        memcpy(dest, buf, w * h * sizeof(uint32_t));
       }
+      _openslide_cache_entry_unref(entry);
     } else {
       _openslide_propagate_error(osr, tmp_err);
     }
+  }
+}
+
+static bool level_has_raw_tiles(openslide_t *osr, int32_t level) {
+  return level_in_range(osr, level) &&
+         osr->ops->read_raw_tile &&
+         _openslide_get_level(osr, level)->raw_tiles;
+}
+
+void openslide_get_level_raw_tile_dimensions(openslide_t *osr,
+					     int32_t level,
+					     int64_t *w, int64_t *h) {
+  *w = -1;
+  *h = -1;
+
+  if (openslide_get_error(osr)) {
+    return;
+  }
+
+  if (!level_has_raw_tiles(osr, level)) {
+    return;
+  }
 
-    g_free(buf);
+  *w = _openslide_get_level(osr, level)->tile_w;
+  *h = _openslide_get_level(osr, level)->tile_h;
+}
+
+void *openslide_read_raw_tile(openslide_t *osr,
+			      int32_t level,
+			      int64_t tile_col, int64_t tile_row,
+			      int64_t *len) {
+  GError *tmp_err = NULL;
+
+  *len = 0;
+
+  if (openslide_get_error(osr)) {
+    return NULL;
+  }
+
+  if (!level_has_raw_tiles(osr, level)) {
+    return NULL;
+  }
+
+  // tiles outside the level don't exist
+  struct _openslide_level *l = _openslide_get_level(osr, level);
+  if (tile_col < 0 || tile_row < 0 ||
+      tile_col * l->tile_w >= l->w || tile_row * l->tile_h >= l->h) {
+    return NULL;
+  }
+
+  void *buf;
+  int32_t buflen;
+  if (!osr->ops->read_raw_tile(osr, l, tile_col, tile_row,
+                               &buf, &buflen, &tmp_err)) {
+    _openslide_propagate_error(osr, tmp_err);
+    return NULL;
   }
+
+  if (buf) {
+    *len = buflen;
+  }
+  return buf;
+}
+
+void openslide_free_raw_tile(void *data) {
+  g_free(data);
+}
+
+char *openslide_compute_quickhash1(const char *filename, char **error) {
+  g_assert(openslide_was_dynamically_loaded);
+
+  GError *tmp_err = NULL;
+  char *result = NULL;
+  struct _openslide_tifflike *tl;
+  const struct _openslide_format *format = detect_format(filename, &tl);
+  if (format) {
+    result = hash_slide(format, filename, tl, &tmp_err);
+    _openslide_tifflike_destroy(tl);
+    if (!result && !tmp_err) {
+      g_set_error(&tmp_err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                  "No quickhash-1 available");
+    }
+  } else {
+    g_set_error(&tmp_err, OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                "Not a file that OpenSlide can recognize");
+  }
+
+  if (error) {
+    *error = tmp_err ? g_strdup(tmp_err->message) : NULL;
+  }
+  g_clear_error(&tmp_err);
+  return result;
+}
+
+void openslide_free_string(char *str) {
+  g_free(str);
+}
+
+static int32_t sample_type_size(int32_t sample_type) {
+  switch (sample_type) {
+  case OPENSLIDE_SAMPLE_TYPE_UINT8:
+    return 1;
+  case OPENSLIDE_SAMPLE_TYPE_UINT16:
+    return 2;
+  case OPENSLIDE_SAMPLE_TYPE_FLOAT32:
+    return 4;
+  default:
+    g_assert_not_reached();
+  }
+}
+
+static bool get_native_format(openslide_t *osr,
+                              int32_t *sample_type, int32_t *channels) {
+  return osr->ops->get_native_format &&
+         osr->ops->get_native_format(osr, sample_type, channels);
+}
+
+void openslide_get_native_format(openslide_t *osr,
+				 int32_t *sample_type,
+				 int32_t *channels) {
+  *sample_type = -1;
+  *channels = -1;
+
+  if (openslide_get_error(osr)) {
+    return;
+  }
+
+  int32_t type, count;
+  if (get_native_format(osr, &type, &count)) {
+    *sample_type = type;
+    *channels = count;
+  }
+}
+
+void openslide_read_region_native(openslide_t *osr,
+				  void *dest,
+				  const int32_t *channels,
+				  int32_t channel_count,
+				  int64_t x, int64_t y,
+				  int32_t level,
+				  int64_t w, int64_t h) {
+  GError *tmp_err = NULL;
+
+  if (!ensure_nonnegative_dimensions(osr, w, h)) {
+    return;
+  }
+
+  int32_t type, count;
+  if (!get_native_format(osr, &type, &count)) {
+    return;
+  }
+
+  if (!channels) {
+    channel_count = count;
+  }
+  bool valid = channel_count > 0;
+  for (int32_t i = 0; channels && i < channel_count && valid; i++) {
+    valid = channels[i] >= 0 && channels[i] < count;
+  }
+  if (!openslide_get_error(osr) && !valid) {
+    tmp_err = g_error_new(OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                          "Invalid channel selection");
+    _openslide_propagate_error(osr, tmp_err);
+    // don't clear a buffer of unknown size
+    return;
+  }
+
+  if (!dest) {
+    return;
+  }
+  size_t size = w * h * channel_count * sample_type_size(type);
+  memset(dest, 0, size);
+
+  // return if an error occurred, with the dest cleared
+  if (openslide_get_error(osr)) {
+    return;
+  }
+
+  if (!w || !h || !level_in_range(osr, level)) {
+    return;
+  }
+
+  // synthesized levels only have ARGB pixels; leave them cleared
+  if (_openslide_level_is_synthesized(osr, _openslide_get_level(osr, level))) {
+    return;
+  }
+
+  // all channels, in order
+  int32_t *all_channels = NULL;
+  if (!channels) {
+    all_channels = g_new(int32_t, count);
+    for (int32_t i = 0; i < count; i++) {
+      all_channels[i] = i;
+    }
+    channels = all_channels;
+  }
+
+  if (!osr->ops->read_native_region(osr, dest, channels, channel_count,
+                                    x, y, _openslide_get_level(osr, level), w, h,
+                                    &tmp_err)) {
+    _openslide_propagate_error(osr, tmp_err);
+    // ensure we don't return a partial result
+    memset(dest, 0, size);
+  }
+  g_free(all_channels);
+}
+
+int32_t openslide_get_plane_count(openslide_t *osr, int32_t dimension) {
+  if (openslide_get_error(osr)) {
+    return -1;
+  }
+
+  if (dimension < 0 || dimension >= _OPENSLIDE_PLANE_DIMENSIONS) {
+    return -1;
+  }
+
+  if (!osr->ops->get_plane_count) {
+    return 1;
+  }
+  return osr->ops->get_plane_count(osr, dimension);
+}
+
+void openslide_set_plane(openslide_t *osr,
+			 int32_t channel, int32_t z, int32_t time) {
+  GError *tmp_err = NULL;
+
+  if (openslide_get_error(osr)) {
+    return;
+  }
+
+  int32_t plane[_OPENSLIDE_PLANE_DIMENSIONS] = {channel, z, time};
+  for (int32_t i = 0; i < _OPENSLIDE_PLANE_DIMENSIONS; i++) {
+    if (plane[i] < 0 || plane[i] >= openslide_get_plane_count(osr, i)) {
+      tmp_err = g_error_new(OPENSLIDE_ERROR, OPENSLIDE_ERROR_FAILED,
+                            "Plane (%d, %d, %d) out of range",
+                            channel, z, time);
+      _openslide_propagate_error(osr, tmp_err);
+      return;
+    }
+  }
+
+  // without planes, the only valid plane is already selected
+  if (osr->ops->set_plane &&
+      !osr->ops->set_plane(osr, plane, &tmp_err)) {
+    _openslide_propagate_error(osr, tmp_err);
+    return;
+  }
+  memcpy(osr->plane, plane, sizeof(osr->plane));
+}
+
+openslide_cache_t *openslide_cache_create(uint64_t capacity) {
+  return _openslide_cache_create(capacity);
+}
+
+void openslide_set_cache(openslide_t *osr, openslide_cache_t *cache) {
+  if (openslide_get_error(osr)) {
+    return;
+  }
+  _openslide_cache_binding_set(osr->cache, cache);
+}
+
+openslide_cache_t *openslide_get_cache(openslide_t *osr) {
+  if (openslide_get_error(osr)) {
+    return NULL;
+  }
+  return _openslide_cache_binding_get(osr->cache);
+}
+
+void openslide_cache_set_capacity(openslide_cache_t *cache, uint64_t capacity) {
+  _openslide_cache_set_capacity(cache, capacity);
+}
+
+uint64_t openslide_cache_get_capacity(openslide_cache_t *cache) {
+  return _openslide_cache_get_capacity(cache);
+}
+
+void openslide_cache_set_compressed_capacity(openslide_cache_t *cache,
+                                             uint64_t capacity) {
+  _openslide_cache_set_compressed_capacity(cache, capacity);
+}
+
+uint64_t openslide_cache_get_compressed_capacity(openslide_cache_t *cache) {
+  return _openslide_cache_get_compressed_capacity(cache);
+}
+
+void openslide_cache_set_policy(openslide_cache_t *cache, int32_t policy) {
+  switch (policy) {
+  case OPENSLIDE_CACHE_POLICY_LRU:
+  case OPENSLIDE_CACHE_POLICY_SEGMENTED_LRU:
+    _openslide_cache_set_policy(cache, policy);
+    break;
+  }
+}
+
+int32_t openslide_cache_get_policy(openslide_cache_t *cache) {
+  return _openslide_cache_get_policy(cache);
+}
+
+void openslide_cache_get_stats(openslide_cache_t *cache,
+                               uint64_t *hits, uint64_t *misses,
+                               uint64_t *evictions, uint64_t *size) {
+  _openslide_cache_get_stats(cache, hits, misses, evictions, size);
+}
+
+void openslide_cache_release(openslide_cache_t *cache) {
+  _openslide_cache_unref(cache);
+}
+
+void openslide_set_disk_cache(const char *dir, int64_t capacity) {
+  _openslide_diskcache_set(dir, capacity);
 }
 
 const char *openslide_get_version(void) {
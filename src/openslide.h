@@ -43,6 +43,91 @@ extern "C" {
  */
 typedef struct _openslide openslide_t;
 
+/**
+ * An OpenSlide tile cache.
+ */
+typedef struct _openslide_cache openslide_cache_t;
+
+/**
+ * An asynchronous read.
+ *
+ * @since 3.5.0
+ */
+typedef struct _openslide_read openslide_read_t;
+
+/**
+ * Called on a library thread when an asynchronous read is done.
+ *
+ * @param read The finished read.
+ * @param data The data given to openslide_read_region_async().
+ * @since 3.5.0
+ */
+typedef void (*openslide_read_callback_t)(openslide_read_t *read, void *data);
+
+/**
+ * One region of a batched read.
+ *
+ * The fields have the meaning of the corresponding arguments of
+ * openslide_read_region().
+ *
+ * @since 3.5.0
+ */
+typedef struct _openslide_region_request {
+  uint32_t *dest;  ///< The destination buffer for the ARGB data.
+  int64_t x;       ///< The top left x-coordinate, in the level 0 reference frame.
+  int64_t y;       ///< The top left y-coordinate, in the level 0 reference frame.
+  int32_t level;   ///< The desired level.
+  int64_t w;       ///< The width of the region. Must be non-negative.
+  int64_t h;       ///< The height of the region. Must be non-negative.
+} openslide_region_request_t;
+
+/**
+ * A tracing event, passed to the callback set with
+ * openslide_set_trace_callback().
+ *
+ * Fields that don't apply to the event are NULL or -1.
+ *
+ * @since 3.5.0
+ */
+typedef struct _openslide_trace_event {
+  int32_t type;          ///< The event, such as #OPENSLIDE_TRACE_TILE_READ.
+  const char *filename;  ///< The file opened.
+  int32_t level;         ///< The level of the tile.
+  int64_t tile_col;      ///< The column of the tile, or its ID for slide formats without a regular tile grid.
+  int64_t tile_row;      ///< The row of the tile.
+  int64_t bytes;         ///< The number of bytes read from slide files, 0 if none.
+  const char *codec;     ///< The decoder used, such as "jpeg", or NULL if the tile was found in the cache.
+  int64_t duration;      ///< The duration of the event, in microseconds.
+} openslide_trace_event_t;
+
+/**
+ * Called on the thread that did the work when a tracing event has
+ * finished.
+ *
+ * @param event The event, valid only during the call.
+ * @param data The data given to openslide_set_trace_callback().
+ * @since 3.5.0
+ */
+typedef void (*openslide_trace_callback_t)(const openslide_trace_event_t *event,
+                                           void *data);
+
+/**
+ * Reads part of a slide file, for openslide_set_range_reader().
+ *
+ * @param filename The path of the file.
+ * @param offset The offset of the range in the file.
+ * @param buf The buffer to read into.
+ * @param len The length of the range.
+ * @param data The data given to openslide_set_range_reader().
+ * @return The number of bytes read, which is less than @p len only at the
+ *         end of the file, or -1 on error.
+ * @since 3.5.0
+ */
+typedef int64_t (*openslide_range_reader_t)(const char *filename,
+                                            int64_t offset,
+                                            void *buf, int64_t len,
+                                            void *data);
+
 
 /**
  * @name Basic Usage
@@ -89,6 +174,32 @@ OPENSLIDE_PUBLIC()
 openslide_t *openslide_open(const char *filename);
 
 
+/**
+ * Create another OpenSlide object for an open whole slide image.
+ *
+ * The new object shares the levels, properties, associated images and
+ * backend state of @p osr, so this is much cheaper than opening the slide
+ * again.  It has its own error state.  Prefetch hints and asynchronous
+ * reads also belong to each object.
+ *
+ * The new object reads the plane selected on @p osr, and
+ * openslide_set_plane() on either object afterwards selects the plane of
+ * that object only.
+ *
+ * The tile cache and the number of decode threads are shared, so
+ * openslide_set_cache() and openslide_set_decode_threads() on either
+ * object affect both of them.
+ *
+ * The objects may be closed in any order.
+ *
+ * @param osr The OpenSlide object.
+ * @return A new OpenSlide object, or NULL if @p osr is in error state.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+openslide_t *openslide_dup(openslide_t *osr);
+
+
 /**
  * Get the number of levels in the whole slide image.
  *
@@ -179,6 +290,188 @@ void openslide_read_region(openslide_t *osr,
 			   int64_t w, int64_t h);
 
 
+/**
+ * Copy pre-multiplied ARGB data from a whole slide image at any scale.
+ *
+ * This function reads a region at an arbitrary downsample, which need not
+ * be the downsample of a level.  The most detailed level needed is read
+ * and area-averaged down to the requested size, so that the caller need
+ * not read and scale the next larger level itself.  @p dest must be a
+ * valid pointer to enough memory to hold the region, at least
+ * (@p w * @p h * 4) bytes in length.  If an error occurs or has occurred,
+ * then the memory pointed to by @p dest will be cleared.
+ *
+ * @param osr The OpenSlide object.
+ * @param dest The destination buffer for the ARGB data.
+ * @param x The top left x-coordinate, in the level 0 reference frame.
+ * @param y The top left y-coordinate, in the level 0 reference frame.
+ * @param downsample The downsample of the output, relative to level 0.
+ *                   Must be positive.
+ * @param w The width of the output. Must be non-negative.
+ * @param h The height of the output. Must be non-negative.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_region_scaled(openslide_t *osr,
+				  uint32_t *dest,
+				  int64_t x, int64_t y,
+				  double downsample,
+				  int64_t w, int64_t h);
+
+
+/**
+ * Pixel format: pre-multiplied ARGB in native-endian 32-bit words, as
+ * produced by openslide_read_region().
+ * @since 3.5.0
+ */
+#define OPENSLIDE_PIXEL_FORMAT_ARGB32 0
+
+/**
+ * Pixel format: bytes R, G, B, A, not pre-multiplied.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_PIXEL_FORMAT_RGBA32 1
+
+/**
+ * Pixel format: bytes R, G, B, not pre-multiplied.  Transparent pixels
+ * are black.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_PIXEL_FORMAT_RGB24 2
+
+/**
+ * Pixel format: one byte of Rec. 601 luma, not pre-multiplied.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_PIXEL_FORMAT_GRAY8 3
+
+/**
+ * Copy data from a whole slide image in a given pixel format.
+ *
+ * This function is equivalent to openslide_read_region(), but converts
+ * the pixels to @p format while reading, a few rows at a time, and
+ * writes rows @p stride bytes apart.  If an error occurs or has occurred,
+ * then the pixels of the region will be cleared.
+ *
+ * @param osr The OpenSlide object.
+ * @param dest The destination buffer, at least (@p stride * @p h) bytes
+ *             in length.
+ * @param stride The distance between rows of @p dest, in bytes.  Must be
+ *               at least @p w times the size of a pixel.
+ * @param format The pixel format, such as #OPENSLIDE_PIXEL_FORMAT_RGB24.
+ * @param x The top left x-coordinate, in the level 0 reference frame.
+ * @param y The top left y-coordinate, in the level 0 reference frame.
+ * @param level The desired level.
+ * @param w The width of the region. Must be non-negative.
+ * @param h The height of the region. Must be non-negative.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_region_format(openslide_t *osr,
+				  void *dest,
+				  int64_t stride,
+				  int32_t format,
+				  int64_t x, int64_t y,
+				  int32_t level,
+				  int64_t w, int64_t h);
+
+
+/**
+ * Copy pre-multiplied ARGB data from many regions of a whole slide image.
+ *
+ * This function is equivalent to calling openslide_read_region() for
+ * each request, but is faster for many small regions.  The regions are
+ * read in an order that keeps tiles shared by nearby regions in the
+ * cache, so that each tile is decoded once.  If decode threads were
+ * enabled with openslide_set_decode_threads(), the regions are read by
+ * that many threads in parallel.
+ *
+ * If an error occurs or has occurred, then the memory pointed to by
+ * every @p dest will be cleared.
+ *
+ * @param osr The OpenSlide object.
+ * @param requests The regions to read.
+ * @param count The number of regions.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_regions(openslide_t *osr,
+			    const openslide_region_request_t *requests,
+			    int32_t count);
+
+
+/**
+ * Start copying pre-multiplied ARGB data from a whole slide image.
+ *
+ * This function is the non-blocking equivalent of openslide_read_region().
+ * The region is read by a small pool of threads belonging to the
+ * OpenSlide object, and @p callback is invoked from one of those threads
+ * once @p dest is filled.  The callback must not block for long; to
+ * integrate with an event loop, it can for example write to an eventfd
+ * or a pipe.  The callback may call openslide_read_release().
+ *
+ * @p dest must stay valid until the read is done.  Errors are reported
+ * as with openslide_read_region(): check openslide_get_error() once the
+ * read is done, and on failure @p dest is cleared.
+ *
+ * openslide_close() waits for outstanding reads, but every read must
+ * still be released with openslide_read_release(), before or after it
+ * is done.
+ *
+ * @param osr The OpenSlide object.
+ * @param dest The destination buffer for the ARGB data.
+ * @param x The top left x-coordinate, in the level 0 reference frame.
+ * @param y The top left y-coordinate, in the level 0 reference frame.
+ * @param level The desired level.
+ * @param w The width of the region. Must be non-negative.
+ * @param h The height of the region. Must be non-negative.
+ * @param callback A function called when the read is done, or NULL.
+ * @param data Data passed to @p callback.
+ * @return A handle for the read, or NULL if an error occurred, in which
+ *         case @p callback is not invoked.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+openslide_read_t *openslide_read_region_async(openslide_t *osr,
+					      uint32_t *dest,
+					      int64_t x, int64_t y,
+					      int32_t level,
+					      int64_t w, int64_t h,
+					      openslide_read_callback_t callback,
+					      void *data);
+
+/**
+ * Check whether an asynchronous read is done, without blocking.
+ *
+ * @param read The read.
+ * @return Non-zero if the read is done.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+int openslide_read_is_done(openslide_read_t *read);
+
+/**
+ * Wait for an asynchronous read to be done.
+ *
+ * @param read The read.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_wait(openslide_read_t *read);
+
+/**
+ * Release an asynchronous read.
+ *
+ * The read continues if it is not done, but can no longer be waited for.
+ * Its destination buffer must stay valid until it is done.
+ *
+ * @param read The read, or NULL.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_release(openslide_read_t *read);
+
+
 /**
  * Close an OpenSlide object.
  * No other threads may be using the object.
@@ -253,6 +546,12 @@ const char *openslide_get_error(openslide_t *osr);
 
 /**
  * The name of the property containing the "quickhash-1" sum.
+ *
+ * The sum is computed the first time the value of this property is
+ * requested, which rereads part of the slide.  The property is always
+ * listed by openslide_get_property_names(), but its value is NULL if the
+ * sum can't be computed, for example because the slide file has changed
+ * since it was opened.
  */
 #define OPENSLIDE_PROPERTY_NAME_QUICKHASH1 "openslide.quickhash-1"
 
@@ -359,6 +658,38 @@ const char * const *openslide_get_property_names(openslide_t *osr);
 OPENSLIDE_PUBLIC()
 const char *openslide_get_property_value(openslide_t *osr, const char *name);
 
+
+/**
+ * Compute the quickhash-1 of a slide file.
+ *
+ * The result is the value that the #OPENSLIDE_PROPERTY_NAME_QUICKHASH1
+ * property of the opened slide would have.  The slide is only opened as
+ * far as hashing requires, and nothing is set up for reading it, so this
+ * is cheaper than opening the slide and reading the property.  It may be
+ * called from several threads at once.
+ *
+ * @param filename The filename to hash.
+ * @param[out] error If not NULL and no hash is returned, set to a
+ *                   description of the reason, to be freed with
+ *                   openslide_free_string().  Otherwise set to NULL.
+ * @return The hash, to be freed with openslide_free_string(), or NULL if
+ *         the file is not a slide, the slide has no quickhash-1, or an
+ *         error occurred.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+char *openslide_compute_quickhash1(const char *filename, char **error);
+
+
+/**
+ * Free a string returned by OpenSlide.
+ *
+ * @param str The string, or NULL.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_free_string(char *str);
+
 //@}
 
 /**
@@ -422,6 +753,853 @@ OPENSLIDE_PUBLIC()
 void openslide_read_associated_image(openslide_t *osr,
 				     const char *name,
 				     uint32_t *dest);
+
+/**
+ * Get the dimensions of an associated image reduced to fit in a square.
+ *
+ * The image keeps its aspect ratio, and is never enlarged.
+ *
+ * @param osr The OpenSlide object.
+ * @param name The name of the desired associated image. Must be
+ *            a valid name as given by openslide_get_associated_image_names().
+ * @param max_dimension The largest width or height of the result.  Must be
+ *                      positive.
+ * @param[out] w The width of the reduced image, or -1 if an error occurred.
+ * @param[out] h The height of the reduced image, or -1 if an error occurred.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_get_associated_image_scaled_dimensions(openslide_t *osr,
+						      const char *name,
+						      int64_t max_dimension,
+						      int64_t *w, int64_t *h);
+
+/**
+ * Copy pre-multiplied ARGB data from an associated image reduced to fit in
+ * a square.
+ *
+ * This function is equivalent to openslide_read_associated_image(), but
+ * averages the image down to the dimensions given by
+ * openslide_get_associated_image_scaled_dimensions().  JPEG images are
+ * decoded at reduced size when possible, which is much faster than
+ * decoding them whole.  This call does nothing if an error occurred.
+ *
+ * @param osr The OpenSlide object.
+ * @param name The name of the desired associated image. Must be
+ *             a valid name as given by openslide_get_associated_image_names().
+ * @param max_dimension The largest width or height of the result.  Must be
+ *                      positive.
+ * @param dest The destination buffer for the ARGB data.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_associated_image_scaled(openslide_t *osr,
+					    const char *name,
+					    int64_t max_dimension,
+					    uint32_t *dest);
+//@}
+
+/**
+ * @name Raw Tiles
+ * Reading compressed tiles without decoding them.
+ */
+//@{
+
+/**
+ * Get the dimensions of the raw tiles of a level.
+ *
+ * Some slide formats store a level as a grid of JPEG tiles.  For these
+ * levels, openslide_read_raw_tile() returns the compressed data of a tile,
+ * so that it can be passed to a client without being decoded and encoded
+ * again.  Tile (0, 0) has its top left corner at the origin of the level,
+ * and tiles in the last row and column extend past the level.
+ *
+ * @param osr The OpenSlide object.
+ * @param level The desired level.
+ * @param[out] w The width of the tiles, or -1 if the level has no raw
+ *               tiles or an error occurred.
+ * @param[out] h The height of the tiles, or -1 if the level has no raw
+ *               tiles or an error occurred.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_get_level_raw_tile_dimensions(openslide_t *osr,
+					     int32_t level,
+					     int64_t *w, int64_t *h);
+
+/**
+ * Read a tile of a level as a self-contained JPEG.
+ *
+ * The tile is returned as it is stored in the slide, with any shared
+ * JPEG tables merged into it.  Unlike openslide_read_region(), no
+ * background color is applied, and pixels past the edge of the level
+ * are not cleared.
+ *
+ * @param osr The OpenSlide object.
+ * @param level The desired level.  Nothing is returned if it has no
+ *              raw tiles.
+ * @param tile_col The column of the tile.
+ * @param tile_row The row of the tile.
+ * @param[out] len The length of the returned data, or 0 if nothing is
+ *                 returned.
+ * @return The JPEG data, to be freed with openslide_free_raw_tile(), or
+ *         NULL if the tile has no compressed data or an error occurred.
+ *         A tile without data can still be read with
+ *         openslide_read_region().
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void *openslide_read_raw_tile(openslide_t *osr,
+			      int32_t level,
+			      int64_t tile_col, int64_t tile_row,
+			      int64_t *len);
+
+/**
+ * Free data returned by openslide_read_raw_tile().
+ *
+ * @param data The data, or NULL.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_free_raw_tile(void *data);
+//@}
+
+/**
+ * @name Native Samples
+ * Reading samples at the bit depth they are stored with.
+ */
+//@{
+
+/**
+ * Sample type: unsigned 8-bit integers.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_SAMPLE_TYPE_UINT8 0
+
+/**
+ * Sample type: unsigned 16-bit integers, in host byte order.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_SAMPLE_TYPE_UINT16 1
+
+/**
+ * Sample type: 32-bit IEEE floats, in host byte order.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_SAMPLE_TYPE_FLOAT32 2
+
+/**
+ * Get the format of the samples stored in a whole slide image.
+ *
+ * Some slide formats store more than 8 bits per channel, which
+ * openslide_read_region() rescales to 8 bits.  For these slides,
+ * openslide_read_region_native() returns the samples as they are stored.
+ * Channels are numbered in the order they are stored, which is blue,
+ * green, red for color Zeiss slides.  Zeiss slides only have native
+ * samples if their tiles are uncompressed, or compressed with JPEG XR
+ * as 8-bit BGR; slides with other compressed tiles report -1.
+ *
+ * @param osr The OpenSlide object.
+ * @param[out] sample_type The type of a sample, such as
+ *                         #OPENSLIDE_SAMPLE_TYPE_UINT16, or -1 if the
+ *                         slide has no native samples or an error
+ *                         occurred.
+ * @param[out] channels The number of channels, or -1 if the slide has no
+ *                      native samples or an error occurred.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_get_native_format(openslide_t *osr,
+				 int32_t *sample_type,
+				 int32_t *channels);
+
+/**
+ * Copy native samples of some channels from a whole slide image.
+ *
+ * The samples of each pixel are interleaved in the order of @p channels,
+ * and are neither rescaled nor converted.  Unlike openslide_read_region(),
+ * no background color is applied, and samples that no tile covers are
+ * zero.  This call does nothing if the slide has no native samples.  If
+ * an error occurs or has occurred, then the samples of the region will
+ * be cleared.
+ *
+ * @param osr The OpenSlide object.
+ * @param dest The destination buffer, at least (@p w * @p h *
+ *             @p channel_count) samples in length.
+ * @param channels The channels to read, between 0 and the channel count
+ *                 of openslide_get_native_format(), or NULL for all of
+ *                 them in order.
+ * @param channel_count The number of entries in @p channels.  Ignored if
+ *                      @p channels is NULL.
+ * @param x The top left x-coordinate, in the level 0 reference frame.
+ * @param y The top left y-coordinate, in the level 0 reference frame.
+ * @param level The desired level.
+ * @param w The width of the region. Must be non-negative.
+ * @param h The height of the region. Must be non-negative.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_read_region_native(openslide_t *osr,
+				  void *dest,
+				  const int32_t *channels,
+				  int32_t channel_count,
+				  int64_t x, int64_t y,
+				  int32_t level,
+				  int64_t w, int64_t h);
+//@}
+
+/**
+ * @name Planes
+ * Selecting a plane of a slide with several channels, Z slices or time
+ * points.
+ */
+//@{
+
+/**
+ * Plane dimension: fluorescence channels.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_PLANE_CHANNEL 0
+
+/**
+ * Plane dimension: Z slices.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_PLANE_Z 1
+
+/**
+ * Plane dimension: time points.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_PLANE_TIME 2
+
+/**
+ * Get the number of planes of a whole slide image along a dimension.
+ *
+ * @param osr The OpenSlide object.
+ * @param dimension The dimension, such as #OPENSLIDE_PLANE_Z.
+ * @return The number of planes, which is 1 if the slide format has no such
+ *         dimension, or -1 if the dimension is unknown or an error
+ *         occurred.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+int32_t openslide_get_plane_count(openslide_t *osr, int32_t dimension);
+
+/**
+ * Select the plane read by every other function of an OpenSlide object.
+ *
+ * Only the tiles of the selected plane are read.  The first plane along
+ * every dimension is selected when a slide is opened.  The plane belongs
+ * to @p osr, so handles from openslide_dup() can read different planes
+ * of the slide at the same time.  This function must not be called while
+ * other threads read from @p osr.  If a plane index is out of range, an
+ * error is set.
+ *
+ * @param osr The OpenSlide object.
+ * @param channel The channel, from 0.
+ * @param z The Z slice, from 0.
+ * @param time The time point, from 0.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_plane(openslide_t *osr,
+			 int32_t channel, int32_t z, int32_t time);
+//@}
+
+/**
+ * @name Caching
+ * Managing the tile cache.
+ */
+//@{
+
+/**
+ * Cache eviction policy: evict the least recently used tile.  This is the
+ * default.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_CACHE_POLICY_LRU 0
+
+/**
+ * Cache eviction policy: keep most of the cache for tiles used more than
+ * once, so that tiles read only once, for example while scanning a whole
+ * slide, do not evict tiles that are frequently reused.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_CACHE_POLICY_SEGMENTED_LRU 1
+
+/**
+ * Create a new tile cache, unconnected to any OpenSlide object.
+ *
+ * By default, every OpenSlide object has a private cache of a small fixed
+ * size.  A cache created with this function can be attached to one or
+ * more OpenSlide objects with openslide_set_cache().  OpenSlide objects
+ * sharing a cache compete for its capacity, and the least recently used
+ * tiles are evicted regardless of the slide they belong to.
+ *
+ * The cache must be released with openslide_cache_release() when done.
+ *
+ * @param capacity The capacity of the cache, in bytes.
+ * @return A new cache.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+openslide_cache_t *openslide_cache_create(uint64_t capacity);
+
+/**
+ * Attach a cache to an OpenSlide object.
+ *
+ * The OpenSlide object holds its own reference to the cache, so the
+ * caller may release its reference with openslide_cache_release() at any
+ * time.  Tiles cached by the OpenSlide object in its previous cache are
+ * not carried over.  This call does nothing if an error occurred.
+ *
+ * @param osr The OpenSlide object.
+ * @param cache The cache to use.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_cache(openslide_t *osr, openslide_cache_t *cache);
+
+/**
+ * Get the cache used by an OpenSlide object.
+ *
+ * This is either the private cache created by openslide_open() or the
+ * cache given to openslide_set_cache().  The returned reference must be
+ * released with openslide_cache_release().
+ *
+ * @param osr The OpenSlide object.
+ * @return The cache, or NULL if an error occurred.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+openslide_cache_t *openslide_get_cache(openslide_t *osr);
+
+/**
+ * Change the capacity of a cache.
+ *
+ * If the cache holds more than @p capacity bytes, the least recently used
+ * tiles are evicted immediately.
+ *
+ * @param cache The cache.
+ * @param capacity The new capacity of the cache, in bytes.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_cache_set_capacity(openslide_cache_t *cache, uint64_t capacity);
+
+/**
+ * Get the capacity of a cache.
+ *
+ * @param cache The cache.
+ * @return The capacity of the cache, in bytes.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+uint64_t openslide_cache_get_capacity(openslide_cache_t *cache);
+
+/**
+ * Change the capacity of the compressed tier of a cache.
+ *
+ * Besides decoded tiles, a cache can retain the compressed tile data
+ * read from the slide, which is typically much smaller.  A tile evicted
+ * from the decoded tiles can then be decoded again without rereading
+ * the slide file.  Not every slide format uses the compressed tier.
+ *
+ * The compressed tier of a cache created with openslide_cache_create()
+ * is disabled, with a capacity of 0.  The capacity is separate from the
+ * one set with openslide_cache_set_capacity().
+ *
+ * @param cache The cache.
+ * @param capacity The new capacity of the compressed tier, in bytes.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_cache_set_compressed_capacity(openslide_cache_t *cache,
+                                             uint64_t capacity);
+
+/**
+ * Get the capacity of the compressed tier of a cache.
+ *
+ * @param cache The cache.
+ * @return The capacity of the compressed tier, in bytes.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+uint64_t openslide_cache_get_compressed_capacity(openslide_cache_t *cache);
+
+/**
+ * Change the eviction policy of a cache.
+ *
+ * Tiles already in the cache are kept.  Unknown policies are ignored.
+ *
+ * @param cache The cache.
+ * @param policy The new policy, such as #OPENSLIDE_CACHE_POLICY_LRU or
+ *               #OPENSLIDE_CACHE_POLICY_SEGMENTED_LRU.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_cache_set_policy(openslide_cache_t *cache, int32_t policy);
+
+/**
+ * Get the eviction policy of a cache.
+ *
+ * @param cache The cache.
+ * @return The policy of the cache.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+int32_t openslide_cache_get_policy(openslide_cache_t *cache);
+
+/**
+ * Get usage statistics of a cache.
+ *
+ * Counters are cumulative since the creation of the cache.
+ *
+ * @param cache The cache.
+ * @param[out] hits The number of lookups that found a tile.
+ * @param[out] misses The number of lookups that did not find a tile.
+ * @param[out] evictions The number of tiles evicted to make room.
+ * @param[out] size The number of bytes currently held by the cache.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_cache_get_stats(openslide_cache_t *cache,
+                               uint64_t *hits, uint64_t *misses,
+                               uint64_t *evictions, uint64_t *size);
+
+/**
+ * Release a cache.
+ *
+ * The cache is freed once it is no longer used by any OpenSlide object.
+ *
+ * @param cache The cache to release.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_cache_release(openslide_cache_t *cache);
+
+/**
+ * Keep decoded tiles in a directory, in addition to the tile caches.
+ *
+ * Tiles missing from a tile cache are looked for in the directory before
+ * they are decoded, and decoded tiles are saved there.  The directory can
+ * be shared by any number of processes, and keeps its contents across
+ * restarts, so it is best placed on fast local storage or in shared
+ * memory, such as /dev/shm.  Tiles are compressed losslessly.
+ *
+ * Slides are identified by path, size and modification time.  A slide
+ * made of several files is assumed not to change unless its main file
+ * does.  When more than @p capacity bytes are in the directory, the
+ * least recently used tiles are deleted; the directory can exceed the
+ * capacity briefly.  Only tiles of the levels stored in the slide are
+ * kept, not those of synthesized levels.
+ *
+ * The disk cache is disabled by default.  This setting is process-wide,
+ * and applies to slides opened afterward.
+ *
+ * @param dir The directory, created if needed, or NULL to disable the
+ *            disk cache.
+ * @param capacity The capacity of the directory, in bytes.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_disk_cache(const char *dir, int64_t capacity);
+
+/**
+ * Read a region into the cache in the background.
+ *
+ * This function returns immediately.  The tiles needed to read the region
+ * are then read and decoded into the cache by background threads, so that
+ * a later openslide_read_region() of the same region is fast.  Background
+ * reads pause while openslide_read_region() is running on the same
+ * OpenSlide object, and the most recent hints are served first.
+ *
+ * Failures of background reads are not reported.
+ *
+ * @param osr The OpenSlide object.
+ * @param x The top left x-coordinate, in the level 0 reference frame.
+ * @param y The top left y-coordinate, in the level 0 reference frame.
+ * @param level The desired level.
+ * @param w The width of the region. Must be non-negative.
+ * @param h The height of the region. Must be non-negative.
+ * @return An identifier for openslide_cancel_prefetch_hint(), or -1 if
+ *         an error occurred or the level was out of range.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+int openslide_give_prefetch_hint(openslide_t *osr,
+				 int64_t x, int64_t y,
+				 int32_t level,
+				 int64_t w, int64_t h);
+
+/**
+ * Cancel a background read.
+ *
+ * Tiles already read stay in the cache.  Unknown or finished identifiers
+ * are ignored.
+ *
+ * @param osr The OpenSlide object.
+ * @param prefetch_id An identifier returned by
+ *                    openslide_give_prefetch_hint().
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_cancel_prefetch_hint(openslide_t *osr, int prefetch_id);
+
+/**
+ * Preload the lowest-resolution levels of slides opened later.
+ *
+ * The first view of a slide usually shows its smallest level.  With warm
+ * start, openslide_open() begins reading the smallest levels, up to
+ * three levels and 16 million pixels, on a background thread before it
+ * returns.  Their tiles are pinned: they are kept in addition to the
+ * tile cache's capacity, and are never evicted while the slide is open,
+ * even if openslide_set_cache() switches caches.  Like other background
+ * reads, preloading pauses while openslide_read_region() is running, and
+ * its failures are not reported.
+ *
+ * Warm start is disabled by default.  This setting is process-wide, and
+ * doesn't change slides that are already open.
+ *
+ * @param enabled Whether to preload the smallest levels.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_warm_start(bool enabled);
+
+/**
+ * Decode tiles in parallel.
+ *
+ * By default, openslide_read_region() decodes the tiles of a region one
+ * after the other on the calling thread.  With two or more decode threads,
+ * tiles missing from the cache are decoded by a thread pool shared by all
+ * OpenSlide objects, then painted on the calling thread.  The shared pool
+ * grows to the largest number of threads requested.
+ *
+ * Regions too large for the cache, and slides in formats whose tiles
+ * cannot be decoded concurrently, are still decoded sequentially.
+ * JPEG 2000 tiles decoded on the calling thread may also use this many
+ * threads within the tile, if OpenSlide was built with OpenJPEG 2.2 or
+ * later.
+ *
+ * @param osr The OpenSlide object.
+ * @param threads The number of decode threads, or 0 to decode
+ *                sequentially.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_decode_threads(openslide_t *osr, int32_t threads);
+
+/**
+ * Set whether an OpenSlide object is used to read the whole slide once,
+ * in order.
+ *
+ * Passes over the whole slide, such as exporting a pyramid or tiling it
+ * for analysis, rarely read a tile twice.  In scan mode, tiles decoded
+ * for this object are not added to the cache, so they don't evict the
+ * tiles of interactive readers, and the operating system is asked to read
+ * ahead of each file read.  Only the object it is set on is affected,
+ * so a scan can run on a handle from openslide_dup().
+ *
+ * A tile shared by two regions is decoded twice in scan mode, so scans
+ * should read regions aligned to the tile size given by the
+ * openslide.level[N].tile-width and openslide.level[N].tile-height
+ * properties.
+ *
+ * @param osr The OpenSlide object.
+ * @param scan Whether to enable scan mode.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_scan_mode(openslide_t *osr, bool scan);
+
+//@}
+
+/**
+ * @name Statistics
+ * Counters and timers describing where the time of region reads is spent.
+ *
+ * Each OpenSlide object, including each openslide_dup() handle, collects
+ * its own statistics.  They cover the reads, such as
+ * openslide_read_region(), made through that object, including work done
+ * for them by decode threads; background reads from prefetch hints are
+ * not counted.  Times are in microseconds and are exclusive: for example,
+ * the time spent reading compressed data while decoding a tile counts
+ * towards #OPENSLIDE_STAT_READ_TIME rather than the decode time.  When
+ * tiles are decoded in parallel, times from all threads are added up.
+ */
+//@{
+
+/**
+ * Statistic: the number of region reads.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_STAT_READS 0
+
+/**
+ * Statistic: the number of bytes read from slide files.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_STAT_BYTES_READ 1
+
+/**
+ * Statistic: the time spent reading slide files.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_STAT_READ_TIME 2
+
+/**
+ * Statistic: the time spent decoding JPEG tiles.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_STAT_DECODE_TIME_JPEG 3
+
+/**
+ * Statistic: the time spent decoding JPEG 2000 tiles.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_STAT_DECODE_TIME_JPEG2000 4
+
+/**
+ * Statistic: the time spent decoding PNG tiles.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_STAT_DECODE_TIME_PNG 5
+
+/**
+ * Statistic: the time spent decoding BMP tiles.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_STAT_DECODE_TIME_BMP 6
+
+/**
+ * Statistic: the time spent decoding JPEG XR tiles.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_STAT_DECODE_TIME_JPEGXR 7
+
+/**
+ * Statistic: the time spent decoding TIFF tiles with LibTIFF.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_STAT_DECODE_TIME_TIFF 8
+
+/**
+ * Statistic: the time spent decoding tiles in other formats.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_STAT_DECODE_TIME_OTHER 9
+
+/**
+ * Statistic: the time spent converting and scaling pixels, for example
+ * for openslide_read_region_format() and openslide_read_region_scaled().
+ * @since 3.5.0
+ */
+#define OPENSLIDE_STAT_CONVERT_TIME 10
+
+/**
+ * Statistic: the time spent painting tiles into the region, and
+ * everything else not counted by another timer.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_STAT_COMPOSITE_TIME 11
+
+/**
+ * Statistic: the number of tiles found in the cache.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_STAT_CACHE_HITS 12
+
+/**
+ * Statistic: the number of tiles not found in the cache.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_STAT_CACHE_MISSES 13
+
+/**
+ * Statistic: the number of tiles missing from the cache that were found
+ * in the disk cache.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_STAT_DISK_CACHE_HITS 14
+
+/**
+ * Get a statistic of an OpenSlide object.
+ *
+ * Statistics are cumulative since the object was opened, or since the
+ * last call to openslide_reset_stats().
+ *
+ * @param osr The OpenSlide object.
+ * @param stat The statistic, such as #OPENSLIDE_STAT_BYTES_READ.
+ * @return The value of the statistic, or -1 if an error occurred or the
+ *         statistic is unknown.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+int64_t openslide_get_stat(openslide_t *osr, int32_t stat);
+
+/**
+ * Reset the statistics of an OpenSlide object to zero.
+ *
+ * @param osr The OpenSlide object.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_reset_stats(openslide_t *osr);
+
+//@}
+
+/**
+ * @name Tracing
+ * Reporting individual file opens and tile reads, for example to
+ * correlate slow requests with the tiles they read.
+ */
+//@{
+
+/**
+ * Tracing event: a file was opened.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_TRACE_FILE_OPEN 0
+
+/**
+ * Tracing event: a tile was fetched, decoded if it was not in the cache,
+ * and painted into a region.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_TRACE_TILE_READ 1
+
+/**
+ * Tracing event: a tile was fetched and decoded into the cache by a
+ * decode thread, to be painted later.
+ * @since 3.5.0
+ */
+#define OPENSLIDE_TRACE_TILE_DECODE 2
+
+/**
+ * Set a callback to receive tracing events from all OpenSlide objects.
+ *
+ * Tracing is disabled by default, and costs nearly nothing until a
+ * callback is set.  The callback is called on library threads as well as
+ * the caller's, and must be thread safe.  It must not call back into
+ * OpenSlide.
+ *
+ * @param callback The callback, or NULL to disable tracing.
+ * @param data Data passed to the callback.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_trace_callback(openslide_trace_callback_t callback,
+                                  void *data);
+
+//@}
+
+/**
+ * @name Ranged I/O
+ * Reading tile data for slides on slow storage, such as object storage
+ * mounted with FUSE, where each small read is expensive.
+ *
+ * Tile data of TIFF-based slide formats and JPEG tiles of MIRAX slides
+ * are read as byte ranges of the slide files.  These reads can go through
+ * a block cache shared by all OpenSlide objects: a read missing from the
+ * cache fetches all of its missing blocks, and some following ones, in
+ * a single request, and concurrent reads of the same blocks wait for one
+ * fetch.  The ranges can also be fetched by a caller-supplied reader.
+ * Slide metadata and the remaining formats are still read directly, so
+ * the files must be accessible at their paths either way.
+ *
+ * The block cache assumes that slide files don't change while they are
+ * cached.
+ */
+//@{
+
+/**
+ * Set the size of the block cache for ranged reads.
+ *
+ * The block cache is disabled by default.  Setting a smaller size evicts
+ * blocks right away.  This setting is process-wide.
+ *
+ * @param capacity The capacity of the cache in bytes, or 0 to disable it.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_block_cache_capacity(int64_t capacity);
+
+/**
+ * Fetch the byte ranges of slide files with a custom reader.
+ *
+ * The reader is called on library threads as well as the caller's, and
+ * must be thread safe.  This setting is process-wide, and should be made
+ * before any slides are opened.
+ *
+ * @param reader The reader, or NULL to read the files directly.
+ * @param data Data passed to the reader.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_range_reader(openslide_range_reader_t reader, void *data);
+
+//@}
+
+/**
+ * @name Synthesized Levels
+ * Extra pyramid levels for slides whose levels are few or far apart.
+ *
+ * Some slides have only a full-resolution level, or levels that differ
+ * in size by a factor of 16 or more.  Low-resolution reads of them decode
+ * a great many tiles.  OpenSlide can add levels between such levels, and
+ * after the smallest one, each 4 times smaller than the next larger
+ * level.  Their tiles are built from that level when first read, and
+ * kept in the tile cache like any other tiles, but not in the disk cache
+ * set with openslide_set_disk_cache().
+ *
+ * Synthesized levels are listed by openslide_get_level_count() and the
+ * level properties like the slide's own levels, but have no raw tiles
+ * and no native samples.  For Aperio slides compressed with JPEG 2000,
+ * the added levels are instead decoded from the next larger level at
+ * reduced resolution.
+ */
+//@{
+
+/**
+ * Synthesize levels for slides opened later.
+ *
+ * Synthesized levels are disabled by default.  This setting is
+ * process-wide, and doesn't change slides that are already open.
+ *
+ * @param enabled Whether to synthesize levels.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_synthesized_levels(bool enabled);
+
+//@}
+
+/**
+ * @name Tile Snapping
+ * Faster reads of slides with fractional tile positions.
+ *
+ * The tiles of Ventana slides are placed at fractional pixel positions,
+ * so openslide_read_region() resamples every tile it paints.  OpenSlide
+ * can instead paint each tile at the nearest whole pixel, which is much
+ * faster, but moves tiles by up to half a pixel.
+ */
+//@{
+
+/**
+ * Snap tiles to whole pixels in slides opened later.
+ *
+ * Tile snapping is disabled by default, so tiles are painted at their
+ * exact positions.  This setting is process-wide, and doesn't change
+ * slides that are already open.
+ *
+ * @param enabled Whether to snap tiles to whole pixels.
+ * @since 3.5.0
+ */
+OPENSLIDE_PUBLIC()
+void openslide_set_tile_snapping(bool enabled);
+
 //@}
 
 /**
@@ -559,16 +1737,6 @@ const char *openslide_get_comment(openslide_t *osr);
 
 //@}
 
-#ifndef OPENSLIDE_SIMPLIFY_HEADERS
-// these are meant to throw compile- and link-time errors,
-// since the functions they replace were never implemented
-int _openslide_give_prefetch_hint_UNIMPLEMENTED(void);
-void _openslide_cancel_prefetch_hint_UNIMPLEMENTED(void);
-#define openslide_give_prefetch_hint(osr, x, y, level, w, h)	\
-  _openslide_give_prefetch_hint_UNIMPLEMENTED(-1);
-#define openslide_cancel_prefetch_hint(osr, prefetch_id)	\
-  _openslide_cancel_prefetch_hint_UNIMPLEMENTED(-1)
-#endif
 
 /**
  * @mainpage OpenSlide
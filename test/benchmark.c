@@ -0,0 +1,362 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2007-2015 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Run named read workloads against a slide, and report throughput,
+// latency and cache hit rates as JSON.  Each workload runs twice with the
+// same reads: once with an empty cache, then again with the cache it
+// left behind.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <glib.h>
+#include <openslide.h>
+#include "openslide-common.h"
+
+// fixed, so runs are comparable
+#define SEED 42
+#define CACHE_SIZE (256 << 20)
+
+#define SEQUENTIAL_SIZE 1000
+#define SEQUENTIAL_MAX_READS 1000
+#define VIEWPORT_WIDTH 1024
+#define VIEWPORT_HEIGHT 768
+#define PAN_SESSIONS 10
+#define PAN_STEPS 50
+#define ZOOM_SESSIONS 20
+#define DEEPZOOM_TILE_SIZE 254
+#define DEEPZOOM_OVERLAP 1
+#define DEEPZOOM_READS 500
+#define PATCH_SIZE 256
+#define PATCH_READS 500
+
+struct read {
+  int64_t x;
+  int64_t y;
+  int32_t level;
+  int64_t w;
+  int64_t h;
+};
+
+struct bounds {
+  int64_t x;
+  int64_t y;
+  int64_t w;
+  int64_t h;
+};
+
+struct workload {
+  const char *name;
+  void (*make_reads)(openslide_t *osr, const struct bounds *b,
+                     GRand *rand, GArray *reads);
+};
+
+static void add_read(GArray *reads, int64_t x, int64_t y, int32_t level,
+                     int64_t w, int64_t h) {
+  struct read r = { x, y, level, w, h };
+  g_array_append_val(reads, r);
+}
+
+// a random point in the bounds, in level 0 coordinates
+static void random_point(const struct bounds *b, GRand *rand,
+                         int64_t *x, int64_t *y) {
+  *x = b->x + (int64_t) (g_rand_double(rand) * b->w);
+  *y = b->y + (int64_t) (g_rand_double(rand) * b->h);
+}
+
+// a level-sized read centered on a level 0 point
+static void add_centered_read(openslide_t *osr, GArray *reads,
+                              int64_t x, int64_t y, int32_t level,
+                              int64_t w, int64_t h) {
+  double ds = openslide_get_level_downsample(osr, level);
+  add_read(reads, x - w / 2 * ds, y - h / 2 * ds, level, w, h);
+}
+
+static void make_sequential(openslide_t *osr G_GNUC_UNUSED,
+                            const struct bounds *b,
+                            GRand *rand G_GNUC_UNUSED, GArray *reads) {
+  const int64_t d = SEQUENTIAL_SIZE;
+  for (int64_t y = 0; y < b->h; y += d) {
+    for (int64_t x = 0; x < b->w; x += d) {
+      if (reads->len == SEQUENTIAL_MAX_READS) {
+        return;
+      }
+      add_read(reads, b->x + x, b->y + y, 0,
+               MIN(d, b->w - x), MIN(d, b->h - y));
+    }
+  }
+}
+
+// a viewer panning around at one zoom level
+static void make_pan(openslide_t *osr, const struct bounds *b,
+                     GRand *rand, GArray *reads) {
+  int32_t levels = openslide_get_level_count(osr);
+  for (int i = 0; i < PAN_SESSIONS; i++) {
+    int32_t level = g_rand_int_range(rand, 0, levels);
+    double ds = openslide_get_level_downsample(osr, level);
+    int64_t x, y;
+    random_point(b, rand, &x, &y);
+    for (int j = 0; j < PAN_STEPS; j++) {
+      add_centered_read(osr, reads, x, y, level,
+                        VIEWPORT_WIDTH, VIEWPORT_HEIGHT);
+      // move by up to a quarter of the viewport, staying in the bounds
+      x += g_rand_int_range(rand, -VIEWPORT_WIDTH / 4,
+                            VIEWPORT_WIDTH / 4 + 1) * ds;
+      y += g_rand_int_range(rand, -VIEWPORT_HEIGHT / 4,
+                            VIEWPORT_HEIGHT / 4 + 1) * ds;
+      x = CLAMP(x, b->x, b->x + b->w - 1);
+      y = CLAMP(y, b->y, b->y + b->h - 1);
+    }
+  }
+}
+
+// a viewer zooming all the way in on a point, then back out
+static void make_zoom(openslide_t *osr, const struct bounds *b,
+                      GRand *rand, GArray *reads) {
+  int32_t levels = openslide_get_level_count(osr);
+  for (int i = 0; i < ZOOM_SESSIONS; i++) {
+    int64_t x, y;
+    random_point(b, rand, &x, &y);
+    for (int32_t level = levels - 1; level > 0; level--) {
+      add_centered_read(osr, reads, x, y, level,
+                        VIEWPORT_WIDTH, VIEWPORT_HEIGHT);
+    }
+    for (int32_t level = 0; level < levels; level++) {
+      add_centered_read(osr, reads, x, y, level,
+                        VIEWPORT_WIDTH, VIEWPORT_HEIGHT);
+    }
+  }
+}
+
+// Deep Zoom tiles with overlap, as a tile server would read them
+static void make_deepzoom(openslide_t *osr, const struct bounds *b,
+                          GRand *rand, GArray *reads) {
+  const int64_t ts = DEEPZOOM_TILE_SIZE;
+  const int64_t overlap = DEEPZOOM_OVERLAP;
+  int32_t levels = openslide_get_level_count(osr);
+  for (int i = 0; i < DEEPZOOM_READS; i++) {
+    int32_t level = g_rand_int_range(rand, 0, levels);
+    double ds = openslide_get_level_downsample(osr, level);
+    int64_t cols = MAX(b->w / ds / ts, 1);
+    int64_t rows = MAX(b->h / ds / ts, 1);
+    int64_t col = g_rand_double(rand) * cols;
+    int64_t row = g_rand_double(rand) * rows;
+    int64_t x = col * ts - (col ? overlap : 0);
+    int64_t y = row * ts - (row ? overlap : 0);
+    add_read(reads, b->x + x * ds, b->y + y * ds, level,
+             ts + (col ? overlap : 0) + overlap,
+             ts + (row ? overlap : 0) + overlap);
+  }
+}
+
+// uniformly sampled training patches
+static void make_patches(openslide_t *osr G_GNUC_UNUSED,
+                         const struct bounds *b,
+                         GRand *rand, GArray *reads) {
+  for (int i = 0; i < PATCH_READS; i++) {
+    int64_t x = b->x + g_rand_double(rand) * MAX(b->w - PATCH_SIZE, 1);
+    int64_t y = b->y + g_rand_double(rand) * MAX(b->h - PATCH_SIZE, 1);
+    add_read(reads, x, y, 0, PATCH_SIZE, PATCH_SIZE);
+  }
+}
+
+static const struct workload workloads[] = {
+  {"sequential", make_sequential},
+  {"pan", make_pan},
+  {"zoom", make_zoom},
+  {"deepzoom", make_deepzoom},
+  {"patches", make_patches},
+};
+
+// the active region, if denoted, else all of level 0
+static void get_bounds(openslide_t *osr, struct bounds *b) {
+  const char *bounds_x = openslide_get_property_value(osr, OPENSLIDE_PROPERTY_NAME_BOUNDS_X);
+  const char *bounds_y = openslide_get_property_value(osr, OPENSLIDE_PROPERTY_NAME_BOUNDS_Y);
+  const char *bounds_w = openslide_get_property_value(osr, OPENSLIDE_PROPERTY_NAME_BOUNDS_WIDTH);
+  const char *bounds_h = openslide_get_property_value(osr, OPENSLIDE_PROPERTY_NAME_BOUNDS_HEIGHT);
+  b->x = 0;
+  b->y = 0;
+  openslide_get_level0_dimensions(osr, &b->w, &b->h);
+  if (bounds_x && bounds_y) {
+    b->x = g_ascii_strtoll(bounds_x, NULL, 10);
+    b->y = g_ascii_strtoll(bounds_y, NULL, 10);
+  }
+  if (bounds_w && bounds_h) {
+    b->w = g_ascii_strtoll(bounds_w, NULL, 10);
+    b->h = g_ascii_strtoll(bounds_h, NULL, 10);
+  }
+}
+
+static void print_json_string(const char *str) {
+  putchar('"');
+  for (const char *p = str; *p; p++) {
+    if (*p == '"' || *p == '\\') {
+      printf("\\%c", *p);
+    } else if ((unsigned char) *p < 0x20) {
+      printf("\\u%04x", *p);
+    } else {
+      putchar(*p);
+    }
+  }
+  putchar('"');
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double da = *(const double *) a;
+  double db = *(const double *) b;
+  return (da > db) - (da < db);
+}
+
+static double percentile(const double *sorted, int count, double p) {
+  int i = count * p;
+  return sorted[MIN(i, count - 1)];
+}
+
+static void run_pass(openslide_t *osr, const char *name, const char *cache,
+                     GArray *reads, bool first) {
+  openslide_cache_t *c = openslide_get_cache(osr);
+  uint64_t hits0, misses0, evictions, size;
+  openslide_cache_get_stats(c, &hits0, &misses0, &evictions, &size);
+
+  int64_t max_pixels = 0;
+  for (guint i = 0; i < reads->len; i++) {
+    struct read *r = &g_array_index(reads, struct read, i);
+    max_pixels = MAX(max_pixels, r->w * r->h);
+  }
+  uint32_t *buf = g_new(uint32_t, max_pixels);
+  double *latencies = g_new(double, reads->len);
+
+  GTimer *total = g_timer_new();
+  GTimer *timer = g_timer_new();
+  int64_t pixels = 0;
+  for (guint i = 0; i < reads->len; i++) {
+    struct read *r = &g_array_index(reads, struct read, i);
+    g_timer_start(timer);
+    openslide_read_region(osr, buf, r->x, r->y, r->level, r->w, r->h);
+    latencies[i] = g_timer_elapsed(timer, NULL);
+    pixels += r->w * r->h;
+  }
+  double elapsed = g_timer_elapsed(total, NULL);
+  g_timer_destroy(timer);
+  g_timer_destroy(total);
+
+  const char *err = openslide_get_error(osr);
+  if (err) {
+    common_fail("Read failed: %s", err);
+  }
+
+  uint64_t hits, misses;
+  openslide_cache_get_stats(c, &hits, &misses, &evictions, &size);
+  openslide_cache_release(c);
+  hits -= hits0;
+  misses -= misses0;
+
+  qsort(latencies, reads->len, sizeof(*latencies), compare_doubles);
+  int count = reads->len;
+
+  printf("%s    {\"workload\": \"%s\", \"cache\": \"%s\", "
+         "\"reads\": %d, \"seconds\": %.6f, "
+         "\"reads_per_second\": %.2f, \"megapixels_per_second\": %.2f, "
+         "\"p50_ms\": %.3f, \"p99_ms\": %.3f, "
+         "\"cache_hits\": %"PRIu64", \"cache_misses\": %"PRIu64", "
+         "\"cache_hit_rate\": %.4f}",
+         first ? "" : ",\n", name, cache,
+         count, elapsed,
+         count / elapsed, pixels / elapsed / 1e6,
+         count ? percentile(latencies, count, 0.5) * 1000 : 0,
+         count ? percentile(latencies, count, 0.99) * 1000 : 0,
+         hits, misses,
+         hits + misses ? (double) hits / (hits + misses) : 0);
+  fflush(stdout);
+
+  g_free(latencies);
+  g_free(buf);
+}
+
+int main(int argc, char **argv) {
+  common_fix_argv(&argc, &argv);
+  if (argc < 2) {
+    common_fail("Usage: %s <slide> [workload...]", argv[0]);
+  }
+  const char *path = argv[1];
+
+  // check workload names before doing anything
+  for (int i = 2; i < argc; i++) {
+    bool found = false;
+    for (unsigned j = 0; j < G_N_ELEMENTS(workloads); j++) {
+      found |= !strcmp(argv[i], workloads[j].name);
+    }
+    if (!found) {
+      common_fail("Unknown workload: %s", argv[i]);
+    }
+  }
+
+  openslide_t *osr = openslide_open(path);
+  if (!osr) {
+    common_fail("Couldn't open %s", path);
+  }
+  const char *err = openslide_get_error(osr);
+  if (err) {
+    common_fail("Open failed: %s", err);
+  }
+
+  struct bounds b;
+  get_bounds(osr, &b);
+
+  printf("{\n  \"slide\": ");
+  print_json_string(path);
+  printf(",\n  \"vendor\": ");
+  print_json_string(openslide_get_property_value(osr,
+                                                 OPENSLIDE_PROPERTY_NAME_VENDOR));
+  printf(",\n  \"results\": [\n");
+
+  bool first = true;
+  for (unsigned i = 0; i < G_N_ELEMENTS(workloads); i++) {
+    const struct workload *w = &workloads[i];
+    bool selected = argc == 2;
+    for (int j = 2; j < argc; j++) {
+      selected |= !strcmp(argv[j], w->name);
+    }
+    if (!selected) {
+      continue;
+    }
+
+    GRand *rand = g_rand_new_with_seed(SEED);
+    GArray *reads = g_array_new(FALSE, FALSE, sizeof(struct read));
+    w->make_reads(osr, &b, rand, reads);
+    g_rand_free(rand);
+
+    // start from an empty cache, then rerun with what it kept
+    openslide_cache_t *cache = openslide_cache_create(CACHE_SIZE);
+    openslide_set_cache(osr, cache);
+    openslide_cache_release(cache);
+    run_pass(osr, w->name, "cold", reads, first);
+    run_pass(osr, w->name, "warm", reads, false);
+    first = false;
+
+    g_array_free(reads, TRUE);
+  }
+  printf("\n  ]\n}\n");
+
+  openslide_close(osr);
+  return 0;
+}
@@ -1,7 +1,7 @@
 /*
  *  OpenSlide, a library for reading whole slide image files
  *
- *  Copyright (c) 2012 Carnegie Mellon University
+ *  Copyright (c) 2012-2015 Carnegie Mellon University
  *  All rights reserved.
  *
  *  OpenSlide is free software: you can redistribute it and/or modify
@@ -19,12 +19,15 @@
  *
  */
 
-/* Read the entirety of slide level 0, using the specified number of threads,
-   and report the runtime. */
+/* Read the entirety of a slide level with 1, 2, 4, ... threads up to the
+   specified count, and report how throughput scales.  Threads share one
+   OpenSlide handle, or each open their own. */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
 #include <glib.h>
 #include <openslide.h>
 #include "openslide-common.h"
@@ -32,11 +35,17 @@
 #define TILE_SIZE 512
 
 struct state {
-  openslide_t *osr;
+  openslide_t **handles;  // one per thread, possibly all the same
+  int32_t level;
   GAsyncQueue *jobs;
   GAsyncQueue *completions;
 };
 
+struct thread_data {
+  struct state *state;
+  openslide_t *osr;
+};
+
 struct tile {
   int64_t x;
   int64_t y;
@@ -45,7 +54,8 @@ struct tile {
 static struct tile sentinel;
 
 static void *thread_func(void *data) {
-  struct state *state = data;
+  struct thread_data *td = data;
+  struct state *state = td->state;
   struct tile *tile;	
   uint32_t bufsz = TILE_SIZE * TILE_SIZE * sizeof(uint32_t);
   uint32_t *buf = g_slice_alloc(bufsz);
@@ -56,8 +66,8 @@ static void *thread_func(void *data) {
     if (tile == &sentinel) {
       break;
     }
-    openslide_read_region(state->osr, buf, tile->x, tile->y, 0, TILE_SIZE,
-                          TILE_SIZE);
+    openslide_read_region(td->osr, buf, tile->x, tile->y, state->level,
+                          TILE_SIZE, TILE_SIZE);
     g_async_queue_push(state->completions, tile);
   }
   g_async_queue_push(state->completions, &sentinel);
@@ -65,41 +75,41 @@ static void *thread_func(void *data) {
   return NULL;
 }
 
-int main(int argc, char **argv) {
-  struct state state;
-
-  common_fix_argv(&argc, &argv);
-  if (argc != 3) {
-    printf("Usage: %s <file> <threads>\n", argv[0]);
-    return 2;
+static openslide_t *open_slide(const char *path) {
+  openslide_t *osr = openslide_open(path);
+  if (!osr) {
+    common_fail("Unrecognized file");
   }
-
-  int threads = atoi(argv[2]);
-  if (threads < 1) {
-    printf("Invalid thread count\n");
-    return 1;
+  const char *error = openslide_get_error(osr);
+  if (error) {
+    common_fail("%s", error);
   }
+  return osr;
+}
 
-  // open file
-  state.osr = openslide_open(argv[1]);
-  if (!state.osr) {
-    printf("Unrecognized file\n");
-    return 1;
-  }
-  const char *error = openslide_get_error(state.osr);
-  if (error) {
-    printf("%s\n", error);
-    openslide_close(state.osr);
-    return 1;
+// read the level with the given number of threads; returns seconds
+static double run(const char *path, int32_t level, int threads,
+                  bool separate, int64_t *tiles_OUT) {
+  struct state state = {
+    .handles = g_new(openslide_t *, threads),
+    .level = level,
+  };
+
+  // fresh handles, so every run starts with empty caches and pools
+  for (int i = 0; i < threads; i++) {
+    state.handles[i] = (separate || i == 0) ? open_slide(path)
+                                            : state.handles[0];
   }
 
   // start threads
   state.jobs = g_async_queue_new();
   state.completions = g_async_queue_new();
+  struct thread_data *td = g_new(struct thread_data, threads);
   for (int i = 0; i < threads; i++) {
-    if (g_thread_create(thread_func, &state, FALSE, NULL) == NULL) {
-      printf("Couldn't start thread\n");
-      return 1;
+    td[i].state = &state;
+    td[i].osr = state.handles[i];
+    if (g_thread_create(thread_func, &td[i], FALSE, NULL) == NULL) {
+      common_fail("Couldn't start thread");
     }
   }
 
@@ -111,8 +121,10 @@ int main(int argc, char **argv) {
   // enqueue jobs
   struct tile *tile;
   int priming = 5 * threads;
+  int64_t tiles = 0;
   int64_t w, h;
-  openslide_get_level0_dimensions(state.osr, &w, &h);
+  openslide_get_level_dimensions(state.handles[0], level, &w, &h);
+  double ds = openslide_get_level_downsample(state.handles[0], level);
   GTimer *timer = g_timer_new();
   for (int64_t y = 0; y < h; y += TILE_SIZE) {
     for (int64_t x = 0; x < w; x += TILE_SIZE) {
@@ -122,9 +134,10 @@ int main(int argc, char **argv) {
       } else {
         tile = g_async_queue_pop(state.completions);
       }
-      tile->x = x;
-      tile->y = y;
+      tile->x = x * ds;
+      tile->y = y * ds;
       g_async_queue_push(state.jobs, tile);
+      tiles++;
     }
   }
 
@@ -134,30 +147,87 @@ int main(int argc, char **argv) {
   }
 
   // wait for threads
-  while (threads > 0) {
+  int running = threads;
+  while (running > 0) {
     tile = g_async_queue_pop(state.completions);
     if (tile == &sentinel) {
-      threads--;
+      running--;
     } else {
       g_slice_free(struct tile, tile);
     }
   }
+  double seconds = g_timer_elapsed(timer, NULL);
+  g_timer_destroy(timer);
 
-  // print error or time
-  error = openslide_get_error(state.osr);
-  if (error) {
-    printf("%s\n", error);
-  } else {
-    double seconds = g_timer_elapsed(timer, NULL);
-    int tiles = (w + TILE_SIZE - 1) * (h + TILE_SIZE - 1) /
-                (TILE_SIZE * TILE_SIZE);
-    printf("%d tiles in %g seconds -> %g tiles/sec\n", tiles, seconds,
-           tiles / seconds);
+  // check for errors and clean up
+  for (int i = 0; i < threads; i++) {
+    if (separate || i == 0) {
+      const char *error = openslide_get_error(state.handles[i]);
+      if (error) {
+        common_fail("%s", error);
+      }
+      openslide_close(state.handles[i]);
+    }
   }
-
-  // clean up
-  openslide_close(state.osr);
   g_async_queue_unref(state.jobs);
   g_async_queue_unref(state.completions);
+  g_free(td);
+  g_free(state.handles);
+
+  *tiles_OUT = tiles;
+  return seconds;
+}
+
+int main(int argc, char **argv) {
+  common_fix_argv(&argc, &argv);
+  if (argc < 3 || argc > 5) {
+    printf("Usage: %s <file> <max-threads> [level [shared|separate]]\n",
+           argv[0]);
+    return 2;
+  }
+  const char *path = argv[1];
+
+  int max_threads = atoi(argv[2]);
+  if (max_threads < 1) {
+    printf("Invalid thread count\n");
+    return 1;
+  }
+
+  int32_t level = argc > 3 ? atoi(argv[3]) : 0;
+  bool separate = false;
+  if (argc > 4) {
+    if (!strcmp(argv[4], "separate")) {
+      separate = true;
+    } else if (strcmp(argv[4], "shared")) {
+      printf("Invalid handle mode: %s\n", argv[4]);
+      return 2;
+    }
+  }
+
+  // check the level
+  openslide_t *osr = open_slide(path);
+  if (level < 0 || level >= openslide_get_level_count(osr)) {
+    common_fail("No such level: %d", level);
+  }
+  openslide_close(osr);
+
+  printf("%s handles, level %d\n", separate ? "separate" : "shared", level);
+  printf("threads      tiles    seconds  tiles/sec  per-thread  efficiency\n");
+  double base_rate = 0;
+  for (int threads = 1; threads <= max_threads;
+       threads = (threads == max_threads) ? threads + 1
+                                          : MIN(threads * 2, max_threads)) {
+    int64_t tiles;
+    double seconds = run(path, level, threads, separate, &tiles);
+    double rate = tiles / seconds;
+    if (threads == 1) {
+      base_rate = rate;
+    }
+    printf("%7d %10"PRId64" %10.3f %10.1f %11.1f %10.1f%%\n",
+           threads, tiles, seconds, rate, rate / threads,
+           100 * rate / (threads * base_rate));
+    fflush(stdout);
+  }
+
   return 0;
 }
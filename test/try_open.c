@@ -24,13 +24,23 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include "openslide.h"
 #include "openslide-common.h"
 
 #define MAX_FDS 128
 #define TIME_ITERATIONS 5
+#define SHARED_CACHE_SIZE (64 << 20)
+#define SMALL_CACHE_SIZE (1 << 20)
+#define CACHE_THREADS 4
+#define CACHE_THREAD_READS 4
+#define BATCH_REGIONS 2
+#define BATCH_DECODE_THREADS 4
+#define BLOCK_CACHE_SIZE (16 << 20)
+#define DISK_CACHE_WAIT 100  // tenths of a second
 
 static gchar *vendor_check;
 static gchar **prop_checks;
@@ -146,7 +156,970 @@ static void check_props(openslide_t *osr) {
   }
 }
 
-static void check_regions(openslide_t *osr) {
+static void check_pixels(const char *what, const uint32_t *expected,
+                         const uint32_t *buf, int64_t w, int64_t h) {
+  for (int64_t i = 0; i < w * h; i++) {
+    if (buf[i] != expected[i]) {
+      fail("%s differs from openslide_read_region() at (%"PRId64", %"PRId64
+           "): %08x != %08x", what, i % w, i / w, buf[i], expected[i]);
+      return;
+    }
+  }
+}
+
+static void check_region_cache(openslide_t *orig, const char *filename,
+                               const uint32_t *expected,
+                               int64_t x, int64_t y, int32_t level,
+                               int64_t w, int64_t h) {
+  // every handle starts with a private cache
+  openslide_cache_t *cache = openslide_get_cache(orig);
+  if (!cache || !openslide_cache_get_capacity(cache)) {
+    fail("Handle has no private cache");
+  }
+  if (cache) {
+    openslide_cache_release(cache);
+  }
+
+  cache = openslide_cache_create(SHARED_CACHE_SIZE);
+  if (openslide_cache_get_capacity(cache) != SHARED_CACHE_SIZE) {
+    fail("Cache capacity wasn't kept");
+  }
+  openslide_t *osr = openslide_open(filename);
+  if (!osr) {
+    fail("Couldn't reopen %s", filename);
+    openslide_cache_release(cache);
+    return;
+  }
+  openslide_set_cache(osr, cache);
+  openslide_cache_t *attached = openslide_get_cache(osr);
+  if (attached != cache) {
+    fail("openslide_get_cache() didn't return the attached cache");
+  }
+  openslide_cache_release(attached);
+
+  uint32_t *buf = g_new(uint32_t, w * h);
+  openslide_read_region(osr, buf, x, y, level, w, h);
+  check_error(osr);
+  check_pixels("Read through a new cache", expected, buf, w, h);
+  uint64_t hits, misses, evictions, size;
+  openslide_cache_get_stats(cache, &hits, &misses, &evictions, &size);
+  if (size > SHARED_CACHE_SIZE) {
+    fail("Cache holds %"PRIu64" bytes, more than its capacity", size);
+  }
+
+  // tiles cached by the first read are hits.  Single tile reads may be
+  // decoded into the caller's buffer instead of the cache.
+  uint64_t first_hits = hits;
+  openslide_read_region(osr, buf, x, y, level, w, h);
+  check_error(osr);
+  check_pixels("Read from the cache", expected, buf, w, h);
+  openslide_cache_get_stats(cache, &hits, &misses, &evictions, &size);
+  if (size && hits == first_hits) {
+    fail("Cache had no hits on a second read");
+  }
+
+  // shrinking the cache evicts right away
+  openslide_cache_set_capacity(cache, 0);
+  if (openslide_cache_get_capacity(cache) != 0) {
+    fail("Cache capacity wasn't changed");
+  }
+  openslide_cache_get_stats(cache, &hits, &misses, &evictions, &size);
+  if (size) {
+    fail("Emptied cache still holds %"PRIu64" bytes", size);
+  }
+
+  openslide_close(osr);
+  openslide_cache_release(cache);
+  g_free(buf);
+}
+
+static void check_region_shared_cache(const char *filename,
+                                      const uint32_t *expected,
+                                      int64_t x, int64_t y, int32_t level,
+                                      int64_t w, int64_t h) {
+  uint32_t *buf = g_new(uint32_t, w * h);
+  openslide_cache_t *cache = openslide_cache_create(SHARED_CACHE_SIZE);
+  openslide_t *a = openslide_open(filename);
+  openslide_t *b = openslide_open(filename);
+  if (!a || !b) {
+    fail("Couldn't reopen %s", filename);
+    goto OUT;
+  }
+  openslide_set_cache(a, cache);
+  openslide_set_cache(b, cache);
+
+  openslide_read_region(a, buf, x, y, level, w, h);
+  check_error(a);
+  check_pixels("Read through a shared cache", expected, buf, w, h);
+
+  // the second handle reads the tiles cached by the first
+  uint64_t hits, misses, evictions, size;
+  openslide_cache_get_stats(cache, &hits, &misses, &evictions, &size);
+  uint64_t first_hits = hits;
+  openslide_read_region(b, buf, x, y, level, w, h);
+  check_error(b);
+  check_pixels("Read of another handle through a shared cache",
+               expected, buf, w, h);
+  openslide_cache_get_stats(cache, &hits, &misses, &evictions, &size);
+  if (size && hits == first_hits) {
+    fail("Shared cache had no hits");
+  }
+
+OUT:
+  if (a) {
+    openslide_close(a);
+  }
+  if (b) {
+    openslide_close(b);
+  }
+  openslide_cache_release(cache);
+  g_free(buf);
+}
+
+static void check_region_cache_policy(const char *filename,
+                                      const uint32_t *expected,
+                                      int64_t x, int64_t y, int32_t level,
+                                      int64_t w, int64_t h) {
+  openslide_cache_t *cache = openslide_cache_create(SHARED_CACHE_SIZE);
+  if (openslide_cache_get_policy(cache) != OPENSLIDE_CACHE_POLICY_LRU) {
+    fail("New cache isn't LRU");
+  }
+  openslide_cache_set_policy(cache, OPENSLIDE_CACHE_POLICY_SEGMENTED_LRU);
+  openslide_cache_set_policy(cache, -1);
+  if (openslide_cache_get_policy(cache) !=
+      OPENSLIDE_CACHE_POLICY_SEGMENTED_LRU) {
+    fail("Cache policy wasn't kept");
+  }
+  openslide_t *osr = openslide_open(filename);
+  if (!osr) {
+    fail("Couldn't reopen %s", filename);
+    openslide_cache_release(cache);
+    return;
+  }
+  openslide_set_cache(osr, cache);
+
+  // the second read promotes the tiles to the protected segment, and the
+  // third finds them there
+  uint32_t *buf = g_new(uint32_t, w * h);
+  uint64_t hits, misses, evictions, size;
+  uint64_t first_misses = 0;
+  for (int i = 0; i < 3 && !have_error; i++) {
+    openslide_read_region(osr, buf, x, y, level, w, h);
+    check_error(osr);
+    check_pixels("Read through a segmented LRU cache", expected, buf, w, h);
+    openslide_cache_get_stats(cache, &hits, &misses, &evictions, &size);
+    if (!i) {
+      first_misses = misses;
+    }
+  }
+  if (size && misses != first_misses) {
+    fail("Segmented LRU cache missed tiles read again");
+  }
+
+  // a cache too small for the region still reads it correctly
+  openslide_cache_set_capacity(cache, SMALL_CACHE_SIZE);
+  for (int i = 0; i < 2 && !have_error; i++) {
+    openslide_read_region(osr, buf, x, y, level, w, h);
+    check_error(osr);
+    check_pixels("Read through a small segmented LRU cache",
+                 expected, buf, w, h);
+  }
+  openslide_cache_get_stats(cache, &hits, &misses, &evictions, &size);
+  if (size > SMALL_CACHE_SIZE) {
+    fail("Segmented LRU cache holds %"PRIu64" bytes, more than its "
+         "capacity of %d", size, SMALL_CACHE_SIZE);
+  }
+
+  openslide_close(osr);
+  openslide_cache_release(cache);
+  g_free(buf);
+}
+
+// with no room for decoded tiles, every read decodes the compressed ones
+static void check_region_compressed_cache(const char *filename,
+                                          const uint32_t *expected,
+                                          int64_t x, int64_t y,
+                                          int32_t level,
+                                          int64_t w, int64_t h) {
+  openslide_cache_t *cache = openslide_cache_create(0);
+  if (openslide_cache_get_compressed_capacity(cache) != 0) {
+    fail("New cache has a compressed tier");
+  }
+  openslide_cache_set_compressed_capacity(cache, SHARED_CACHE_SIZE);
+  if (openslide_cache_get_compressed_capacity(cache) != SHARED_CACHE_SIZE) {
+    fail("Compressed cache capacity wasn't kept");
+  }
+  openslide_t *osr = openslide_open(filename);
+  if (!osr) {
+    fail("Couldn't reopen %s", filename);
+    openslide_cache_release(cache);
+    return;
+  }
+  openslide_set_cache(osr, cache);
+
+  uint32_t *buf = g_new(uint32_t, w * h);
+  for (int i = 0; i < 2 && !have_error; i++) {
+    openslide_read_region(osr, buf, x, y, level, w, h);
+    check_error(osr);
+    check_pixels("Read through a compressed cache", expected, buf, w, h);
+  }
+
+  openslide_close(osr);
+  openslide_cache_release(cache);
+  g_free(buf);
+}
+
+static void check_region_prefetch(const char *filename,
+                                  const uint32_t *expected,
+                                  int64_t x, int64_t y, int32_t level,
+                                  int64_t w, int64_t h) {
+  openslide_t *osr = openslide_open(filename);
+  if (!osr) {
+    fail("Couldn't reopen %s", filename);
+    return;
+  }
+  if (openslide_give_prefetch_hint(osr, x, y,
+                                   openslide_get_level_count(osr),
+                                   w, h) != -1) {
+    fail("Prefetch hint accepted a level out of range");
+  }
+  check_error(osr);
+
+  // the read pauses the background one, and gets the same pixels
+  int id = openslide_give_prefetch_hint(osr, x, y, level, w, h);
+  check_error(osr);
+  if (id < 0) {
+    fail("Prefetch hint failed");
+  }
+  uint32_t *buf = g_new(uint32_t, w * h);
+  openslide_read_region(osr, buf, x, y, level, w, h);
+  check_error(osr);
+  check_pixels("Read after a prefetch hint", expected, buf, w, h);
+  openslide_cancel_prefetch_hint(osr, id);
+
+  // closing the handle stops its background reads
+  int other = openslide_give_prefetch_hint(osr, x, y, level, w, h);
+  if (other == id) {
+    fail("Prefetch hints share an identifier");
+  }
+  openslide_give_prefetch_hint(osr, x, y, level, w, h);
+  openslide_cancel_prefetch_hint(osr, other);
+  check_error(osr);
+  openslide_close(osr);
+  g_free(buf);
+}
+
+static void check_region_batch(const char *filename,
+                               const uint32_t *expected,
+                               int64_t x, int64_t y, int32_t level,
+                               int64_t w, int64_t h) {
+  openslide_region_request_t requests[BATCH_REGIONS];
+  uint32_t *bufs[BATCH_REGIONS];
+  for (int i = 0; i < BATCH_REGIONS; i++) {
+    bufs[i] = g_new(uint32_t, w * h);
+    requests[i] = (openslide_region_request_t) {
+      .dest = bufs[i], .x = x, .y = y, .level = level, .w = w, .h = h
+    };
+  }
+
+  // the same region twice, so the batch shares its tiles, with parallel
+  // decode
+  openslide_t *osr = openslide_open(filename);
+  if (!osr) {
+    fail("Couldn't reopen %s", filename);
+  } else {
+    openslide_set_decode_threads(osr, BATCH_DECODE_THREADS);
+    openslide_read_regions(osr, requests, BATCH_REGIONS);
+    check_error(osr);
+    for (int i = 0; i < BATCH_REGIONS; i++) {
+      check_pixels("Batched read", expected, bufs[i], w, h);
+    }
+    openslide_close(osr);
+  }
+
+  for (int i = 0; i < BATCH_REGIONS; i++) {
+    g_free(bufs[i]);
+  }
+}
+
+static void async_callback(openslide_read_t *read, void *data) {
+  // done before the callback, then released by it
+  if (openslide_read_is_done(read)) {
+    g_atomic_int_inc((gint *) data);
+  }
+  openslide_read_release(read);
+}
+
+static void check_region_async(openslide_t *osr, const char *filename,
+                               const uint32_t *expected,
+                               int64_t x, int64_t y, int32_t level,
+                               int64_t w, int64_t h) {
+  uint32_t *buf = g_new(uint32_t, w * h);
+  openslide_read_t *read = openslide_read_region_async(osr, buf, x, y,
+                                                       level, w, h,
+                                                       NULL, NULL);
+  if (!read) {
+    fail("openslide_read_region_async() failed");
+  } else {
+    openslide_read_wait(read);
+    if (!openslide_read_is_done(read)) {
+      fail("Asynchronous read isn't done after waiting");
+    }
+    openslide_read_release(read);
+    check_error(osr);
+    check_pixels("Asynchronous read", expected, buf, w, h);
+  }
+
+  // openslide_close() waits for the read and its callback
+  openslide_t *other = openslide_open(filename);
+  if (!other) {
+    fail("Couldn't reopen %s", filename);
+  } else {
+    gint callbacks = 0;
+    if (!openslide_read_region_async(other, buf, x, y, level, w, h,
+                                     async_callback, &callbacks)) {
+      fail("openslide_read_region_async() failed");
+    }
+    openslide_close(other);
+    if (g_atomic_int_get(&callbacks) != 1) {
+      fail("Asynchronous read callback wasn't called once when done");
+    } else {
+      check_pixels("Asynchronous read with a callback", expected, buf, w, h);
+    }
+  }
+  g_free(buf);
+}
+
+
+static void check_region_raw_tile(openslide_t *osr,
+                                  int64_t x, int64_t y, int32_t level) {
+  int64_t tile_w, tile_h, level_w, level_h;
+  openslide_get_level_raw_tile_dimensions(osr, level, &tile_w, &tile_h);
+  openslide_get_level_dimensions(osr, level, &level_w, &level_h);
+  check_error(osr);
+  double downsample = openslide_get_level_downsample(osr, level);
+  int64_t lx = x / downsample;
+  int64_t ly = y / downsample;
+  if (tile_w <= 0 || lx < 0 || ly < 0 || lx >= level_w || ly >= level_h) {
+    return;
+  }
+
+  // the tile under the region is a complete JPEG
+  int64_t len;
+  uint8_t *data = openslide_read_raw_tile(osr, level,
+                                          lx / tile_w, ly / tile_h, &len);
+  check_error(osr);
+  if (data && (len < 4 || data[0] != 0xff || data[1] != 0xd8 ||
+               data[len - 2] != 0xff || data[len - 1] != 0xd9)) {
+    fail("Raw tile of level %d isn't a JPEG", level);
+  }
+  openslide_free_raw_tile(data);
+
+  // tiles outside the level don't exist
+  data = openslide_read_raw_tile(osr, level, -1, ly / tile_h, &len);
+  if (data || len) {
+    fail("Raw tile outside level %d was returned", level);
+  }
+  openslide_free_raw_tile(data);
+  check_error(osr);
+}
+
+static void check_region_scaled(openslide_t *osr, const uint32_t *expected,
+                                int64_t x, int64_t y, int32_t level,
+                                int64_t w, int64_t h) {
+  // at the downsample of a level, the level is read without scaling
+  uint32_t *buf = g_new(uint32_t, w * h);
+  openslide_read_region_scaled(osr, buf, x, y,
+                               openslide_get_level_downsample(osr, level),
+                               w, h);
+  check_error(osr);
+  check_pixels("Scaled read", expected, buf, w, h);
+  g_free(buf);
+}
+
+static void check_region_format(openslide_t *osr, const uint32_t *expected,
+                                int64_t x, int64_t y, int32_t level,
+                                int64_t w, int64_t h) {
+  // rows are padded, and the padding must survive
+  int64_t stride = w * 4 + 8;
+  uint8_t *argb = g_malloc(stride * h);
+  uint8_t *rgba = g_malloc(stride * h);
+  uint8_t *rgb = g_malloc(stride * h);
+  uint8_t *gray = g_malloc(stride * h);
+  memset(argb, 0xaa, stride * h);
+  openslide_read_region_format(osr, argb, stride,
+                               OPENSLIDE_PIXEL_FORMAT_ARGB32,
+                               x, y, level, w, h);
+  openslide_read_region_format(osr, rgba, stride,
+                               OPENSLIDE_PIXEL_FORMAT_RGBA32,
+                               x, y, level, w, h);
+  openslide_read_region_format(osr, rgb, stride,
+                               OPENSLIDE_PIXEL_FORMAT_RGB24,
+                               x, y, level, w, h);
+  openslide_read_region_format(osr, gray, stride,
+                               OPENSLIDE_PIXEL_FORMAT_GRAY8,
+                               x, y, level, w, h);
+  check_error(osr);
+
+  for (int64_t row = 0; !have_error && row < h; row++) {
+    const uint32_t *in = expected + row * w;
+    if (memcmp(argb + row * stride, in, w * 4)) {
+      fail("ARGB32 row %"PRId64" differs from openslide_read_region()",
+           row);
+    } else if (argb[row * stride + w * 4] != 0xaa) {
+      fail("ARGB32 row %"PRId64" overwrote its padding", row);
+    }
+    for (int64_t col = 0; !have_error && col < w; col++) {
+      uint32_t a = in[col] >> 24;
+      const uint8_t *px = rgba + row * stride + col * 4;
+      const uint8_t *px3 = rgb + row * stride + col * 3;
+      if (px[3] != a) {
+        fail("RGBA32 alpha differs at (%"PRId64", %"PRId64")", col, row);
+      }
+      // Rec. 601 luma, give or take the rounding of each step.
+      // Unpremultiplying magnifies the rounding of translucent pixels.
+      int32_t luma = (77 * px[0] + 150 * px[1] + 29 * px[2] + 128) >> 8;
+      int32_t gray_px = gray[row * stride + col];
+      if ((a == 0 || a == 255) &&
+          (gray_px + 2 < luma || gray_px > luma + 2)) {
+        fail("GRAY8 differs from the luma of RGBA32 at "
+             "(%"PRId64", %"PRId64")", col, row);
+      }
+      for (int32_t c = 0; c < 3 && !have_error; c++) {
+        // premultiplying again must give back the ARGB sample
+        uint32_t premultiplied = (px[c] * a + 127) / 255;
+        uint32_t argb_c = (in[col] >> (16 - 8 * c)) & 0xff;
+        if (premultiplied + 1 < argb_c || premultiplied > argb_c + 1) {
+          fail("RGBA32 differs at (%"PRId64", %"PRId64")", col, row);
+        } else if (px3[c] != px[c]) {
+          fail("RGB24 differs from RGBA32 at (%"PRId64", %"PRId64")",
+               col, row);
+        }
+      }
+    }
+  }
+
+  g_free(argb);
+  g_free(rgba);
+  g_free(rgb);
+  g_free(gray);
+}
+
+static void check_region_dup(openslide_t *osr, const char *filename,
+                             const uint32_t *expected,
+                             int64_t x, int64_t y, int32_t level,
+                             int64_t w, int64_t h) {
+  uint32_t *buf = g_new(uint32_t, w * h);
+  openslide_t *dup = openslide_dup(osr);
+  if (!dup) {
+    fail("openslide_dup() failed");
+    g_free(buf);
+    return;
+  }
+  openslide_read_region(dup, buf, x, y, level, w, h);
+  check_error(dup);
+  check_pixels("Duplicate handle", expected, buf, w, h);
+
+  // errors stay on the duplicate
+  openslide_read_region(dup, buf, x, y, level, -1, -1);
+  if (!openslide_get_error(dup)) {
+    fail("Duplicate handle accepted a negative size");
+  }
+  openslide_read_region(osr, buf, x, y, level, w, h);
+  check_error(osr);
+  check_pixels("Original after an error on a duplicate", expected, buf, w, h);
+  openslide_close(dup);
+
+  // a duplicate outlives the handle it was made from
+  openslide_t *other = openslide_open(filename);
+  if (!other) {
+    fail("Couldn't reopen %s", filename);
+  } else {
+    dup = openslide_dup(other);
+    openslide_close(other);
+    if (!dup) {
+      fail("openslide_dup() failed");
+    } else {
+      openslide_read_region(dup, buf, x, y, level, w, h);
+      check_error(dup);
+      check_pixels("Duplicate of a closed handle", expected, buf, w, h);
+      openslide_close(dup);
+    }
+  }
+  g_free(buf);
+}
+
+static void check_region_native(openslide_t *osr,
+                                int64_t x, int64_t y, int32_t level,
+                                int64_t w, int64_t h) {
+  int32_t sample_type, channel_count;
+  openslide_get_native_format(osr, &sample_type, &channel_count);
+  check_error(osr);
+  if ((sample_type == -1) != (channel_count == -1)) {
+    fail("Native format has a sample type %d but %d channels",
+         sample_type, channel_count);
+  }
+  if (sample_type == -1) {
+    return;
+  }
+  int32_t sample_size;
+  switch (sample_type) {
+  case OPENSLIDE_SAMPLE_TYPE_UINT8:
+    sample_size = 1;
+    break;
+  case OPENSLIDE_SAMPLE_TYPE_UINT16:
+    sample_size = 2;
+    break;
+  case OPENSLIDE_SAMPLE_TYPE_FLOAT32:
+    sample_size = 4;
+    break;
+  default:
+    fail("Unknown native sample type %d", sample_type);
+    return;
+  }
+
+  // reading the channels in reverse order must permute every pixel
+  int32_t *reversed = g_new(int32_t, channel_count);
+  for (int32_t c = 0; c < channel_count; c++) {
+    reversed[c] = channel_count - 1 - c;
+  }
+  int64_t pixel_size = channel_count * sample_size;
+  uint8_t *all = g_malloc(w * h * pixel_size);
+  uint8_t *rev = g_malloc(w * h * pixel_size);
+  openslide_read_region_native(osr, all, NULL, 0, x, y, level, w, h);
+  openslide_read_region_native(osr, rev, reversed, channel_count,
+                               x, y, level, w, h);
+  check_error(osr);
+  for (int64_t i = 0; !have_error && i < w * h; i++) {
+    for (int32_t c = 0; c < channel_count; c++) {
+      if (memcmp(all + i * pixel_size + c * sample_size,
+                 rev + i * pixel_size + reversed[c] * sample_size,
+                 sample_size)) {
+        fail("Native channel %d differs when read out of order", c);
+        break;
+      }
+    }
+  }
+  g_free(all);
+  g_free(rev);
+  g_free(reversed);
+}
+
+static void check_region_planes(openslide_t *osr, const uint32_t *expected,
+                                int64_t x, int64_t y, int32_t level,
+                                int64_t w, int64_t h) {
+  if (openslide_get_plane_count(osr, -1) != -1) {
+    fail("Plane count of an unknown dimension isn't -1");
+  }
+  int32_t channels = openslide_get_plane_count(osr, OPENSLIDE_PLANE_CHANNEL);
+  int32_t zs = openslide_get_plane_count(osr, OPENSLIDE_PLANE_Z);
+  int32_t times = openslide_get_plane_count(osr, OPENSLIDE_PLANE_TIME);
+  check_error(osr);
+  if (channels < 1 || zs < 1 || times < 1) {
+    fail("Invalid plane counts %d, %d, %d", channels, zs, times);
+    return;
+  }
+  openslide_t *dup = openslide_dup(osr);
+  if (!dup) {
+    fail("openslide_dup() failed");
+    return;
+  }
+
+  // another plane selected on the duplicate isn't read by the original
+  uint32_t *buf = g_new(uint32_t, w * h);
+  openslide_set_plane(dup, channels - 1, zs - 1, times - 1);
+  check_error(dup);
+  openslide_read_region(dup, buf, x, y, level, w, h);
+  check_error(dup);
+  openslide_read_region(osr, buf, x, y, level, w, h);
+  check_error(osr);
+  check_pixels("Plane of the original after openslide_set_plane() "
+               "on a duplicate", expected, buf, w, h);
+
+  // and selecting the first plane again reads what the original does
+  openslide_set_plane(dup, 0, 0, 0);
+  openslide_read_region(dup, buf, x, y, level, w, h);
+  check_error(dup);
+  check_pixels("First plane of a duplicate", expected, buf, w, h);
+
+  // planes out of range are errors of the duplicate only
+  openslide_set_plane(dup, channels, 0, 0);
+  if (!openslide_get_error(dup)) {
+    fail("openslide_set_plane() accepted an invalid plane");
+  }
+  openslide_read_region(osr, buf, x, y, level, w, h);
+  check_error(osr);
+  check_pixels("Original after an invalid plane on a duplicate",
+               expected, buf, w, h);
+
+  openslide_close(dup);
+  g_free(buf);
+}
+
+static int64_t counting_range_reader(const char *filename, int64_t offset,
+                                     void *buf, int64_t len, void *data) {
+  g_atomic_int_inc((gint *) data);
+  FILE *f = fopen(filename, "rb");
+  if (!f) {
+    return -1;
+  }
+  int64_t count = -1;
+  if (!fseeko(f, offset, SEEK_SET)) {
+    count = fread(buf, 1, len, f);
+    if (ferror(f)) {
+      count = -1;
+    }
+  }
+  fclose(f);
+  return count;
+}
+
+// slide formats whose tile data is always read as ranges
+static bool reads_ranges(openslide_t *osr) {
+  static const char *vendors[] = {
+    "aperio", "generic-tiff", "leica", "philips", "trestle", "ventana", NULL
+  };
+  const char *vendor =
+    openslide_get_property_value(osr, OPENSLIDE_PROPERTY_NAME_VENDOR);
+  for (const char **cur = vendors; vendor && *cur; cur++) {
+    if (!strcmp(vendor, *cur)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void check_region_range_reader(const char *filename,
+                                      const uint32_t *expected,
+                                      int64_t x, int64_t y, int32_t level,
+                                      int64_t w, int64_t h) {
+  gint calls = 0;
+  openslide_set_block_cache_capacity(BLOCK_CACHE_SIZE);
+  openslide_set_range_reader(counting_range_reader, &calls);
+
+  // the second handle reads through the blocks fetched for the first
+  uint32_t *buf = g_new(uint32_t, w * h);
+  for (int i = 0; i < 2 && !have_error; i++) {
+    openslide_t *osr = openslide_open(filename);
+    if (!osr) {
+      fail("Couldn't reopen %s", filename);
+      break;
+    }
+    openslide_read_region(osr, buf, x, y, level, w, h);
+    check_error(osr);
+    check_pixels("Read through the block cache", expected, buf, w, h);
+    if (!i && reads_ranges(osr) && !g_atomic_int_get(&calls)) {
+      fail("Range reader wasn't called");
+    }
+    openslide_close(osr);
+  }
+
+  openslide_set_range_reader(NULL, NULL);
+  openslide_set_block_cache_capacity(0);
+  g_free(buf);
+}
+
+static void check_region_cached_fetch(const char *filename,
+                                      const uint32_t *expected,
+                                      int64_t x, int64_t y, int32_t level,
+                                      int64_t w, int64_t h) {
+  openslide_t *osr = openslide_open(filename);
+  if (!osr) {
+    fail("Couldn't reopen %s", filename);
+    return;
+  }
+  openslide_cache_t *cache = openslide_cache_create(SHARED_CACHE_SIZE);
+  openslide_set_cache(osr, cache);
+  gint calls = 0;
+  openslide_set_range_reader(counting_range_reader, &calls);
+
+  // tiles already in the cache must not be fetched again
+  uint32_t *buf = g_new(uint32_t, w * h);
+  openslide_read_region(osr, buf, x, y, level, w, h);
+  check_error(osr);
+  check_pixels("Read before caching", expected, buf, w, h);
+  gint fetched = g_atomic_int_get(&calls);
+  openslide_read_region(osr, buf, x, y, level, w, h);
+  check_error(osr);
+  check_pixels("Read from the cache", expected, buf, w, h);
+  uint64_t hits, misses, evictions, size;
+  openslide_cache_get_stats(cache, &hits, &misses, &evictions, &size);
+  if (size && g_atomic_int_get(&calls) != fetched) {
+    fail("Cached region fetched %d more ranges",
+         g_atomic_int_get(&calls) - fetched);
+  }
+
+  openslide_set_range_reader(NULL, NULL);
+  g_free(buf);
+  openslide_close(osr);
+  openslide_cache_release(cache);
+}
+
+static void check_region_synthesized(openslide_t *orig, const char *filename,
+                                     const uint32_t *expected,
+                                     int64_t x, int64_t y, int32_t level,
+                                     int64_t w, int64_t h) {
+  openslide_set_synthesized_levels(true);
+  openslide_t *osr = openslide_open(filename);
+  openslide_set_synthesized_levels(false);
+  if (!osr) {
+    fail("Couldn't reopen %s with synthesized levels", filename);
+    return;
+  }
+
+  int32_t count = openslide_get_level_count(osr);
+  if (count < openslide_get_level_count(orig)) {
+    fail("Synthesized levels dropped levels: %d < %d",
+         count, openslide_get_level_count(orig));
+  }
+
+  // the slide's own levels read as before; the added ones read cleanly
+  double downsample = openslide_get_level_downsample(orig, level);
+  bool found = false;
+  uint32_t *buf = g_new(uint32_t, w * h);
+  for (int32_t l = 0; l < count && !have_error; l++) {
+    openslide_read_region(osr, buf, x, y, l, w, h);
+    check_error(osr);
+    if (!found && openslide_get_level_downsample(osr, l) == downsample) {
+      check_pixels("Read with synthesized levels", expected, buf, w, h);
+      found = true;
+    }
+  }
+  if (!found && !have_error) {
+    fail("No level with downsample %g among synthesized levels", downsample);
+  }
+
+  g_free(buf);
+  openslide_close(osr);
+}
+
+// files in the slide directories of a disk cache
+static int count_disk_cache_files(const char *dir) {
+  int count = 0;
+  GDir *d = g_dir_open(dir, 0, NULL);
+  if (!d) {
+    return 0;
+  }
+  const char *name;
+  while ((name = g_dir_read_name(d)) != NULL) {
+    char *path = g_build_filename(dir, name, NULL);
+    GDir *slide_dir = g_dir_open(path, 0, NULL);
+    if (slide_dir) {
+      while (g_dir_read_name(slide_dir)) {
+        count++;
+      }
+      g_dir_close(slide_dir);
+    }
+    g_free(path);
+  }
+  g_dir_close(d);
+  return count;
+}
+
+static void remove_disk_cache(const char *dir) {
+  GDir *d = g_dir_open(dir, 0, NULL);
+  if (d) {
+    const char *name;
+    while ((name = g_dir_read_name(d)) != NULL) {
+      char *path = g_build_filename(dir, name, NULL);
+      if (g_file_test(path, G_FILE_TEST_IS_DIR)) {
+        remove_disk_cache(path);
+      } else {
+        g_remove(path);
+      }
+      g_free(path);
+    }
+    g_dir_close(d);
+  }
+  g_rmdir(dir);
+}
+
+static void check_region_disk_cache(const char *filename,
+                                    const uint32_t *expected,
+                                    int64_t x, int64_t y, int32_t level,
+                                    int64_t w, int64_t h) {
+  char *name = g_strdup_printf("openslide-test-disk-cache-%d",
+                               (int) getpid());
+  char *dir = g_build_filename(g_get_tmp_dir(), name, NULL);
+  g_free(name);
+  if (g_mkdir_with_parents(dir, 0700)) {
+    fail("Couldn't create %s", dir);
+    g_free(dir);
+    return;
+  }
+  openslide_set_disk_cache(dir, SHARED_CACHE_SIZE);
+
+  // tiles are written in the background after the first handle reads them
+  uint32_t *buf = g_new(uint32_t, w * h);
+  int files = 0;
+  for (int i = 0; i < 2 && !have_error; i++) {
+    openslide_t *osr = openslide_open(filename);
+    if (!osr) {
+      fail("Couldn't reopen %s with a disk cache", filename);
+      break;
+    }
+    openslide_read_region(osr, buf, x, y, level, w, h);
+    check_error(osr);
+    check_pixels(i ? "Read from the disk cache" : "Read into the disk cache",
+                 expected, buf, w, h);
+    if (!i) {
+      for (int wait = 0; wait < DISK_CACHE_WAIT && !files; wait++) {
+        g_usleep(G_USEC_PER_SEC / 10);
+        files = count_disk_cache_files(dir);
+      }
+    } else if (files &&
+               openslide_get_stat(osr, OPENSLIDE_STAT_DISK_CACHE_HITS) <= 0) {
+      fail("Saved tiles weren't read from the disk cache");
+    }
+    openslide_close(osr);
+  }
+
+  // let the writer thread finish before removing its files
+  openslide_set_disk_cache(NULL, 0);
+  for (int wait = 0; wait < DISK_CACHE_WAIT; wait++) {
+    g_usleep(G_USEC_PER_SEC / 10);
+    int cur = count_disk_cache_files(dir);
+    if (cur == files) {
+      break;
+    }
+    files = cur;
+  }
+  remove_disk_cache(dir);
+  g_free(buf);
+  g_free(dir);
+}
+
+static void check_region_warm_start(const char *filename,
+                                    const uint32_t *expected,
+                                    int64_t x, int64_t y, int32_t level,
+                                    int64_t w, int64_t h) {
+  openslide_set_warm_start(true);
+  openslide_t *osr = openslide_open(filename);
+  openslide_set_warm_start(false);
+  if (!osr) {
+    fail("Couldn't reopen %s with warm start", filename);
+    return;
+  }
+
+  // pinned tiles move along with the handle to a new cache
+  uint32_t *buf = g_new(uint32_t, w * h);
+  openslide_read_region(osr, buf, x, y, level, w, h);
+  check_error(osr);
+  check_pixels("Read with warm start", expected, buf, w, h);
+  openslide_cache_t *cache = openslide_cache_create(SMALL_CACHE_SIZE);
+  openslide_set_cache(osr, cache);
+  openslide_read_region(osr, buf, x, y, level, w, h);
+  check_error(osr);
+  check_pixels("Read with warm start after switching caches",
+               expected, buf, w, h);
+
+  g_free(buf);
+  openslide_close(osr);
+  openslide_cache_release(cache);
+}
+
+struct cache_thread {
+  openslide_t *osr;
+  const uint32_t *expected;
+  int64_t x;
+  int64_t y;
+  int32_t level;
+  int64_t w;
+  int64_t h;
+  bool differs;
+};
+
+static gpointer cache_thread_func(gpointer data) {
+  struct cache_thread *ct = data;
+  uint32_t *buf = g_new(uint32_t, ct->w * ct->h);
+  for (int i = 0; i < CACHE_THREAD_READS && !ct->differs; i++) {
+    openslide_read_region(ct->osr, buf, ct->x, ct->y, ct->level,
+                          ct->w, ct->h);
+    ct->differs = memcmp(buf, ct->expected, ct->w * ct->h * 4) != 0;
+  }
+  g_free(buf);
+  return NULL;
+}
+
+// threads reading through a cache too small for the region evict
+// each other's tiles in every shard
+static void check_region_cache_threads(const char *filename,
+                                       const uint32_t *expected,
+                                       int64_t x, int64_t y, int32_t level,
+                                       int64_t w, int64_t h) {
+  openslide_t *osr = openslide_open(filename);
+  if (!osr) {
+    fail("Couldn't reopen %s", filename);
+    return;
+  }
+  openslide_cache_t *cache = openslide_cache_create(SMALL_CACHE_SIZE);
+  openslide_set_cache(osr, cache);
+
+  struct cache_thread cts[CACHE_THREADS];
+  GThread *threads[CACHE_THREADS];
+  for (int i = 0; i < CACHE_THREADS; i++) {
+    cts[i] = (struct cache_thread) {
+      .osr = osr, .expected = expected,
+      .x = x, .y = y, .level = level, .w = w, .h = h,
+    };
+    threads[i] = g_thread_create(cache_thread_func, &cts[i], TRUE, NULL);
+    if (!threads[i]) {
+      fail("Couldn't start cache thread");
+    }
+  }
+  for (int i = 0; i < CACHE_THREADS; i++) {
+    if (threads[i]) {
+      g_thread_join(threads[i]);
+      if (cts[i].differs) {
+        fail("Read from several threads differs from "
+             "openslide_read_region()");
+      }
+    }
+  }
+  check_error(osr);
+
+  uint64_t hits, misses, evictions, size;
+  openslide_cache_get_stats(cache, &hits, &misses, &evictions, &size);
+  if (size > SMALL_CACHE_SIZE) {
+    fail("Cache holds %"PRIu64" bytes, more than its capacity of %d",
+         size, SMALL_CACHE_SIZE);
+  }
+
+  openslide_close(osr);
+  openslide_cache_release(cache);
+}
+
+// every other way of reading a region returns what
+// openslide_read_region() does
+static void check_region_equivalence(openslide_t *osr, const char *filename,
+                                     const uint32_t *expected,
+                                     int64_t x, int64_t y, int32_t level,
+                                     int64_t w, int64_t h) {
+  if (!w || !h) {
+    return;
+  }
+  check_region_cache(osr, filename, expected, x, y, level, w, h);
+  check_region_cache_threads(filename, expected, x, y, level, w, h);
+  check_region_shared_cache(filename, expected, x, y, level, w, h);
+  check_region_cache_policy(filename, expected, x, y, level, w, h);
+  check_region_compressed_cache(filename, expected, x, y, level, w, h);
+  check_region_prefetch(filename, expected, x, y, level, w, h);
+  check_region_batch(filename, expected, x, y, level, w, h);
+  check_region_async(osr, filename, expected, x, y, level, w, h);
+  check_region_raw_tile(osr, x, y, level);
+  check_region_scaled(osr, expected, x, y, level, w, h);
+  check_region_format(osr, expected, x, y, level, w, h);
+  check_region_dup(osr, filename, expected, x, y, level, w, h);
+  check_region_native(osr, x, y, level, w, h);
+  check_region_planes(osr, expected, x, y, level, w, h);
+  check_region_range_reader(filename, expected, x, y, level, w, h);
+  check_region_cached_fetch(filename, expected, x, y, level, w, h);
+  check_region_synthesized(osr, filename, expected, x, y, level, w, h);
+  check_region_disk_cache(filename, expected, x, y, level, w, h);
+  check_region_warm_start(filename, expected, x, y, level, w, h);
+}
+
+static void check_regions(openslide_t *osr, const char *filename) {
   for (gchar **check = region_checks; !have_error && check && *check;
        check++) {
     gchar **args = g_strsplit(*check, " ", 5);
@@ -165,6 +1138,9 @@ static void check_regions(openslide_t *osr) {
     uint32_t *buf = g_slice_alloc(w * h * 4);
     openslide_read_region(osr, buf, x, y, level, w, h);
     check_error(osr);
+    if (!have_error) {
+      check_region_equivalence(osr, filename, buf, x, y, level, w, h);
+    }
     g_slice_free1(w * h * 4, buf);
   }
 }
@@ -246,7 +1222,7 @@ int main(int argc, char **argv) {
   if (osr != NULL) {
     // Check properties and regions
     check_props(osr);
-    check_regions(osr);
+    check_regions(osr, filename);
 
     // Close
     openslide_close(osr);
@@ -1,7 +1,7 @@
 /*
  *  OpenSlide, a library for reading whole slide image files
  *
- *  Copyright (c) 2010-2012 Carnegie Mellon University
+ *  Copyright (c) 2010-2015 Carnegie Mellon University
  *  All rights reserved.
  *
  *  OpenSlide is free software: you can redistribute it and/or modify
@@ -20,47 +20,69 @@
  */
 
 #include <stdio.h>
+#include <stdbool.h>
 #include <glib.h>
 #include "openslide.h"
 #include "openslide-common.h"
 
-static gboolean process(const char *file) {
-  openslide_t *osr = openslide_open(file);
-  if (osr == NULL) {
-    fprintf(stderr, "%s: %s: Not a file that OpenSlide can recognize\n",
-	    g_get_prgname(), file);
-    fflush(stderr);
-    return FALSE;
-  }
+static gint jobs;
 
-  const char *err = openslide_get_error(osr);
-  if (err) {
-    fprintf(stderr, "%s: %s: %s\n", g_get_prgname(), file, err);
-    fflush(stderr);
-    openslide_close(osr);
-    return FALSE;
+static const GOptionEntry options[] = {
+  {"jobs", 'j', 0, G_OPTION_ARG_INT, &jobs,
+   "Hash N files at once (default: one per processor)", "N"},
+  {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}
+};
+
+struct hash_job {
+  const char *file;
+  char *hash;
+  char *error;
+  bool done;      // protected by lock
+};
+
+static GMutex *lock;
+static GCond *cond;   // a job is done
+
+static void hash_file(gpointer data, gpointer user_data G_GNUC_UNUSED) {
+  struct hash_job *job = data;
+
+  char *error;
+  char *hash = openslide_compute_quickhash1(job->file, &error);
+
+  g_mutex_lock(lock);
+  job->hash = hash;
+  job->error = error;
+  job->done = true;
+  g_cond_broadcast(cond);
+  g_mutex_unlock(lock);
+}
+
+static gboolean process(struct hash_job *job) {
+  // print in argument order, whatever order the hashes finish in
+  g_mutex_lock(lock);
+  while (!job->done) {
+    g_cond_wait(cond, lock);
   }
+  g_mutex_unlock(lock);
 
-  const char *hash = openslide_get_property_value(osr,
-        "openslide.quickhash-1");
-  if (hash != NULL) {
-    printf("%s  %s\n", hash, file);
+  gboolean success = job->hash != NULL;
+  if (success) {
+    printf("%s  %s\n", job->hash, job->file);
   } else {
-    fprintf(stderr, "%s: %s: No quickhash-1 available\n", g_get_prgname(),
-            file);
+    fprintf(stderr, "%s: %s: %s\n", g_get_prgname(), job->file, job->error);
     fflush(stderr);
-    openslide_close(osr);
-    return FALSE;
   }
 
-  openslide_close(osr);
-  return TRUE;
+  openslide_free_string(job->hash);
+  openslide_free_string(job->error);
+  return success;
 }
 
 
 static const struct common_usage_info usage_info = {
   "FILE...",
   "Print OpenSlide quickhash-1 (256-bit) checksums.",
+  options,
 };
 
 int main (int argc, char **argv) {
@@ -68,13 +90,36 @@ int main (int argc, char **argv) {
   if (argc < 2) {
     common_usage(&usage_info);
   }
+  if (jobs <= 0) {
+    jobs = common_get_thread_count();
+  }
+
+  // hash in parallel, since slides are often on high-latency storage
+  lock = g_mutex_new();
+  cond = g_cond_new();
+  struct hash_job *hash_jobs = g_new0(struct hash_job, argc);
+  GError *tmp_err = NULL;
+  GThreadPool *pool = g_thread_pool_new(hash_file, NULL, jobs, TRUE,
+                                        &tmp_err);
+  if (!pool) {
+    common_fail("%s: Couldn't start threads: %s", g_get_prgname(),
+                tmp_err->message);
+  }
+  for (int i = 1; i < argc; i++) {
+    hash_jobs[i].file = argv[i];
+    g_thread_pool_push(pool, &hash_jobs[i], NULL);
+  }
 
   int ret = 0;
   for (int i = 1; i < argc; i++) {
-    if (!process(argv[i])) {
+    if (!process(&hash_jobs[i])) {
       ret = 1;
     }
   }
 
+  g_thread_pool_free(pool, FALSE, TRUE);
+  g_free(hash_jobs);
+  g_cond_free(cond);
+  g_mutex_free(lock);
   return ret;
 }
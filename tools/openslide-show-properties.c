@@ -68,6 +68,7 @@ static gboolean process(const char *file, int successes, int total) {
 static const struct common_usage_info usage_info = {
   "FILE...",
   "Print OpenSlide properties for a slide.",
+  NULL,
 };
 
 int main (int argc, char **argv) {
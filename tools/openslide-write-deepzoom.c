@@ -0,0 +1,417 @@
+/*
+ *  OpenSlide, a library for reading whole slide image files
+ *
+ *  Copyright (c) 2007-2015 Carnegie Mellon University
+ *  All rights reserved.
+ *
+ *  OpenSlide is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation, version 2.1.
+ *
+ *  OpenSlide is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with OpenSlide. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "openslide.h"
+#include "openslide-common.h"
+
+#include <inttypes.h>
+#include <glib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+
+#define JPEG_QUALITY 75
+// subtrees are rendered in parallel from the first Deep Zoom level with
+// at least this many tiles per thread
+#define TILES_PER_THREAD 4
+
+struct deepzoom {
+  openslide_t *osr;
+  char *files_dir;
+  int32_t tile_size;
+  int32_t level_count;
+  int64_t *level_w;
+  int64_t *level_h;
+  uint8_t background[3];
+
+  // the base level is a grid of JPEG tiles of the same size,
+  // which are copied instead of being encoded again
+  bool copy_raw;
+
+  // tiles of the level subtrees are rendered from, filled by the workers
+  int32_t split_level;
+  uint32_t **split_tiles;
+};
+
+struct jpeg_fail_mgr {
+  struct jpeg_error_mgr base;
+  jmp_buf env;
+};
+
+static void fail(const char *format, ...) {
+  va_list ap;
+
+  va_start(ap, format);
+  char *msg = g_strdup_vprintf(format, ap);
+  va_end(ap);
+
+  fprintf(stderr, "%s: %s\n", g_get_prgname(), msg);
+  fflush(stderr);
+
+  exit(1);
+}
+
+static int64_t get_cols(struct deepzoom *dz, int32_t level) {
+  return (dz->level_w[level] + dz->tile_size - 1) / dz->tile_size;
+}
+
+static int64_t get_rows(struct deepzoom *dz, int32_t level) {
+  return (dz->level_h[level] + dz->tile_size - 1) / dz->tile_size;
+}
+
+static char *get_tile_path(struct deepzoom *dz, int32_t level,
+                           int64_t col, int64_t row) {
+  return g_strdup_printf("%s/%d/%"PRId64"_%"PRId64".jpeg",
+                         dz->files_dir, level, col, row);
+}
+
+static void jpeg_error_exit(j_common_ptr cinfo) {
+  struct jpeg_fail_mgr *jerr = (struct jpeg_fail_mgr *) cinfo->err;
+  longjmp(jerr->env, 1);
+}
+
+static void write_jpeg(struct deepzoom *dz, const char *path,
+                       const uint32_t *pixels, int32_t w, int32_t h) {
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    fail("Can't open %s for writing: %s", path, strerror(errno));
+  }
+
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_fail_mgr jerr;
+  uint8_t *row = g_malloc(w * 3);
+  cinfo.err = jpeg_std_error(&jerr.base);
+  jerr.base.error_exit = jpeg_error_exit;
+  if (setjmp(jerr.env)) {
+    char msg[JMSG_LENGTH_MAX];
+    (*cinfo.err->format_message) ((j_common_ptr) &cinfo, msg);
+    fail("Error writing %s: %s", path, msg);
+  }
+  jpeg_create_compress(&cinfo);
+  jpeg_stdio_dest(&cinfo, f);
+
+  cinfo.image_width = w;
+  cinfo.image_height = h;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, JPEG_QUALITY, TRUE);
+  jpeg_start_compress(&cinfo, TRUE);
+
+  while (cinfo.next_scanline < cinfo.image_height) {
+    // composite premultiplied ARGB over the background
+    const uint32_t *p = pixels + cinfo.next_scanline * w;
+    for (int32_t x = 0; x < w; x++) {
+      uint32_t a = p[x] >> 24;
+      for (int c = 0; c < 3; c++) {
+        uint32_t v = (p[x] >> (16 - 8 * c)) & 0xff;
+        row[x * 3 + c] = v + (dz->background[c] * (255 - a) + 127) / 255;
+      }
+    }
+    JSAMPROW rows[1] = { row };
+    jpeg_write_scanlines(&cinfo, rows, 1);
+  }
+
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  g_free(row);
+  if (fclose(f)) {
+    fail("Error writing %s: %s", path, strerror(errno));
+  }
+}
+
+static void write_raw(const char *path, const void *data, int64_t len) {
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    fail("Can't open %s for writing: %s", path, strerror(errno));
+  }
+  if (fwrite(data, len, 1, f) != 1 || fclose(f)) {
+    fail("Error writing %s: %s", path, strerror(errno));
+  }
+}
+
+// base level tiles are read from level 0 of the slide
+static uint32_t *render_base_tile(struct deepzoom *dz,
+                                  int64_t col, int64_t row,
+                                  int32_t w, int32_t h) {
+  int32_t level = dz->level_count - 1;
+  char *path = get_tile_path(dz, level, col, row);
+  uint32_t *pixels = g_new(uint32_t, (int64_t) w * h);
+  openslide_read_region(dz->osr, pixels,
+                        col * dz->tile_size, row * dz->tile_size, 0, w, h);
+  const char *err = openslide_get_error(dz->osr);
+  if (err) {
+    fail("%s", err);
+  }
+
+  // edge tiles are cropped, so only whole tiles can be copied
+  void *data = NULL;
+  int64_t len = 0;
+  if (dz->copy_raw && w == dz->tile_size && h == dz->tile_size) {
+    data = openslide_read_raw_tile(dz->osr, 0, col, row, &len);
+  }
+  if (data) {
+    write_raw(path, data, len);
+    openslide_free_raw_tile(data);
+  } else {
+    write_jpeg(dz, path, pixels, w, h);
+  }
+
+  g_free(path);
+  return pixels;
+}
+
+static uint32_t *render_tile(struct deepzoom *dz, int32_t level,
+                             int64_t col, int64_t row);
+
+static uint32_t *get_tile(struct deepzoom *dz, int32_t level,
+                          int64_t col, int64_t row) {
+  if (level == dz->split_level && dz->split_tiles) {
+    // already rendered by a worker
+    int64_t i = row * get_cols(dz, level) + col;
+    uint32_t *pixels = dz->split_tiles[i];
+    dz->split_tiles[i] = NULL;
+    return pixels;
+  }
+  return render_tile(dz, level, col, row);
+}
+
+// Write a tile and return its premultiplied ARGB pixels.  Tiles other
+// than base tiles are averaged from the four tiles below them, so each
+// base pixel is read once.
+static uint32_t *render_tile(struct deepzoom *dz, int32_t level,
+                             int64_t col, int64_t row) {
+  const int32_t ts = dz->tile_size;
+  int32_t w = MIN(ts, dz->level_w[level] - col * ts);
+  int32_t h = MIN(ts, dz->level_h[level] - row * ts);
+  if (level == dz->level_count - 1) {
+    return render_base_tile(dz, col, row, w, h);
+  }
+
+  // the region of the level below that this tile covers
+  int32_t sw = MIN(2 * ts, dz->level_w[level + 1] - 2 * col * ts);
+  int32_t sh = MIN(2 * ts, dz->level_h[level + 1] - 2 * row * ts);
+  uint32_t *src = g_new(uint32_t, (int64_t) sw * sh);
+  for (int32_t dy = 0; dy < 2 && dy * ts < sh; dy++) {
+    for (int32_t dx = 0; dx < 2 && dx * ts < sw; dx++) {
+      uint32_t *child = get_tile(dz, level + 1, 2 * col + dx, 2 * row + dy);
+      int32_t cw = MIN(ts, sw - dx * ts);
+      int32_t ch = MIN(ts, sh - dy * ts);
+      for (int32_t y = 0; y < ch; y++) {
+        memcpy(src + (int64_t) (dy * ts + y) * sw + dx * ts,
+               child + (int64_t) y * cw, cw * 4);
+      }
+      g_free(child);
+    }
+  }
+
+  // 2x2 box filter; odd edges average the pixels that exist
+  uint32_t *pixels = g_new(uint32_t, (int64_t) w * h);
+  for (int32_t y = 0; y < h; y++) {
+    int32_t y1 = MIN(2 * y + 1, sh - 1);
+    for (int32_t x = 0; x < w; x++) {
+      int32_t x1 = MIN(2 * x + 1, sw - 1);
+      const uint32_t p[4] = {
+        src[(int64_t) 2 * y * sw + 2 * x],
+        src[(int64_t) 2 * y * sw + x1],
+        src[(int64_t) y1 * sw + 2 * x],
+        src[(int64_t) y1 * sw + x1],
+      };
+      uint32_t out = 0;
+      for (int shift = 0; shift < 32; shift += 8) {
+        uint32_t sum = 2;
+        for (int i = 0; i < 4; i++) {
+          sum += (p[i] >> shift) & 0xff;
+        }
+        out |= (sum / 4) << shift;
+      }
+      pixels[(int64_t) y * w + x] = out;
+    }
+  }
+  g_free(src);
+
+  char *path = get_tile_path(dz, level, col, row);
+  write_jpeg(dz, path, pixels, w, h);
+  g_free(path);
+  return pixels;
+}
+
+static void render_subtree(gpointer data, gpointer user_data) {
+  struct deepzoom *dz = user_data;
+  int64_t i = GPOINTER_TO_SIZE(data) - 1;
+  int64_t cols = get_cols(dz, dz->split_level);
+  dz->split_tiles[i] = render_tile(dz, dz->split_level, i % cols, i / cols);
+}
+
+static void write_dzi(struct deepzoom *dz, const char *path) {
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    fail("Can't open %s for writing: %s", path, strerror(errno));
+  }
+  int32_t base = dz->level_count - 1;
+  fprintf(f, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+          "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" "
+          "Format=\"jpeg\" Overlap=\"0\" TileSize=\"%d\">"
+          "<Size Width=\"%"PRId64"\" Height=\"%"PRId64"\"/></Image>\n",
+          dz->tile_size, dz->level_w[base], dz->level_h[base]);
+  if (fclose(f)) {
+    fail("Error writing %s: %s", path, strerror(errno));
+  }
+}
+
+static void write_deepzoom(openslide_t *osr, int32_t tile_size,
+                           const char *output) {
+  struct deepzoom dz = {
+    .osr = osr,
+    .files_dir = g_strdup_printf("%s_files", output),
+    .tile_size = tile_size,
+    .background = { 255, 255, 255 },
+  };
+
+  // levels, halving each time down to a single pixel
+  int64_t w, h;
+  openslide_get_level0_dimensions(osr, &w, &h);
+  if (w <= 0 || h <= 0) {
+    fail("Slide is empty");
+  }
+  dz.level_count = 1;
+  for (int64_t d = MAX(w, h); d > 1; d = (d + 1) / 2) {
+    dz.level_count++;
+  }
+  dz.level_w = g_new(int64_t, dz.level_count);
+  dz.level_h = g_new(int64_t, dz.level_count);
+  for (int32_t level = dz.level_count - 1; level >= 0; level--) {
+    dz.level_w[level] = w;
+    dz.level_h[level] = h;
+    w = (w + 1) / 2;
+    h = (h + 1) / 2;
+  }
+
+  const char *bgcolor =
+    openslide_get_property_value(osr, OPENSLIDE_PROPERTY_NAME_BACKGROUND_COLOR);
+  if (bgcolor) {
+    unsigned int r, g, b;
+    if (sscanf(bgcolor, "%2x%2x%2x", &r, &g, &b) == 3) {
+      dz.background[0] = r;
+      dz.background[1] = g;
+      dz.background[2] = b;
+    }
+  }
+
+  int64_t raw_w, raw_h;
+  openslide_get_level_raw_tile_dimensions(osr, 0, &raw_w, &raw_h);
+  dz.copy_raw = raw_w == tile_size && raw_h == tile_size;
+
+  for (int32_t level = 0; level < dz.level_count; level++) {
+    char *dir = g_strdup_printf("%s/%d", dz.files_dir, level);
+    if (g_mkdir_with_parents(dir, 0777)) {
+      fail("Can't create %s: %s", dir, strerror(errno));
+    }
+    g_free(dir);
+  }
+
+  // render enough subtrees in parallel to keep the threads busy, then
+  // the levels above them from their top tiles
+  int threads = common_get_thread_count();
+  dz.split_level = dz.level_count - 1;
+  for (int32_t level = 0; level < dz.level_count; level++) {
+    if (get_cols(&dz, level) * get_rows(&dz, level) >=
+        threads * TILES_PER_THREAD) {
+      dz.split_level = level;
+      break;
+    }
+  }
+  int64_t split_count = get_cols(&dz, dz.split_level) *
+                        get_rows(&dz, dz.split_level);
+  dz.split_tiles = g_new0(uint32_t *, split_count);
+
+  GError *tmp_err = NULL;
+  GThreadPool *pool = g_thread_pool_new(render_subtree, &dz,
+                                        threads, TRUE, &tmp_err);
+  if (!pool) {
+    fail("Couldn't start threads: %s", tmp_err->message);
+  }
+  for (int64_t i = 0; i < split_count; i++) {
+    g_thread_pool_push(pool, GSIZE_TO_POINTER(i + 1), NULL);
+  }
+  g_thread_pool_free(pool, FALSE, TRUE);
+
+  g_free(get_tile(&dz, 0, 0, 0));
+
+  char *dzi = g_strdup_printf("%s.dzi", output);
+  write_dzi(&dz, dzi);
+  g_free(dzi);
+
+  g_free(dz.split_tiles);
+  g_free(dz.level_w);
+  g_free(dz.level_h);
+  g_free(dz.files_dir);
+}
+
+
+static const struct common_usage_info usage_info = {
+  "slide tile-size output",
+  "Write a virtual slide as a Deep Zoom tile pyramid.",
+  NULL,
+};
+
+int main (int argc, char **argv) {
+  common_parse_commandline(&usage_info, &argc, &argv);
+  if (argc != 4) {
+    common_usage(&usage_info);
+  }
+
+  // get args
+  const char *slide = argv[1];
+  int64_t tile_size = g_ascii_strtoll(argv[2], NULL, 10);
+  const char *output = argv[3];
+
+  if (tile_size <= 0) {
+    fail("tile-size must be positive");
+  }
+  // JPEG dimensions are limited to 65500
+  if (tile_size > 65500) {
+    fail("tile-size must be <= 65500 for JPEG");
+  }
+
+  // open slide
+  openslide_t *osr = openslide_open(slide);
+
+  // check errors
+  if (osr == NULL) {
+    fail("%s: Not a file that OpenSlide can recognize", slide);
+  }
+
+  const char *err = openslide_get_error(osr);
+  if (err) {
+    fail("%s: %s", slide, err);
+  }
+
+  write_deepzoom(osr, tile_size, output);
+
+  openslide_close(osr);
+
+  return 0;
+}
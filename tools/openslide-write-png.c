@@ -35,6 +35,36 @@
 static const char SOFTWARE[] = "Software";
 static const char OPENSLIDE[] = "OpenSlide <http://openslide.org/>";
 
+// strips are rendered this many ahead of the compressor, or being compressed
+#define STRIP_BUFFERS 3
+// upper bound on the size of one strip
+#define MAX_STRIP_BYTES (64 << 20)
+// strip height when the level has no tile height
+#define DEFAULT_STRIP_HEIGHT 256
+// strips are read in columns of this many pixels, so the tiles of a column
+// stay in the cache until all of their rows have been read
+#define READ_COLUMN_WIDTH 4096
+
+struct strip {
+  uint8_t *data;
+  int32_t rows;
+};
+
+struct render_state {
+  openslide_t *osr;
+  int64_t x;
+  int64_t y;
+  int64_t strip_offset;  // level row of y, only used to align strips
+  int32_t level;
+  double downsample;
+  int32_t w;
+  int32_t h;
+  int32_t strip_height;
+
+  GAsyncQueue *free_strips;
+  GAsyncQueue *full_strips;
+};
+
 #define ENSURE_NONNEG(i) \
   if (i < 0) {					\
     fail(#i " must be non-negative");	\
@@ -58,6 +88,53 @@ static void fail(const char *format, ...) {
   exit(1);
 }
 
+static int32_t get_strip_height(openslide_t *osr, int32_t level, int32_t w) {
+  // follow the tile rows of the level, so each tile is decoded once
+  int64_t height = DEFAULT_STRIP_HEIGHT;
+  char *name = g_strdup_printf("openslide.level[%d].tile-height", level);
+  const char *value = openslide_get_property_value(osr, name);
+  if (value && g_ascii_strtoll(value, NULL, 10) > 0) {
+    height = g_ascii_strtoll(value, NULL, 10);
+  }
+  g_free(name);
+
+  height = MIN(height, MAX_STRIP_BYTES / ((int64_t) w * 4));
+  return MAX(height, 1);
+}
+
+// runs in its own thread, while the main thread compresses
+static gpointer render_strips(gpointer data) {
+  struct render_state *rs = data;
+  int64_t stride = (int64_t) rs->w * 4;
+
+  int32_t row = 0;
+  while (row < rs->h) {
+    struct strip *strip = g_async_queue_pop(rs->free_strips);
+
+    // end strips on strip height boundaries of the level
+    int64_t offset = (rs->strip_offset + row) % rs->strip_height;
+    if (offset < 0) {
+      offset += rs->strip_height;
+    }
+    int32_t rows = rs->strip_height - offset;
+    strip->rows = MIN(rows, rs->h - row);
+
+    for (int32_t col = 0; col < rs->w; col += READ_COLUMN_WIDTH) {
+      openslide_read_region_format(rs->osr, strip->data + col * 4, stride,
+                                   OPENSLIDE_PIXEL_FORMAT_RGBA32,
+                                   rs->x + col * rs->downsample,
+                                   rs->y + row * rs->downsample,
+                                   rs->level,
+                                   MIN(READ_COLUMN_WIDTH, rs->w - col),
+                                   strip->rows);
+    }
+
+    row += strip->rows;
+    // the consumer checks for errors
+    g_async_queue_push(rs->full_strips, strip);
+  }
+  return NULL;
+}
 
 static void write_png(openslide_t *osr, FILE *f,
 		      int64_t x, int64_t y, int32_t level,
@@ -112,61 +189,61 @@ static void write_png(openslide_t *osr, FILE *f,
   // start writing
   png_write_info(png_ptr, info_ptr);
 
-  uint32_t *dest = g_malloc(w * 4);
-  int32_t lines_to_draw = h;
-  double ds = openslide_get_level_downsample(osr, level);
-  int32_t yy = y / ds;
-  while (lines_to_draw) {
-    openslide_read_region(osr, dest,
-			  x, yy * ds, level, w, 1);
+  // render strips in another thread, with parallel tile decoding, while
+  // compressing finished ones here
+  openslide_set_decode_threads(osr, common_get_thread_count());
+
+  struct render_state rs = {
+    .osr = osr,
+    .x = x,
+    .y = y,
+    .level = level,
+    .downsample = openslide_get_level_downsample(osr, level),
+    .w = w,
+    .h = h,
+    .strip_height = get_strip_height(osr, level, w),
+    .free_strips = g_async_queue_new(),
+    .full_strips = g_async_queue_new(),
+  };
+  rs.strip_offset = y / rs.downsample;
+
+  // unpremultiplied RGBA is what PNG expects
+  int64_t stride = (int64_t) w * 4;
+  struct strip strips[STRIP_BUFFERS];
+  for (int i = 0; i < STRIP_BUFFERS; i++) {
+    strips[i].data = g_malloc(stride * rs.strip_height);
+    g_async_queue_push(rs.free_strips, &strips[i]);
+  }
+
+  GError *tmp_err = NULL;
+  GThread *thread = g_thread_create(render_strips, &rs, TRUE, &tmp_err);
+  if (!thread) {
+    fail("Couldn't start render thread: %s", tmp_err->message);
+  }
+
+  int32_t row = 0;
+  while (row < h) {
+    struct strip *strip = g_async_queue_pop(rs.full_strips);
 
     const char *err = openslide_get_error(osr);
     if (err) {
       fail("%s", err);
     }
 
-    // un-premultiply alpha and pack into expected format
-    for (int i = 0; i < w; i++) {
-      uint32_t p = dest[i];
-      uint8_t *p8 = (uint8_t *) (dest + i);
-
-      uint8_t a = (p >> 24) & 0xFF;
-      uint8_t r = (p >> 16) & 0xFF;
-      uint8_t g = (p >> 8) & 0xFF;
-      uint8_t b = p & 0xFF;
-
-      switch (a) {
-      case 0:
-	r = 0;
-	b = 0;
-	g = 0;
-	break;
-
-      case 255:
-	// no action
-	break;
-
-      default:
-	r = (r * 255 + a / 2) / a;
-	g = (g * 255 + a / 2) / a;
-	b = (b * 255 + a / 2) / a;
-	break;
-      }
-
-      // write back
-      p8[0] = r;
-      p8[1] = g;
-      p8[2] = b;
-      p8[3] = a;
+    for (int32_t i = 0; i < strip->rows; i++) {
+      png_write_row(png_ptr, (png_bytep) (strip->data + i * stride));
     }
-
-    png_write_row(png_ptr, (png_bytep) dest);
-    yy++;
-    lines_to_draw--;
+    row += strip->rows;
+    g_async_queue_push(rs.free_strips, strip);
   }
+  g_thread_join(thread);
 
   // end
-  g_free(dest);
+  for (int i = 0; i < STRIP_BUFFERS; i++) {
+    g_free(strips[i].data);
+  }
+  g_async_queue_unref(rs.free_strips);
+  g_async_queue_unref(rs.full_strips);
   g_free(key);
   g_free(text);
   png_write_end(png_ptr, info_ptr);
@@ -177,6 +254,7 @@ static void write_png(openslide_t *osr, FILE *f,
 static const struct common_usage_info usage_info = {
   "slide x y level width height output.png",
   "Write a region of a virtual slide to a PNG.",
+  NULL,
 };
 
 int main (int argc, char **argv) {